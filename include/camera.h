@@ -20,9 +20,15 @@ struct PomCameraCtx{
     bool initialised;
     PomVkDescriptorCtx cameraUboDescriptor;
     PomCameraUBO cameraUboData;
+    // Kept to rebuild the projection on resize
+    float fovRad;
+    float near;
+    float far;
 };
 
 struct PomCameraCreateInfo{
+    // Ring the camera's UBO is written to each frame. If NULL, the UBO gets its own buffer
+    PomVkRingBufferCtx *frameRing;
     Vec4 location;
     float width;
     float height;
@@ -38,7 +44,12 @@ int pomCameraDestroy( PomCameraCtx *_cameraCtx );
 
 PomVkDescriptorCtx* pomCameraGetDescriptor( PomCameraCtx *_cameraCtx );
 
+// Rebuild the projection for a new viewport size
+int pomCameraResize( PomCameraCtx *_cameraCtx, float _width, float _height );
+
 int pomCameraTranslate( PomCameraCtx *_cameraCtx, Vec4 _translation );
-int pomCameraUpdateUBO( PomCameraCtx *_cameraCtx, VkDevice _device );
+// Write the camera UBO for the frame ring's current frame. Returns 2 if descriptor sets
+// need rewriting, as pomVkDescriptorUpdateFrame
+int pomCameraUpdateUBO( PomCameraCtx *_cameraCtx, uint32_t _frameIdx );
 
 #endif // CAMERA_H
\ No newline at end of file
@@ -44,6 +44,41 @@
 #define DEFAULT_NUMTHREADS "3"
 #endif //DEFAULT_NUMTHREADS
 
+#define CONFIG_PIPELINE_CACHE_KEY "pipeline_cache_path"
+#ifndef DEFAULT_PIPELINE_CACHE_PATH
+#define DEFAULT_PIPELINE_CACHE_PATH "./pipeline.cache"
+#endif //DEFAULT_PIPELINE_CACHE_PATH
+
+// Defaults to pipelines.manifest beside the config file
+#define CONFIG_PIPELINE_MANIFEST_KEY "pipeline_manifest_path"
+#define DEFAULT_PIPELINE_MANIFEST_NAME "pipelines.manifest"
+
+// Non-zero to render with VK_KHR_dynamic_rendering, where the device supports it, instead of
+// render pass and framebuffer objects
+#define CONFIG_DYNAMIC_RENDERING_KEY "dynamic_rendering"
+#ifndef DEFAULT_DYNAMIC_RENDERING
+#define DEFAULT_DYNAMIC_RENDERING "0"
+#endif //DEFAULT_DYNAMIC_RENDERING
+
+// Non-zero to lay down depth before shading, so each pixel is shaded only once
+#define CONFIG_DEPTH_PREPASS_KEY "depth_prepass"
+#ifndef DEFAULT_DEPTH_PREPASS
+#define DEFAULT_DEPTH_PREPASS "0"
+#endif //DEFAULT_DEPTH_PREPASS
+
+// Microseconds per frame to spend compacting model memory, or 0 to never compact it
+#define CONFIG_DEFRAGMENT_BUDGET_KEY "defragment_budget_us"
+#ifndef DEFAULT_DEFRAGMENT_BUDGET
+#define DEFAULT_DEFRAGMENT_BUDGET "500"
+#endif //DEFAULT_DEFRAGMENT_BUDGET
+
+// KiB of staging memory for each batch of uploads to the GPU. Bigger uploads are split
+// between batches
+#define CONFIG_UPLOAD_STAGING_SIZE_KEY "upload_staging_kib"
+#ifndef DEFAULT_UPLOAD_STAGING_SIZE
+#define DEFAULT_UPLOAD_STAGING_SIZE "8192"
+#endif //DEFAULT_UPLOAD_STAGING_SIZE
+
 // TODO - move this def to somewhere more common
 typedef struct PomCommonNode PomCommonNode;
 
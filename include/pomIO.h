@@ -33,6 +33,12 @@ bool pomIoShouldClose();
 // Poll for IO events
 int pomIoPoll();
 
+// Check if the window has been resized since the last check
+bool pomIoWindowResized();
+
+// Block on IO events while the window has no area to render to
+int pomIoWaitWhileMinimised();
+
 // TODO - remove this hacky bit once proper key events are implemented
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
 
 #define POM_FORMAT_MAGIC_NUM 0xDEADBEEFDEADBEEF
 
@@ -12,25 +14,85 @@ typedef struct PomModelMaterialInfo PomModelMaterialInfo;
 typedef struct PomModelMeshInfo PomModelMeshInfo;
 typedef struct PomSubmodelInfo PomSubmodelInfo;
 typedef struct PomModelInfo PomModelInfo;
+typedef struct PomModelInstanceInfo PomModelInstanceInfo;
 typedef struct PomModelFormat PomModelFormat;
+typedef struct PomModelStreamWriter PomModelStreamWriter;
 
 typedef uint8_t PomDataBlock;
 
+// Encoding of a texture's data block. Mip levels are stored contiguously,
+// largest first. Block-compressed levels are padded out to whole 4x4 blocks.
+typedef enum PomModelTextureDataType{
+    POM_TEXTURE_DATA_RAW_U8 = 0, // Uncompressed, dataUnitSizeBytes 8-bit channels per texel
+    POM_TEXTURE_DATA_BC1    = 1, // RGB, 8 bytes per block
+    POM_TEXTURE_DATA_BC3    = 2, // RGBA, 16 bytes per block
+    POM_TEXTURE_DATA_BC4    = 3, // R, 8 bytes per block
+    POM_TEXTURE_DATA_BC5    = 4, // RG, 16 bytes per block
+    POM_TEXTURE_DATA_BC7    = 5, // RGBA, 16 bytes per block
+
+    POM_TEXTURE_DATA_UNKNOWN = 6,
+    POM_TEXTURE_DATA_END = POM_TEXTURE_DATA_UNKNOWN,
+    POM_TEXTURE_DATA_START = POM_TEXTURE_DATA_RAW_U8,
+    POM_TEXTURE_DATA_RANGE = POM_TEXTURE_DATA_END - POM_TEXTURE_DATA_START
+}PomModelTextureDataType;
+
 int relativisePointers( PomModelFormat *_format, uint8_t *_dataBlock );
 int absolutisePointers( PomModelFormat *_format );
 int writeBakedModel( PomModelFormat *_format, uint8_t *_dataBlock, size_t _blockSize,
                      const char *filePath );
 int loadBakedModel( const char *_filePath, PomModelFormat **_format,
                     uint8_t **_dataBlock );
+// Whether the mesh's back faces must be drawn. Meshes with no valid material are
+// treated as two-sided, to be safe
+bool pomModelMeshIsTwoSided( const PomModelFormat *_format, const PomModelMeshInfo *_meshInfo );
+
+// Streaming writer, for models too large to be built in memory in one go.
+// Space is reserved at the start of the data block for the metadata (infos,
+// ID arrays etc.), bulk data is then streamed out section by section, and the
+// header + metadata are patched in at the end.
+int pomModelStreamOpen( PomModelStreamWriter *_writer, const char *_filePath,
+                        size_t _metadataSize );
+// Write a section to the file. _relativeOffset receives the section's offset in
+// the same relative form used by relativisePointers, so it can be stored directly
+// in the (already relativised) metadata.
+int pomModelStreamWrite( PomModelStreamWriter *_writer, const void *_data,
+                         size_t _dataSize, uint8_t **_relativeOffset );
+// Patch the header and metadata block in and close the file. The metadata block must
+// already be relativised. On failure the file is removed, as by pomModelStreamAbort.
+int pomModelStreamFinalise( PomModelStreamWriter *_writer, PomModelFormat *_format,
+                            const uint8_t *_metadataBlock );
+// Close and remove a partially written file
+int pomModelStreamAbort( PomModelStreamWriter *_writer );
+
+struct PomModelStreamWriter{
+    bool initialised;
+    FILE *file;
+    const char *filePath;
+    size_t metadataSize;
+    // Bytes of the data block written so far, including the reserved metadata region
+    size_t dataBlockBytesWritten;
+};
 
 struct PomModelTextureInfo{
     uint32_t textureId;
     const char *nameOffset;
     uint64_t textureType;
-    uint64_t dataType;  // Colour, vector, data, etc (largely unimportant)
-    uint32_t dataUnitSizeBytes; // vec2 vs vec4 etc
-    uint32_t dataBlockSizeBytes;
+    uint64_t dataType;  // PomModelTextureDataType
+    uint32_t dataUnitSizeBytes; // Bytes per texel for raw data, bytes per 4x4 block for BC
+    uint32_t dataBlockSizeBytes; // All mip levels
     uint8_t *dataOffset;
+    uint32_t width;
+    uint32_t height;
+    uint32_t numMipLevels;
+    uint32_t isSrgb;
+    // Set when this texture is a region of a shared atlas. The data block is the
+    // whole atlas (width/height are the atlas size) and UVs of meshes using the
+    // material have already been remapped into the region, given here in texels.
+    uint32_t isAtlas;
+    uint32_t atlasRegionX;
+    uint32_t atlasRegionY;
+    uint32_t atlasRegionWidth;
+    uint32_t atlasRegionHeight;
 };
 
 struct PomModelMaterialInfo{
@@ -40,6 +102,8 @@ struct PomModelMaterialInfo{
     uint8_t *paramDataOffset; // maybe replace this with struct
     uint32_t numTextures;
     uint32_t *textureIdsOffset;
+    // Back faces are visible, so mustn't be culled
+    uint32_t isTwoSided;
 };
 
 struct PomModelMeshInfo{
@@ -52,8 +116,20 @@ struct PomModelMeshInfo{
     uint32_t dataStride;
     uint32_t numUvCoords;
     uint32_t hasTangentSpace;
+    // Equal to meshId, unless this mesh is identical to (and shares the data of)
+    // an earlier mesh
+    uint32_t sourceMeshId;
+    // Range of submodel infos for a mesh merged from several source meshes,
+    // numSubmodels is 0 otherwise
+    uint32_t firstSubmodel;
+    uint32_t numSubmodels;
+    // Meshes are only merged with others sharing their material
+    uint32_t materialId;
 };
 
+// One source mesh's range within a merged mesh. Indices are already rebased
+// against the merged mesh's vertices, so the range can be drawn on its own
+// (e.g. after culling against the bounds) with firstIndex and no vertex offset.
 struct PomSubmodelInfo{
     uint32_t submodelId;
     const char *nameOffset;
@@ -62,16 +138,31 @@ struct PomSubmodelInfo{
     float *dataOffset;
     uint64_t numIndices;
     uint32_t *indexOffset;
+    uint32_t meshId;
+    uint32_t firstIndex;
+    uint32_t vertexOffset;
+    uint32_t numVertices;
+    float boundsMin[ 3 ];
+    float boundsMax[ 3 ];
 };
 
 struct PomModelInfo{
     uint32_t modelId;
     const char *nameOffset;
+    // Output meshes of the node's meshes, one per source mesh. Source meshes merged
+    // together all list the mesh they were merged into
     uint32_t numSubmodels;
     uint32_t *submodelIdsOffset;
     float *defaultMatrixOffset;
 };
 
+// All placements of one (source) mesh in the scene, for instanced drawing
+struct PomModelInstanceInfo{
+    uint32_t meshId;
+    uint32_t numInstances;
+    float *transformsOffset; // numInstances column-major 4x4 matrices
+};
+
 struct PomModelFormat{
 
     uint64_t magicNumber;
@@ -92,5 +183,8 @@ struct PomModelFormat{
 
     uint32_t numModelInfo;
     PomModelInfo *modelInfo;
+
+    uint32_t numInstanceInfo;
+    PomModelInstanceInfo *instanceInfo;
 };
 #endif // POM_MODEL_FORMAT_H
\ No newline at end of file
@@ -0,0 +1,111 @@
+#ifndef POM_PROGRAM_FORMAT_H
+#define POM_PROGRAM_FORMAT_H
+
+#include "pomShaderFormat.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <vulkan/vulkan.h>
+
+// Single-blob shader program, holding the bytecode of every stage alongside the
+// vertex input and descriptor layout data pipeline setup needs, already merged
+// across stages. Everything is addressed by byte offsets from the start of the
+// blob, so a program can be mapped straight from disk and used read-only.
+
+#define POM_PROGRAM_FORMAT_MAGIC_NUM 0x4D4F5050474F5250 // "PROGPPOM"
+#define POM_PROGRAM_FORMAT_VERSION 1
+#define POM_PROGRAM_MAX_STAGES 4
+
+typedef struct PomProgramFormat PomProgramFormat;
+typedef struct PomProgramStageInfo PomProgramStageInfo;
+typedef struct PomProgramVariantInfo PomProgramVariantInfo;
+typedef struct PomProgramSetInfo PomProgramSetInfo;
+typedef struct PomProgramBindingInfo PomProgramBindingInfo;
+
+struct PomProgramVariantInfo{
+    // Space-separated `NAME=VALUE` macro definitions the variant was compiled with
+    uint64_t definesOffset;
+    uint64_t bytecodeOffset;
+    uint64_t bytecodeSizeBytes;
+};
+
+struct PomProgramStageInfo{
+    VkShaderStageFlagBits stage;
+    // The first variant is the default
+    uint32_t numVariants;
+    uint64_t nameOffset;
+    uint64_t variantInfoOffset;
+};
+
+// A binding, merged across every stage using it
+struct PomProgramBindingInfo{
+    uint32_t set;
+    uint32_t binding;
+    VkDescriptorType type;
+    uint32_t count;
+    VkShaderStageFlags stageFlags;
+};
+
+// The bindings of a set are contiguous in the binding infos. Sets no stage uses are
+// still present, with no bindings
+struct PomProgramSetInfo{
+    uint32_t firstBinding;
+    uint32_t numBindings;
+};
+
+struct PomProgramFormat{
+    uint64_t magic;
+    uint32_t version;
+
+    uint32_t numStages;
+    uint64_t stageInfoOffset;
+
+    // Attributes of the vertex stage, interleaved in location order in one binding
+    uint32_t vertexStrideBytes;
+    uint32_t numVertexAttributes;
+    uint64_t vertexAttributeOffset; // VkVertexInputAttributeDescription[]
+
+    uint32_t numSets;
+    uint32_t numBindings;
+    uint64_t setInfoOffset;
+    uint64_t bindingInfoOffset; // Sorted by set, then binding
+
+    // At most one range per stage
+    uint32_t numPushConstantRanges;
+    uint64_t pushConstantRangeOffset; // VkPushConstantRange[]
+
+    // Size of the whole blob, header included
+    uint64_t sizeBytes;
+};
+
+// Build a program from the loaded stage formats. The vertex and fragment stages are
+// required. The program is allocated as one block, to be freed with free().
+// Returns the size of the program on success, 0 on failure
+size_t pomProgramFormatBuild( PomShaderFormat **_stageFormats, uint32_t _numStages,
+                              PomProgramFormat **_program );
+
+// Returns number of bytes written if success, 0 on failure
+size_t pomProgramFormatWrite( const char *_path, const PomProgramFormat *_program );
+
+// Map a program file read-only, and check every offset in it lies within the file.
+// Returns number of bytes mapped on success, 0 on failure
+size_t pomProgramFormatMap( const char *_path, const PomProgramFormat **_program );
+void pomProgramFormatUnmap( const PomProgramFormat *_program );
+
+// Read-only accessors, turning the program's offsets into pointers
+const PomProgramStageInfo *pomProgramFormatGetStage( const PomProgramFormat *_program,
+                                                     VkShaderStageFlagBits _stage );
+// Find the stage variant matching the space-separated `NAME=VALUE` definitions in _defines,
+// as pomShaderFormatFindVariant does. Returns NULL if no variant matches
+const PomProgramVariantInfo *pomProgramFormatFindVariant( const PomProgramFormat *_program,
+                                                          const PomProgramStageInfo *_stageInfo,
+                                                          const char *_defines );
+const char *pomProgramFormatGetString( const PomProgramFormat *_program, uint64_t _offset );
+const uint32_t *pomProgramFormatGetBytecode( const PomProgramFormat *_program,
+                                             const PomProgramVariantInfo *_variantInfo );
+const VkVertexInputAttributeDescription *pomProgramFormatGetVertexAttributes(
+    const PomProgramFormat *_program );
+const PomProgramSetInfo *pomProgramFormatGetSets( const PomProgramFormat *_program );
+const PomProgramBindingInfo *pomProgramFormatGetBindings( const PomProgramFormat *_program );
+const VkPushConstantRange *pomProgramFormatGetPushConstantRanges( const PomProgramFormat *_program );
+
+#endif // POM_PROGRAM_FORMAT_H
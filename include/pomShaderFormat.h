@@ -3,11 +3,14 @@
 
 #include "common.h"
 #include <stdint.h>
+#include <stdbool.h>
 #include <vulkan/vulkan.h>
 
 typedef struct PomShaderFormat PomShaderFormat;
 typedef struct PomShaderAttributeInfo PomShaderAttributeInfo;
 typedef struct PomShaderDescriptorInfo PomShaderDescriptorInfo;
+typedef struct PomShaderVariantInfo PomShaderVariantInfo;
+typedef struct PomShaderPushConstantInfo PomShaderPushConstantInfo;
 
 typedef enum PomShaderDataTypes{
     SHADER_FLOAT = 0,
@@ -40,22 +43,49 @@ struct PomShaderDescriptorInfo{
     uint32_t set;
     uint32_t binding;
     VkDescriptorType type;
+    // Number of descriptors in the binding, for arrays
+    uint32_t count;
+};
+
+// The range of the push constant block used by the shader
+struct PomShaderPushConstantInfo{
+    char *nameOffset;
+    uint32_t offset;
+    uint32_t sizeBytes;
+};
+
+// One compiled permutation of the shader's POM_VARIANT axes
+struct PomShaderVariantInfo{
+    // Space-separated `NAME=VALUE` macro definitions the variant was compiled with
+    char *definesOffset;
+    size_t shaderBytecodeSizeBytes;
+    uint32_t *shaderBytecodeOffset;
 };
 
 struct PomShaderFormat{
     // ShaderNameOffset is always the start of the data block
     char *shaderNameOffset; //8
 
+    VkShaderStageFlagBits shaderStage; //4
+
     uint64_t numAttributeInfo; //4
     PomShaderAttributeInfo *attributeInfoOffset; //8
 
-    // TODO - consider splitting this into model/rendergroup/program-local descriptors
+    // Sorted by set, then binding
     uint64_t numDescriptorInfo; //4
     PomShaderDescriptorInfo *descriptorInfoOffset; //8
 
+    uint64_t numPushConstantInfo; //8
+    PomShaderPushConstantInfo *pushConstantInfoOffset; //8
+
+    // Bytecode of the default variant (first value of every axis)
     size_t shaderBytecodeSizeBytes; //8
     uint32_t *shaderBytecodeOffset; //8
 
+    // Always at least one variant, the first being the default
+    uint64_t numVariantInfo; //8
+    PomShaderVariantInfo *variantInfoOffset; //8
+
     size_t dataBlockSize; //8
 };
 
@@ -65,6 +95,20 @@ int pomShaderFormatRelativisePointers( PomShaderFormat *_format, uint8_t *_dataB
 // Turn relative offsets into the format block into absolute pointers to system memory
 int pomShaderFormatAbsolutisePointers( PomShaderFormat *_format );
 
+// Vertex input format and size of a shader data type
+VkFormat pomShaderDataTypeFormat( PomShaderDataTypes _dataType );
+size_t pomShaderDataTypeSize( PomShaderDataTypes _dataType );
+
+// Check a variant's defines against the space-separated `NAME=VALUE` definitions in _defines.
+// Definitions for macros the variant wasn't compiled with are ignored
+bool pomShaderDefinesMatch( const char *_variantDefines, const char *_defines );
+
+// Find the variant matching the space-separated `NAME=VALUE` definitions in _defines.
+// Definitions for macros the shader has no axis for are ignored, and axes not mentioned
+// take their first value. Returns NULL if no variant matches
+const PomShaderVariantInfo *pomShaderFormatFindVariant( const PomShaderFormat *_format,
+                                                        const char *_defines );
+
 // Write Shader Format to disk. Function will relativise pointers in the format.
 // Returns number of bytes written if success, 0 on failure
 size_t pomShaderFormatWrite( const char *_path, PomShaderFormat *_format, void *_dataBlock );
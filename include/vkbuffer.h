@@ -19,15 +19,30 @@ struct PomVkBufferCtx{
     _Atomic bool inUse; // TODO - this may need to be an "inUse counter"
     _Atomic bool bound;
     PomVkMemoryCtx memCtx;
+    // Offset into memCtx the buffer is bound at
+    VkDeviceSize bindOffset;
+    // Host address of the buffer's start while bound to host-visible memory, else NULL
+    uint8_t *mapped;
+    // Bytes written through mapped since the last flush, as [dirtyBegin, dirtyEnd)
+    VkDeviceSize dirtyBegin;
+    VkDeviceSize dirtyEnd;
     VkMemoryRequirements memoryRequirements;
     VkMemoryPropertyFlags memoryFlags;
+    VkMemoryPropertyFlags desiredMemoryFlags;
+    // Where the buffer was created, for memory leak reports
+    const char *allocationSite;
     VkBufferCreateInfo bufferInfo;
+    // Buffer and memory a move is copying out of, until the move ends
+    VkBuffer movedFromBuffer;
+    PomVkMemoryCtx movedFromMemCtx;
 };
 
 int pomVkBufferCreate( PomVkBufferCtx *_buffCtx, VkBufferUsageFlags _usage,
                        VkDeviceSize _bSizeBytes, uint32_t _numQueueFamilies,
                        const uint32_t* _queueFamilies,
-                       VkMemoryPropertyFlags memoryFlags );
+                       VkMemoryPropertyFlags memoryFlags,
+                       VkMemoryPropertyFlags desiredMemoryFlags,
+                       const char *_site );
 
 int pomVkBufferDestroy( PomVkBufferCtx *_buffCtx );
 
@@ -35,6 +50,29 @@ int pomVkBufferBind( PomVkBufferCtx *_buffCtx, VkDeviceSize _offset );
 
 int pomVkBufferUnbind( PomVkBufferCtx *_buffCtx );
 
+// Host address of a bound buffer's contents, or NULL if its memory isn't host-visible. The
+// memory stays mapped for as long as the buffer is bound
+void *pomVkBufferGetMapped( PomVkBufferCtx *_buffCtx );
+
+// Note that _size bytes at _offset were written through the mapping, to be flushed by the
+// next pomVkBufferFlush. Not safe to call on the same buffer from several threads at once
+void pomVkBufferMarkDirty( PomVkBufferCtx *_buffCtx, VkDeviceSize _offset, VkDeviceSize _size );
+
+// Make writes marked dirty visible to the device. Free for host-coherent memory, otherwise
+// one vkFlushMappedMemoryRanges covering every dirty byte
+int pomVkBufferFlush( PomVkBufferCtx *_buffCtx );
+
+// Start moving a bound buffer into a fuller memory block, recording the copy of its contents
+// into _cmdBuffer. The buffer takes on a new VkBuffer straight away, so anything referring to
+// the old one (descriptors, recorded commands) has to be updated before its next use.
+// Buffers must have been created with transfer source and destination usage.
+// Returns 0 if the move was started, 2 if the buffer can't or needn't move, 1 on error
+int pomVkBufferMoveBegin( PomVkBufferCtx *_buffCtx, VkCommandBuffer _cmdBuffer );
+
+// Release the old buffer and memory of a move, once the copy has completed.
+// Returns 2 if there is no move to end
+int pomVkBufferMoveEnd( PomVkBufferCtx *_buffCtx );
+
 // TODO - functions here for memory allocation/binding
 
 /******************
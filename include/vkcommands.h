@@ -10,6 +10,28 @@ int pomCommandBuffersCreate();
 
 int pomCommandBuffersDestroy();
 
+// Replace the command buffers with one per current swapchain image, such as after the
+// swapchain is recreated with a different number of images. None of them may be pending
+// execution, and the new ones need recording
+int pomCommandBuffersRecreate();
+
+// Return all command buffers to the initial state, ready to be recorded again. None of them
+// may be pending execution
+int pomCommandBuffersReset();
+
 int pomRecordDefaultCommands( VkRenderPass *_renderPass, PomPipelineCtx *_pipelineCtx );
 
+// Set the (dynamic) viewport and scissor to cover _extent
+void pomRecordViewportScissor( VkCommandBuffer _cmdBuffer, const VkExtent2D *_extent );
+
 VkCommandBuffer *pomCommandBuffersGet( uint32_t *numBuffers );
+
+// Allocate and begin a command buffer for a single submission outside the frame
+int pomCommandBufferOneShotBegin( VkCommandBuffer *_cmdBuffer );
+
+// End and submit a command buffer from pomCommandBufferOneShotBegin to the graphics queue,
+// wait for it to complete, then free it
+int pomCommandBufferOneShotSubmit( VkCommandBuffer _cmdBuffer );
+
+// Free a command buffer from pomCommandBufferOneShotBegin without submitting it
+void pomCommandBufferOneShotDiscard( VkCommandBuffer _cmdBuffer );
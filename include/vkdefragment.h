@@ -0,0 +1,20 @@
+#ifndef VK_DEFRAGMENT_H
+#define VK_DEFRAGMENT_H
+
+#include "common.h"
+#include "vkmodel.h"
+#include <stdint.h>
+
+// Compacts model buffers into as few memory blocks as possible, a little at a time, so that
+// blocks left empty by models coming and going are given back. Buffers are moved with GPU
+// copies into fuller blocks of the same memory type, and emptied blocks are freed.
+
+// Move model buffers for up to roughly _budgetUs microseconds, including waiting on the
+// copies. Carries on from where the previous step stopped. The graphics queue must be idle.
+// Moved models get new vertex and index buffer handles. Their descriptors live in the frame
+// ring and are unaffected, but if _numMoved comes back non-zero the caller must re-record
+// command buffers drawing them before the next frame
+int pomVkDefragmentStep( PomVkModelCtx *_models, uint32_t _numModels, uint32_t _budgetUs,
+                         uint32_t *_numMoved );
+
+#endif // VK_DEFRAGMENT_H
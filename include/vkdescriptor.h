@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "vkbuffer.h"
+#include "vkringbuffer.h"
 #include <vulkan/vulkan.h>
 
 typedef struct PomVkDescriptorCtx PomVkDescriptorCtx;
@@ -15,6 +16,8 @@ struct PomVkDescriptorMemoryInfo{
     PomVkBufferCtx *bufferCtx; // Pointer to existing buffer context
     VkDeviceSize uboOffset; // TODO - put this somewhere else
     PomVkBufferCtx bufferCtxOwned; // Copy of buffer context owned by this descriptor
+    // Set instead of bufferCtx for data rewritten every frame, which then lives in the ring
+    PomVkRingBufferCtx *ringCtx;
         // TODO - imageCtx will go here, if applicable
 };
 
@@ -32,6 +35,8 @@ struct PomVkDescriptorCtx{
     PomVkUniformBufferObject uboMainMemory; // TODO - better name here
     PomVkDescriptorMemoryInfo uboDeviceMemory; // TODO - ditto
 
+    // Per-frame buffer infos, one per ring frame, for descriptors living in a ring buffer
+    VkDescriptorBufferInfo *frameBufferInfos;
 };
 
 // TODO - we're only using 1 buffer per descriptor for now. This should probably be 1
@@ -39,18 +44,35 @@ struct PomVkDescriptorCtx{
 
 
 
-// _ubo and _memoryInfo are copied so can be caller scope-limited
+// _ubo and _memoryInfo are copied so can be caller scope-limited. With a ring buffer in
+// _memoryInfo, the data is written to the ring each frame by pomVkDescriptorUpdateFrame
 int pomVkDescriptorCreate( PomVkDescriptorCtx *_descriptorCtx, 
                            const PomVkUniformBufferObject *_ubo, // TODO - extend beyond just UBOs
                            PomVkDescriptorMemoryInfo *_memoryInfo );
 
 int pomVkDescriptorDestroy( PomVkDescriptorCtx *_descriptorCtx );
 
-// Update the memory in VRAM with the memory in main memory
+// Update the memory in VRAM with the memory in main memory. Not for ring buffer descriptors
 int pomVkDescriptorUpdate( PomVkDescriptorCtx *_descriptorCtx, VkDevice _device );
 
+// Write the data for the ring buffer's current frame, _frameIdx. Returns 2 if it landed
+// somewhere other than it did last time for this frame, in which case descriptor sets
+// written from the frame's buffer info need rewriting (and commands using them re-recording).
+// Descriptors outside a ring are just updated
+int pomVkDescriptorUpdateFrame( PomVkDescriptorCtx *_descriptorCtx, uint32_t _frameIdx );
+
 VkDescriptorBufferInfo* pomVkDescriptorGetBufferInfo( PomVkDescriptorCtx *_descriptorCtx );
 
+// Buffer info for descriptor sets used by frame _frameIdx. The same for every frame unless
+// the descriptor lives in a ring buffer
+VkDescriptorBufferInfo* pomVkDescriptorGetFrameBufferInfo( PomVkDescriptorCtx *_descriptorCtx,
+                                                          uint32_t _frameIdx );
+
+// Point the buffer info back at the descriptor's buffer after the buffer has moved, or for
+// descriptors in a ring, the frame buffer infos at the ring after it's resized. Descriptor
+// sets written from the old info still need rewriting
+int pomVkDescriptorRefreshBufferInfo( PomVkDescriptorCtx *_descriptorCtx );
+
 
 /****
 * Descriptor Pool declarations
@@ -1,4 +1,5 @@
 #include <vulkan/vulkan.h>
+#include <stdbool.h>
 
 int pomPickPhysicalDevice();
 
@@ -8,18 +9,44 @@ int pomCreateLogicalDevice();
 
 int pomDestroyLogicalDevice();
 
+// idx is set to the queue's family index
 VkQueue * pomDeviceGetGraphicsQueue( uint32_t *idx );
 
 VkQueue * pomDeviceGetPresentQueue( uint32_t *idx );
 
+// Queue for uploads, preferring a transfer-only family. Shares the graphics queue where the
+// device has nothing better, in which case idx matches the graphics queue's
+VkQueue * pomDeviceGetTransferQueue( uint32_t *idx );
+
 VkDevice * pomGetLogicalDevice();
 
 VkPhysicalDevice * pomGetPhysicalDevice();
 
+// Whether VK_KHR_dynamic_rendering was asked for in the config and enabled on the device
+bool pomDeviceDynamicRenderingEnabled();
+
+// vkCmdBeginRenderingKHR/vkCmdEndRenderingKHR. Only valid with dynamic rendering enabled
+void pomDeviceCmdBeginRendering( VkCommandBuffer _cmdBuffer, const VkRenderingInfoKHR *_renderingInfo );
+
+void pomDeviceCmdEndRendering( VkCommandBuffer _cmdBuffer );
+
+// Memory types and heaps of the device, cached at logical device creation. NULL before then
+const VkPhysicalDeviceMemoryProperties * pomDeviceGetMemoryProperties();
+
+// Current budget and usage of each heap, from VK_EXT_memory_budget. Both arrays need room for
+// every heap. Returns 1 if the extension isn't available
+int pomDeviceGetMemoryBudget( VkDeviceSize *_heapBudgets, VkDeviceSize *_heapUsages );
+
 VkFormat * pomGetSwapchainImageFormat();
 
 VkExtent2D * pomGetSwapchainExtent();
 
 VkImage * pomGetSwapchainImages( uint32_t *numImages );
 
-VkSwapchainKHR * pomGetSwapchain();
\ No newline at end of file
+VkSwapchainKHR * pomGetSwapchain();
+
+// Replace the swapchain with one matching the surface's current extent. Anything made from
+// the old swapchain's images must be destroyed first, and the device must be idle. The new
+// swapchain may have a different number of images. Returns 2, leaving the old swapchain in
+// place, while the surface has no area (such as when minimised)
+int pomSwapchainRecreate();
\ No newline at end of file
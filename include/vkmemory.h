@@ -5,20 +5,112 @@
 #include <vulkan/vulkan.h>
 #include <stdbool.h>
 
+// Device memory is allocated in large blocks per memory type, which allocations are then
+// sub-allocated from (TLSF, so both allocating and freeing are constant time). Allocations
+// too big to share a block get a dedicated one.
+
 typedef struct PomVkMemoryCtx PomVkMemoryCtx;
+typedef struct PomVkMemoryBlock PomVkMemoryBlock;
+typedef struct PomVkMemoryRange PomVkMemoryRange;
+
+// Linear resources (buffers) and optimal-tiling images never share a block, so neighbouring
+// allocations never need padding out to bufferImageGranularity
+typedef enum PomVkMemoryResourceType{
+    POM_VK_MEMORY_RESOURCE_LINEAR,
+    POM_VK_MEMORY_RESOURCE_OPTIMAL,
+    POM_VK_MEMORY_NUM_RESOURCE_TYPES
+} PomVkMemoryResourceType;
+
+// What an allocation is used for, which memory use is tallied by alongside memory type and heap
+typedef enum PomVkMemoryCategory{
+    POM_VK_MEMORY_CATEGORY_GEOMETRY,
+    POM_VK_MEMORY_CATEGORY_UNIFORM,
+    // Textures and attachments
+    POM_VK_MEMORY_CATEGORY_IMAGE,
+    POM_VK_MEMORY_CATEGORY_STAGING,
+    POM_VK_MEMORY_CATEGORY_OTHER,
+    POM_VK_MEMORY_NUM_CATEGORIES
+} PomVkMemoryCategory;
+
+#define _POM_VK_MEMORY_STRINGIFY( _x ) #_x
+#define _POM_VK_MEMORY_SITE( _file, _line ) _file ":" _POM_VK_MEMORY_STRINGIFY( _line )
+// "file:line" of the code asking for an allocation, named in the leak report
+#define POM_VK_MEMORY_SITE _POM_VK_MEMORY_SITE( __FILE__, __LINE__ )
+
+typedef struct PomVkMemoryStats PomVkMemoryStats;
+struct PomVkMemoryStats{
+    // Bytes handed out to live allocations, alignment slack included
+    VkDeviceSize allocatedBytes;
+    VkDeviceSize peakAllocatedBytes;
+    uint32_t numAllocations;
+    // Device memory blocks the allocations live in, and how much of them is free. Categories
+    // share blocks, so these are left zero for them
+    uint32_t numBlocks;
+    VkDeviceSize blockBytes;
+    VkDeviceSize freeBytes;
+    // Share of the free bytes outside the largest free range: 0 while free memory is all in
+    // one piece, approaching 1 as it splinters
+    float fragmentation;
+};
+
 struct PomVkMemoryCtx{
+    // Memory of the block the allocation lives in, shared with other allocations
     VkDeviceMemory memory;
+    // Start of the allocation within memory. Bind and map at offsets relative to this
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    PomVkMemoryBlock *block;
+    PomVkMemoryRange *range;
     bool initialised;
 };
 
-// TODO - memory view maybe? Basically represents an offset into a normal memory block
-// for updating subsetions of memory
+int pomVkMemoryManagerCreate();
+
+// Free every block, logging usage statistics and any allocations still live, along with
+// where they were made
+int pomVkMemoryManagerDestroy();
 
+// Allocate from the memory type with all of _memFlags that best matches _desiredFlags,
+// preferring heaps with room left in their budget. _site is kept for leak reports, so should
+// be a string literal (POM_VK_MEMORY_SITE)
 int pomVkAllocateMemory( PomVkMemoryCtx *_memCtx,
-                         VkMemoryPropertyFlags _memFlags, 
+                         PomVkMemoryResourceType _resourceType,
+                         PomVkMemoryCategory _category,
+                         VkMemoryPropertyFlags _memFlags,
+                         VkMemoryPropertyFlags _desiredFlags,
                          VkMemoryRequirements *_memReq,
-                         VkMemoryRequirements *_memDesired );
+                         const char *_site );
 
 int pomVkFreeMemory( PomVkMemoryCtx *_memCtx );
 
-#endif // VK_MEMORY_H
\ No newline at end of file
+// Whether any memory type has allocations spread over more than one shared block, and so
+// might be compacted by pomVkMemoryDefragmentAllocate
+bool pomVkMemoryCanDefragment();
+
+// Allocate somewhere better for the contents of _memCtx to live: in a fuller block of the
+// same pool, so that _memCtx's block drains. Never creates blocks. Returns 0 with _newMemCtx
+// allocated, 2 if there's nowhere better, or 1 on error. The caller copies the contents
+// across and frees _memCtx
+int pomVkMemoryDefragmentAllocate( const PomVkMemoryCtx *_memCtx,
+                                   const VkMemoryRequirements *_memReq,
+                                   PomVkMemoryCtx *_newMemCtx );
+
+// Host address of the start of the allocation, or NULL if its memory isn't host-visible.
+// Host-visible blocks stay mapped for their whole lifetime, so there's nothing to unmap
+void *pomVkMemoryGetMapped( const PomVkMemoryCtx *_memCtx );
+
+// Make host writes to _size bytes at _offset into the allocation visible to the device.
+// Needed before the device reads them unless the memory is host-coherent, in which case
+// this does nothing. The range is widened to nonCoherentAtomSize
+int pomVkMemoryFlush( const PomVkMemoryCtx *_memCtx, VkDeviceSize _offset, VkDeviceSize _size );
+
+int pomVkMemoryGetTypeStats( uint32_t _memoryTypeIndex, PomVkMemoryStats *_stats );
+
+int pomVkMemoryGetHeapStats( uint32_t _heapIndex, PomVkMemoryStats *_stats );
+
+int pomVkMemoryGetCategoryStats( PomVkMemoryCategory _category, PomVkMemoryStats *_stats );
+
+// Log the statistics of every heap, memory type and category in use
+void pomVkMemoryLogStats();
+
+#endif // VK_MEMORY_H
@@ -0,0 +1,56 @@
+#ifndef VK_MEMORY_TLSF_H
+#define VK_MEMORY_TLSF_H
+
+#include "common.h"
+#include "vkmemory.h"
+#include <vulkan/vulkan.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Two-level segregated fit index of the free ranges of a memory block. Free ranges are
+// binned by power-of-two size class, and each class is split into 16 linear subclasses, so
+// a free range big enough for a request is found with a couple of bit scans.
+
+// Each power-of-two size class is split into 16 linear subclasses
+#define TLSF_SL_LOG2 4
+#define TLSF_SL_COUNT ( 1 << TLSF_SL_LOG2 )
+#define TLSF_FL_COUNT ( 64 - TLSF_SL_LOG2 + 1 )
+
+typedef struct PomVkMemoryTlsf PomVkMemoryTlsf;
+
+struct PomVkMemoryRange{
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    // Neighbouring ranges in the block, in order of offset
+    PomVkMemoryRange *prevPhysical;
+    PomVkMemoryRange *nextPhysical;
+    // Neighbouring free ranges of the same size class
+    PomVkMemoryRange *prevFree;
+    PomVkMemoryRange *nextFree;
+    bool free;
+    // Of the allocation holding the range, when not free
+    PomVkMemoryCategory category;
+    const char *site;
+};
+
+// A set bit in flBitmap means the matching slBitmap is non-zero, and a set bit there means
+// the matching free list is non-empty. Zero-initialised is empty
+struct PomVkMemoryTlsf{
+    uint64_t flBitmap;
+    uint32_t slBitmaps[ TLSF_FL_COUNT ];
+    PomVkMemoryRange *freeLists[ TLSF_FL_COUNT ][ TLSF_SL_COUNT ];
+};
+
+// Size class and subclass a range of _size bytes is filed under. _size must be non-zero
+void pomVkMemoryTlsfMapping( VkDeviceSize _size, uint32_t *_fl, uint32_t *_sl );
+
+// File a range as free
+void pomVkMemoryTlsfInsertFree( PomVkMemoryTlsf *_tlsf, PomVkMemoryRange *_range );
+
+// Take a free range out of the index, marking it in use
+void pomVkMemoryTlsfRemoveFree( PomVkMemoryTlsf *_tlsf, PomVkMemoryRange *_range );
+
+// Find a free range of at least _size bytes, or NULL if there is none. Doesn't remove it
+PomVkMemoryRange *pomVkMemoryTlsfFindFree( PomVkMemoryTlsf *_tlsf, VkDeviceSize _size );
+
+#endif // VK_MEMORY_TLSF_H
@@ -6,6 +6,7 @@
 #include "pomMaths.h"
 #include "vkbuffer.h"
 #include "vkdescriptor.h"
+#include "vkringbuffer.h"
 
 #include <stdbool.h>
 
@@ -13,8 +14,14 @@ typedef struct PomVkModelCtx PomVkModelCtx;
 struct PomVkModelCtx{
     bool initialised;
     bool active;
+    // Rendered without back-face culling
+    bool twoSided;
     PomModelMeshInfo *modelMeshInfo;
     PomModelInfo *modelInfo;
+    // Source mesh ranges of a mesh merged from several, which it's drawn by. None for a
+    // mesh baked from a single source mesh, which is drawn whole
+    const PomSubmodelInfo *submodels;
+    uint32_t numSubmodels;
     PomVkBufferCtx modelBuffer;
 
     Mat4x4 transformationMatrix;
@@ -22,11 +29,19 @@ struct PomVkModelCtx{
 
 };
 
-int pomVkModelCreate( PomVkModelCtx *_modelCtx, PomModelMeshInfo *_meshInfo );
+// The model's matrix is written to _frameRing each frame by pomVkModelUpdateDescriptors
+int pomVkModelCreate( PomVkModelCtx *_modelCtx, PomModelMeshInfo *_meshInfo,
+                      PomVkRingBufferCtx *_frameRing );
 
 int pomVkModelDestroy( PomVkModelCtx *_modelCtx );
 
-// Indicate that model must be available to the GPU.
+// Draw the model by the ranges of the source meshes merged into it, rather than whole.
+// Fails if any range lies outside the model's mesh
+int pomVkModelSetSubmodels( PomVkModelCtx *_modelCtx, const PomSubmodelInfo *_submodels,
+                            uint32_t _numSubmodels );
+
+// Indicate that model must be available to the GPU. The model's data is queued for upload,
+// and can be drawn by work submitted after pomVkUploadSubmit.
 int pomVkModelActivate( PomVkModelCtx *_modelCtx );
 
 // Indicate that model is not needed by GPU. This does not
@@ -34,8 +49,9 @@ int pomVkModelActivate( PomVkModelCtx *_modelCtx );
 // may be removed.
 int pomVkModelDeactivate( PomVkModelCtx *_modelCtx );
 
-// Update model descriptor data in VRAM
-int pomVkModelUpdateDescriptors( PomVkModelCtx *_modelCtx, VkDevice _device );
+// Write the model's descriptor data for the frame ring's current frame. Returns 2 if
+// descriptor sets need rewriting, as pomVkDescriptorUpdateFrame
+int pomVkModelUpdateDescriptors( PomVkModelCtx *_modelCtx, uint32_t _frameIdx );
 
 // Get the main model descriptor (UBO for now, maybe more later?)
 PomVkDescriptorCtx* pomVkModelGetDescriptor( PomVkModelCtx *_modelCtx );
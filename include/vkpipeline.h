@@ -4,13 +4,17 @@
 #include <vulkan/vulkan.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include "pomShaderFormat.h"
+#include "pomProgramFormat.h"
+#include "cmore/threadpool.h"
 
 typedef struct ShaderDescriptorSetCtx ShaderDescriptorSetCtx;
+typedef struct ShaderDescriptorSetLayoutInfo ShaderDescriptorSetLayoutInfo;
 typedef struct ShaderAttributeInfo ShaderAttributeInfo;
 typedef struct ShaderInterfaceInfo ShaderInterfaceInfo;
 typedef struct ShaderInfo ShaderInfo;
+typedef struct PomPipelineState PomPipelineState;
 typedef struct PomPipelineCtx PomPipelineCtx;
+typedef struct PomPipelineBatchItem PomPipelineBatchItem;
 
 struct ShaderAttributeInfo{
     uint32_t bindingLocation;
@@ -18,9 +22,16 @@ struct ShaderAttributeInfo{
     uint32_t dataType; // Placeholder for datatype enum
 };
 
+struct ShaderDescriptorSetLayoutInfo{
+    uint32_t numBindings;
+    VkDescriptorSetLayoutBinding *bindings;
+};
+
+// One layout per descriptor set, indexed by set number
 struct ShaderDescriptorSetCtx{
     uint32_t numLayouts;
     VkDescriptorSetLayout *layouts;
+    ShaderDescriptorSetLayoutInfo *layoutInfos;
 
     // The rest of the members just alias the above array
     uint32_t numModelLocalLayouts;
@@ -37,47 +48,147 @@ struct ShaderInterfaceInfo{
     VkVertexInputBindingDescription inputBinding;
     VkVertexInputAttributeDescription inputAttribs[ 16 ];
     ShaderDescriptorSetCtx descriptorSetLayoutCtx;
+    // At most one range per stage
+    uint32_t numPushConstantRanges;
+    VkPushConstantRange pushConstantRanges[ 4 ];
 };
 
 struct ShaderInfo{
+    // Baked program holding every stage. Used in place of the vertex/fragment paths if set
+    const char * programPath;
     const char * vertexShaderPath;
     const char * fragmentShaderPath;
     const char * geometryShaderPath;
     const char * tesselationShaderPath;
+    // Space-separated `NAME=VALUE` selecting the baked variant of each stage.
+    // NULL (or axes left out) selects the first value of each variant axis
+    const char * variantDefines;
 
     // Max 4 stages (vertex, geometry, tesselation, fragment)
     VkPipelineShaderStageCreateInfo shaderStages[ 4 ];
     uint8_t numStages;
 
     ShaderInterfaceInfo shaderInputAttributes;
-    PomShaderFormat *shaderFormats[ 4 ];    
+    // Either mapped from programPath, or built from the vertex/fragment stage blobs
+    const PomProgramFormat *program;
+    bool programMapped;
 
     bool initialised;
 };
 
+// Fixed-function state of a graphics pipeline. Every member is 32 bits wide, so the
+// struct has no padding and can be hashed and compared as bytes
+struct PomPipelineState{
+    VkPrimitiveTopology topology;
+    VkPolygonMode polygonMode;
+    VkCullModeFlags cullMode;
+    VkFrontFace frontFace;
+
+    VkBool32 depthTestEnable;
+    VkBool32 depthWriteEnable;
+    VkCompareOp depthCompareOp;
+
+    VkBool32 blendEnable;
+    VkBlendFactor srcColourBlendFactor;
+    VkBlendFactor dstColourBlendFactor;
+    VkBlendOp colourBlendOp;
+    VkBlendFactor srcAlphaBlendFactor;
+    VkBlendFactor dstAlphaBlendFactor;
+    VkBlendOp alphaBlendOp;
+    VkColorComponentFlags colourWriteMask;
+
+    // Bind only the vertex stage, for depth prepasses. Colour writes should be masked off
+    VkBool32 depthOnly;
+
+    // Attachment formats rendered to, which stand in for the render pass when rendering
+    // dynamically. Ignored when a render pass is given
+    VkFormat colourFormat;
+    VkFormat depthFormat;
+};
+
+// Opaque triangles with back faces culled and depth tested. The camera's projection flips Y,
+// so counter-clockwise model faces stay counter-clockwise in framebuffer space
+#define POM_PIPELINE_STATE_DEFAULT ( (PomPipelineState){ \
+    .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, \
+    .polygonMode = VK_POLYGON_MODE_FILL, \
+    .cullMode = VK_CULL_MODE_BACK_BIT, \
+    .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE, \
+    .depthTestEnable = VK_TRUE, \
+    .depthWriteEnable = VK_TRUE, \
+    .depthCompareOp = VK_COMPARE_OP_LESS, \
+    .blendEnable = VK_FALSE, \
+    .srcColourBlendFactor = VK_BLEND_FACTOR_ONE, \
+    .dstColourBlendFactor = VK_BLEND_FACTOR_ZERO, \
+    .colourBlendOp = VK_BLEND_OP_ADD, \
+    .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE, \
+    .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO, \
+    .alphaBlendOp = VK_BLEND_OP_ADD, \
+    .colourWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | \
+                       VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT, \
+    .depthOnly = VK_FALSE, \
+    .colourFormat = VK_FORMAT_UNDEFINED, \
+    .depthFormat = VK_FORMAT_UNDEFINED \
+} )
+
 struct PomPipelineCtx{
     union{
         VkGraphicsPipelineCreateInfo graphicsPipelineInfo;
         VkComputePipelineCreateInfo computePipelineInfo;
     };
     ShaderInfo shaderInfo;
+    PomPipelineState state;
     VkPipeline pipeline;
     // Should be either VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO
     // or VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO
     VkStructureType pipelineType;
+    // Assigned by the pipeline registry, 0 for pipelines created outside of it
+    uint32_t registryId;
     bool initialised;
 };
 
+// One pipeline to be acquired from the pipeline registry by pomPipelineCreateBatch
+struct PomPipelineBatchItem{
+    // Shader description, with its paths and variant defines filled in
+    const ShaderInfo *shaderInfo;
+    // NULL for POM_PIPELINE_STATE_DEFAULT
+    const PomPipelineState *state;
+    VkRenderPass *renderPass;
+    // Receives the shared pipeline, to be released with pomPipelineRegistryRelease
+    PomPipelineCtx *pipelineCtx;
+    // 0 once the shader and pipeline are created
+    int result;
+};
+
 
 int pomShaderCreate( ShaderInfo *_shaderInfo );
 
 int pomShaderDestroy( ShaderInfo *_shaderInfo );
 const ShaderDescriptorSetCtx* pomShaderGetDescriptorSetLayoutCtx( const ShaderInfo *_shaderInfo );
 
+// Single subpass rendering to a swapchain image, with a depth attachment
 int pomRenderPassCreate( VkRenderPass *_renderPass );
 int pomRenderPassDestroy( VkRenderPass *_renderPass );
 
-int pomPipelineCreate( PomPipelineCtx *_pipelineCtx, const ShaderInfo *_shaderInfo, VkRenderPass *_renderPass );
+// Split _state into a depth-only prepass, which writes depth, and a main pass which then only
+// shades the fragments left visible (testing for equal depth without writing it)
+void pomPipelineStateSplitDepthPrepass( const PomPipelineState *_state,
+                                        PomPipelineState *_prepassState,
+                                        PomPipelineState *_mainState );
+
+// _state may be NULL for POM_PIPELINE_STATE_DEFAULT. A VK_NULL_HANDLE render pass creates the
+// pipeline for dynamic rendering, to the attachment formats of _state
+int pomPipelineCreate( PomPipelineCtx *_pipelineCtx, const ShaderInfo *_shaderInfo,
+                       const PomPipelineState *_state, VkRenderPass *_renderPass );
 int pomPipelineDestroy( PomPipelineCtx *_pipeline );
 
+// Acquire the pipelines of a batch of items from the pipeline registry concurrently, spread over
+// the threadpool's workers and all sharing the pipeline cache. The calling thread works through the batch too,
+// so this can be called from a threadpool job. Returns once every item is done; 0 if all of them
+// succeeded, 1 otherwise (with each item's result saying which).
+// Up to _numHelperJobs helpers are scheduled, one per item past the first. Helpers can start
+// after this returns, so _helperJobs has to stay valid until the threadpool has been joined
+int pomPipelineCreateBatch( PomPipelineBatchItem *_items, uint32_t _numItems,
+                            PomThreadpoolCtx *_threadpool, PomThreadpoolJob *_helperJobs,
+                            uint32_t _numHelperJobs );
+
 #endif //VK_PIPELINE_H
\ No newline at end of file
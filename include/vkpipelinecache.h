@@ -0,0 +1,21 @@
+#ifndef VK_PIPELINE_CACHE_H
+#define VK_PIPELINE_CACHE_H
+
+#include "common.h"
+#include <vulkan/vulkan.h>
+
+// One pipeline cache shared by every pipeline creation, persisted to disk between runs.
+// Vulkan synchronises access to the cache internally, so it can be used from any thread.
+
+// Create the cache, seeded from the file at _cachePath if it was written by this
+// device and driver. Called once the logical device exists.
+int pomPipelineCacheCreate( const char *_cachePath );
+
+// Write the cache back to disk and destroy it. The file is replaced atomically,
+// so an interrupted write never leaves a truncated cache behind.
+int pomPipelineCacheDestroy();
+
+// Returns VK_NULL_HANDLE if there's no cache, which Vulkan accepts as "don't cache"
+VkPipelineCache pomPipelineCacheGet();
+
+#endif //VK_PIPELINE_CACHE_H
@@ -0,0 +1,30 @@
+#ifndef VK_PIPELINE_MANIFEST_H
+#define VK_PIPELINE_MANIFEST_H
+
+#include "common.h"
+#include "vkpipeline.h"
+#include "cmore/threadpool.h"
+#include <vulkan/vulkan.h>
+
+// Record of the pipelines (shader description + state) requested during a run, saved on
+// shutdown so the next run can build them all in the background before they're first used.
+// Manifests are plain text, one pipeline per line.
+
+// Load the manifest of the previous run from _manifestPath, if there is one, and start
+// recording this run's requests to be saved back to it
+int pomPipelineManifestCreate( const char *_manifestPath );
+
+// Wait for any warmup to finish, release the warmed pipelines, and save the requests
+// recorded this run. Pipelines of the previous run that weren't requested are dropped
+int pomPipelineManifestDestroy();
+
+// Note a pipeline request. Repeats of a request are only recorded once
+int pomPipelineManifestRecord( const ShaderInfo *_shaderDesc, const PomPipelineState *_state );
+
+// Schedule a job per pipeline of the previous run, each building its pipeline through the
+// registry against _renderPass (the manifest doesn't record render passes). The warmed
+// pipelines are kept alive until the manifest is destroyed, so a later request for any of
+// them is just a lookup. Returns without waiting for the jobs
+int pomPipelineManifestWarmup( VkRenderPass *_renderPass, PomThreadpoolCtx *_threadpool );
+
+#endif //VK_PIPELINE_MANIFEST_H
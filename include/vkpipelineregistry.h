@@ -0,0 +1,42 @@
+#ifndef VK_PIPELINE_REGISTRY_H
+#define VK_PIPELINE_REGISTRY_H
+
+#include "common.h"
+#include "vkpipeline.h"
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+
+// Shared, refcounted pipelines, keyed on everything that goes into building one: the
+// shader program (and so its vertex layout), the variant, the fixed-function state and
+// the render pass. Identical requests get the same pipeline rather than compiling it
+// twice. Safe to use from any thread; a request for a pipeline another thread is still
+// building waits for that build rather than starting its own.
+
+int pomPipelineRegistryCreate();
+
+// Destroy every pipeline still in the registry, logging each one as leaked
+int pomPipelineRegistryDestroy();
+
+// Get the pipeline for a shader description (paths and variant defines filled in, not yet
+// created) and state, creating the shader and pipeline if no matching one exists.
+// _state may be NULL for POM_PIPELINE_STATE_DEFAULT. The request is recorded in the
+// pipeline manifest. Returns NULL on failure
+PomPipelineCtx *pomPipelineRegistryAcquire( const ShaderInfo *_shaderDesc,
+                                            const PomPipelineState *_state,
+                                            VkRenderPass *_renderPass );
+
+// As pomPipelineRegistryAcquire, but without recording the request, for building pipelines
+// ahead of their first use
+PomPipelineCtx *pomPipelineRegistryPrewarm( const ShaderInfo *_shaderDesc,
+                                            const PomPipelineState *_state,
+                                            VkRenderPass *_renderPass );
+
+// Drop a reference taken by pomPipelineRegistryAcquire, destroying the pipeline and its
+// shader with the last one
+int pomPipelineRegistryRelease( PomPipelineCtx *_pipelineCtx );
+
+// Non-zero ID, unique for the lifetime of the registry. IDs are handed out in order of
+// first request, so sorting draws by them groups draws sharing a pipeline
+uint32_t pomPipelineRegistryGetId( const PomPipelineCtx *_pipelineCtx );
+
+#endif //VK_PIPELINE_REGISTRY_H
@@ -4,8 +4,37 @@ int pomSwapchainImageViewsCreate();
 
 int pomSwapchainImageViewsDestroy();
 
+// Best depth attachment format the device supports, VK_FORMAT_UNDEFINED if none
+VkFormat pomSwapchainDepthFormatGet();
+
+// Depth attachment matching the swapchain extent
+int pomSwapchainDepthCreate();
+
+int pomSwapchainDepthDestroy();
+
+// Framebuffers of the swapchain image views plus the depth attachment, creating those first
+// if needed
 int pomSwapchainFramebuffersCreate( VkRenderPass *_renderPass );
 
 int pomSwapchainFramebuffersDestroy();
 
-VkFramebuffer *pomSwapchainFramebuffersGet( uint32_t *numBuffers );
\ No newline at end of file
+VkFramebuffer *pomSwapchainFramebuffersGet( uint32_t *numBuffers );
+
+// Recreate the swapchain at the surface's current size, along with its image views, depth and
+// framebuffers (if rendering with a render pass). Nothing else depends on the swapchain extent,
+// so pipelines, buffers and descriptor sets carry on as they are, though command buffers must
+// be re-recorded. If the number of swapchain images changed, whatever is made per image must
+// be remade too. Returns 2 while the surface has no area, with the views, depth and
+// framebuffers destroyed, to be called again once the window is restored
+int pomSwapchainResize( VkRenderPass *_renderPass );
+
+// Begin rendering to swapchain image _imageIdx and the depth attachment, clearing both to
+// _clearValues (colour, then depth). With a render pass, it's begun on the image's framebuffer.
+// With a VK_NULL_HANDLE render pass, the image views are rendered to directly with dynamic
+// rendering, which needs no framebuffers
+int pomSwapchainRenderingBegin( VkCommandBuffer _cmdBuffer, uint32_t _imageIdx,
+                                VkRenderPass *_renderPass, const VkClearValue _clearValues[ 2 ] );
+
+// End rendering begun by pomSwapchainRenderingBegin, leaving the image ready to present
+int pomSwapchainRenderingEnd( VkCommandBuffer _cmdBuffer, uint32_t _imageIdx,
+                              VkRenderPass *_renderPass );
\ No newline at end of file
@@ -15,6 +15,8 @@ typedef struct PomVkRenderGroupDescriptorSets PomVkRenderGroupDescriptorSets;
 struct PomVkRenderGroupCtx{
     bool initialised;
     PomPipelineCtx *pipelineCtx;
+    // Depth-only variant of pipelineCtx, NULL if the group has no depth prepass
+    PomPipelineCtx *depthPrepassPipelineCtx;
     uint32_t numModels;
     PomVkModelCtx **modelList;
     uint32_t numModelDescriptorSets;
@@ -26,6 +28,7 @@ struct PomVkRenderGroupCtx{
     uint32_t numLocalDescriptors;
     PomVkDescriptorCtx *localDescriptors;
 
+    // Descriptor sets allocated for each swapchain image, known from creation
     size_t setsPerSwapchainImage;
 };
 
@@ -39,7 +42,26 @@ int pomVkRenderGroupDestroy( PomVkRenderGroupCtx *_renderGroupCtx );
 int pomVkRenderGroupRecord( PomVkRenderGroupCtx *_renderGroupCtx, VkCommandBuffer _cmdBuffer,
                             uint32_t bufferIdx );
 
+// Give the rendergroup a depth prepass. _prepassPipelineCtx must be built from the same
+// shader as the group's pipeline, so that both share descriptor layouts and vertex positions
+int pomVkRenderGroupSetDepthPrepass( PomVkRenderGroupCtx *_renderGroupCtx,
+                                     PomPipelineCtx *_prepassPipelineCtx );
+
+// Record the depth prepass, if the rendergroup has one. Same requirements as pomVkRenderGroupRecord,
+// and should be recorded before the main pass of any rendergroup
+int pomVkRenderGroupRecordDepthPrepass( PomVkRenderGroupCtx *_renderGroupCtx,
+                                        VkCommandBuffer _cmdBuffer, uint32_t bufferIdx );
+
 int pomVkRenderGroupAllocateDescriptorSets( PomVkRenderGroupCtx *_renderGroupCtx,
                                             VkDescriptorPool _descriptorPool );
 
+// Forget the allocated descriptor sets once their pool has been reset or destroyed, so that
+// sets can be allocated again, such as for a different number of swapchain images
+int pomVkRenderGroupReleaseDescriptorSets( PomVkRenderGroupCtx *_renderGroupCtx );
+
+// Rewrite the allocated descriptor sets from the current buffer infos of the group's
+// descriptors, such as after their buffers move. None of the sets may be in use by
+// pending command buffers, and commands recorded with them must be re-recorded
+int pomVkRenderGroupWriteDescriptorSets( PomVkRenderGroupCtx *_renderGroupCtx );
+
 #endif // VK_RENDERGOUP_H
\ No newline at end of file
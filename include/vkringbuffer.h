@@ -0,0 +1,55 @@
+#ifndef VK_RING_BUFFER_H
+#define VK_RING_BUFFER_H
+
+#include "common.h"
+#include "vkbuffer.h"
+#include <vulkan/vulkan.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// A persistently mapped uniform buffer for data rewritten every frame, split into one
+// partition per frame in flight. Each frame's allocations are bumped from the start of its
+// partition and are all dropped together when the partition comes around again, so an
+// allocation costs an aligned pointer bump. Only for use from the thread recording frames.
+
+// Space an allocation of _size bytes can take up in a frame, whatever the alignment
+// (minUniformBufferOffsetAlignment is at most 256), for sizing frames up front
+#define POM_VK_RING_BUFFER_ALLOCATION_BOUND( _size ) ( ( (VkDeviceSize) ( _size ) + 255 ) & ~(VkDeviceSize) 255 )
+
+typedef struct PomVkRingBufferCtx PomVkRingBufferCtx;
+struct PomVkRingBufferCtx{
+    bool initialised;
+    PomVkBufferCtx bufferCtx;
+    uint8_t *mapped;
+    // minUniformBufferOffsetAlignment, which every allocation starts on
+    VkDeviceSize alignment;
+    VkDeviceSize frameSize;
+    uint32_t numFrames;
+    // Partition being allocated from, and the offset of its next free byte
+    uint32_t frameIdx;
+    VkDeviceSize head;
+};
+
+// _frameSize is rounded up to the alignment. Each of the _numFrames partitions gets that much
+int pomVkRingBufferCreate( PomVkRingBufferCtx *_ringCtx, VkDeviceSize _frameSize, uint32_t _numFrames );
+
+int pomVkRingBufferDestroy( PomVkRingBufferCtx *_ringCtx );
+
+// Replace the buffer with one of _numFrames frames of the same size, dropping everything
+// allocated from it. The GPU must be done with every frame. Descriptors in the ring need
+// their buffer infos refreshing afterwards
+int pomVkRingBufferResize( PomVkRingBufferCtx *_ringCtx, uint32_t _numFrames );
+
+// Start allocating from _frameIdx's partition, dropping whatever was allocated from it
+// before. The GPU must be done with the frame's previous use of it
+int pomVkRingBufferBeginFrame( PomVkRingBufferCtx *_ringCtx, uint32_t _frameIdx );
+
+// Allocate _size bytes from the current frame's partition, returning where to write them
+// and setting _offset to their offset in the buffer. NULL if the partition is full
+void *pomVkRingBufferAllocate( PomVkRingBufferCtx *_ringCtx, VkDeviceSize _size, VkDeviceSize *_offset );
+
+// Make what was written to the frame's allocations visible to the GPU, before submitting
+// work that reads them. Does nothing for host-coherent memory
+int pomVkRingBufferFlush( PomVkRingBufferCtx *_ringCtx );
+
+#endif // VK_RING_BUFFER_H
@@ -0,0 +1,38 @@
+#ifndef VK_UPLOAD_H
+#define VK_UPLOAD_H
+
+#include "common.h"
+#include "vkbuffer.h"
+#include <vulkan/vulkan.h>
+
+// Uploads to device-local buffers, which the host can't write directly. Data is copied into
+// host-visible staging memory, and from there into the destination by copies batched into a
+// single submission on the transfer queue. Where the transfer queue is of a different family
+// to the graphics queue, ownership of the written ranges is handed over to graphics as part
+// of the submission, so destination buffers stay exclusive to one family at a time.
+// Staging memory is split between a few batches, each reused once its submission completes.
+//
+// Batches are submitted to the graphics queue (for the ownership handover), so uploads
+// must come from the thread that submits frames.
+
+// _stagingSize bytes of staging memory for each batch
+int pomVkUploadManagerCreate( VkDeviceSize _stagingSize );
+
+// Waits for any uploads still in flight
+int pomVkUploadManagerDestroy();
+
+// Queue a copy of _size bytes of _data into a bound buffer at _dstOffset. _data is copied to
+// staging memory before returning, so can be freed straight away. The copy happens once the
+// batch is submitted, by pomVkUploadSubmit or by the batch filling up; uploads bigger than a
+// batch are split between several. Work on the graphics queue submitted after that sees the
+// uploaded data
+int pomVkUploadBuffer( PomVkBufferCtx *_dstBuffer, VkDeviceSize _dstOffset,
+                       const void *_data, VkDeviceSize _size );
+
+// Submit the uploads queued so far. Returns 2 if there were none
+int pomVkUploadSubmit();
+
+// Submit any queued uploads and wait for every submitted upload to complete
+int pomVkUploadWaitIdle();
+
+#endif // VK_UPLOAD_H
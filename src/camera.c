@@ -11,6 +11,9 @@ int pomCameraCreate( PomCameraCtx *_cameraCtx, const PomCameraCreateInfo *_creat
                                                            _createInfo->far,
                                                            _createInfo->width,
                                                            _createInfo->height );
+    _cameraCtx->fovRad = _createInfo->fovRad;
+    _cameraCtx->near = _createInfo->near;
+    _cameraCtx->far = _createInfo->far;
     _cameraCtx->cameraUboData.viewMatrix = mat4x4Identity();
     mat4x4ColumnVector( _cameraCtx->cameraUboData.viewMatrix, 3 ) = Vec4Gen( 0, 0, -10, 1 );
 
@@ -26,7 +29,12 @@ int pomCameraCreate( PomCameraCtx *_cameraCtx, const PomCameraCreateInfo *_creat
     PomVkUniformBufferObject ubo;
     ubo.data = (void*) &_cameraCtx->cameraUboData;
     ubo.dataSize = sizeof( PomCameraUBO );
-    if( pomVkDescriptorCreate( &_cameraCtx->cameraUboDescriptor, &ubo, NULL ) ){
+    PomVkDescriptorMemoryInfo memInfo = {
+        .ringCtx = _createInfo->frameRing
+    };
+    // Without a ring, the descriptor gets a buffer of its own
+    PomVkDescriptorMemoryInfo *memInfoPtr = _createInfo->frameRing ? &memInfo : NULL;
+    if( pomVkDescriptorCreate( &_cameraCtx->cameraUboDescriptor, &ubo, memInfoPtr ) ){
         LOG( ERR, "Failed to create camera descriptor" );
         return 1;
     }
@@ -34,6 +42,21 @@ int pomCameraCreate( PomCameraCtx *_cameraCtx, const PomCameraCreateInfo *_creat
     return 0;
 }
 
+int pomCameraResize( PomCameraCtx *_cameraCtx, float _width, float _height ){
+    if( !_cameraCtx->initialised ){
+        LOG( WARN, "Attempting to resize uninitialised camera" );
+        return 1;
+    }
+    _cameraCtx->cameraUboData.projectionMatrix = createProjectionMatrix( _cameraCtx->fovRad,
+                                                                         _cameraCtx->near,
+                                                                         _cameraCtx->far,
+                                                                         _width, _height );
+    _cameraCtx->cameraUboData.projectionViewMatrix =
+        mat4Mult( _cameraCtx->cameraUboData.projectionMatrix,
+                  _cameraCtx->cameraUboData.viewMatrix );
+    return 0;
+}
+
 int pomCameraTranslate( PomCameraCtx *_cameraCtx, Vec4 _translation ){
     _cameraCtx->cameraUboData.viewMatrix = mat4Translate( _cameraCtx->cameraUboData.viewMatrix,
                                                           _translation );
@@ -63,6 +86,6 @@ PomVkDescriptorCtx* pomCameraGetDescriptor( PomCameraCtx *_cameraCtx ){
 }
 
 
-int pomCameraUpdateUBO( PomCameraCtx *_cameraCtx, VkDevice _device ){
-    return pomVkDescriptorUpdate( &_cameraCtx->cameraUboDescriptor, _device );
+int pomCameraUpdateUBO( PomCameraCtx *_cameraCtx, uint32_t _frameIdx ){
+    return pomVkDescriptorUpdateFrame( &_cameraCtx->cameraUboDescriptor, _frameIdx );
 }
\ No newline at end of file
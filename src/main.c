@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "config.h"
 #include "system_hw.h"
 #include "cmore/hashmap.h"
@@ -7,6 +8,8 @@
 #include "vkinstance.h"
 #include "vkdevice.h"
 #include "vkpipeline.h"
+#include "vkpipelineregistry.h"
+#include "vkpipelinemanifest.h"
 #include "vkpresentation.h"
 #include "vkcommands.h"
 #include "pomIO.h"
@@ -14,6 +17,10 @@
 #include "cmore/threadpool.h"
 #include "pomModelFormat.h"
 #include "vkbuffer.h"
+#include "vkmemory.h"
+#include "vkdefragment.h"
+#include "vkringbuffer.h"
+#include "vkupload.h"
 #include "vkrendergroup.h"
 #include "vkmodel.h"
 #include "camera.h"
@@ -43,12 +50,28 @@ const char *modelPaths[] = {
 };
 const size_t numModelPaths = sizeof( modelPaths ) / sizeof( char* );
 
+// Pipelines of the scene. Two-sided geometry has its own, unculled pipelines, and the
+// prepass pipelines are only created with the depth prepass enabled
+typedef enum ScenePipeline{
+    SCENE_PIPELINE_CULLED,
+    SCENE_PIPELINE_TWO_SIDED,
+    SCENE_PIPELINE_CULLED_PREPASS,
+    SCENE_PIPELINE_TWO_SIDED_PREPASS,
+    NUM_SCENE_PIPELINES
+} ScenePipeline;
+#define SCENE_PIPELINE_PREPASS_OFFSET SCENE_PIPELINE_CULLED_PREPASS
+
 typedef struct VulkanCtx VulkanCtx;
 struct VulkanCtx{
     bool initialised;
     ShaderInfo basicShaders;
+    // VK_NULL_HANDLE when rendering dynamically
     VkRenderPass renderPass;
-    PomPipelineCtx pipelineCtx;
+    bool depthPrepass;
+    // Per-frame time given to compacting model memory, 0 if disabled
+    uint32_t defragmentBudgetUs;
+    // NULL where unused
+    PomPipelineCtx *pipelines[ NUM_SCENE_PIPELINES ];
     PomSemaphoreCtx imageSemaphore, renderSemaphore;
     uint32_t numBuffers;
     PomVkBufferCtx *modelBuffers;
@@ -58,7 +81,13 @@ struct VulkanCtx{
     uint32_t numRenderGroups;
     PomVkRenderGroupCtx *renderGroups;
     PomVkDescriptorPoolCtx descriptorPoolCtx;
+    // Per-frame data: the camera UBO and model matrices
+    PomVkRingBufferCtx frameRing;
     PomCameraCtx camera;
+    // Spreads pipeline creation over the workers. Helper jobs outlive setup, until the
+    // threadpool is joined
+    PomThreadpoolCtx *threadpool;
+    PomThreadpoolJob pipelineBatchJobs[ NUM_SCENE_PIPELINES ];
 };
 
 PomCameraCtx *camera;
@@ -66,6 +95,12 @@ PomCameraCtx *camera;
 void setupVulkan( void* _userData );
 void loadModel( void* _userData );
 static int setupCommandBuffers( VulkanCtx *_vCtx );
+static int resizeSwapchain( VulkanCtx *_vCtx );
+static int createDescriptorPool( VulkanCtx *_vCtx, uint32_t _numImages );
+static int recreateImageResources( VulkanCtx *_vCtx, uint32_t _numImages );
+static int defragmentModels( VulkanCtx *_vCtx );
+static int updateFrameData( VulkanCtx *_vCtx, uint32_t _imageIndex );
+static char *defaultManifestPath( const char *_configPath );
 //static int manualShaderSetup( ShaderInfo *_shaderInfo, VkDevice _device );
 
 static void keyEvent( GLFWwindow* window, int key, int scancode, int action, int mods );
@@ -94,6 +129,20 @@ int main( int argc, char ** argv ){
     PomThreadpoolCtx threadpoolCtx = { 0 };
     pomThreadpoolInit( &threadpoolCtx, numThreads );
     VulkanCtx vCtx = { 0 };
+    vCtx.threadpool = &threadpoolCtx;
+    vCtx.depthPrepass = atoi( pomMapGetSet( &systemConfig.mapCtx, CONFIG_DEPTH_PREPASS_KEY,
+                                            DEFAULT_DEPTH_PREPASS ) ) != 0;
+    vCtx.defragmentBudgetUs = atoi( pomMapGetSet( &systemConfig.mapCtx, CONFIG_DEFRAGMENT_BUDGET_KEY,
+                                                  DEFAULT_DEFRAGMENT_BUDGET ) );
+
+    // Start recording pipeline requests before any are made
+    char *manifestDefault = defaultManifestPath( configPath );
+    const char *manifestPath = pomMapGetSet( &systemConfig.mapCtx, CONFIG_PIPELINE_MANIFEST_KEY,
+                                             manifestDefault ? manifestDefault : DEFAULT_PIPELINE_MANIFEST_NAME );
+    free( manifestDefault );
+    if( pomPipelineManifestCreate( manifestPath ) ){
+        LOG( "Failed to create pipeline manifest, pipelines won't be warmed up" );
+    }
 
     // TODO - maybe move the whole setup stuff to a separate function altogether
     
@@ -132,6 +181,20 @@ int main( int argc, char ** argv ){
         }
         numModels += models[ i ].format->numMeshInfo;
     }
+    // One frame of the ring per swapchain image, each with room for every model's matrix
+    // and the camera
+    uint32_t numSwapchainImages;
+    if( !pomGetSwapchainImages( &numSwapchainImages ) ){
+        LOG( "Failed to get swapchain image count" );
+        return 1;
+    }
+    VkDeviceSize frameRingSize = numModels * POM_VK_RING_BUFFER_ALLOCATION_BOUND( sizeof( Mat4x4 ) ) +
+                                 POM_VK_RING_BUFFER_ALLOCATION_BOUND( sizeof( PomCameraUBO ) );
+    if( pomVkRingBufferCreate( &vCtx.frameRing, frameRingSize, numSwapchainImages ) ){
+        LOG( "Failed to create frame ring buffer" );
+        return 1;
+    }
+
     // Create models
     vCtx.models = (PomVkModelCtx*) calloc( numModels, sizeof( PomVkModelCtx ) );
     vCtx.numModels = numModels;
@@ -143,14 +206,31 @@ int main( int argc, char ** argv ){
         for( uint32_t modelMeshIdx = 0; modelMeshIdx <  numMesh; modelMeshIdx++ ){
             PomModelMeshInfo *meshInfo = &modelCtx->format->meshInfoOffset[ modelMeshIdx ];
             PomVkModelCtx *vkModelCtx = &vCtx.models[ modelIdx++ ];
-            pomVkModelCreate( vkModelCtx, meshInfo );
+            pomVkModelCreate( vkModelCtx, meshInfo, &vCtx.frameRing );
+            vkModelCtx->twoSided = pomModelMeshIsTwoSided( modelCtx->format, meshInfo );
+            // Meshes merged at bake time are drawn by their source meshes' ranges
+            if( meshInfo->numSubmodels ){
+                const PomModelFormat *format = modelCtx->format;
+                if( meshInfo->firstSubmodel > format->numSubmodelInfo ||
+                    meshInfo->numSubmodels > format->numSubmodelInfo - meshInfo->firstSubmodel ||
+                    pomVkModelSetSubmodels( vkModelCtx, &format->submodelInfo[ meshInfo->firstSubmodel ],
+                                            meshInfo->numSubmodels ) ){
+                    LOG( "Invalid submodel ranges in model %s", modelCtx->filePath );
+                    return 1;
+                }
+            }
             pomVkModelActivate( vkModelCtx );
         }
     }
+    if( pomVkUploadSubmit() == 1 ){
+        LOG( "Failed to submit model uploads" );
+        return 1;
+    }
 
     // Create camera
     const VkExtent2D *windowExtent = pomIoGetWindowExtent();
     PomCameraCreateInfo cameraInfo = {
+        .frameRing = &vCtx.frameRing,
         .far = 100.0f,
         .near = 0.1f,
         .height = windowExtent->height,
@@ -171,46 +251,61 @@ int main( int argc, char ** argv ){
         return 1;
     }
 
-    // Create descriptor pool
-    PomVkDescriptorPoolInfo poolInfo = { 0 };
-    //5 swapchain images, 1 RGL per SCI, 1 ML per Model per SCI. (7 + 1) * 5 = 40;
-    poolInfo.descriptorTypeSizes[ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER ] = 40;
-    if( pomVkDescriptorPoolCreate( &vCtx.descriptorPoolCtx, &poolInfo, *device ) ){
-        LOG( "Failed to create descriptor pool " );
-        // TODO - error handling
-        return 1;
-    }
-    VkDescriptorPool descriptorPool = pomVkGetDescriptorPool( &vCtx.descriptorPoolCtx );
-    if( !descriptorPool ){
-        LOG( "Failed to get descriptor pool" );
-        return 1;
+    const uint32_t renderGroupModelIndices[] = { 0, 1, 2, 3, 4, 5, 7 };
+    const uint32_t numRenderGroupModels = sizeof( renderGroupModelIndices ) / sizeof( uint32_t );
+    // Split the models between the culled and two-sided rendergroups
+    PomVkModelCtx *renderGroupModels[ 2 ][ sizeof( renderGroupModelIndices ) / sizeof( uint32_t ) ];
+    uint32_t numGroupModels[ 2 ] = { 0 };
+    for( uint32_t i = 0; i < numRenderGroupModels; i++ ){
+        // Models with their meshes merged at bake time have fewer
+        if( renderGroupModelIndices[ i ] >= vCtx.numModels ){
+            continue;
+        }
+        PomVkModelCtx *model = &vCtx.models[ renderGroupModelIndices[ i ] ];
+        uint32_t group = model->twoSided ? SCENE_PIPELINE_TWO_SIDED : SCENE_PIPELINE_CULLED;
+        renderGroupModels[ group ][ numGroupModels[ group ]++ ] = model;
     }
-
-    PomVkModelCtx *renderGroupModels[] = { &vCtx.models[ 0 ], &vCtx.models[ 1 ],
-                                           &vCtx.models[ 2 ], &vCtx.models[ 3 ],
-                                           &vCtx.models[ 4 ], &vCtx.models[ 5 ],
-                                           &vCtx.models[ 7 ] };
     // Set up renderpass
-    PomVkRenderGroupCtx renderGroupCtx = { 0 };
-    if( pomVkRenderGroupCreate( &renderGroupCtx, &vCtx.pipelineCtx,
-                                1, cameraDescriptor,
-                                vCtx.numModels - 1, renderGroupModels ) ){
-        LOG( "Failed to create rendergroup" );
+    PomVkRenderGroupCtx renderGroupCtxs[ 2 ] = { 0 };
+    vCtx.renderGroups = renderGroupCtxs;
+    vCtx.numRenderGroups = 0;
+    for( uint32_t group = 0; group < 2; group++ ){
+        if( !numGroupModels[ group ] ){
+            continue;
+        }
+        PomVkRenderGroupCtx *renderGroupCtx = &renderGroupCtxs[ vCtx.numRenderGroups ];
+        if( pomVkRenderGroupCreate( renderGroupCtx, vCtx.pipelines[ group ],
+                                    1, cameraDescriptor,
+                                    numGroupModels[ group ], renderGroupModels[ group ] ) ){
+            LOG( "Failed to create rendergroup" );
+            return 1;
+        }
+        PomPipelineCtx *prepassPipeline = vCtx.pipelines[ group + SCENE_PIPELINE_PREPASS_OFFSET ];
+        if( prepassPipeline && pomVkRenderGroupSetDepthPrepass( renderGroupCtx, prepassPipeline ) ){
+            LOG( "Failed to set rendergroup depth prepass" );
+            return 1;
+        }
+        vCtx.numRenderGroups++;
+    }
+    // Now the rendergroups know how many descriptor sets they need, allocate them
+    if( createDescriptorPool( &vCtx, numSwapchainImages ) ){
+        LOG( "Failed to create descriptor pool" );
         return 1;
     }
-    // Allocate descriptor sets for rendergroup
-    pomVkRenderGroupAllocateDescriptorSets( &renderGroupCtx, descriptorPool );
-    vCtx.renderGroups = &renderGroupCtx;
-    vCtx.numRenderGroups = 1;
+    VkDescriptorPool descriptorPool = pomVkGetDescriptorPool( &vCtx.descriptorPoolCtx );
+    for( uint32_t i = 0; i < vCtx.numRenderGroups; i++ ){
+        if( pomVkRenderGroupAllocateDescriptorSets( &vCtx.renderGroups[ i ], descriptorPool ) ){
+            LOG( "Failed to allocate rendergroup descriptor sets" );
+            return 1;
+        }
+    }
     setupCommandBuffers( &vCtx );
 
     // TODO - get rid of this
     camera = &vCtx.camera;
     glfwSetKeyCallback( getWindow(), keyEvent );
 
-    uint32_t numCommandBuffers;
     uint32_t gfxQueueIdx, presentQueueIdx;
-    VkCommandBuffer *commandBuffers = pomCommandBuffersGet( &numCommandBuffers );
     VkSwapchainKHR *swapchain = pomGetSwapchain();
     VkQueue *gfxQueue = pomDeviceGetGraphicsQueue( &gfxQueueIdx );
     VkQueue *presentQueue = pomDeviceGetPresentQueue( &presentQueueIdx );
@@ -218,23 +313,34 @@ int main( int argc, char ** argv ){
     while( !pomIoShouldClose() ){
         // Poll for IO events
         pomIoPoll();
-        
-        // Update Camera UBO
-        if( pomCameraUpdateUBO( &vCtx.camera, *device ) ){
-            LOG( "Failed to update camera UBO" );
-            break;
-        }
 
         // Draw a frame
         uint32_t imageIndex;
-        vkAcquireNextImageKHR( *device, *swapchain, UINT64_MAX,
-                               vCtx.imageSemaphore.semaphore, NULL, &imageIndex );
+        VkResult acquireRes = vkAcquireNextImageKHR( *device, *swapchain, UINT64_MAX,
+                                                     vCtx.imageSemaphore.semaphore, NULL, &imageIndex );
+        if( acquireRes == VK_ERROR_OUT_OF_DATE_KHR ){
+            // Nothing was acquired, so just rebuild and try again
+            if( resizeSwapchain( &vCtx ) ){
+                break;
+            }
+            continue;
+        }
+        if( acquireRes != VK_SUCCESS && acquireRes != VK_SUBOPTIMAL_KHR ){
+            LOG( "Failed to acquire swapchain image" );
+            break;
+        }
 
-        if( imageIndex >= numCommandBuffers ){
+        // Replaced along with the swapchain when its image count changes
+        uint32_t numCommandBuffers;
+        VkCommandBuffer *commandBuffers = pomCommandBuffersGet( &numCommandBuffers );
+        if( !commandBuffers || imageIndex >= numCommandBuffers ){
             LOG( "Discrepency between swapchain image index and command buffer size.\
                   Requesting index %i for buffer size %i", imageIndex, numCommandBuffers );
             break;
         }
+        if( updateFrameData( &vCtx, imageIndex ) ){
+            break;
+        }
         VkSubmitInfo drawSubmitInfo = {
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
             .pWaitSemaphores = (VkSemaphore[]){ vCtx.imageSemaphore.semaphore },
@@ -261,13 +367,26 @@ int main( int argc, char ** argv ){
             .pResults = NULL
         };
 
-        if( vkQueuePresentKHR( *presentQueue, &presentInfo ) != VK_SUCCESS ){
+        VkResult presentRes = vkQueuePresentKHR( *presentQueue, &presentInfo );
+        if( presentRes != VK_SUCCESS && presentRes != VK_SUBOPTIMAL_KHR &&
+            presentRes != VK_ERROR_OUT_OF_DATE_KHR ){
             LOG( "Failed to present swapchain" );
             break;
         }
 
         vkQueueWaitIdle( *presentQueue );
 
+        if( defragmentModels( &vCtx ) ){
+            break;
+        }
+
+        // Checking the window too, as not every platform reports resizes through the swapchain
+        if( pomIoWindowResized() || presentRes != VK_SUCCESS ){
+            if( resizeSwapchain( &vCtx ) ){
+                break;
+            }
+        }
+
     }
     
     vkDeviceWaitIdle( *device );
@@ -287,25 +406,56 @@ int main( int argc, char ** argv ){
     if( pomCommandPoolDestroy() ){
         LOG( "Failed to destroy command pool" );
     }
-    LOG( "Destroy swapchain framebuffers" );
-    if( pomSwapchainFramebuffersDestroy() ){
-        LOG( "Failed to destroy swapchain framebuffers" );
+    if( vCtx.renderPass != VK_NULL_HANDLE ){
+        // Also destroys the image views and depth
+        LOG( "Destroy swapchain framebuffers" );
+        if( pomSwapchainFramebuffersDestroy() ){
+            LOG( "Failed to destroy swapchain framebuffers" );
+        }
+    }else{
+        LOG( "Destroy swapchain depth" );
+        if( pomSwapchainDepthDestroy() ){
+            LOG( "Failed to destroy swapchain depth" );
+        }
+        LOG( "Destroy swapchain image views" );
+        if( pomSwapchainImageViewsDestroy() ){
+            LOG( "Failed to destroy swapchain image views" );
+        }
     }
-    LOG( "Destroy swapchain image views" );
-    if( pomSwapchainImageViewsDestroy() ){
-        LOG( "Failed to destroy swapchain image views" );
+    LOG( "Destroy pipeline manifest" );
+    if( pomPipelineManifestDestroy() ){
+        LOG( "Failed to destroy pipeline manifest" );
     }
-    LOG( "Destroy Pipeline" );
-    if( pomPipelineDestroy( &vCtx.pipelineCtx ) ){
-        LOG( "Failed to destroy pipeline" );
+    LOG( "Release Pipelines" );
+    for( uint32_t i = 0; i < NUM_SCENE_PIPELINES; i++ ){
+        if( vCtx.pipelines[ i ] && pomPipelineRegistryRelease( vCtx.pipelines[ i ] ) ){
+            LOG( "Failed to release pipeline" );
+        }
+    }
+    LOG( "Destroy pipeline registry" );
+    if( pomPipelineRegistryDestroy() ){
+        LOG( "Failed to destroy pipeline registry" );
+    }
+    if( vCtx.renderPass != VK_NULL_HANDLE ){
+        LOG( "Destroy RenderPass" );
+        if( pomRenderPassDestroy( &vCtx.renderPass ) ){
+            LOG( "Failed to destroy RenderPass" );
+        }
     }
-    LOG( "Destroy RenderPass" );
-    if( pomRenderPassDestroy( &vCtx.renderPass ) ){
-        LOG( "Failed to destroy RenderPass" );
+
+    LOG( "Destroy upload manager" );
+    if( pomVkUploadManagerDestroy() ){
+        LOG( "Failed to destroy upload manager" );
     }
-    LOG( "Destroy shaders" );
-    if( pomShaderDestroy( &vCtx.basicShaders ) ){
-        LOG( "Failed to destroy shaders" );
+
+    LOG( "Destroy frame ring buffer" );
+    if( pomVkRingBufferDestroy( &vCtx.frameRing ) ){
+        LOG( "Failed to destroy frame ring buffer" );
+    }
+
+    LOG( "Destroy memory manager" );
+    if( pomVkMemoryManagerDestroy() ){
+        LOG( "Failed to destroy memory manager" );
     }
 
     LOG( "Destroy logical device" );
@@ -351,6 +501,17 @@ void loadModel( void *_userData ){
         modelCtx->initialised = false;
         return;
     }
+    if( modelCtx->format->numInstanceInfo ){
+        // Baked with --instancing, where meshes keep their node transforms separately and
+        // duplicates share data. Each mesh would be drawn once at its local origin
+        LOG( "Model %s has instanced meshes, which can't be drawn yet. Bake it without "
+             "--instancing", modelCtx->filePath );
+        free( modelCtx->format );
+        modelCtx->format = NULL;
+        modelCtx->dataBlock = NULL;
+        modelCtx->initialised = false;
+        return;
+    }
     modelCtx->initialised = true;
     return;
 }
@@ -381,43 +542,104 @@ void setupVulkan( void* _userData ){
         return;
     }
 
-    LOG( "Create shaders" );
-    vCtx->basicShaders = (ShaderInfo){
-        .vertexShaderPath = "./res/shaders/basicV.vert.psf",
-        .fragmentShaderPath = "./res/shaders/basicF.frag.psf"
-    };
-    if( pomShaderCreate( &vCtx->basicShaders ) ){
-        LOG( "Failed to create shaders" );
+    LOG( "Create memory manager" );
+    if( pomVkMemoryManagerCreate() ){
+        LOG( "Failed to create memory manager" );
+        return;
+    }
+
+    LOG( "Create upload manager" );
+    const char *cStagingSize = pomMapGetSet( &systemConfig.mapCtx, CONFIG_UPLOAD_STAGING_SIZE_KEY,
+                                             DEFAULT_UPLOAD_STAGING_SIZE );
+    if( pomVkUploadManagerCreate( (VkDeviceSize) atoi( cStagingSize ) * 1024 ) ){
+        LOG( "Failed to create upload manager" );
         return;
     }
+
+    LOG( "Create pipeline registry" );
+    if( pomPipelineRegistryCreate() ){
+        LOG( "Failed to create pipeline registry" );
+        return;
+    }
+
+    bool dynamicRendering = pomDeviceDynamicRenderingEnabled();
+    vCtx->renderPass = VK_NULL_HANDLE;
+    if( !dynamicRendering ){
+        LOG( "Create RenderPass" );
+        if( pomRenderPassCreate( &vCtx->renderPass ) ){
+            LOG( "Failed to create RenderPass" );
+            return;
+        }
+    }
+
+    // Build the previous run's pipelines in the background. Scene pipelines requested below
+    // that are among them wait on the build in flight rather than starting their own
+    if( pomPipelineManifestWarmup( &vCtx->renderPass, vCtx->threadpool ) ){
+        LOG( "Failed to warm up pipelines" );
+    }
+
     // Need to manually set shader attrib info for now
 //    if( manualShaderSetup( &vCtx->basicShaders, *dev ) ){
 //        LOG( "Failed to setup shader interface info" );
 //        return;
  //   }
 
-    LOG( "Create RenderPass" );
-    if( pomRenderPassCreate( &vCtx->renderPass ) ){
-        LOG( "Failed to create RenderPass" );
-        return;
-    }
-    vCtx->pipelineCtx=(PomPipelineCtx){
-        .pipelineType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO
+    LOG( "Create shaders and pipelines" );
+    vCtx->basicShaders = (ShaderInfo){
+        .programPath = "./res/shaders/basic.ppf",
+        .vertexShaderPath = "./res/shaders/basicV.vert.psf",
+        .fragmentShaderPath = "./res/shaders/basicF.frag.psf",
+        .variantDefines = "POM_SHOW_NORMALS=0"
     };
-    LOG( "Create Pipeline" );
-    if( pomPipelineCreate( &vCtx->pipelineCtx, &vCtx->basicShaders, &vCtx->renderPass ) ){
-        LOG( "Failed to create Pipeline" );
+    PomPipelineState pipelineStates[ NUM_SCENE_PIPELINES ];
+    pipelineStates[ SCENE_PIPELINE_CULLED ] = POM_PIPELINE_STATE_DEFAULT;
+    pipelineStates[ SCENE_PIPELINE_CULLED ].colourFormat = *pomGetSwapchainImageFormat();
+    pipelineStates[ SCENE_PIPELINE_CULLED ].depthFormat = pomSwapchainDepthFormatGet();
+    pipelineStates[ SCENE_PIPELINE_TWO_SIDED ] = pipelineStates[ SCENE_PIPELINE_CULLED ];
+    pipelineStates[ SCENE_PIPELINE_TWO_SIDED ].cullMode = VK_CULL_MODE_NONE;
+    uint32_t numPipelines = SCENE_PIPELINE_PREPASS_OFFSET;
+    if( vCtx->depthPrepass ){
+        for( uint32_t i = 0; i < SCENE_PIPELINE_PREPASS_OFFSET; i++ ){
+            PomPipelineState baseState = pipelineStates[ i ];
+            pomPipelineStateSplitDepthPrepass( &baseState,
+                                               &pipelineStates[ i + SCENE_PIPELINE_PREPASS_OFFSET ],
+                                               &pipelineStates[ i ] );
+        }
+        numPipelines = NUM_SCENE_PIPELINES;
+    }
+    PomPipelineBatchItem pipelineItems[ NUM_SCENE_PIPELINES ];
+    for( uint32_t i = 0; i < numPipelines; i++ ){
+        pipelineItems[ i ] = (PomPipelineBatchItem){
+            .shaderInfo = &vCtx->basicShaders,
+            .state = &pipelineStates[ i ],
+            .renderPass = &vCtx->renderPass
+        };
+    }
+    if( pomPipelineCreateBatch( pipelineItems, numPipelines, vCtx->threadpool,
+                                vCtx->pipelineBatchJobs, NUM_SCENE_PIPELINES ) ){
+        LOG( "Failed to create Pipelines" );
         return;
     }
+    for( uint32_t i = 0; i < numPipelines; i++ ){
+        vCtx->pipelines[ i ] = pipelineItems[ i ].pipelineCtx;
+    }
     LOG( "Create swapchain image views" );
     if( pomSwapchainImageViewsCreate() ){
         LOG( "Failed to create swapchain image views" );
         return;
     }
-    LOG( "Create swapchain framebuffers" );
-    if( pomSwapchainFramebuffersCreate( &vCtx->renderPass ) ){
-        LOG( "Failed to create swapchain framebuffers" );
-        return;
+    if( dynamicRendering ){
+        LOG( "Create swapchain depth" );
+        if( pomSwapchainDepthCreate() ){
+            LOG( "Failed to create swapchain depth" );
+            return;
+        }
+    }else{
+        LOG( "Create swapchain framebuffers" );
+        if( pomSwapchainFramebuffersCreate( &vCtx->renderPass ) ){
+            LOG( "Failed to create swapchain framebuffers" );
+            return;
+        }
     }
     LOG( "Create command pool" );
     if( pomCommandPoolCreate() ){
@@ -431,7 +653,7 @@ void setupVulkan( void* _userData ){
     }
     /*
     LOG( "Record default renderpass" );
-    if( pomRecordDefaultCommands( &vCtx->renderPass, &vCtx->pipelineCtx ) ){
+    if( pomRecordDefaultCommands( &vCtx->renderPass, vCtx->pipelines[ SCENE_PIPELINE_CULLED ] ) ){
         LOG( "Failed to record default renderpass" );
         return;
     }
@@ -447,6 +669,200 @@ void setupVulkan( void* _userData ){
     vCtx->initialised = true;
 }
 
+// Path of the pipeline manifest beside the config file, to be freed by the caller
+static char *defaultManifestPath( const char *_configPath ){
+    const char *lastSlash = strrchr( _configPath, '/' );
+    size_t dirLength = lastSlash ? (size_t) ( lastSlash - _configPath ) + 1 : 0;
+    size_t pathSize = dirLength + sizeof( DEFAULT_PIPELINE_MANIFEST_NAME );
+    char *path = (char*) malloc( pathSize );
+    if( !path ){
+        return NULL;
+    }
+    memcpy( path, _configPath, dirLength );
+    memcpy( path + dirLength, DEFAULT_PIPELINE_MANIFEST_NAME, sizeof( DEFAULT_PIPELINE_MANIFEST_NAME ) );
+    return path;
+}
+
+// Rebuild the swapchain at the window's new size, then everything recorded against it
+static int resizeSwapchain( VulkanCtx *_vCtx ){
+    int resizeRet;
+    do{
+        // The surface can still have no area for a moment after the window is restored
+        pomIoWaitWhileMinimised();
+        if( pomIoShouldClose() ){
+            return 0;
+        }
+        resizeRet = pomSwapchainResize( &_vCtx->renderPass );
+        if( resizeRet == 1 ){
+            LOG( "Failed to resize swapchain" );
+            return 1;
+        }
+        if( resizeRet == 2 ){
+            pomIoPoll();
+        }
+    }while( resizeRet == 2 );
+
+    uint32_t numImages, numCmdBuffers;
+    if( !pomGetSwapchainImages( &numImages ) || !pomCommandBuffersGet( &numCmdBuffers ) ){
+        LOG( "Failed to get swapchain image and command buffer counts" );
+        return 1;
+    }
+    if( numImages != numCmdBuffers && recreateImageResources( _vCtx, numImages ) ){
+        LOG( "Failed to recreate resources for %u swapchain images", numImages );
+        return 1;
+    }
+    const VkExtent2D *swapchainExtent = pomGetSwapchainExtent();
+    if( pomCameraResize( &_vCtx->camera, swapchainExtent->width, swapchainExtent->height ) ){
+        LOG( "Failed to resize camera" );
+        return 1;
+    }
+    if( pomCommandBuffersReset() || setupCommandBuffers( _vCtx ) ){
+        LOG( "Failed to re-record command buffers" );
+        return 1;
+    }
+    return 0;
+}
+
+// A descriptor pool with room for every rendergroup's sets for _numImages swapchain images.
+// Each set holds a single uniform buffer
+static int createDescriptorPool( VulkanCtx *_vCtx, uint32_t _numImages ){
+    VkDevice *device = pomGetLogicalDevice();
+    if( !device ){
+        LOG( "Attempting to create descriptor pool without logical device" );
+        return 1;
+    }
+    uint32_t numSets = 0;
+    for( uint32_t i = 0; i < _vCtx->numRenderGroups; i++ ){
+        numSets += (uint32_t) _vCtx->renderGroups[ i ].setsPerSwapchainImage * _numImages;
+    }
+    if( !numSets ){
+        // Pools can't be empty
+        numSets = 1;
+    }
+    PomVkDescriptorPoolInfo poolInfo = { 0 };
+    poolInfo.descriptorTypeSizes[ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER ] = numSets;
+    return pomVkDescriptorPoolCreate( &_vCtx->descriptorPoolCtx, &poolInfo, *device );
+}
+
+// Remake everything there's one of per swapchain image, after the swapchain is recreated
+// with a different number of them. The device must be idle. Commands need recording after
+static int recreateImageResources( VulkanCtx *_vCtx, uint32_t _numImages ){
+    VkDevice *device = pomGetLogicalDevice();
+    if( !device ){
+        LOG( "Attempting to recreate swapchain image resources without logical device" );
+        return 1;
+    }
+    if( pomCommandBuffersRecreate() ){
+        LOG( "Failed to recreate command buffers" );
+        return 1;
+    }
+
+    // The ring has a frame per image, and descriptors living in it a buffer info per frame
+    if( pomVkRingBufferResize( &_vCtx->frameRing, _numImages ) ){
+        LOG( "Failed to resize frame ring buffer" );
+        return 1;
+    }
+    PomVkDescriptorCtx *cameraDescriptor = pomCameraGetDescriptor( &_vCtx->camera );
+    if( !cameraDescriptor || pomVkDescriptorRefreshBufferInfo( cameraDescriptor ) ){
+        LOG( "Failed to refresh camera descriptor" );
+        return 1;
+    }
+    for( uint32_t i = 0; i < _vCtx->numModels; i++ ){
+        if( !_vCtx->models[ i ].initialised ){
+            continue;
+        }
+        if( pomVkDescriptorRefreshBufferInfo( pomVkModelGetDescriptor( &_vCtx->models[ i ] ) ) ){
+            LOG( "Failed to refresh model descriptor" );
+            return 1;
+        }
+    }
+
+    // Descriptor sets are allocated per image too, so the pool is replaced with one sized for
+    // the new count
+    if( pomVkDescriptorPoolDestroy( &_vCtx->descriptorPoolCtx, *device ) ){
+        LOG( "Failed to destroy descriptor pool" );
+        return 1;
+    }
+    if( createDescriptorPool( _vCtx, _numImages ) ){
+        LOG( "Failed to recreate descriptor pool" );
+        return 1;
+    }
+    VkDescriptorPool descriptorPool = pomVkGetDescriptorPool( &_vCtx->descriptorPoolCtx );
+    for( uint32_t i = 0; i < _vCtx->numRenderGroups; i++ ){
+        PomVkRenderGroupCtx *renderGroupCtx = &_vCtx->renderGroups[ i ];
+        if( pomVkRenderGroupReleaseDescriptorSets( renderGroupCtx ) ||
+            pomVkRenderGroupAllocateDescriptorSets( renderGroupCtx, descriptorPool ) ){
+            LOG( "Failed to reallocate rendergroup descriptor sets" );
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Write this frame's camera UBO and model matrices to its part of the ring. Where one lands
+// somewhere new, descriptor sets are rewritten and commands re-recorded to match, which only
+// happens while the ring is first filled or when the set of models changes
+static int updateFrameData( VulkanCtx *_vCtx, uint32_t _imageIndex ){
+    if( pomVkRingBufferBeginFrame( &_vCtx->frameRing, _imageIndex ) ){
+        LOG( "Failed to begin frame ring" );
+        return 1;
+    }
+    bool moved = false;
+    int updateRet = pomCameraUpdateUBO( &_vCtx->camera, _imageIndex );
+    if( updateRet == 1 ){
+        LOG( "Failed to update camera UBO" );
+        return 1;
+    }
+    moved |= updateRet == 2;
+    for( uint32_t i = 0; i < _vCtx->numModels; i++ ){
+        if( !_vCtx->models[ i ].initialised ){
+            continue;
+        }
+        updateRet = pomVkModelUpdateDescriptors( &_vCtx->models[ i ], _imageIndex );
+        if( updateRet == 1 ){
+            LOG( "Failed to update model descriptors" );
+            return 1;
+        }
+        moved |= updateRet == 2;
+    }
+    if( pomVkRingBufferFlush( &_vCtx->frameRing ) ){
+        LOG( "Failed to flush frame ring buffer" );
+        return 1;
+    }
+    if( !moved ){
+        return 0;
+    }
+    for( uint32_t i = 0; i < _vCtx->numRenderGroups; i++ ){
+        if( pomVkRenderGroupWriteDescriptorSets( &_vCtx->renderGroups[ i ] ) ){
+            LOG( "Failed to rewrite rendergroup descriptor sets" );
+            return 1;
+        }
+    }
+    if( pomCommandBuffersReset() || setupCommandBuffers( _vCtx ) ){
+        LOG( "Failed to re-record command buffers" );
+        return 1;
+    }
+    return 0;
+}
+
+// Spend the frame's defragment budget, then re-record the commands binding moved models'
+// buffers. Descriptor sets only point at the frame ring, so are left as they are
+static int defragmentModels( VulkanCtx *_vCtx ){
+    uint32_t numMoved;
+    if( pomVkDefragmentStep( _vCtx->models, _vCtx->numModels, _vCtx->defragmentBudgetUs, &numMoved ) ){
+        LOG( "Failed to defragment model memory" );
+        return 1;
+    }
+    if( !numMoved ){
+        return 0;
+    }
+    if( pomCommandBuffersReset() || setupCommandBuffers( _vCtx ) ){
+        LOG( "Failed to re-record command buffers" );
+        return 1;
+    }
+    return 0;
+}
+
 static int setupCommandBuffers( VulkanCtx *_vCtx ){
     uint32_t numCmdBuffers;
     VkCommandBuffer * cmdBuffers = pomCommandBuffersGet( &numCmdBuffers );
@@ -459,12 +875,6 @@ static int setupCommandBuffers( VulkanCtx *_vCtx ){
         LOG( "Attempting to record commands without available logical device" );
         return 1;
     }
-    uint32_t numFramebuffers;
-    VkFramebuffer *swapchainBuffers = pomSwapchainFramebuffersGet( &numFramebuffers );
-    if( !swapchainBuffers ){
-        LOG( "Attempting to record commands without valid framebuffers" );
-        return 1;
-    }
     VkExtent2D *swapchainExtent = pomGetSwapchainExtent();
     if( !swapchainExtent ){
         LOG( "Attempting to record commands without valid swapchain extent" );
@@ -482,23 +892,29 @@ static int setupCommandBuffers( VulkanCtx *_vCtx ){
             return 1;
         }
 
-        VkClearValue clearValue = {{{ 0.5f, 0.5f, 0.5f, 1.0f }}};
-        
-        VkRenderPassBeginInfo renderPassBeginInfo = {
-            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-            .framebuffer = swapchainBuffers[ i ],
-            .renderArea.extent = *swapchainExtent,
-            .renderArea.offset = (VkOffset2D){ .x = 0, .y = 0 },
-            .renderPass = _vCtx->renderPass,
-            .pClearValues = &clearValue,
-            .clearValueCount = 1
+        // Colour, then depth
+        VkClearValue clearValues[] = {
+            {{{ 0.5f, 0.5f, 0.5f, 1.0f }}},
+            { .depthStencil = { 1.0f, 0 } }
         };
-        vkCmdBeginRenderPass( cmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE );
+        
+        if( pomSwapchainRenderingBegin( cmdBuffer, i, &_vCtx->renderPass, clearValues ) ){
+            LOG( "Failed to begin rendering to swapchain image" );
+            return 1;
+        }
+        pomRecordViewportScissor( cmdBuffer, swapchainExtent );
 
+        // Lay down all depth before shading anything
+        for( uint32_t renderGroupIdx = 0; renderGroupIdx < _vCtx->numRenderGroups; renderGroupIdx++ ){
+            pomVkRenderGroupRecordDepthPrepass( &_vCtx->renderGroups[ renderGroupIdx ], cmdBuffer, i );
+        }
         for( uint32_t renderGroupIdx = 0; renderGroupIdx < _vCtx->numRenderGroups; renderGroupIdx++ ){
             pomVkRenderGroupRecord( &_vCtx->renderGroups[ renderGroupIdx ], cmdBuffer, i );
         }
-        vkCmdEndRenderPass( cmdBuffer );
+        if( pomSwapchainRenderingEnd( cmdBuffer, i, &_vCtx->renderPass ) ){
+            LOG( "Failed to end rendering to swapchain image" );
+            return 1;
+        }
 
         if( vkEndCommandBuffer( cmdBuffer ) != VK_SUCCESS ){
             LOG( "Failed to record command" );
@@ -20,10 +20,20 @@ struct PomIoCtx{
     GLFWwindow *window;
     bool surfaceInitialised;
     VkSurfaceKHR renderSurface;
+    // Set by the framebuffer size callback, cleared by pomIoWindowResized
+    bool resized;
 };
 
 PomIoCtx pomIoCtx = { 0 };
 
+static void framebufferSizeEvent( GLFWwindow* UNUSED(window), int width, int height ){
+    pomIoCtx.windowExtent = (VkExtent2D){
+        .width = width,
+        .height = height
+    };
+    pomIoCtx.resized = true;
+}
+
 // TODO - remove
 GLFWwindow *getWindow(){
     return pomIoCtx.window;
@@ -41,7 +51,7 @@ int pomIoInit(){
     }
 
     glfwWindowHint( GLFW_CLIENT_API, GLFW_NO_API );
-    glfwWindowHint( GLFW_RESIZABLE, GLFW_FALSE );
+    glfwWindowHint( GLFW_RESIZABLE, GLFW_TRUE );
 
     const char * cwidth = pomMapGetSet( &systemConfig.mapCtx, "window_width", DEFAULT_WIDTH );
     const char * cheight = pomMapGetSet( &systemConfig.mapCtx, "window_height", DEFAULT_HEIGHT );
@@ -84,6 +94,7 @@ int pomIoInit(){
         .width = width,
         .height = height
     };
+    glfwSetFramebufferSizeCallback( pomIoCtx.window, framebufferSizeEvent );
 
     pomIoCtx.initialised = true;
     return 0;
@@ -133,6 +144,20 @@ int pomIoPoll(){
     return 0;
 }
 
+bool pomIoWindowResized(){
+    bool resized = pomIoCtx.resized;
+    pomIoCtx.resized = false;
+    return resized;
+}
+
+int pomIoWaitWhileMinimised(){
+    while( ( !pomIoCtx.windowExtent.width || !pomIoCtx.windowExtent.height ) &&
+           !glfwWindowShouldClose( pomIoCtx.window ) ){
+        glfwWaitEvents();
+    }
+    return 0;
+}
+
 // Create the rendering surface
 int pomIoCreateSurface(){
     if( pomIoCtx.surfaceInitialised ){
@@ -95,6 +95,13 @@ int loadBakedModel( const char *_filePath, PomModelFormat **_format,
     return 0;
 }
 
+bool pomModelMeshIsTwoSided( const PomModelFormat *_format, const PomModelMeshInfo *_meshInfo ){
+    if( _meshInfo->materialId >= _format->numMaterialInfo ){
+        return true;
+    }
+    return _format->materialInfoOffset[ _meshInfo->materialId ].isTwoSided != 0;
+}
+
 
 // TODO - consider making this a macro
 static inline uint8_t *getRelativeOffset( const uint8_t *_dataBlockStart, const uint8_t *_dataLoc ){
@@ -185,11 +192,20 @@ int relativisePointers( PomModelFormat *_format, uint8_t *_dataBlock ){
         }
     }
 
+    for( uint32_t i = 0; i < _format->numInstanceInfo; i++ ){
+        PomModelInstanceInfo *instanceInfo = &_format->instanceInfo[ i ];
+        if( relativiseOffset( _dataBlock, (uint8_t**)&instanceInfo->transformsOffset ) ){
+            printf( "Failed to relativise instance info\n" );
+            return 1;
+        }
+    }
+
     if( relativiseOffset( _dataBlock, (uint8_t**)&_format->textureInfoOffset ) ||
         relativiseOffset( _dataBlock, (uint8_t**)&_format->meshInfoOffset ) ||
         relativiseOffset( _dataBlock, (uint8_t**)&_format->materialInfoOffset ) ||
         relativiseOffset( _dataBlock, (uint8_t**)&_format->submodelInfo ) ||
-        relativiseOffset( _dataBlock, (uint8_t**)&_format->modelInfo ) ){
+        relativiseOffset( _dataBlock, (uint8_t**)&_format->modelInfo ) ||
+        relativiseOffset( _dataBlock, (uint8_t**)&_format->instanceInfo ) ){
             printf( "Failed to relativise data block pointers\n" );
             return 1;
     }
@@ -213,7 +229,8 @@ int absolutisePointers( PomModelFormat *_format ){
         absolutiseOffset( dataStart, (uint8_t**)&_format->meshInfoOffset ) ||
         absolutiseOffset( dataStart, (uint8_t**)&_format->materialInfoOffset ) ||
         absolutiseOffset( dataStart, (uint8_t**)&_format->submodelInfo ) ||
-        absolutiseOffset( dataStart, (uint8_t**)&_format->modelInfo ) ){
+        absolutiseOffset( dataStart, (uint8_t**)&_format->modelInfo ) ||
+        absolutiseOffset( dataStart, (uint8_t**)&_format->instanceInfo ) ){
             printf( "Failed to relativise data block pointers\n" );
             return 1;
     }
@@ -268,5 +285,119 @@ int absolutisePointers( PomModelFormat *_format ){
         }
     }
 
+    for( uint32_t i = 0; i < _format->numInstanceInfo; i++ ){
+        PomModelInstanceInfo *instanceInfo = &_format->instanceInfo[ i ];
+        if( absolutiseOffset( dataStart, (uint8_t**)&instanceInfo->transformsOffset ) ){
+            printf( "Failed to relativise instance info\n" );
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int pomModelStreamOpen( PomModelStreamWriter *_writer, const char *_filePath,
+                        size_t _metadataSize ){
+    if( _writer->initialised ){
+        LOG( WARN, "Attempting to open an already open stream writer" );
+        return 2;
+    }
+    FILE *outputFile = fopen( _filePath, "wb" );
+    if( !outputFile ){
+        LOG( ERR, "Failed to open output file %s", _filePath );
+        return 1;
+    }
+
+    // Reserve space for the header and metadata, which get patched in on finalise
+    static const uint8_t zeroBlock[ 4096 ] = { 0 };
+    size_t reserveRemaining = sizeof( PomModelFormat ) + _metadataSize;
+    while( reserveRemaining ){
+        size_t writeSize = reserveRemaining < sizeof( zeroBlock ) ? reserveRemaining : sizeof( zeroBlock );
+        if( fwrite( zeroBlock, sizeof( uint8_t ), writeSize, outputFile ) != writeSize ){
+            LOG( ERR, "Failed to reserve metadata space in %s", _filePath );
+            fclose( outputFile );
+            remove( _filePath );
+            return 1;
+        }
+        reserveRemaining -= writeSize;
+    }
+
+    *_writer = (PomModelStreamWriter){
+        .initialised = true,
+        .file = outputFile,
+        .filePath = _filePath,
+        .metadataSize = _metadataSize,
+        .dataBlockBytesWritten = _metadataSize
+    };
     return 0;
-}
\ No newline at end of file
+}
+
+int pomModelStreamWrite( PomModelStreamWriter *_writer, const void *_data,
+                         size_t _dataSize, uint8_t **_relativeOffset ){
+    if( !_writer->initialised ){
+        LOG( ERR, "Attempting to write to an unopened stream writer" );
+        return 1;
+    }
+    size_t bytesWritten = fwrite( _data, sizeof( uint8_t ), _dataSize, _writer->file );
+    if( bytesWritten != _dataSize ){
+        LOG( ERR, "Failed to write section to %s", _writer->filePath );
+        return 1;
+    }
+    if( _relativeOffset ){
+        *_relativeOffset = (uint8_t*) NULL + sizeof( PomModelFormat ) + _writer->dataBlockBytesWritten;
+    }
+    _writer->dataBlockBytesWritten += bytesWritten;
+    return 0;
+}
+
+int pomModelStreamFinalise( PomModelStreamWriter *_writer, PomModelFormat *_format,
+                            const uint8_t *_metadataBlock ){
+    if( !_writer->initialised ){
+        LOG( ERR, "Attempting to finalise an unopened stream writer" );
+        return 1;
+    }
+    int err = 0;
+    _format->dataBlockSize = _writer->dataBlockBytesWritten;
+
+    if( fseek( _writer->file, 0, SEEK_SET ) ){
+        LOG( ERR, "Failed to seek to start of %s", _writer->filePath );
+        err = 1;
+        goto finaliseFailure;
+    }
+    if( fwrite( _format, sizeof( PomModelFormat ), 1, _writer->file ) != 1 ){
+        LOG( ERR, "Failed to write format header to %s", _writer->filePath );
+        err = 1;
+        goto finaliseFailure;
+    }
+    size_t metadataWritten = fwrite( _metadataBlock, sizeof( uint8_t ),
+                                     _writer->metadataSize, _writer->file );
+    if( metadataWritten != _writer->metadataSize ){
+        LOG( ERR, "Failed to write metadata block to %s", _writer->filePath );
+        err = 1;
+        goto finaliseFailure;
+    }
+
+finaliseFailure:
+    if( fclose( _writer->file ) ){
+        LOG( ERR, "Failed to close output file %s", _writer->filePath );
+        err = 1;
+    }
+    if( err ){
+        // Without a valid header the file is useless, and would look up to date to make
+        remove( _writer->filePath );
+    }
+    _writer->file = NULL;
+    _writer->initialised = false;
+    return err;
+}
+
+int pomModelStreamAbort( PomModelStreamWriter *_writer ){
+    if( !_writer->initialised ){
+        return 0;
+    }
+    fclose( _writer->file );
+    remove( _writer->filePath );
+    _writer->file = NULL;
+    _writer->initialised = false;
+    return 0;
+}
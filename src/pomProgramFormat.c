@@ -0,0 +1,471 @@
+#include "pomProgramFormat.h"
+#include "common.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LOG( lvl, log, ... ) LOG_MODULE( lvl, PomProgramFormat, log, ##__VA_ARGS__ )
+
+// Every section starts 8-byte aligned, so bytecode can be handed to Vulkan in place
+#define PROGRAM_ALIGNMENT 8
+
+static uint64_t _priv_alignUp( uint64_t _size ){
+    return ( _size + PROGRAM_ALIGNMENT - 1 ) & ~( (uint64_t) PROGRAM_ALIGNMENT - 1 );
+}
+
+// Return the offset of a new section of _sizeBytes and move _cursor past it
+static uint64_t _priv_reserve( uint64_t *_cursor, uint64_t _sizeBytes ){
+    uint64_t offset = *_cursor;
+    *_cursor += _priv_alignUp( _sizeBytes );
+    return offset;
+}
+
+static const PomShaderFormat *_priv_findStageFormat( PomShaderFormat **_stageFormats, uint32_t _numStages,
+                                                     VkShaderStageFlagBits _stage ){
+    for( uint32_t i = 0; i < _numStages; i++ ){
+        if( _stageFormats[ i ]->shaderStage == _stage ){
+            return _stageFormats[ i ];
+        }
+    }
+    return NULL;
+}
+
+static int _priv_compareBindings( const void *_a, const void *_b ){
+    const PomProgramBindingInfo *a = (const PomProgramBindingInfo*) _a;
+    const PomProgramBindingInfo *b = (const PomProgramBindingInfo*) _b;
+    if( a->set != b->set ){
+        return a->set < b->set ? -1 : 1;
+    }
+    if( a->binding != b->binding ){
+        return a->binding < b->binding ? -1 : 1;
+    }
+    return 0;
+}
+
+// Merge the descriptors of every stage into _bindings, which must be able to hold all of them.
+// Stages sharing a binding share the entry. Returns 0 on success, 1 on failure
+static int _priv_mergeBindings( PomShaderFormat **_stageFormats, uint32_t _numStages,
+                                PomProgramBindingInfo *_bindings, uint32_t *_numBindings ){
+    uint32_t numBindings = 0;
+    for( uint32_t i = 0; i < _numStages; i++ ){
+        const PomShaderFormat *format = _stageFormats[ i ];
+        for( uint32_t j = 0; j < format->numDescriptorInfo; j++ ){
+            const PomShaderDescriptorInfo *descInfo = &format->descriptorInfoOffset[ j ];
+            PomProgramBindingInfo *binding = NULL;
+            for( uint32_t k = 0; k < numBindings; k++ ){
+                if( _bindings[ k ].set == descInfo->set && _bindings[ k ].binding == descInfo->binding ){
+                    binding = &_bindings[ k ];
+                    break;
+                }
+            }
+            if( binding ){
+                if( binding->type != descInfo->type || binding->count != descInfo->count ){
+                    LOG( ERR, "Stages disagree on descriptor %s at set %u binding %u",
+                         descInfo->nameOffset, descInfo->set, descInfo->binding );
+                    return 1;
+                }
+                binding->stageFlags |= format->shaderStage;
+                continue;
+            }
+            _bindings[ numBindings++ ] = (PomProgramBindingInfo){
+                .set = descInfo->set,
+                .binding = descInfo->binding,
+                .type = descInfo->type,
+                .count = descInfo->count,
+                .stageFlags = format->shaderStage
+            };
+        }
+    }
+    qsort( _bindings, numBindings, sizeof( PomProgramBindingInfo ), _priv_compareBindings );
+    *_numBindings = numBindings;
+    return 0;
+}
+
+size_t pomProgramFormatBuild( PomShaderFormat **_stageFormats, uint32_t _numStages,
+                              PomProgramFormat **_program ){
+    if( _numStages == 0 || _numStages > POM_PROGRAM_MAX_STAGES ){
+        LOG( ERR, "Programs need between 1 and %u stages, got %u", POM_PROGRAM_MAX_STAGES, _numStages );
+        return 0;
+    }
+    for( uint32_t i = 0; i < _numStages; i++ ){
+        if( _priv_findStageFormat( _stageFormats, i, _stageFormats[ i ]->shaderStage ) ){
+            LOG( ERR, "Stage of %s appears more than once in program", _stageFormats[ i ]->shaderNameOffset );
+            return 0;
+        }
+    }
+    const PomShaderFormat *vertexFormat =
+        _priv_findStageFormat( _stageFormats, _numStages, VK_SHADER_STAGE_VERTEX_BIT );
+    if( !vertexFormat ||
+        !_priv_findStageFormat( _stageFormats, _numStages, VK_SHADER_STAGE_FRAGMENT_BIT ) ){
+        LOG( ERR, "Program requires vertex and fragment stages" );
+        return 0;
+    }
+
+    // Merge the descriptors up front, since the set count depends on them
+    uint32_t maxBindings = 0;
+    for( uint32_t i = 0; i < _numStages; i++ ){
+        maxBindings += _stageFormats[ i ]->numDescriptorInfo;
+    }
+    PomProgramBindingInfo *bindings = NULL;
+    if( maxBindings ){
+        bindings = (PomProgramBindingInfo*) calloc( maxBindings, sizeof( PomProgramBindingInfo ) );
+        if( !bindings ){
+            LOG( ERR, "Failed to allocate program bindings" );
+            return 0;
+        }
+    }
+    uint32_t numBindings = 0;
+    if( _priv_mergeBindings( _stageFormats, _numStages, bindings, &numBindings ) ){
+        free( bindings );
+        return 0;
+    }
+    uint32_t numSets = numBindings ? bindings[ numBindings - 1 ].set + 1 : 0;
+
+    // Size everything up
+    uint64_t numVariants = 0;
+    uint64_t stringsSize = 0;
+    uint64_t bytecodeSize = 0;
+    uint32_t numPushConstantRanges = 0;
+    for( uint32_t i = 0; i < _numStages; i++ ){
+        const PomShaderFormat *format = _stageFormats[ i ];
+        numVariants += format->numVariantInfo;
+        stringsSize += _priv_alignUp( strlen( format->shaderNameOffset ) + 1 );
+        for( uint32_t j = 0; j < format->numVariantInfo; j++ ){
+            const PomShaderVariantInfo *variant = &format->variantInfoOffset[ j ];
+            stringsSize += _priv_alignUp( strlen( variant->definesOffset ) + 1 );
+            bytecodeSize += _priv_alignUp( variant->shaderBytecodeSizeBytes );
+        }
+        if( format->numPushConstantInfo ){
+            numPushConstantRanges++;
+        }
+    }
+    uint64_t programSize = _priv_alignUp( sizeof( PomProgramFormat ) )
+        + _priv_alignUp( _numStages * sizeof( PomProgramStageInfo ) )
+        + _priv_alignUp( numVariants * sizeof( PomProgramVariantInfo ) )
+        + _priv_alignUp( vertexFormat->numAttributeInfo * sizeof( VkVertexInputAttributeDescription ) )
+        + _priv_alignUp( numSets * sizeof( PomProgramSetInfo ) )
+        + _priv_alignUp( numBindings * sizeof( PomProgramBindingInfo ) )
+        + _priv_alignUp( numPushConstantRanges * sizeof( VkPushConstantRange ) )
+        + stringsSize + bytecodeSize;
+
+    uint8_t *programData = (uint8_t*) calloc( 1, programSize );
+    if( !programData ){
+        LOG( ERR, "Failed to allocate %lu byte program", programSize );
+        free( bindings );
+        return 0;
+    }
+    PomProgramFormat *program = (PomProgramFormat*) programData;
+    uint64_t cursor = 0;
+    _priv_reserve( &cursor, sizeof( PomProgramFormat ) );
+    *program = (PomProgramFormat){
+        .magic = POM_PROGRAM_FORMAT_MAGIC_NUM,
+        .version = POM_PROGRAM_FORMAT_VERSION,
+        .numStages = _numStages,
+        .stageInfoOffset = _priv_reserve( &cursor, _numStages * sizeof( PomProgramStageInfo ) ),
+        .numVertexAttributes = vertexFormat->numAttributeInfo,
+        .numSets = numSets,
+        .numBindings = numBindings,
+        .numPushConstantRanges = numPushConstantRanges,
+        .sizeBytes = programSize
+    };
+    uint64_t variantInfoOffset = _priv_reserve( &cursor, numVariants * sizeof( PomProgramVariantInfo ) );
+    program->vertexAttributeOffset =
+        _priv_reserve( &cursor, program->numVertexAttributes * sizeof( VkVertexInputAttributeDescription ) );
+    program->setInfoOffset = _priv_reserve( &cursor, numSets * sizeof( PomProgramSetInfo ) );
+    program->bindingInfoOffset = _priv_reserve( &cursor, numBindings * sizeof( PomProgramBindingInfo ) );
+    program->pushConstantRangeOffset =
+        _priv_reserve( &cursor, numPushConstantRanges * sizeof( VkPushConstantRange ) );
+
+    // Stages, their variants, names and bytecode
+    PomProgramStageInfo *stageInfos = (PomProgramStageInfo*) ( programData + program->stageInfoOffset );
+    PomProgramVariantInfo *variantInfos = (PomProgramVariantInfo*) ( programData + variantInfoOffset );
+    VkPushConstantRange *pushConstantRanges =
+        (VkPushConstantRange*) ( programData + program->pushConstantRangeOffset );
+    uint32_t pushConstantIdx = 0;
+    for( uint32_t i = 0; i < _numStages; i++ ){
+        const PomShaderFormat *format = _stageFormats[ i ];
+        size_t nameSize = strlen( format->shaderNameOffset ) + 1;
+        stageInfos[ i ] = (PomProgramStageInfo){
+            .stage = format->shaderStage,
+            .numVariants = format->numVariantInfo,
+            .nameOffset = _priv_reserve( &cursor, nameSize ),
+            .variantInfoOffset = (uint8_t*) variantInfos - programData
+        };
+        memcpy( programData + stageInfos[ i ].nameOffset, format->shaderNameOffset, nameSize );
+        for( uint32_t j = 0; j < format->numVariantInfo; j++ ){
+            const PomShaderVariantInfo *variant = &format->variantInfoOffset[ j ];
+            size_t definesSize = strlen( variant->definesOffset ) + 1;
+            variantInfos->definesOffset = _priv_reserve( &cursor, definesSize );
+            variantInfos->bytecodeOffset = _priv_reserve( &cursor, variant->shaderBytecodeSizeBytes );
+            variantInfos->bytecodeSizeBytes = variant->shaderBytecodeSizeBytes;
+            memcpy( programData + variantInfos->definesOffset, variant->definesOffset, definesSize );
+            memcpy( programData + variantInfos->bytecodeOffset, variant->shaderBytecodeOffset,
+                    variant->shaderBytecodeSizeBytes );
+            variantInfos++;
+        }
+        if( format->numPushConstantInfo ){
+            pushConstantRanges[ pushConstantIdx++ ] = (VkPushConstantRange){
+                .stageFlags = format->shaderStage,
+                .offset = format->pushConstantInfoOffset[ 0 ].offset,
+                .size = format->pushConstantInfoOffset[ 0 ].sizeBytes
+            };
+        }
+    }
+
+    // Vertex input, with attributes interleaved in location order
+    VkVertexInputAttributeDescription *attributes =
+        (VkVertexInputAttributeDescription*) ( programData + program->vertexAttributeOffset );
+    uint32_t vertexStride = 0;
+    for( uint32_t i = 0; i < vertexFormat->numAttributeInfo; i++ ){
+        const PomShaderAttributeInfo *attrInfo = &vertexFormat->attributeInfoOffset[ i ];
+        attributes[ i ] = (VkVertexInputAttributeDescription){
+            .location = attrInfo->location,
+            .binding = 0,
+            .format = pomShaderDataTypeFormat( attrInfo->dataType ),
+            .offset = vertexStride
+        };
+        if( attributes[ i ].format == VK_FORMAT_UNDEFINED ){
+            LOG( ERR, "Unsupported data type for vertex attribute %s", attrInfo->nameOffset );
+            free( programData );
+            free( bindings );
+            return 0;
+        }
+        vertexStride += pomShaderDataTypeSize( attrInfo->dataType );
+    }
+    program->vertexStrideBytes = vertexStride;
+
+    // Descriptor sets, each pointing at its run of the sorted bindings
+    PomProgramSetInfo *setInfos = (PomProgramSetInfo*) ( programData + program->setInfoOffset );
+    if( numBindings ){
+        memcpy( programData + program->bindingInfoOffset, bindings,
+                numBindings * sizeof( PomProgramBindingInfo ) );
+    }
+    for( uint32_t i = 0; i < numBindings; i++ ){
+        PomProgramSetInfo *setInfo = &setInfos[ bindings[ i ].set ];
+        if( !setInfo->numBindings ){
+            setInfo->firstBinding = i;
+        }
+        setInfo->numBindings++;
+    }
+    for( uint32_t i = 0; i < numSets; i++ ){
+        if( !setInfos[ i ].numBindings ){
+            // Keep empty sets pointing within the bindings
+            setInfos[ i ].firstBinding = i ? setInfos[ i - 1 ].firstBinding + setInfos[ i - 1 ].numBindings : 0;
+        }
+    }
+    free( bindings );
+
+    if( cursor != programSize ){
+        LOG( ERR, "Program layout inconsistent with its size (%lu vs %lu bytes)", cursor, programSize );
+        free( programData );
+        return 0;
+    }
+    *_program = program;
+    return programSize;
+}
+
+size_t pomProgramFormatWrite( const char *_path, const PomProgramFormat *_program ){
+    FILE *outputFile = fopen( _path, "wb" );
+    if( !outputFile ){
+        LOG( ERR, "Failed to open program output file %s", _path );
+        return 0;
+    }
+    size_t written = fwrite( _program, sizeof( uint8_t ), _program->sizeBytes, outputFile );
+    if( fclose( outputFile ) ){
+        LOG( ERR, "Failed to close program output file %s", _path );
+        return 0;
+    }
+    if( written != _program->sizeBytes ){
+        LOG( ERR, "Failed to write program %s", _path );
+        return 0;
+    }
+    return written;
+}
+
+// Check _count elements of _elementSize at _offset lie within the program
+static bool _priv_rangeValid( const PomProgramFormat *_program, uint64_t _offset, uint64_t _count,
+                              uint64_t _elementSize ){
+    if( !_count ){
+        return true;
+    }
+    if( _offset < sizeof( PomProgramFormat ) || _offset >= _program->sizeBytes ||
+        _offset % PROGRAM_ALIGNMENT ){
+        return false;
+    }
+    return _count <= ( _program->sizeBytes - _offset ) / _elementSize;
+}
+
+static bool _priv_stringValid( const PomProgramFormat *_program, uint64_t _offset ){
+    if( _offset < sizeof( PomProgramFormat ) || _offset >= _program->sizeBytes ){
+        return false;
+    }
+    return memchr( (const uint8_t*) _program + _offset, '\0', _program->sizeBytes - _offset ) != NULL;
+}
+
+// Check every offset in the program, so the accessors never need to.
+// Returns 0 if valid, 1 otherwise
+static int _priv_validate( const PomProgramFormat *_program, size_t _sizeBytes ){
+    if( _program->magic != POM_PROGRAM_FORMAT_MAGIC_NUM ){
+        LOG( ERR, "Not a program file" );
+        return 1;
+    }
+    if( _program->version != POM_PROGRAM_FORMAT_VERSION ){
+        LOG( ERR, "Program version %u unsupported, expected %u",
+             _program->version, POM_PROGRAM_FORMAT_VERSION );
+        return 1;
+    }
+    if( _program->sizeBytes != _sizeBytes ){
+        LOG( ERR, "Program size inconsistent with header description" );
+        return 1;
+    }
+    if( !_priv_rangeValid( _program, _program->stageInfoOffset, _program->numStages,
+                           sizeof( PomProgramStageInfo ) ) ||
+        !_priv_rangeValid( _program, _program->vertexAttributeOffset, _program->numVertexAttributes,
+                           sizeof( VkVertexInputAttributeDescription ) ) ||
+        !_priv_rangeValid( _program, _program->setInfoOffset, _program->numSets,
+                           sizeof( PomProgramSetInfo ) ) ||
+        !_priv_rangeValid( _program, _program->bindingInfoOffset, _program->numBindings,
+                           sizeof( PomProgramBindingInfo ) ) ||
+        !_priv_rangeValid( _program, _program->pushConstantRangeOffset, _program->numPushConstantRanges,
+                           sizeof( VkPushConstantRange ) ) ){
+        LOG( ERR, "Program section out of bounds" );
+        return 1;
+    }
+    const PomProgramSetInfo *setInfos = pomProgramFormatGetSets( _program );
+    for( uint32_t i = 0; i < _program->numSets; i++ ){
+        if( setInfos[ i ].firstBinding > _program->numBindings ||
+            setInfos[ i ].numBindings > _program->numBindings - setInfos[ i ].firstBinding ){
+            LOG( ERR, "Program set %u bindings out of bounds", i );
+            return 1;
+        }
+    }
+    const PomProgramStageInfo *stageInfos =
+        (const PomProgramStageInfo*) ( (const uint8_t*) _program + _program->stageInfoOffset );
+    for( uint32_t i = 0; i < _program->numStages; i++ ){
+        const PomProgramStageInfo *stageInfo = &stageInfos[ i ];
+        if( !_priv_stringValid( _program, stageInfo->nameOffset ) ||
+            !stageInfo->numVariants ||
+            !_priv_rangeValid( _program, stageInfo->variantInfoOffset, stageInfo->numVariants,
+                               sizeof( PomProgramVariantInfo ) ) ){
+            LOG( ERR, "Program stage %u out of bounds", i );
+            return 1;
+        }
+        const PomProgramVariantInfo *variantInfos =
+            (const PomProgramVariantInfo*) ( (const uint8_t*) _program + stageInfo->variantInfoOffset );
+        for( uint32_t j = 0; j < stageInfo->numVariants; j++ ){
+            if( !_priv_stringValid( _program, variantInfos[ j ].definesOffset ) ||
+                !variantInfos[ j ].bytecodeSizeBytes ||
+                variantInfos[ j ].bytecodeSizeBytes % sizeof( uint32_t ) ||
+                !_priv_rangeValid( _program, variantInfos[ j ].bytecodeOffset,
+                                   variantInfos[ j ].bytecodeSizeBytes, sizeof( uint8_t ) ) ){
+                LOG( ERR, "Program stage %u variant %u out of bounds", i, j );
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+size_t pomProgramFormatMap( const char *_path, const PomProgramFormat **_program ){
+    int fd = open( _path, O_RDONLY );
+    if( fd < 0 ){
+        LOG( ERR, "Failed to open program file %s", _path );
+        return 0;
+    }
+    struct stat fileStat;
+    if( fstat( fd, &fileStat ) ){
+        LOG( ERR, "Failed to get size of program file %s", _path );
+        close( fd );
+        return 0;
+    }
+    size_t fSize = fileStat.st_size;
+    if( fSize < sizeof( PomProgramFormat ) ){
+        LOG( ERR, "Program file %s does not contain header", _path );
+        close( fd );
+        return 0;
+    }
+
+    // The mapping stays valid once the file is closed
+    void *mapping = mmap( NULL, fSize, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if( mapping == MAP_FAILED ){
+        LOG( ERR, "Failed to map program file %s", _path );
+        return 0;
+    }
+    if( _priv_validate( (const PomProgramFormat*) mapping, fSize ) ){
+        LOG( ERR, "Invalid program file %s", _path );
+        munmap( mapping, fSize );
+        return 0;
+    }
+
+    LOG( DEBUG, "Successfully mapped program %s", _path );
+    *_program = (const PomProgramFormat*) mapping;
+    return fSize;
+}
+
+void pomProgramFormatUnmap( const PomProgramFormat *_program ){
+    if( munmap( (void*) _program, _program->sizeBytes ) ){
+        LOG( WARN, "Failed to unmap program" );
+    }
+}
+
+const PomProgramStageInfo *pomProgramFormatGetStage( const PomProgramFormat *_program,
+                                                     VkShaderStageFlagBits _stage ){
+    const PomProgramStageInfo *stageInfos =
+        (const PomProgramStageInfo*) ( (const uint8_t*) _program + _program->stageInfoOffset );
+    for( uint32_t i = 0; i < _program->numStages; i++ ){
+        if( stageInfos[ i ].stage == _stage ){
+            return &stageInfos[ i ];
+        }
+    }
+    return NULL;
+}
+
+const PomProgramVariantInfo *pomProgramFormatFindVariant( const PomProgramFormat *_program,
+                                                          const PomProgramStageInfo *_stageInfo,
+                                                          const char *_defines ){
+    const PomProgramVariantInfo *variantInfos =
+        (const PomProgramVariantInfo*) ( (const uint8_t*) _program + _stageInfo->variantInfoOffset );
+    if( !_defines ){
+        return &variantInfos[ 0 ];
+    }
+    for( uint32_t i = 0; i < _stageInfo->numVariants; i++ ){
+        const char *variantDefines = pomProgramFormatGetString( _program, variantInfos[ i ].definesOffset );
+        if( pomShaderDefinesMatch( variantDefines, _defines ) ){
+            return &variantInfos[ i ];
+        }
+    }
+    return NULL;
+}
+
+const char *pomProgramFormatGetString( const PomProgramFormat *_program, uint64_t _offset ){
+    return (const char*) _program + _offset;
+}
+
+const uint32_t *pomProgramFormatGetBytecode( const PomProgramFormat *_program,
+                                             const PomProgramVariantInfo *_variantInfo ){
+    return (const uint32_t*) ( (const uint8_t*) _program + _variantInfo->bytecodeOffset );
+}
+
+const VkVertexInputAttributeDescription *pomProgramFormatGetVertexAttributes(
+    const PomProgramFormat *_program ){
+    return (const VkVertexInputAttributeDescription*)
+        ( (const uint8_t*) _program + _program->vertexAttributeOffset );
+}
+
+const PomProgramSetInfo *pomProgramFormatGetSets( const PomProgramFormat *_program ){
+    return (const PomProgramSetInfo*) ( (const uint8_t*) _program + _program->setInfoOffset );
+}
+
+const PomProgramBindingInfo *pomProgramFormatGetBindings( const PomProgramFormat *_program ){
+    return (const PomProgramBindingInfo*) ( (const uint8_t*) _program + _program->bindingInfoOffset );
+}
+
+const VkPushConstantRange *pomProgramFormatGetPushConstantRanges( const PomProgramFormat *_program ){
+    return (const VkPushConstantRange*) ( (const uint8_t*) _program + _program->pushConstantRangeOffset );
+}
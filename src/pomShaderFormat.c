@@ -1,5 +1,7 @@
 #include "pomShaderFormat.h"
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
 
 #define LOG( lvl, log, ... ) LOG_MODULE( lvl, PomShaderFormat, log, ##__VA_ARGS__ )
 
@@ -54,7 +56,22 @@ int pomShaderFormatRelativisePointers( PomShaderFormat *_format, uint8_t *_dataB
             return 1;
         }
     }
-    // Adjust the attribute/descriptor/bytecode blocks
+    for( uint32_t i = 0; i < _format->numPushConstantInfo; i++ ){
+        PomShaderPushConstantInfo *pushInfo = &_format->pushConstantInfoOffset[ i ];
+        if( _priv_relativisePointer( _format, (void*)&pushInfo->nameOffset, _dataBlock ) ){
+            LOG( ERR, "Failed to relativise push constant name" );
+            return 1;
+        }
+    }
+    for( uint32_t i = 0; i < _format->numVariantInfo; i++ ){
+        PomShaderVariantInfo *variantInfo = &_format->variantInfoOffset[ i ];
+        if( _priv_relativisePointer( _format, (void*)&variantInfo->definesOffset, _dataBlock ) ||
+            _priv_relativisePointer( _format, (void*)&variantInfo->shaderBytecodeOffset, _dataBlock ) ){
+            LOG( ERR, "Failed to relativise variant info" );
+            return 1;
+        }
+    }
+    // Adjust the attribute/descriptor/variant/bytecode blocks
     if( _priv_relativisePointer( _format, (void*)&_format->attributeInfoOffset, _dataBlock ) ){
             LOG( ERR, "Failed to relativise attribute infos" );
             return 1;
@@ -63,6 +80,14 @@ int pomShaderFormatRelativisePointers( PomShaderFormat *_format, uint8_t *_dataB
             LOG( ERR, "Failed to relativise descriptor infos" );
             return 1;
     }
+    if( _priv_relativisePointer( _format, (void*)&_format->pushConstantInfoOffset, _dataBlock ) ){
+            LOG( ERR, "Failed to relativise push constant infos" );
+            return 1;
+    }
+    if( _priv_relativisePointer( _format, (void*)&_format->variantInfoOffset, _dataBlock ) ){
+            LOG( ERR, "Failed to relativise variant infos" );
+            return 1;
+    }
     if( _priv_relativisePointer( _format, (void*)&_format->shaderBytecodeOffset, _dataBlock ) ){
             LOG( ERR, "Failed to relativise shader bytecode block" );
             return 1;
@@ -72,7 +97,7 @@ int pomShaderFormatRelativisePointers( PomShaderFormat *_format, uint8_t *_dataB
 
 // Turn relative offsets into the format block into absolute pointers to system memory
 int pomShaderFormatAbsolutisePointers( PomShaderFormat *_format ){
-    // Adjust the attribute/descriptor/bytecode blocks
+    // Adjust the attribute/descriptor/variant/bytecode blocks
     if( _priv_absolutisePointer( _format, (void*)&_format->attributeInfoOffset ) ){
             LOG( ERR, "Failed to absolutise attribute infos" );
             return 1;
@@ -81,6 +106,14 @@ int pomShaderFormatAbsolutisePointers( PomShaderFormat *_format ){
             LOG( ERR, "Failed to absolutise descriptor infos" );
             return 1;
     }
+    if( _priv_absolutisePointer( _format, (void*)&_format->pushConstantInfoOffset ) ){
+            LOG( ERR, "Failed to absolutise push constant infos" );
+            return 1;
+    }
+    if( _priv_absolutisePointer( _format, (void*)&_format->variantInfoOffset ) ){
+            LOG( ERR, "Failed to absolutise variant infos" );
+            return 1;
+    }
     if( _priv_absolutisePointer( _format, (void*)&_format->shaderBytecodeOffset ) ){
             LOG( ERR, "Failed to absolutise shader bytecode block" );
             return 1;
@@ -101,6 +134,21 @@ int pomShaderFormatAbsolutisePointers( PomShaderFormat *_format ){
             return 1;
         }
     }
+    for( uint32_t i = 0; i < _format->numPushConstantInfo; i++ ){
+        PomShaderPushConstantInfo *pushInfo = &_format->pushConstantInfoOffset[ i ];
+        if( _priv_absolutisePointer( _format, (void*)&pushInfo->nameOffset ) ){
+            LOG( ERR, "Failed to absolutise push constant name" );
+            return 1;
+        }
+    }
+    for( uint32_t i = 0; i < _format->numVariantInfo; i++ ){
+        PomShaderVariantInfo *variantInfo = &_format->variantInfoOffset[ i ];
+        if( _priv_absolutisePointer( _format, (void*)&variantInfo->definesOffset ) ||
+            _priv_absolutisePointer( _format, (void*)&variantInfo->shaderBytecodeOffset ) ){
+            LOG( ERR, "Failed to absolutise variant info" );
+            return 1;
+        }
+    }
     if( _priv_absolutisePointer( _format, (void*)&_format->shaderNameOffset ) ){
         LOG( ERR, "Failed to absolutise shader name" );
         return 1;
@@ -109,6 +157,110 @@ int pomShaderFormatAbsolutisePointers( PomShaderFormat *_format ){
     return 0;
 }
 
+VkFormat pomShaderDataTypeFormat( PomShaderDataTypes _dataType ){
+    switch( _dataType ){
+        case SHADER_FLOAT:
+            return VK_FORMAT_R32_SFLOAT;
+        case SHADER_INT8:
+            return VK_FORMAT_R8_SINT;
+        case SHADER_INT16:
+            return VK_FORMAT_R16_SINT;
+        case SHADER_INT32:
+            return VK_FORMAT_R32_SINT;
+        case SHADER_INT64:
+            return VK_FORMAT_R64_SINT;
+        case SHADER_VEC2:
+            return VK_FORMAT_R32G32_SFLOAT;
+        case SHADER_VEC3:
+            return VK_FORMAT_R32G32B32_SFLOAT;
+        case SHADER_VEC4:
+            return VK_FORMAT_R32G32B32A32_SFLOAT;
+        default:
+            return VK_FORMAT_UNDEFINED;
+    }
+    return VK_FORMAT_UNDEFINED;
+}
+
+size_t pomShaderDataTypeSize( PomShaderDataTypes _dataType ){
+    // TODO - verify these values; alignment may be an issue
+    switch( _dataType ){
+        case SHADER_FLOAT:
+            return sizeof( float );
+        case SHADER_INT8:
+            return sizeof( int8_t );
+        case SHADER_INT16:
+            return sizeof( int16_t );
+        case SHADER_INT32:
+            return sizeof( int32_t );
+        case SHADER_INT64:
+            return sizeof( int64_t );
+        case SHADER_VEC2:
+            return 2 * sizeof( float );
+        case SHADER_VEC3:
+            return 3 * sizeof( float );
+        case SHADER_VEC4:
+            return 4 * sizeof( float );
+        default:
+            LOG( ERR, "Failed to get format data size" );
+            return 0;
+    }
+    LOG( ERR, "Failed to get format data size" );
+    return 0;
+}
+
+// Find the `NAME=` definition in a space-separated defines string.
+// Returns a pointer to the start of the value, or NULL if the name isn't defined
+static const char *_priv_findDefineValue( const char *_defines, const char *_name, size_t _nameLen ){
+    const char *define = _defines;
+    while( *define ){
+        define += strspn( define, " " );
+        size_t defineLen = strcspn( define, " " );
+        if( defineLen > _nameLen && define[ _nameLen ] == '=' &&
+            !strncmp( define, _name, _nameLen ) ){
+            return define + _nameLen + 1;
+        }
+        define += defineLen;
+    }
+    return NULL;
+}
+
+bool pomShaderDefinesMatch( const char *_variantDefines, const char *_defines ){
+    const char *define = _defines;
+    while( *define ){
+        define += strspn( define, " " );
+        size_t defineLen = strcspn( define, " " );
+        const char *equals = memchr( define, '=', defineLen );
+        if( equals ){
+            size_t nameLen = equals - define;
+            size_t valueLen = defineLen - nameLen - 1;
+            const char *variantValue = _priv_findDefineValue( _variantDefines, define, nameLen );
+            if( variantValue && ( strcspn( variantValue, " " ) != valueLen ||
+                                  strncmp( variantValue, equals + 1, valueLen ) ) ){
+                return false;
+            }
+        }
+        define += defineLen;
+    }
+    return true;
+}
+
+const PomShaderVariantInfo *pomShaderFormatFindVariant( const PomShaderFormat *_format,
+                                                        const char *_defines ){
+    if( !_format->numVariantInfo ){
+        return NULL;
+    }
+    if( !_defines ){
+        return &_format->variantInfoOffset[ 0 ];
+    }
+    // Variants are baked with the first axis values first, so the first match
+    // has any unmentioned axes at their defaults
+    for( uint32_t i = 0; i < _format->numVariantInfo; i++ ){
+        if( pomShaderDefinesMatch( _format->variantInfoOffset[ i ].definesOffset, _defines ) ){
+            return &_format->variantInfoOffset[ i ];
+        }
+    }
+    return NULL;
+}
 
 // Write Shader Format to disk. Function will relativise pointers in the format
 size_t pomShaderFormatWrite( const char *_path, PomShaderFormat *_format, void *_dataBlock  ){
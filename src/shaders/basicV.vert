@@ -9,30 +9,30 @@ layout( location = 2 ) in vec3 vertexTangent;
 layout( location = 3 ) in vec3 vertexBitangent;
 layout( location = 4 ) in vec2 uvCoord;
 
-// POM_ATTRIBUTE vertexPos 0 SHADER_VEC3
-// POM_ATTRIBUTE vertexNorm 1 SHADER_VEC3
-// POM_ATTRIBUTE vertexTangent 2 SHADER_VEC3
-// POM_ATTRIBUTE vertexBitangent 3 SHADER_VEC3
-// POM_ATTRIBUTE uvCoord 4 SHADER_VEC2
-
 layout( location = 0 ) out vec3 fragColor;
 
-layout( binding = 0 ) uniform CameraUBO {
+// Set 0 is bound once per rendergroup, set 1 per model
+layout( set = 0, binding = 0 ) uniform CameraUBO {
     mat4 projectionMatrix;
     mat4 viewMatrix;
     mat4 PvMatrix;
 } cameraUbo;
 
-layout( binding = 1 ) uniform ModelUBO {
+layout( set = 1, binding = 0 ) uniform ModelUBO {
     mat4 modelMatrix;
 } modelUbo;
 
-// POM_DESCRIPTOR CameraUBO UNIFORM_BUFFER 0 0 192
-// POM_DESCRIPTOR ModelUBO UNIFORM_BUFFER 0 1 64
-
 // Can put another UBO here for shading properties
 
+// Flat shading, or normals shown as colour for debugging
+// POM_VARIANT POM_SHOW_NORMALS 0 1
+
 void main() {
-    gl_Position = cameraUbo.projectionMatrix * cameraUbo.viewMatrix * vec4( vertexPos, 1.0 );
+    gl_Position = cameraUbo.projectionMatrix * cameraUbo.viewMatrix * modelUbo.modelMatrix *
+                  vec4( vertexPos, 1.0 );
+#if POM_SHOW_NORMALS
+    fragColor = vertexNorm * 0.5 + 0.5;
+#else
     fragColor = vec3( 0.1, 0.1, 0.1 );
+#endif
 }
\ No newline at end of file
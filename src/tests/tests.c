@@ -6,6 +6,7 @@
 #include "cmore/queue.h"
 #include <stdlib.h>
 #include "cmore/threadpool.h"
+#include "vkmemorytlsf.h"
 #include <time.h>
 
 // Allow default config path to be overruled by compile option
@@ -19,6 +20,7 @@ void testHashmap();
 void testConfig();
 void testQueues();
 void testThreadpool();
+int testMemoryTlsf();
 
 // Equivalent to b-a
 void timeDiff( struct timespec *a, struct timespec *b, struct timespec *out ){
@@ -48,6 +50,9 @@ int main(){
 //    testConfig();
 //    testQueues();
     testThreadpool();
+    if( testMemoryTlsf() ){
+        return 1;
+    }
     return 0;
 }
 
@@ -221,3 +226,53 @@ void testThreadpool(){
     LOG( "SJ Time %f", sjTimeMs );
 }
 
+
+int testMemoryTlsf(){
+    PomVkMemoryTlsf *tlsf = (PomVkMemoryTlsf*) calloc( 1, sizeof( PomVkMemoryTlsf ) );
+    int failed = 0;
+
+    // A dedicated block holds one free range of exactly the requested size, which doesn't
+    // have to be a subclass boundary
+    PomVkMemoryRange dedicated = { .offset = 0, .size = 40000000 };
+    pomVkMemoryTlsfInsertFree( tlsf, &dedicated );
+    if( pomVkMemoryTlsfFindFree( tlsf, 40000000 ) != &dedicated ){
+        LOG( "TLSF didn't find an exact-size free range" );
+        failed = 1;
+    }
+    if( pomVkMemoryTlsfFindFree( tlsf, 40000001 ) ){
+        LOG( "TLSF found a free range smaller than requested" );
+        failed = 1;
+    }
+    pomVkMemoryTlsfRemoveFree( tlsf, &dedicated );
+    if( tlsf->flBitmap || pomVkMemoryTlsfFindFree( tlsf, 1 ) ){
+        LOG( "TLSF index not empty after removing its only range" );
+        failed = 1;
+    }
+
+    // Requests are served from the smallest class guaranteed to fit, including larger classes
+    PomVkMemoryRange small = { .offset = 0, .size = 100 };
+    PomVkMemoryRange large = { .offset = 100, .size = 1 << 20 };
+    pomVkMemoryTlsfInsertFree( tlsf, &small );
+    pomVkMemoryTlsfInsertFree( tlsf, &large );
+    if( pomVkMemoryTlsfFindFree( tlsf, 64 ) != &small ){
+        LOG( "TLSF didn't find the smaller fitting range" );
+        failed = 1;
+    }
+    if( pomVkMemoryTlsfFindFree( tlsf, 4096 ) != &large ){
+        LOG( "TLSF didn't find a range in a larger class" );
+        failed = 1;
+    }
+    pomVkMemoryTlsfRemoveFree( tlsf, &large );
+    if( pomVkMemoryTlsfFindFree( tlsf, 4096 ) ){
+        LOG( "TLSF found a removed range" );
+        failed = 1;
+    }
+    if( pomVkMemoryTlsfFindFree( tlsf, 3 ) != &small ){
+        LOG( "TLSF lost a range still free" );
+        failed = 1;
+    }
+
+    free( tlsf );
+    LOG( "TLSF index test %s", failed ? "failed" : "passed" );
+    return failed;
+}
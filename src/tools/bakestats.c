@@ -0,0 +1,461 @@
+#include "common.h"
+#include "bakestats.h"
+#include "meshweld.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define LOG( level, log, ... ) LOG_MODULE( level, BakeStats, log, ##__VA_ARGS__ )
+
+// Typical post-transform cache size for current hardware
+#define STATS_VERTEX_CACHE_SIZE 32
+#define STATS_OVERDRAW_GRID_SIZE 256
+#define STATS_NUM_LARGEST 5
+
+static const char *textureDataTypeNames[ POM_TEXTURE_DATA_RANGE ] = {
+    [ POM_TEXTURE_DATA_RAW_U8 ] = "raw",
+    [ POM_TEXTURE_DATA_BC1 ] = "bc1",
+    [ POM_TEXTURE_DATA_BC3 ] = "bc3",
+    [ POM_TEXTURE_DATA_BC4 ] = "bc4",
+    [ POM_TEXTURE_DATA_BC5 ] = "bc5",
+    [ POM_TEXTURE_DATA_BC7 ] = "bc7"
+};
+
+static const char *getTextureDataTypeName( PomModelTextureDataType _dataType ){
+    if( _dataType >= POM_TEXTURE_DATA_END ){
+        return "unknown";
+    }
+    return textureDataTypeNames[ _dataType ];
+}
+
+int pomBakeStatsCreate( PomBakeStats *_stats, uint32_t _numMeshes, uint32_t _numTextures ){
+    if( _stats->initialised ){
+        LOG( WARN, "Attempting to create existing bake stats" );
+        return 2;
+    }
+    *_stats = (PomBakeStats){ 0 };
+    _stats->meshes = (PomMeshStats*) calloc( _numMeshes + 1, sizeof( PomMeshStats ) );
+    _stats->textures = (PomTextureStats*) calloc( _numTextures + 1, sizeof( PomTextureStats ) );
+    if( !_stats->meshes || !_stats->textures ){
+        LOG( ERR, "Failed to allocate bake stats" );
+        free( _stats->meshes );
+        free( _stats->textures );
+        return 1;
+    }
+    _stats->numMeshes = _numMeshes;
+    _stats->initialised = true;
+    return 0;
+}
+
+void pomBakeStatsDestroy( PomBakeStats *_stats ){
+    if( !_stats->initialised ){
+        return;
+    }
+    free( _stats->meshes );
+    free( _stats->textures );
+    *_stats = (PomBakeStats){ 0 };
+}
+
+int pomBakeStatsAddSection( PomBakeStats *_stats, const char *_name, uint64_t _sizeBytes ){
+    if( _stats->numSections >= POM_BAKE_STATS_MAX_SECTIONS ){
+        LOG( ERR, "Too many bake stats sections" );
+        return 1;
+    }
+    _stats->sections[ _stats->numSections++ ] = (PomBakeStatsSection){
+        .name = _name,
+        .sizeBytes = _sizeBytes
+    };
+    return 0;
+}
+
+static uint64_t simulateVertexCache( const uint32_t *_indices, uint32_t _numIndices,
+                                     uint32_t _numVertices, uint32_t *_cacheTimestamps ){
+    // A vertex is in the FIFO if it was added within the last cache-size misses
+    uint32_t time = STATS_VERTEX_CACHE_SIZE + 1;
+    uint64_t misses = 0;
+    memset( _cacheTimestamps, 0, sizeof( uint32_t ) * _numVertices );
+    for( uint32_t i = 0; i < _numIndices; i++ ){
+        uint32_t index = _indices[ i ];
+        if( index >= _numVertices ){
+            continue;
+        }
+        if( time - _cacheTimestamps[ index ] > STATS_VERTEX_CACHE_SIZE ){
+            _cacheTimestamps[ index ] = time++;
+            misses++;
+        }
+    }
+    return misses;
+}
+
+// Rasterise front faces in index order into a depth grid looking down one axis,
+// counting fragments that pass a less-than depth test
+static void rasteriseView( const uint32_t *_indices, uint32_t _numIndices,
+                           const float *_vertices, uint32_t _numVertices, uint32_t _strideFloats,
+                           const float *_boundsMin, const float *_boundsMax,
+                           uint32_t _axis, bool _flip, float *_depthGrid,
+                           uint64_t *_shadedPixels, uint64_t *_coveredPixels ){
+    const uint32_t gridSize = STATS_OVERDRAW_GRID_SIZE;
+    uint32_t axisU = ( _axis + 1 ) % 3, axisV = ( _axis + 2 ) % 3;
+    float extentU = _boundsMax[ axisU ] - _boundsMin[ axisU ];
+    float extentV = _boundsMax[ axisV ] - _boundsMin[ axisV ];
+    float scale = (float) gridSize / fmaxf( fmaxf( extentU, extentV ), 1e-6f );
+    for( uint32_t i = 0; i < gridSize * gridSize; i++ ){
+        _depthGrid[ i ] = INFINITY;
+    }
+
+    for( uint32_t tri = 0; tri + 2 < _numIndices; tri += 3 ){
+        float screen[ 3 ][ 3 ];
+        bool valid = true;
+        for( uint32_t corner = 0; corner < 3; corner++ ){
+            uint32_t index = _indices[ tri + corner ];
+            if( index >= _numVertices ){
+                valid = false;
+                break;
+            }
+            const float *position = &_vertices[ (size_t) index * _strideFloats ];
+            float u = ( position[ axisU ] - _boundsMin[ axisU ] ) * scale;
+            float depth = position[ _axis ] - _boundsMin[ _axis ];
+            // Looking the other way mirrors the view, so keep winding consistent
+            screen[ corner ][ 0 ] = _flip ? (float) gridSize - u : u;
+            screen[ corner ][ 1 ] = ( position[ axisV ] - _boundsMin[ axisV ] ) * scale;
+            screen[ corner ][ 2 ] = _flip ? -depth : depth;
+        }
+        if( !valid ){
+            continue;
+        }
+        float area = ( screen[ 1 ][ 0 ] - screen[ 0 ][ 0 ] ) * ( screen[ 2 ][ 1 ] - screen[ 0 ][ 1 ] ) -
+                     ( screen[ 2 ][ 0 ] - screen[ 0 ][ 0 ] ) * ( screen[ 1 ][ 1 ] - screen[ 0 ][ 1 ] );
+        if( area <= 0.0f ){
+            continue;
+        }
+        float minX = fminf( screen[ 0 ][ 0 ], fminf( screen[ 1 ][ 0 ], screen[ 2 ][ 0 ] ) );
+        float maxX = fmaxf( screen[ 0 ][ 0 ], fmaxf( screen[ 1 ][ 0 ], screen[ 2 ][ 0 ] ) );
+        float minY = fminf( screen[ 0 ][ 1 ], fminf( screen[ 1 ][ 1 ], screen[ 2 ][ 1 ] ) );
+        float maxY = fmaxf( screen[ 0 ][ 1 ], fmaxf( screen[ 1 ][ 1 ], screen[ 2 ][ 1 ] ) );
+        int32_t x0 = (int32_t) fmaxf( floorf( minX ), 0.0f );
+        int32_t x1 = (int32_t) fminf( ceilf( maxX ), (float) gridSize - 1.0f );
+        int32_t y0 = (int32_t) fmaxf( floorf( minY ), 0.0f );
+        int32_t y1 = (int32_t) fminf( ceilf( maxY ), (float) gridSize - 1.0f );
+        for( int32_t y = y0; y <= y1; y++ ){
+            for( int32_t x = x0; x <= x1; x++ ){
+                float px = (float) x + 0.5f, py = (float) y + 0.5f;
+                float w0 = ( screen[ 2 ][ 0 ] - screen[ 1 ][ 0 ] ) * ( py - screen[ 1 ][ 1 ] ) -
+                           ( screen[ 2 ][ 1 ] - screen[ 1 ][ 1 ] ) * ( px - screen[ 1 ][ 0 ] );
+                float w1 = ( screen[ 0 ][ 0 ] - screen[ 2 ][ 0 ] ) * ( py - screen[ 2 ][ 1 ] ) -
+                           ( screen[ 0 ][ 1 ] - screen[ 2 ][ 1 ] ) * ( px - screen[ 2 ][ 0 ] );
+                float w2 = area - w0 - w1;
+                if( w0 < 0.0f || w1 < 0.0f || w2 < 0.0f ){
+                    continue;
+                }
+                float depth = ( w0 * screen[ 0 ][ 2 ] + w1 * screen[ 1 ][ 2 ] + w2 * screen[ 2 ][ 2 ] ) / area;
+                float *gridDepth = &_depthGrid[ y * gridSize + x ];
+                if( depth < *gridDepth ){
+                    *gridDepth = depth;
+                    *_shadedPixels += 1;
+                }
+            }
+        }
+    }
+
+    for( uint32_t i = 0; i < gridSize * gridSize; i++ ){
+        if( _depthGrid[ i ] != INFINITY ){
+            *_coveredPixels += 1;
+        }
+    }
+}
+
+int pomMeshStatsAnalyse( const uint32_t *_indices, uint32_t _numIndices,
+                         const float *_vertices, uint32_t _numVertices, uint32_t _strideFloats,
+                         PomMeshStats *_meshStats ){
+    _meshStats->numSubmeshes++;
+    _meshStats->numVertices += _numVertices;
+    _meshStats->numIndices += _numIndices;
+    _meshStats->vertexStrideBytes = _strideFloats * sizeof( float );
+    _meshStats->dataSizeBytes += ( sizeof( uint32_t ) * _numIndices ) +
+                                 ( sizeof( float ) * _strideFloats * _numVertices );
+    if( _numVertices == 0 || _strideFloats < 3 ){
+        return 0;
+    }
+
+    int err = 0;
+    uint32_t *cacheTimestamps = (uint32_t*) malloc( sizeof( uint32_t ) * _numVertices );
+    float *vertexCopy = (float*) malloc( sizeof( float ) * _strideFloats * _numVertices );
+    float *depthGrid = (float*) malloc( sizeof( float ) * STATS_OVERDRAW_GRID_SIZE * STATS_OVERDRAW_GRID_SIZE );
+    if( !cacheTimestamps || !vertexCopy || !depthGrid ){
+        LOG( ERR, "Failed to allocate mesh analysis memory" );
+        err = 1;
+        goto analyseCleanup;
+    }
+
+    _meshStats->cacheMisses += simulateVertexCache( _indices, _numIndices, _numVertices, cacheTimestamps );
+
+    // Exact duplicates are whatever an epsilon-0 weld would remove
+    memcpy( vertexCopy, _vertices, sizeof( float ) * _strideFloats * _numVertices );
+    uint32_t numUnique;
+    if( pomMeshWeld( NULL, 0.0f, NULL, 0, vertexCopy, _numVertices, _strideFloats, &numUnique ) ){
+        err = 1;
+        goto analyseCleanup;
+    }
+    _meshStats->duplicateVertices += _numVertices - numUnique;
+
+    float boundsMin[ 3 ], boundsMax[ 3 ];
+    for( uint32_t axis = 0; axis < 3; axis++ ){
+        boundsMin[ axis ] = boundsMax[ axis ] = _vertices[ axis ];
+    }
+    for( uint32_t v = 1; v < _numVertices; v++ ){
+        const float *position = &_vertices[ (size_t) v * _strideFloats ];
+        for( uint32_t axis = 0; axis < 3; axis++ ){
+            boundsMin[ axis ] = fminf( boundsMin[ axis ], position[ axis ] );
+            boundsMax[ axis ] = fmaxf( boundsMax[ axis ], position[ axis ] );
+        }
+    }
+    for( uint32_t axis = 0; axis < 3; axis++ ){
+        rasteriseView( _indices, _numIndices, _vertices, _numVertices, _strideFloats,
+                       boundsMin, boundsMax, axis, false, depthGrid,
+                       &_meshStats->shadedPixels, &_meshStats->coveredPixels );
+        rasteriseView( _indices, _numIndices, _vertices, _numVertices, _strideFloats,
+                       boundsMin, boundsMax, axis, true, depthGrid,
+                       &_meshStats->shadedPixels, &_meshStats->coveredPixels );
+    }
+
+analyseCleanup:
+    free( depthGrid );
+    free( vertexCopy );
+    free( cacheTimestamps );
+    return err;
+}
+
+static double safeRatio( uint64_t _numerator, uint64_t _denominator ){
+    return _denominator ? (double) _numerator / (double) _denominator : 0.0;
+}
+
+static double getWeldReduction( const PomMeshStats *_mesh ){
+    if( _mesh->numSourceVertices <= _mesh->numVertices ){
+        return 0.0;
+    }
+    return safeRatio( _mesh->numSourceVertices - _mesh->numVertices, _mesh->numSourceVertices );
+}
+
+// Accumulate every mesh into one, with shared meshes counted for drawing but not data
+static void getMeshTotals( const PomBakeStats *_stats, PomMeshStats *_totals ){
+    *_totals = (PomMeshStats){ 0 };
+    uint64_t vertexBytes = 0;
+    for( uint32_t i = 0; i < _stats->numMeshes; i++ ){
+        const PomMeshStats *mesh = &_stats->meshes[ i ];
+        vertexBytes += mesh->numVertices * mesh->vertexStrideBytes;
+        _totals->numSubmeshes += mesh->numSubmeshes;
+        _totals->numSourceVertices += mesh->numSourceVertices;
+        _totals->numVertices += mesh->numVertices;
+        _totals->numIndices += mesh->numIndices;
+        _totals->cacheMisses += mesh->cacheMisses;
+        _totals->duplicateVertices += mesh->duplicateVertices;
+        _totals->shadedPixels += mesh->shadedPixels;
+        _totals->coveredPixels += mesh->coveredPixels;
+        if( !mesh->sharesData ){
+            _totals->dataSizeBytes += mesh->dataSizeBytes;
+        }
+    }
+    // Average over all vertices
+    _totals->vertexStrideBytes = (uint32_t) safeRatio( vertexBytes, _totals->numVertices );
+}
+
+static int compareMeshSize( const void *_a, const void *_b ){
+    const PomMeshStats *a = *(const PomMeshStats* const*) _a;
+    const PomMeshStats *b = *(const PomMeshStats* const*) _b;
+    return ( a->dataSizeBytes < b->dataSizeBytes ) - ( a->dataSizeBytes > b->dataSizeBytes );
+}
+
+static int compareTextureSize( const void *_a, const void *_b ){
+    const PomTextureStats *a = *(const PomTextureStats* const*) _a;
+    const PomTextureStats *b = *(const PomTextureStats* const*) _b;
+    return ( a->dataSizeBytes < b->dataSizeBytes ) - ( a->dataSizeBytes > b->dataSizeBytes );
+}
+
+static int compareSectionSize( const void *_a, const void *_b ){
+    const PomBakeStatsSection *a = (const PomBakeStatsSection*) _a;
+    const PomBakeStatsSection *b = (const PomBakeStatsSection*) _b;
+    return ( a->sizeBytes < b->sizeBytes ) - ( a->sizeBytes > b->sizeBytes );
+}
+
+// Largest unshared meshes and textures, biggest first. Returns the number found.
+static uint32_t getLargestMeshes( const PomBakeStats *_stats, const PomMeshStats **_largest ){
+    const PomMeshStats **sorted = (const PomMeshStats**) malloc( sizeof( PomMeshStats* ) * ( _stats->numMeshes + 1 ) );
+    if( !sorted ){
+        return 0;
+    }
+    uint32_t numSorted = 0;
+    for( uint32_t i = 0; i < _stats->numMeshes; i++ ){
+        if( !_stats->meshes[ i ].sharesData ){
+            sorted[ numSorted++ ] = &_stats->meshes[ i ];
+        }
+    }
+    qsort( sorted, numSorted, sizeof( PomMeshStats* ), compareMeshSize );
+    uint32_t numLargest = numSorted < STATS_NUM_LARGEST ? numSorted : STATS_NUM_LARGEST;
+    memcpy( _largest, sorted, sizeof( PomMeshStats* ) * numLargest );
+    free( sorted );
+    return numLargest;
+}
+
+static uint32_t getLargestTextures( const PomBakeStats *_stats, const PomTextureStats **_largest ){
+    const PomTextureStats **sorted = (const PomTextureStats**) malloc( sizeof( PomTextureStats* ) * ( _stats->numTextures + 1 ) );
+    if( !sorted ){
+        return 0;
+    }
+    for( uint32_t i = 0; i < _stats->numTextures; i++ ){
+        sorted[ i ] = &_stats->textures[ i ];
+    }
+    qsort( sorted, _stats->numTextures, sizeof( PomTextureStats* ), compareTextureSize );
+    uint32_t numLargest = _stats->numTextures < STATS_NUM_LARGEST ? _stats->numTextures : STATS_NUM_LARGEST;
+    memcpy( _largest, sorted, sizeof( PomTextureStats* ) * numLargest );
+    free( sorted );
+    return numLargest;
+}
+
+static void getTextureFormatTotals( const PomBakeStats *_stats, uint64_t *_bytes, uint32_t *_counts ){
+    memset( _bytes, 0, sizeof( uint64_t ) * ( POM_TEXTURE_DATA_RANGE + 1 ) );
+    memset( _counts, 0, sizeof( uint32_t ) * ( POM_TEXTURE_DATA_RANGE + 1 ) );
+    for( uint32_t i = 0; i < _stats->numTextures; i++ ){
+        const PomTextureStats *texture = &_stats->textures[ i ];
+        uint32_t typeIdx = texture->dataType < POM_TEXTURE_DATA_END ? texture->dataType : POM_TEXTURE_DATA_RANGE;
+        _bytes[ typeIdx ] += texture->dataSizeBytes;
+        _counts[ typeIdx ]++;
+    }
+}
+
+static void printMeshRow( const char *_label, uint32_t _meshId, const PomMeshStats *_mesh ){
+    printf( "%-6s %4u %6u %9lu %9lu %5u %6.3f %6.3f %8.2f %6.1f%% %6.1f%% %10lu\n",
+            _label, _meshId, _mesh->numSubmeshes, _mesh->numVertices, _mesh->numIndices,
+            _mesh->vertexStrideBytes,
+            safeRatio( _mesh->cacheMisses, _mesh->numIndices / 3 ),
+            safeRatio( _mesh->cacheMisses, _mesh->numVertices ),
+            safeRatio( _mesh->shadedPixels, _mesh->coveredPixels ),
+            100.0 * safeRatio( _mesh->duplicateVertices, _mesh->numVertices ),
+            100.0 * getWeldReduction( _mesh ),
+            _mesh->dataSizeBytes );
+}
+
+void pomBakeStatsPrint( const PomBakeStats *_stats ){
+    printf( "\nMesh statistics (ACMR/ATVR with a %u entry FIFO cache)\n", STATS_VERTEX_CACHE_SIZE );
+    printf( "%-6s %4s %6s %9s %9s %5s %6s %6s %8s %7s %7s %10s\n",
+            "", "id", "parts", "vertices", "indices", "B/vtx", "ACMR", "ATVR",
+            "overdraw", "dupes", "welded", "bytes" );
+    for( uint32_t i = 0; i < _stats->numMeshes; i++ ){
+        const PomMeshStats *mesh = &_stats->meshes[ i ];
+        printMeshRow( mesh->sharesData ? "shared" : "mesh", mesh->meshId, mesh );
+    }
+    PomMeshStats totals;
+    getMeshTotals( _stats, &totals );
+    printMeshRow( "total", _stats->numMeshes, &totals );
+
+    uint64_t formatBytes[ POM_TEXTURE_DATA_RANGE + 1 ];
+    uint32_t formatCounts[ POM_TEXTURE_DATA_RANGE + 1 ];
+    getTextureFormatTotals( _stats, formatBytes, formatCounts );
+    printf( "\nTexture bytes by format\n" );
+    for( uint32_t i = 0; i <= POM_TEXTURE_DATA_RANGE; i++ ){
+        if( formatCounts[ i ] ){
+            printf( "  %-8s %4u textures %12lu bytes\n",
+                    getTextureDataTypeName( (PomModelTextureDataType) i ), formatCounts[ i ], formatBytes[ i ] );
+        }
+    }
+
+    PomBakeStatsSection sections[ POM_BAKE_STATS_MAX_SECTIONS ];
+    memcpy( sections, _stats->sections, sizeof( PomBakeStatsSection ) * _stats->numSections );
+    qsort( sections, _stats->numSections, sizeof( PomBakeStatsSection ), compareSectionSize );
+    printf( "\nLargest sections\n" );
+    for( uint32_t i = 0; i < _stats->numSections; i++ ){
+        printf( "  %-20s %12lu bytes\n", sections[ i ].name, sections[ i ].sizeBytes );
+    }
+
+    const PomMeshStats *largestMeshes[ STATS_NUM_LARGEST ];
+    uint32_t numLargestMeshes = getLargestMeshes( _stats, largestMeshes );
+    printf( "\nLargest meshes\n" );
+    for( uint32_t i = 0; i < numLargestMeshes; i++ ){
+        printf( "  mesh %-4u %12lu bytes\n", largestMeshes[ i ]->meshId, largestMeshes[ i ]->dataSizeBytes );
+    }
+
+    const PomTextureStats *largestTextures[ STATS_NUM_LARGEST ];
+    uint32_t numLargestTextures = getLargestTextures( _stats, largestTextures );
+    printf( "\nLargest textures\n" );
+    for( uint32_t i = 0; i < numLargestTextures; i++ ){
+        const PomTextureStats *texture = largestTextures[ i ];
+        printf( "  texture %-4u %5ux%-5u %2u mips %-8s %12lu bytes\n", texture->textureId,
+                texture->width, texture->height, texture->numMipLevels,
+                getTextureDataTypeName( texture->dataType ), texture->dataSizeBytes );
+    }
+    printf( "\n" );
+}
+
+static void writeMeshJson( FILE *_file, const PomMeshStats *_mesh ){
+    fprintf( _file,
+             "{ \"id\": %u, \"submeshes\": %u, \"shared\": %s, \"sourceVertices\": %lu, "
+             "\"vertices\": %lu, \"indices\": %lu, \"bytesPerVertex\": %u, \"bytes\": %lu, "
+             "\"acmr\": %.4f, \"atvr\": %.4f, \"overdraw\": %.4f, "
+             "\"duplicateVertexRatio\": %.4f, \"weldReduction\": %.4f }",
+             _mesh->meshId, _mesh->numSubmeshes, _mesh->sharesData ? "true" : "false",
+             _mesh->numSourceVertices, _mesh->numVertices, _mesh->numIndices,
+             _mesh->vertexStrideBytes, _mesh->dataSizeBytes,
+             safeRatio( _mesh->cacheMisses, _mesh->numIndices / 3 ),
+             safeRatio( _mesh->cacheMisses, _mesh->numVertices ),
+             safeRatio( _mesh->shadedPixels, _mesh->coveredPixels ),
+             safeRatio( _mesh->duplicateVertices, _mesh->numVertices ),
+             getWeldReduction( _mesh ) );
+}
+
+int pomBakeStatsWriteJson( const PomBakeStats *_stats, const char *_filePath ){
+    FILE *file = fopen( _filePath, "w" );
+    if( !file ){
+        LOG( ERR, "Failed to open stats file %s", _filePath );
+        return 1;
+    }
+
+    fprintf( file, "{\n  \"vertexCacheSize\": %u,\n  \"meshes\": [\n", STATS_VERTEX_CACHE_SIZE );
+    for( uint32_t i = 0; i < _stats->numMeshes; i++ ){
+        fprintf( file, "    " );
+        writeMeshJson( file, &_stats->meshes[ i ] );
+        fprintf( file, "%s\n", ( i + 1 < _stats->numMeshes ) ? "," : "" );
+    }
+    PomMeshStats totals;
+    getMeshTotals( _stats, &totals );
+    totals.meshId = _stats->numMeshes;
+    fprintf( file, "  ],\n  \"totals\": " );
+    writeMeshJson( file, &totals );
+
+    fprintf( file, ",\n  \"textures\": [\n" );
+    for( uint32_t i = 0; i < _stats->numTextures; i++ ){
+        const PomTextureStats *texture = &_stats->textures[ i ];
+        fprintf( file, "    { \"id\": %u, \"format\": \"%s\", \"width\": %u, \"height\": %u, "
+                       "\"mips\": %u, \"bytes\": %lu }%s\n",
+                 texture->textureId, getTextureDataTypeName( texture->dataType ),
+                 texture->width, texture->height, texture->numMipLevels, texture->dataSizeBytes,
+                 ( i + 1 < _stats->numTextures ) ? "," : "" );
+    }
+
+    uint64_t formatBytes[ POM_TEXTURE_DATA_RANGE + 1 ];
+    uint32_t formatCounts[ POM_TEXTURE_DATA_RANGE + 1 ];
+    getTextureFormatTotals( _stats, formatBytes, formatCounts );
+    fprintf( file, "  ],\n  \"textureBytesByFormat\": {" );
+    bool first = true;
+    for( uint32_t i = 0; i <= POM_TEXTURE_DATA_RANGE; i++ ){
+        if( formatCounts[ i ] ){
+            fprintf( file, "%s \"%s\": %lu", first ? "" : ",",
+                     getTextureDataTypeName( (PomModelTextureDataType) i ), formatBytes[ i ] );
+            first = false;
+        }
+    }
+
+    fprintf( file, " },\n  \"sections\": [\n" );
+    for( uint32_t i = 0; i < _stats->numSections; i++ ){
+        fprintf( file, "    { \"name\": \"%s\", \"bytes\": %lu }%s\n",
+                 _stats->sections[ i ].name, _stats->sections[ i ].sizeBytes,
+                 ( i + 1 < _stats->numSections ) ? "," : "" );
+    }
+    fprintf( file, "  ]\n}\n" );
+
+    int err = ferror( file ) ? 1 : 0;
+    if( fclose( file ) || err ){
+        LOG( ERR, "Failed to write stats file %s", _filePath );
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+#ifndef POM_BAKE_STATS_H
+#define POM_BAKE_STATS_H
+
+#include "pomModelFormat.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define POM_BAKE_STATS_MAX_SECTIONS 16
+
+typedef struct PomMeshStats PomMeshStats;
+typedef struct PomTextureStats PomTextureStats;
+typedef struct PomBakeStatsSection PomBakeStatsSection;
+typedef struct PomBakeStats PomBakeStats;
+
+// Raw counts, so stats for several meshes (e.g. members of a merged mesh) can
+// be accumulated. Ratios are derived when reporting.
+struct PomMeshStats{
+    uint32_t meshId;
+    uint32_t numSubmeshes;
+    bool sharesData; // Duplicate of an earlier mesh, so its data isn't counted
+    uint64_t numSourceVertices;
+    uint64_t numVertices;
+    uint64_t numIndices;
+    uint32_t vertexStrideBytes;
+    uint64_t dataSizeBytes;
+    // Post-transform cache misses, from a FIFO cache simulation
+    uint64_t cacheMisses;
+    // Baked vertices that exactly match an earlier one
+    uint64_t duplicateVertices;
+    // Fragments passing the depth test vs pixels covered, from rasterising the
+    // mesh in index order from the six axis directions
+    uint64_t shadedPixels;
+    uint64_t coveredPixels;
+};
+
+struct PomTextureStats{
+    uint32_t textureId;
+    PomModelTextureDataType dataType;
+    uint32_t width;
+    uint32_t height;
+    uint32_t numMipLevels;
+    uint64_t dataSizeBytes;
+};
+
+struct PomBakeStatsSection{
+    const char *name;
+    uint64_t sizeBytes;
+};
+
+struct PomBakeStats{
+    bool initialised;
+    uint32_t numMeshes;
+    PomMeshStats *meshes;
+    uint32_t numTextures;
+    PomTextureStats *textures;
+    uint32_t numSections;
+    PomBakeStatsSection sections[ POM_BAKE_STATS_MAX_SECTIONS ];
+};
+
+int pomBakeStatsCreate( PomBakeStats *_stats, uint32_t _numMeshes, uint32_t _numTextures );
+void pomBakeStatsDestroy( PomBakeStats *_stats );
+
+// Analyse one mesh's baked data and add the results to _meshStats. Indices are
+// relative to _vertices.
+int pomMeshStatsAnalyse( const uint32_t *_indices, uint32_t _numIndices,
+                         const float *_vertices, uint32_t _numVertices, uint32_t _strideFloats,
+                         PomMeshStats *_meshStats );
+
+int pomBakeStatsAddSection( PomBakeStats *_stats, const char *_name, uint64_t _sizeBytes );
+
+void pomBakeStatsPrint( const PomBakeStats *_stats );
+int pomBakeStatsWriteJson( const PomBakeStats *_stats, const char *_filePath );
+
+#endif // POM_BAKE_STATS_H
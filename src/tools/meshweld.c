@@ -0,0 +1,218 @@
+#include "common.h"
+#include "meshweld.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+
+#define LOG( level, log, ... ) LOG_MODULE( level, MeshWeld, log, ##__VA_ARGS__ )
+
+// Below this it's not worth handing work to other threads
+#define WELD_PARALLEL_MIN_VERTICES 16384
+// Fixed, so the output doesn't depend on the number of threads
+#define WELD_NUM_PARTITIONS 8
+#define WELD_EMPTY_SLOT UINT32_MAX
+
+typedef struct WeldMesh WeldMesh;
+typedef struct WeldJobArgs WeldJobArgs;
+
+struct WeldMesh{
+    const float *vertices;
+    uint32_t numVertices;
+    uint32_t strideFloats;
+    float epsilon;
+    uint32_t numPartitions;
+    uint64_t *hashes;
+    uint32_t *remap;
+};
+
+struct WeldJobArgs{
+    const WeldMesh *mesh;
+    uint32_t partition;
+    int err;
+};
+
+// Quantise to the epsilon grid so that vertices within epsilon usually land in
+// the same cell. Ones straddling a cell boundary just don't get welded.
+static uint64_t hashVertex( const float *_vertex, uint32_t _strideFloats, float _epsilon ){
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for( uint32_t i = 0; i < _strideFloats; i++ ){
+        uint64_t key;
+        float cell = _epsilon > 0.0f ? _vertex[ i ] / _epsilon + 0.5f : NAN;
+        // Cells beyond int64's range (including inf and NaN) can't be converted, and
+        // floats that large are spaced wider than any epsilon anyway
+        if( fabsf( cell ) < 0x1p62f ){
+            key = (uint64_t) (int64_t) floorf( cell );
+        }else{
+            // Adding 0 turns -0 into +0
+            float value = _vertex[ i ] + 0.0f;
+            uint32_t bits;
+            memcpy( &bits, &value, sizeof( bits ) );
+            key = bits;
+        }
+        hash ^= key;
+        hash *= 0x100000001B3ULL;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+static bool verticesMatch( const float *_a, const float *_b, uint32_t _strideFloats, float _epsilon ){
+    for( uint32_t i = 0; i < _strideFloats; i++ ){
+        if( !( fabsf( _a[ i ] - _b[ i ] ) <= _epsilon ) ){
+            return false;
+        }
+    }
+    return true;
+}
+
+static void hashJob( void *_args ){
+    WeldJobArgs *args = (WeldJobArgs*) _args;
+    const WeldMesh *mesh = args->mesh;
+    uint32_t first = (uint32_t) ( ( (uint64_t) mesh->numVertices * args->partition ) / mesh->numPartitions );
+    uint32_t last = (uint32_t) ( ( (uint64_t) mesh->numVertices * ( args->partition + 1 ) ) / mesh->numPartitions );
+    for( uint32_t v = first; v < last; v++ ){
+        mesh->hashes[ v ] = hashVertex( &mesh->vertices[ (size_t) v * mesh->strideFloats ],
+                                        mesh->strideFloats, mesh->epsilon );
+    }
+    args->err = 0;
+}
+
+// Each partition owns the vertices whose hash falls in it, so partitions never
+// share table entries. Vertices are visited in order, so the first occurrence of
+// each unique vertex becomes the one the rest map to.
+static void matchJob( void *_args ){
+    WeldJobArgs *args = (WeldJobArgs*) _args;
+    const WeldMesh *mesh = args->mesh;
+    uint32_t numInPartition = 0;
+    for( uint32_t v = 0; v < mesh->numVertices; v++ ){
+        if( mesh->hashes[ v ] % mesh->numPartitions == args->partition ){
+            numInPartition++;
+        }
+    }
+    uint32_t tableSize = 16;
+    while( tableSize < numInPartition * 2 ){
+        tableSize *= 2;
+    }
+    uint32_t *table = (uint32_t*) malloc( sizeof( uint32_t ) * tableSize );
+    if( !table ){
+        LOG( ERR, "Failed to allocate weld table" );
+        args->err = 1;
+        return;
+    }
+    memset( table, 0xFF, sizeof( uint32_t ) * tableSize );
+
+    uint32_t mask = tableSize - 1;
+    for( uint32_t v = 0; v < mesh->numVertices; v++ ){
+        uint64_t hash = mesh->hashes[ v ];
+        if( hash % mesh->numPartitions != args->partition ){
+            continue;
+        }
+        const float *vertex = &mesh->vertices[ (size_t) v * mesh->strideFloats ];
+        uint32_t slot = (uint32_t) ( hash / mesh->numPartitions ) & mask;
+        mesh->remap[ v ] = v;
+        for( ;; slot = ( slot + 1 ) & mask ){
+            uint32_t existing = table[ slot ];
+            if( existing == WELD_EMPTY_SLOT ){
+                table[ slot ] = v;
+                break;
+            }
+            if( mesh->hashes[ existing ] == hash &&
+                verticesMatch( &mesh->vertices[ (size_t) existing * mesh->strideFloats ],
+                               vertex, mesh->strideFloats, mesh->epsilon ) ){
+                mesh->remap[ v ] = existing;
+                break;
+            }
+        }
+    }
+    free( table );
+    args->err = 0;
+}
+
+static int runWeldJobs( PomThreadpoolCtx *_threadpool, PomThreadpoolJobFunc _func,
+                        WeldJobArgs *_args, PomThreadpoolJob *_jobs, uint32_t _numPartitions ){
+    for( uint32_t i = 0; i < _numPartitions; i++ ){
+        _args[ i ].err = 1;
+        if( _threadpool ){
+            _jobs[ i ] = (PomThreadpoolJob){ .func = _func, .args = &_args[ i ] };
+            pomThreadpoolScheduleJob( _threadpool, &_jobs[ i ] );
+        }else{
+            _func( &_args[ i ] );
+        }
+    }
+    if( _threadpool ){
+        pomThreadpoolJoinAll( _threadpool );
+    }
+    for( uint32_t i = 0; i < _numPartitions; i++ ){
+        if( _args[ i ].err ){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int pomMeshWeld( PomThreadpoolCtx *_threadpool, float _epsilon,
+                 uint32_t *_indices, uint32_t _numIndices,
+                 float *_vertices, uint32_t _numVertices, uint32_t _strideFloats,
+                 uint32_t *_numWeldedVertices ){
+    *_numWeldedVertices = _numVertices;
+    if( _numVertices < 2 || _strideFloats == 0 ){
+        return 0;
+    }
+    if( _numVertices < WELD_PARALLEL_MIN_VERTICES ){
+        _threadpool = NULL;
+    }
+
+    int err = 0;
+    WeldMesh mesh = {
+        .vertices = _vertices,
+        .numVertices = _numVertices,
+        .strideFloats = _strideFloats,
+        .epsilon = _epsilon,
+        .numPartitions = WELD_NUM_PARTITIONS,
+        .hashes = (uint64_t*) malloc( sizeof( uint64_t ) * _numVertices ),
+        .remap = (uint32_t*) malloc( sizeof( uint32_t ) * _numVertices )
+    };
+    WeldJobArgs args[ WELD_NUM_PARTITIONS ];
+    PomThreadpoolJob jobs[ WELD_NUM_PARTITIONS ];
+    if( !mesh.hashes || !mesh.remap ){
+        LOG( ERR, "Failed to allocate weld working memory" );
+        err = 1;
+        goto weldCleanup;
+    }
+    for( uint32_t i = 0; i < WELD_NUM_PARTITIONS; i++ ){
+        args[ i ] = (WeldJobArgs){ .mesh = &mesh, .partition = i, .err = 0 };
+    }
+
+    if( runWeldJobs( _threadpool, hashJob, args, jobs, WELD_NUM_PARTITIONS ) ||
+        runWeldJobs( _threadpool, matchJob, args, jobs, WELD_NUM_PARTITIONS ) ){
+        err = 1;
+        goto weldCleanup;
+    }
+
+    // Compact in place. A duplicate always maps to an earlier vertex, which has
+    // already been given its new index by the time the duplicate is reached.
+    size_t vertexBytes = sizeof( float ) * _strideFloats;
+    uint32_t numUnique = 0;
+    for( uint32_t v = 0; v < _numVertices; v++ ){
+        uint32_t representative = mesh.remap[ v ];
+        if( representative == v ){
+            if( numUnique != v ){
+                memmove( &_vertices[ (size_t) numUnique * _strideFloats ],
+                         &_vertices[ (size_t) v * _strideFloats ], vertexBytes );
+            }
+            mesh.remap[ v ] = numUnique++;
+        }else{
+            mesh.remap[ v ] = mesh.remap[ representative ];
+        }
+    }
+    for( uint32_t i = 0; i < _numIndices; i++ ){
+        _indices[ i ] = mesh.remap[ _indices[ i ] ];
+    }
+    *_numWeldedVertices = numUnique;
+
+weldCleanup:
+    free( mesh.remap );
+    free( mesh.hashes );
+    return err;
+}
@@ -0,0 +1,18 @@
+#ifndef POM_MESH_WELD_H
+#define POM_MESH_WELD_H
+
+#include "cmore/threadpool.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Merge vertices whose attributes all match to within _epsilon, compacting the
+// vertex array in place (first occurrences keep their order) and remapping the
+// index array to suit. Vertices are _strideFloats floats each. Hashing and
+// matching is split across _threadpool when given and the mesh is big enough;
+// the result is the same either way.
+int pomMeshWeld( PomThreadpoolCtx *_threadpool, float _epsilon,
+                 uint32_t *_indices, uint32_t _numIndices,
+                 float *_vertices, uint32_t _numVertices, uint32_t _strideFloats,
+                 uint32_t *_numWeldedVertices );
+
+#endif // POM_MESH_WELD_H
@@ -1,44 +1,187 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <math.h>
 #include <assimp/scene.h>
 #include <assimp/cimport.h>
 #include <assimp/postprocess.h>
 #include "pomModelFormat.h"
+#include "textureencode.h"
+#include "textureatlas.h"
+#include "meshweld.h"
+#include "bakestats.h"
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_ONLY_PNG
 #include "stb_image.h"
 
 #include "cmore/hashmap.h"
-
+#include "cmore/threadpool.h"
+
+typedef struct ModelBakeOptions ModelBakeOptions;
+typedef struct AtlasPlan AtlasPlan;
+typedef struct MeshGroup MeshGroup;
+typedef struct MeshMergePlan MeshMergePlan;
+
+#define NUM_TEXTURE_SLOTS ( AI_TEXTURE_TYPE_MAX + 1 )
+#define ATLAS_UV_EPSILON 1e-4f
+
+struct ModelBakeOptions{
+    PomTextureEncodeOptions textureEncode;
+    bool atlasEnabled;
+    uint32_t atlasPageSize;
+    uint32_t atlasMaxTextureSize;
+    uint32_t atlasPadding;
+    bool instancingEnabled;
+    bool mergeEnabled;
+    bool weldEnabled;
+    float weldEpsilon;
+    uint32_t numThreads;
+    bool statsEnabled;
+    const char *statsJsonPath;
+};
+
+// Which materials have had their textures packed into atlas pages. A material
+// is packed as one region, and each of its texture slots goes into that page's
+// atlas for the slot, so one UV remap works for all of the material's textures.
+struct AtlasPlan{
+    uint32_t numPages;
+    uint32_t *pageHeights;
+    bool *materialAtlased;
+    uint32_t *materialUvIndex;
+    PomAtlasRect *materialRects;
+    // Channel count of each page's atlas for each texture slot, 0 if unused
+    uint32_t ( *pageSlotChannels )[ NUM_TEXTURE_SLOTS ];
+};
+
+// Source meshes making up one output mesh
+struct MeshGroup{
+    uint32_t firstMember;
+    uint32_t numMembers;
+    uint32_t firstSubmodel;
+};
+
+// How source meshes map to output meshes. Without merging (or for meshes that
+// can't be merged) each group is a single mesh.
+struct MeshMergePlan{
+    uint32_t numGroups;
+    MeshGroup *groups;
+    uint32_t *members; // Source mesh IDs, grouped
+    uint32_t *outputMeshIds; // Output mesh of each source mesh
+    uint32_t numSubmodels;
+};
 
 int loadRawModel( const char *modelPath, struct aiScene const **_scene );
 
 static int getAllTextureSize( const struct aiScene *_scene, uint32_t *_textureCount,
                               size_t *_allTextureDataSize );
 static int getMaterialSize( const struct aiScene *_scene, size_t *_materialSize );
-static int getAllMeshSize( const struct aiScene *_scene, size_t *_sizeBytes );
+static PomTextureUsage getTextureUsage( uint32_t _aiTextureType, int _numChannels );
+static int getMeshSize( const struct aiMesh *_mesh, size_t *_sizeBytes );
+static int getAllMeshSize( const struct aiScene *_scene, size_t *_sizeBytes,
+                           size_t *_maxMeshSizeBytes );
 static int populateMeshData( const struct aiMesh *mesh, PomModelMeshInfo *meshInfo,
                              uint8_t *dataBlock, size_t *bytesWritten );
-static int populateTextureData( const struct aiScene *_scene, uint8_t *_texDataBlock,
-                                PomModelTextureInfo* texInfos, size_t *_bytesWritten );
+static int streamTextureData( const struct aiScene *_scene, PomModelStreamWriter *_writer,
+                              PomModelTextureInfo *_texInfos, uint32_t _numTexInfos,
+                              uint8_t **_texDataOffsets, size_t *_bytesWritten );
 static int populateMaterialInfo( const struct aiScene *_scene, uint8_t *_matDataBlock,
                                  size_t *_bytesWritten );
 static int getModelInfoSize( const struct aiScene *_scene, uint32_t *_numInfos, uint32_t *_numIds );
 static int populateModelInfo( const struct aiScene *_scene, PomModelInfo *_modelInfoBlock,
                               uint32_t *_submodelIdArray, size_t *_bytesWritten );
+static int parseOptions( int argc, char **argv, int *_numOptions );
+static int buildAtlasPlan( const struct aiScene *_scene, AtlasPlan *_plan );
+static void destroyAtlasPlan( AtlasPlan *_plan );
+static int streamAtlasPages( const struct aiScene *_scene, PomModelStreamWriter *_writer,
+                             PomModelTextureInfo *_texInfos, uint32_t _numTexInfos,
+                             const uint32_t *_infoAtlasSlot, uint8_t **_texDataOffsets,
+                             size_t *_bytesWritten );
+static void getTextureFilePath( const struct aiString *_texPath, char *_filePath, size_t _filePathSize );
+static int buildMeshData( const struct aiMesh *_mesh, PomModelMeshInfo *_meshInfo,
+                          uint8_t *_dataBlock, size_t *_bytesWritten );
+static int findDuplicateMeshes( const struct aiScene *_scene, size_t _maxMeshSize,
+                                uint32_t *_sourceMeshIds, uint32_t *_numDuplicates );
+static int getInstanceInfoSize( const struct aiScene *_scene, const uint32_t *_sourceMeshIds,
+                                const MeshMergePlan *_mergePlan, uint32_t *_numInstanceInfos,
+                                uint32_t *_numTransforms );
+static int populateInstanceInfo( const struct aiScene *_scene, const uint32_t *_sourceMeshIds,
+                                 const MeshMergePlan *_mergePlan, PomModelInstanceInfo *_instanceInfos,
+                                 float *_transforms, size_t *_bytesWritten );
+static int buildMeshMergePlan( const struct aiScene *_scene, const uint32_t *_sourceMeshIds,
+                               MeshMergePlan *_plan );
+static void destroyMeshMergePlan( MeshMergePlan *_plan );
+static int streamMergedMesh( const struct aiScene *_scene, const MeshGroup *_group,
+                             uint32_t _meshId, PomModelStreamWriter *_writer, uint8_t *_scratchBlock,
+                             PomModelMeshInfo *_meshInfo, PomSubmodelInfo *_submodelInfos,
+                             uint8_t **_submodelIndexOffsets, uint8_t **_submodelVertexOffsets,
+                             uint8_t **_meshDataOffset, PomMeshStats *_meshStats,
+                             size_t *_bytesWritten );
+static void remapAtlasUvs( const struct aiMesh *_mesh, const PomModelMeshInfo *_meshInfo,
+                           uint8_t *_meshData );
 
 const char *rawModelPath;
 const char *rawModelDir;
 
+ModelBakeOptions bakeOptions = {
+    .textureEncode = {
+        .generateMips = true,
+        .compress = true,
+        .preferBc7 = false,
+        .mipFilter = POM_MIP_FILTER_BOX
+    },
+    .atlasEnabled = false,
+    .atlasPageSize = 2048,
+    .atlasMaxTextureSize = 256,
+    .atlasPadding = 8,
+    .instancingEnabled = false,
+    .mergeEnabled = false,
+    .weldEnabled = false,
+    .weldEpsilon = 1e-6f,
+    .numThreads = 4,
+    .statsEnabled = false,
+    .statsJsonPath = NULL
+};
+
+AtlasPlan atlasPlan = { 0 };
+MeshMergePlan mergePlan = { 0 };
+PomThreadpoolCtx bakeThreadpool = { 0 };
+// NULL when running single-threaded
+PomThreadpoolCtx *weldThreadpool = NULL;
+PomBakeStats bakeStats = { 0 };
+
+static void printUsage( void ){
+    printf( "Usage: modelbake [options] <raw input file> <baked output file>\n"
+            " e.g. modelbake ./model.dae ./model.pom\n"
+            "Options:\n"
+            "  --no-mips              Don't generate texture mip chains\n"
+            "  --no-compress          Store textures uncompressed\n"
+            "  --bc7                  Use BC7 instead of BC1/BC3 for colour textures\n"
+            "  --mip-filter=<filter>  Mip downsample filter, box (default) or kaiser\n"
+            "  --atlas                Pack small textures into atlases and remap UVs\n"
+            "  --atlas-size=<n>       Atlas page size in texels (default 2048)\n"
+            "  --atlas-max=<n>        Largest texture dimension to atlas (default 256)\n"
+            "  --atlas-padding=<n>    Gutter around atlas regions in texels (default 8)\n"
+            "  --instancing           Keep the node graph, store duplicate meshes once and\n"
+            "                         emit a per-mesh instance transform table (the viewer\n"
+            "                         can't draw instances yet, so refuses these models)\n"
+            "  --merge                Merge static meshes sharing a material and vertex\n"
+            "                         layout, keeping each as a submodel range\n"
+            "  --weld                 Weld duplicate vertices\n"
+            "  --weld-epsilon=<e>     Largest attribute difference to weld (default 1e-6)\n"
+            "  --threads=<n>          Worker threads for vertex welding (default 4)\n"
+            "  --stats                Print mesh and texture efficiency statistics\n"
+            "  --stats-json=<path>    Write the statistics to a JSON file\n" );
+}
+
 int main( int argc, char ** argv ){
-    if( argc != 3 ){
-        printf( "modelbake requires a 2 paths as argument, first to raw input file and second to baked output file"
-                " e.g. modelbake ./model.dae ./model.pom\n" );
+    int numOptions;
+    if( parseOptions( argc, argv, &numOptions ) || ( argc - numOptions ) != 3 ){
+        printUsage();
         return 1;
     }
     int err = 0;
-    rawModelPath = argv[ 1 ];
-    const char *bakedModelPath = argv[ 2 ];
+    uint32_t *sourceMeshIds = NULL;
+    rawModelPath = argv[ numOptions + 1 ];
+    const char *bakedModelPath = argv[ numOptions + 2 ];
 
     // Load the model
     const struct aiScene *scene;
@@ -62,17 +205,35 @@ int main( int argc, char ** argv ){
         } 
     }
     
+    if( bakeOptions.weldEnabled && bakeOptions.numThreads > 1 ){
+        uint8_t numThreads = (uint8_t) ( bakeOptions.numThreads > 255 ? 255 : bakeOptions.numThreads );
+        if( pomThreadpoolInit( &bakeThreadpool, numThreads ) ){
+            printf( "ERR: Failed to create threadpool\n" );
+            err = 1;
+            goto getSizeError;
+        }
+        weldThreadpool = &bakeThreadpool;
+    }
+
+    if( bakeOptions.atlasEnabled && buildAtlasPlan( scene, &atlasPlan ) ){
+        printf( "ERR: Failed to build texture atlas plan\n" );
+        err = 1;
+        goto getSizeError;
+    }
+
     /*
-    * Get size of data blocks required for the output file
+    * Get size of data blocks required for the output file.
+    * Only the metadata (infos, ID arrays) is kept in memory for the whole bake;
+    * mesh and texture data is streamed to the output file as it's produced.
     */
 
-    size_t meshBlockSize;
-    if( getAllMeshSize( scene, &meshBlockSize ) ){
+    size_t meshBlockSize, maxMeshSize;
+    if( getAllMeshSize( scene, &meshBlockSize, &maxMeshSize ) ){
         printf( "ERR: Failed to get mesh block size\n" );
         err = 1;
         goto getSizeError;
     }
-    printf( "Mesh block size %lu bytes\n", meshBlockSize );
+    printf( "Mesh block size %lu bytes, largest mesh %lu bytes\n", meshBlockSize, maxMeshSize );
 
     // Get texture count and block size
     size_t texSize;
@@ -99,32 +260,96 @@ int main( int argc, char ** argv ){
         err = 1;
         goto getSizeError;
     }
-    size_t formatHeaderSizeBytes = sizeof( PomModelFormat );
     size_t modelInfoSizeBytes = ( sizeof( PomModelInfo ) * numModelInfos );
     size_t submodelIdArrayBlockSizeBytes = ( sizeof( uint32_t ) * numSubmodelIds );
     size_t modelDataBlockSizeBytes = modelInfoSizeBytes + submodelIdArrayBlockSizeBytes;
+
+    // Each mesh's source mesh - itself, or an earlier identical mesh when instancing
+    sourceMeshIds = (uint32_t*) malloc( sizeof( uint32_t ) * ( scene->mNumMeshes + 1 ) );
+    if( !sourceMeshIds ){
+        printf( "ERR: Failed to allocate mesh ID table\n" );
+        err = 1;
+        goto getSizeError;
+    }
+    for( uint32_t i = 0; i < scene->mNumMeshes; i++ ){
+        sourceMeshIds[ i ] = i;
+    }
+    uint32_t numDuplicates = 0;
+    if( bakeOptions.instancingEnabled &&
+        findDuplicateMeshes( scene, maxMeshSize, sourceMeshIds, &numDuplicates ) ){
+        printf( "Failed to find duplicate meshes\n" );
+        err = 1;
+        goto getSizeError;
+    }
+
+    // Work out which meshes are merged. Done after dedup, since instanced meshes
+    // are left alone.
+    if( buildMeshMergePlan( scene, sourceMeshIds, &mergePlan ) ){
+        printf( "Failed to build mesh merge plan\n" );
+        err = 1;
+        goto getSizeError;
+    }
+    if( bakeOptions.mergeEnabled ){
+        printf( "Merged %u meshes into %u output meshes\n", scene->mNumMeshes, mergePlan.numGroups );
+    }
+    size_t submodelInfoSizeBytes = sizeof( PomSubmodelInfo ) * mergePlan.numSubmodels;
+
+    uint32_t numInstanceInfos = 0, numInstanceTransforms = 0;
+    if( bakeOptions.instancingEnabled ){
+        if( getInstanceInfoSize( scene, sourceMeshIds, &mergePlan,
+                                 &numInstanceInfos, &numInstanceTransforms ) ){
+            printf( "Failed to build instance info\n" );
+            err = 1;
+            goto getSizeError;
+        }
+        printf( "%u duplicate meshes, %u instanced meshes with %u placements\n",
+                numDuplicates, numInstanceInfos, numInstanceTransforms );
+    }
+    size_t instanceInfoSizeBytes = sizeof( PomModelInstanceInfo ) * numInstanceInfos;
+    size_t instanceTransformSizeBytes = sizeof( float ) * 16 * numInstanceTransforms;
     
-    // Create data block
-    printf( "Create data block\n" );
-    size_t meshInfoSize = sizeof( PomModelMeshInfo ) * scene->mNumMeshes;
+    // Create metadata block
+    printf( "Create metadata block\n" );
+    uint32_t numOutputMeshes = mergePlan.numGroups;
+    size_t meshInfoSize = sizeof( PomModelMeshInfo ) * numOutputMeshes;
     size_t texInfoSize = sizeof( PomModelTextureInfo ) * texCount;
 
-    size_t dataBlockSize = meshInfoSize + meshBlockSize +
-                           texInfoSize + texSize +
-                           materialBlockSize + modelDataBlockSizeBytes;
-    size_t totalModelFileSize = formatHeaderSizeBytes + dataBlockSize;
-                              
-    uint8_t *totalModelDataBlock = (uint8_t*) calloc( totalModelFileSize, sizeof( uint8_t ) );
-    // Accumulator makes it easier to later add blocks between existing ones
-    uint8_t *dataBlockAccum = totalModelDataBlock;
+    size_t metadataBlockSize = meshInfoSize + submodelInfoSizeBytes + texInfoSize +
+                               materialBlockSize + modelDataBlockSizeBytes +
+                               instanceInfoSizeBytes + instanceTransformSizeBytes;
 
-    PomModelFormat *format = (PomModelFormat*) dataBlockAccum;
-    dataBlockAccum += formatHeaderSizeBytes;
+    bool collectStats = bakeOptions.statsEnabled || bakeOptions.statsJsonPath;
+    if( collectStats && pomBakeStatsCreate( &bakeStats, numOutputMeshes, texCount ) ){
+        printf( "ERR: Failed to create bake statistics\n" );
+        err = 1;
+        goto getSizeError;
+    }
+
+    // Bulk data offsets are recorded separately and applied after the metadata
+    // has been relativised, since they're already file-relative.
+    uint8_t *metadataBlock = (uint8_t*) calloc( metadataBlockSize + 1, sizeof( uint8_t ) );
+    uint8_t **meshDataOffsets = (uint8_t**) calloc( numOutputMeshes + 1, sizeof( uint8_t* ) );
+    uint8_t **submodelIndexOffsets = (uint8_t**) calloc( mergePlan.numSubmodels + 1, sizeof( uint8_t* ) );
+    uint8_t **submodelVertexOffsets = (uint8_t**) calloc( mergePlan.numSubmodels + 1, sizeof( uint8_t* ) );
+    uint8_t **texDataOffsets = (uint8_t**) calloc( texCount + 1, sizeof( uint8_t* ) );
+    // Scratch space for one mesh at a time
+    uint8_t *meshScratchBlock = (uint8_t*) malloc( maxMeshSize + 1 );
+    if( !metadataBlock || !meshDataOffsets || !submodelIndexOffsets || !submodelVertexOffsets ||
+        !texDataOffsets || !meshScratchBlock ){
+        printf( "ERR: Failed to allocate bake working memory\n" );
+        err = 1;
+        goto allocFailure;
+    }
+
+    // Accumulator makes it easier to later add blocks between existing ones
+    uint8_t *dataBlockAccum = metadataBlock;
 
-    uint8_t *dataBlockStart = dataBlockAccum;
     PomModelMeshInfo *meshInfos = (PomModelMeshInfo*) dataBlockAccum;
     dataBlockAccum += meshInfoSize;
 
+    PomSubmodelInfo *submodelInfos = (PomSubmodelInfo*) dataBlockAccum;
+    dataBlockAccum += submodelInfoSizeBytes;
+
     uint8_t *materialDataBlock = dataBlockAccum;
     dataBlockAccum += materialBlockSize;
     
@@ -134,57 +359,141 @@ int main( int argc, char ** argv ){
     PomModelInfo *modelInfoDataBlock = (PomModelInfo*) dataBlockAccum;
     dataBlockAccum += modelInfoSizeBytes;
 
+    PomModelInstanceInfo *instanceInfos = (PomModelInstanceInfo*) dataBlockAccum;
+    dataBlockAccum += instanceInfoSizeBytes;
+
     uint32_t *submodelIdsArrayBlock = (uint32_t*) dataBlockAccum;
     dataBlockAccum += submodelIdArrayBlockSizeBytes;
 
-    uint8_t *meshDataBlock = (uint8_t*)dataBlockAccum;
-    dataBlockAccum += meshBlockSize;
+    float *instanceTransforms = (float*) dataBlockAccum;
+    dataBlockAccum += instanceTransformSizeBytes;
 
-    uint8_t *textureBlock = dataBlockAccum;
-    dataBlockAccum += texSize;
-
-    *format = (PomModelFormat){
+    PomModelFormat format = {
         .magicNumber = POM_FORMAT_MAGIC_NUM,
         .sceneNameOffset = NULL,
-        .dataBlockSize = dataBlockSize,
+        .dataBlockSize = 0, // Set when the stream is finalised
         .numTextureInfo = texCount,
         .textureInfoOffset = texInfos,
-        .numMeshInfo = scene->mNumMeshes,
+        .numMeshInfo = numOutputMeshes,
         .meshInfoOffset = meshInfos,
         .numMaterialInfo = scene->mNumMaterials,
         .materialInfoOffset = (PomModelMaterialInfo*) materialDataBlock,
-        .numSubmodelInfo = 0,
-        .submodelInfo = NULL,
+        .numSubmodelInfo = mergePlan.numSubmodels,
+        .submodelInfo = mergePlan.numSubmodels ? submodelInfos : NULL,
         .numModelInfo = numModelInfos,
-        .modelInfo = modelInfoDataBlock
+        .modelInfo = modelInfoDataBlock,
+        .numInstanceInfo = numInstanceInfos,
+        .instanceInfo = numInstanceInfos ? instanceInfos : NULL
     };
 
-    // Populate mesh info
+    PomModelStreamWriter streamWriter = { 0 };
+    if( pomModelStreamOpen( &streamWriter, bakedModelPath, metadataBlockSize ) ){
+        printf( "Failed to open output file\n" );
+        err = 1;
+        goto allocFailure;
+    }
+
+    // Populate mesh info, streaming each mesh's data out as we go
     printf( "Populate mesh info\n" );
-    size_t currOffsetBytes = 0;
-    for( uint32_t i = 0; i < scene->mNumMeshes; i++ ){
+    size_t currOffsetBytes = 0, sharedMeshBytes = 0;
+    uint64_t numSourceVertices = 0, numBakedVertices = 0;
+    for( uint32_t i = 0; i < numOutputMeshes; i++ ){
         PomModelMeshInfo *meshInfo = &meshInfos[ i ];
-        const struct aiMesh *mesh = scene->mMeshes[ i ];
+        const MeshGroup *group = &mergePlan.groups[ i ];
         size_t bytesWritten;
-        if( populateMeshData( mesh, meshInfo, &meshDataBlock[ currOffsetBytes ], &bytesWritten ) ){
+        uint64_t groupSourceVertices = 0;
+        for( uint32_t j = 0; j < group->numMembers; j++ ){
+            groupSourceVertices += scene->mMeshes[ mergePlan.members[ group->firstMember + j ] ]->mNumVertices;
+        }
+        numSourceVertices += groupSourceVertices;
+        PomMeshStats *meshStats = collectStats ? &bakeStats.meshes[ i ] : NULL;
+        if( meshStats ){
+            meshStats->meshId = i;
+            meshStats->numSourceVertices = groupSourceVertices;
+        }
+        if( group->numMembers > 1 ){
+            if( streamMergedMesh( scene, group, i, &streamWriter, meshScratchBlock, meshInfo,
+                                  &submodelInfos[ group->firstSubmodel ],
+                                  &submodelIndexOffsets[ group->firstSubmodel ],
+                                  &submodelVertexOffsets[ group->firstSubmodel ],
+                                  &meshDataOffsets[ i ], meshStats, &bytesWritten ) ){
+                printf( "Failed to write merged mesh %u data\n", i );
+                err = 1;
+                goto populateDataFailure;
+            }
+            numBakedVertices += meshInfo->numVertices;
+            currOffsetBytes += bytesWritten;
+            continue;
+        }
+
+        uint32_t sourceMesh = mergePlan.members[ group->firstMember ];
+        const struct aiMesh *mesh = scene->mMeshes[ sourceMesh ];
+        uint32_t sourceMeshId = mergePlan.outputMeshIds[ sourceMeshIds[ sourceMesh ] ];
+        if( sourceMeshId != i ){
+            // Identical to an earlier mesh, so share its (already written) data
+            *meshInfo = meshInfos[ sourceMeshId ];
+            meshInfo->meshId = i;
+            // Identical geometry doesn't mean an identical material
+            meshInfo->materialId = mesh->mMaterialIndex;
+            meshDataOffsets[ i ] = meshDataOffsets[ sourceMeshId ];
+            if( meshStats ){
+                *meshStats = bakeStats.meshes[ sourceMeshId ];
+                meshStats->meshId = i;
+                meshStats->numSourceVertices = groupSourceVertices;
+                meshStats->sharesData = true;
+            }
+            numBakedVertices += meshInfo->numVertices;
+            currOffsetBytes += meshInfo->dataSize;
+            sharedMeshBytes += meshInfo->dataSize;
+            continue;
+        }
+        if( buildMeshData( mesh, meshInfo, meshScratchBlock, &bytesWritten ) ){
             err = 1;
             goto populateDataFailure;
         }
-        meshInfo->dataBlockOffset = &meshDataBlock[ currOffsetBytes ];
+        meshInfo->sourceMeshId = i;
+        meshInfo->firstSubmodel = 0;
+        meshInfo->numSubmodels = 0;
+        if( meshStats &&
+            pomMeshStatsAnalyse( (const uint32_t*) meshScratchBlock, meshInfo->numIndices,
+                                 (const float*) ( meshScratchBlock + sizeof( uint32_t ) * meshInfo->numIndices ),
+                                 meshInfo->numVertices, meshInfo->dataStride / sizeof( float ), meshStats ) ){
+            printf( "Failed to analyse mesh %u\n", i );
+            err = 1;
+            goto populateDataFailure;
+        }
+        if( pomModelStreamWrite( &streamWriter, meshScratchBlock, bytesWritten,
+                                 &meshDataOffsets[ i ] ) ){
+            printf( "Failed to write mesh %u data\n", i );
+            err = 1;
+            goto populateDataFailure;
+        }
+        meshInfo->dataBlockOffset = NULL;
         meshInfo->meshId = i;
+        numBakedVertices += meshInfo->numVertices;
         currOffsetBytes += bytesWritten;
     }
-    // Check that we wrote the estimated amount of data
-    if( currOffsetBytes != meshBlockSize ){
+    // Check that we wrote the estimated amount of data. Welding can only shrink
+    // meshes, so the estimate is an upper bound in that case.
+    if( bakeOptions.weldEnabled ){
+        printf( "Welded %lu vertices down to %lu (%.1f%% fewer), mesh data %lu of %lu bytes\n",
+                numSourceVertices, numBakedVertices,
+                numSourceVertices ? 100.0 * (double) ( numSourceVertices - numBakedVertices ) / (double) numSourceVertices : 0.0,
+                currOffsetBytes, meshBlockSize );
+    }
+    if( bakeOptions.weldEnabled ? ( currOffsetBytes > meshBlockSize ) : ( currOffsetBytes != meshBlockSize ) ){
         printf( "Inconsistency between estimated mesh block size and bytes written. "
                 "Wrote %lu, expected %lu\n", currOffsetBytes, meshBlockSize );
         err = 1;
         goto populateDataFailure;
     }
+    if( sharedMeshBytes ){
+        printf( "Saved %lu bytes of duplicate mesh data\n", sharedMeshBytes );
+    }
 
     printf( "Populate texture info\n" );
     size_t texBytesWritten;
-    if( populateTextureData( scene, textureBlock, texInfos, &texBytesWritten ) ){
+    if( streamTextureData( scene, &streamWriter, texInfos, texCount, texDataOffsets, &texBytesWritten ) ){
         printf( "Failed to populate texture block\n" );
         err = 1;
         goto populateDataFailure;
@@ -194,6 +503,24 @@ int main( int argc, char ** argv ){
         err = 1;
         goto populateDataFailure;
     }
+    // Infos sharing data (deduplicated textures, atlas pages) are only counted once
+    for( uint32_t i = 0; collectStats && i < texCount; i++ ){
+        bool isShared = false;
+        for( uint32_t j = 0; j < i && !isShared; j++ ){
+            isShared = ( texDataOffsets[ j ] == texDataOffsets[ i ] );
+        }
+        if( isShared ){
+            continue;
+        }
+        bakeStats.textures[ bakeStats.numTextures++ ] = (PomTextureStats){
+            .textureId = texInfos[ i ].textureId,
+            .dataType = (PomModelTextureDataType) texInfos[ i ].dataType,
+            .width = texInfos[ i ].width,
+            .height = texInfos[ i ].height,
+            .numMipLevels = texInfos[ i ].numMipLevels,
+            .dataSizeBytes = texInfos[ i ].dataBlockSizeBytes
+        };
+    }
 
     printf( "Write material info block data\n" );
     size_t materialDataWritten;
@@ -202,7 +529,7 @@ int main( int argc, char ** argv ){
         err = 1;
         goto populateDataFailure;
     }
-    if( texBytesWritten != texSize ){
+    if( materialDataWritten != materialBlockSize ){
         printf( "Inconsistency in material bytes written and expected material block size\n" );
         err = 1;
         goto populateDataFailure;
@@ -222,14 +549,69 @@ int main( int argc, char ** argv ){
         goto populateDataFailure;
     }
 
-    printf( "Write output file\n" );
-    if( writeBakedModel( format, dataBlockStart, dataBlockSize, bakedModelPath ) ){
+    if( numInstanceInfos ){
+        printf( "Write instance info block data\n" );
+        size_t instanceDataWritten;
+        if( populateInstanceInfo( scene, sourceMeshIds, &mergePlan, instanceInfos,
+                                  instanceTransforms, &instanceDataWritten ) ){
+            printf( "Failed to populate instance data\n" );
+            err = 1;
+            goto populateDataFailure;
+        }
+        if( instanceDataWritten != instanceInfoSizeBytes + instanceTransformSizeBytes ){
+            printf( "Inconsistency in instance bytes written and expected block size\n" );
+            err = 1;
+            goto populateDataFailure;
+        }
+    }
+
+    printf( "Patch metadata and finalise output file\n" );
+    if( relativisePointers( &format, metadataBlock ) ){
+        printf( "Failed to relativise model pointers\n" );
+        err = 1;
+        goto populateDataFailure;
+    }
+    // Bulk data offsets are already relative, so can be set directly
+    for( uint32_t i = 0; i < numOutputMeshes; i++ ){
+        meshInfos[ i ].dataBlockOffset = meshDataOffsets[ i ];
+    }
+    for( uint32_t i = 0; i < mergePlan.numSubmodels; i++ ){
+        submodelInfos[ i ].indexOffset = (uint32_t*) submodelIndexOffsets[ i ];
+        submodelInfos[ i ].dataOffset = (float*) submodelVertexOffsets[ i ];
+    }
+    for( uint32_t i = 0; i < texCount; i++ ){
+        texInfos[ i ].dataOffset = texDataOffsets[ i ];
+    }
+    if( pomModelStreamFinalise( &streamWriter, &format, metadataBlock ) ){
         printf( "Failed to write output file\n" );
+        err = 1;
         goto populateDataFailure;
     }
+    printf( "Wrote %lu bytes\n", sizeof( PomModelFormat ) + format.dataBlockSize );
+
+    if( collectStats ){
+        pomBakeStatsAddSection( &bakeStats, "header", sizeof( PomModelFormat ) );
+        pomBakeStatsAddSection( &bakeStats, "mesh data", currOffsetBytes - sharedMeshBytes );
+        pomBakeStatsAddSection( &bakeStats, "texture data", texBytesWritten );
+        pomBakeStatsAddSection( &bakeStats, "mesh infos", meshInfoSize );
+        pomBakeStatsAddSection( &bakeStats, "submodel infos", submodelInfoSizeBytes );
+        pomBakeStatsAddSection( &bakeStats, "texture infos", texInfoSize );
+        pomBakeStatsAddSection( &bakeStats, "materials", materialBlockSize );
+        pomBakeStatsAddSection( &bakeStats, "model infos", modelDataBlockSizeBytes );
+        pomBakeStatsAddSection( &bakeStats, "instance infos", instanceInfoSizeBytes );
+        pomBakeStatsAddSection( &bakeStats, "instance transforms", instanceTransformSizeBytes );
+        if( bakeOptions.statsEnabled ){
+            pomBakeStatsPrint( &bakeStats );
+        }
+        if( bakeOptions.statsJsonPath && pomBakeStatsWriteJson( &bakeStats, bakeOptions.statsJsonPath ) ){
+            printf( "Failed to write statistics to %s\n", bakeOptions.statsJsonPath );
+            err = 1;
+        }
+    }
 
 #ifdef SANITY_CHECK_MODEL
-    // Quick test on loading models
+    // Quick test on loading models. Only the metadata is still resident, so
+    // compare against that.
     PomModelFormat *loadedModel;
     uint8_t *loadedDataBlock;
     if( loadBakedModel( bakedModelPath, &loadedModel, &loadedDataBlock ) ){
@@ -239,7 +621,8 @@ int main( int argc, char ** argv ){
     }
     // Relativise loaded model
     relativisePointers( loadedModel, loadedDataBlock );
-    if( memcmp( loadedModel, format, totalModelFileSize ) != 0 ){
+    if( memcmp( loadedModel, &format, sizeof( PomModelFormat ) ) != 0 ||
+        memcmp( loadedDataBlock, metadataBlock, metadataBlockSize ) != 0 ){
         printf( "File comparison failed" );
         free( loadedModel );
         err = 1;
@@ -249,19 +632,85 @@ int main( int argc, char ** argv ){
 #endif // SANITY_CHECK_MODEL
 
 populateDataFailure:
-    free( totalModelDataBlock );
+    if( err ){
+        pomModelStreamAbort( &streamWriter );
+    }
+allocFailure:
+    free( meshScratchBlock );
+    free( texDataOffsets );
+    free( submodelVertexOffsets );
+    free( submodelIndexOffsets );
+    free( meshDataOffsets );
+    free( metadataBlock );
 getSizeError:
+    pomBakeStatsDestroy( &bakeStats );
+    destroyMeshMergePlan( &mergePlan );
+    free( sourceMeshIds );
+    destroyAtlasPlan( &atlasPlan );
+    if( weldThreadpool ){
+        pomThreadpoolClear( weldThreadpool );
+    }
     return err;
 }
 
+
+// Options all come before the two paths
+int parseOptions( int argc, char **argv, int *_numOptions ){
+    int argIdx = 1;
+    for( ; argIdx < argc; argIdx++ ){
+        const char *arg = argv[ argIdx ];
+        if( strncmp( arg, "--", 2 ) != 0 ){
+            break;
+        }
+        if( strcmp( arg, "--no-mips" ) == 0 ){
+            bakeOptions.textureEncode.generateMips = false;
+        }else if( strcmp( arg, "--no-compress" ) == 0 ){
+            bakeOptions.textureEncode.compress = false;
+        }else if( strcmp( arg, "--bc7" ) == 0 ){
+            bakeOptions.textureEncode.preferBc7 = true;
+        }else if( strcmp( arg, "--mip-filter=box" ) == 0 ){
+            bakeOptions.textureEncode.mipFilter = POM_MIP_FILTER_BOX;
+        }else if( strcmp( arg, "--mip-filter=kaiser" ) == 0 ){
+            bakeOptions.textureEncode.mipFilter = POM_MIP_FILTER_KAISER;
+        }else if( strcmp( arg, "--instancing" ) == 0 ){
+            bakeOptions.instancingEnabled = true;
+        }else if( strcmp( arg, "--merge" ) == 0 ){
+            bakeOptions.mergeEnabled = true;
+        }else if( strcmp( arg, "--weld" ) == 0 ){
+            bakeOptions.weldEnabled = true;
+        }else if( strcmp( arg, "--stats" ) == 0 ){
+            bakeOptions.statsEnabled = true;
+        }else if( strncmp( arg, "--stats-json=", strlen( "--stats-json=" ) ) == 0 ){
+            bakeOptions.statsJsonPath = arg + strlen( "--stats-json=" );
+        }else if( strcmp( arg, "--atlas" ) == 0 ){
+            bakeOptions.atlasEnabled = true;
+        }else if( sscanf( arg, "--atlas-size=%u", &bakeOptions.atlasPageSize ) == 1 ||
+                  sscanf( arg, "--atlas-max=%u", &bakeOptions.atlasMaxTextureSize ) == 1 ||
+                  sscanf( arg, "--atlas-padding=%u", &bakeOptions.atlasPadding ) == 1 ||
+                  sscanf( arg, "--weld-epsilon=%f", &bakeOptions.weldEpsilon ) == 1 ||
+                  sscanf( arg, "--threads=%u", &bakeOptions.numThreads ) == 1 ){
+            continue;
+        }else{
+            printf( "ERR: Unknown option %s\n", arg );
+            return 1;
+        }
+    }
+    *_numOptions = argIdx - 1;
+    return 0;
+}
+
 int loadRawModel( const char *modelPath, struct aiScene const **_scene ){
     
     unsigned int aiFlags = aiProcess_CalcTangentSpace |
                            aiProcess_Debone | // no bones for now
                            aiProcess_GenNormals |
-                           aiProcess_OptimizeGraph |
                            aiProcess_OptimizeMeshes |
                            aiProcess_Triangulate;
+    // Collapsing the graph bakes node transforms into (duplicated) vertex data,
+    // which is exactly what instancing needs to avoid
+    if( !bakeOptions.instancingEnabled ){
+        aiFlags |= aiProcess_OptimizeGraph;
+    }
     
     *_scene = aiImportFile( modelPath, aiFlags );
 	if ( !*_scene ) {
@@ -377,43 +826,56 @@ int populateMeshData( const struct aiMesh *mesh, PomModelMeshInfo *meshInfo,
     meshInfo->dataSize = currWrittenBytes;
     meshInfo->hasTangentSpace = hasTangentSpace;
     meshInfo->nameOffset = NULL;
+    meshInfo->materialId = mesh->mMaterialIndex;
+
+    return 0;
+}
+
+int getMeshSize( const struct aiMesh *_mesh, size_t *_sizeBytes ){
+    const uint8_t vectorLen = 3; // 3-element vector
+
+    // Should always have position + normal vectors.
+    // Tangent space is not guaranteed.
+    bool hasTangentSpace = ( _mesh->mTangents ) && ( _mesh->mBitangents );
+    const uint8_t numVectorTypes = hasTangentSpace ? 4 : 2;
+    
+    uint32_t meshIndexCount;
+    uint32_t meshFloatElementCount;
+    // Assume triangulated faces
+    meshIndexCount = _mesh->mNumFaces * 3;
+    uint32_t numVertices = _mesh->mNumVertices;
+    uint32_t numUvComponents = 0;
+    // Count how many components overall we have for texture coords
+    for( uint32_t uvIdx = 0; uvIdx < AI_MAX_NUMBER_OF_TEXTURECOORDS; uvIdx++ ){
+        numUvComponents += _mesh->mNumUVComponents[ uvIdx ];
+    }
+    meshFloatElementCount = numVertices * numVectorTypes * vectorLen;
+    meshFloatElementCount += numVertices * numUvComponents;
+    size_t floatBlockByteSize = meshFloatElementCount * sizeof( float );
+    *_sizeBytes = ( meshIndexCount * sizeof( uint32_t ) ) + floatBlockByteSize;
 
     return 0;
 }
 
-int getAllMeshSize( const struct aiScene *_scene, size_t *_sizeBytes ){
+int getAllMeshSize( const struct aiScene *_scene, size_t *_sizeBytes,
+                    size_t *_maxMeshSizeBytes ){
     uint32_t numMesh = _scene->mNumMeshes;
     size_t bytesAccum = 0; 
-
-    const uint8_t vectorLen = 3; // 3-element vector
+    size_t maxMeshSize = 0;
 
     for( uint32_t i = 0; i < numMesh; i++ ){
-        const struct aiMesh *mesh = _scene->mMeshes[ i ];
-        // Should always have position + normal vectors.
-        // Tangent space is not guaranteed.
-        bool hasTangentSpace = ( mesh->mTangents ) && ( mesh->mBitangents );
-        const uint8_t numVectorTypes = hasTangentSpace ? 4 : 2;
-        
-        uint32_t meshIndexCount;
-        uint32_t meshFloatElementCount;
-        // Assume triangulated faces
-        meshIndexCount = mesh->mNumFaces * 3;
-        uint32_t numVertices = mesh->mNumVertices;
-        uint32_t numUvComponents = 0, numUvCoords = 0;
-        // Count how many components overall we have for texture coords
-        for( uint32_t uvIdx = 0; uvIdx < AI_MAX_NUMBER_OF_TEXTURECOORDS; uvIdx++ ){
-            numUvComponents += mesh->mNumUVComponents[ uvIdx ];
-            if( mesh->mNumUVComponents[ uvIdx ] ) numUvCoords++;
+        size_t meshByteSize;
+        if( getMeshSize( _scene->mMeshes[ i ], &meshByteSize ) ){
+            return 1;
         }
-        meshFloatElementCount = numVertices * numVectorTypes * vectorLen;
-        meshFloatElementCount += numVertices * numUvComponents;
-        size_t floatBlockByteSize = meshFloatElementCount * sizeof( float );
-        size_t meshByteSize = ( meshIndexCount * sizeof( uint32_t ) ) + floatBlockByteSize;
-
         bytesAccum += meshByteSize;
+        if( meshByteSize > maxMeshSize ){
+            maxMeshSize = meshByteSize;
+        }
     }
 
     *_sizeBytes = bytesAccum;
+    *_maxMeshSizeBytes = maxMeshSize;
 
     return 0;
 }
@@ -453,7 +915,14 @@ int populateMaterialInfo( const struct aiScene *_scene, uint8_t *_matDataBlock,
     for( uint32_t i = 0; i < _scene->mNumMaterials; i++ ){
         const struct aiMaterial *material = materials[ i ];
         PomModelMaterialInfo *materialInfo = &materialInfos[ i ];
+        materialInfo->materialId = i;
         materialInfo->textureIdsOffset = &texIdArrays[ texIdArrayIdx ];
+        int twoSided = 0;
+        if( aiGetMaterialIntegerArray( material, AI_MATKEY_TWOSIDED, &twoSided, NULL ) != aiReturn_SUCCESS ){
+            // Most formats leave it out, meaning one-sided
+            twoSided = 0;
+        }
+        materialInfo->isTwoSided = twoSided != 0;
 
         uint32_t numTexIds = 0;
         for( uint32_t texType = 1; texType <= AI_TEXTURE_TYPE_MAX; texType++ ){
@@ -472,6 +941,24 @@ int populateMaterialInfo( const struct aiScene *_scene, uint8_t *_matDataBlock,
     return 0;                              
 }
 
+// Colour textures are filtered in linear space and stored as sRGB. OBJ files tend
+// to reference normal maps as bump maps, so treat multi-channel height maps as normals.
+PomTextureUsage getTextureUsage( uint32_t _aiTextureType, int _numChannels ){
+    switch( _aiTextureType ){
+        case aiTextureType_DIFFUSE:
+        case aiTextureType_SPECULAR:
+        case aiTextureType_AMBIENT:
+        case aiTextureType_EMISSIVE:
+            return POM_TEXTURE_USAGE_COLOUR;
+        case aiTextureType_NORMALS:
+            return POM_TEXTURE_USAGE_NORMAL;
+        case aiTextureType_HEIGHT:
+            return ( _numChannels >= 3 ) ? POM_TEXTURE_USAGE_NORMAL : POM_TEXTURE_USAGE_DATA;
+        default:
+            return POM_TEXTURE_USAGE_DATA;
+    }
+}
+
 int getAllTextureSize( const struct aiScene *_scene, uint32_t *_textureCount,
                        size_t *_allTextureDataSize ){
     uint32_t texCount = 0;
@@ -486,6 +973,10 @@ int getAllTextureSize( const struct aiScene *_scene, uint32_t *_textureCount,
         for( uint32_t texType = 1; texType <= AI_TEXTURE_TYPE_MAX; texType++ ){
             uint32_t matTexCount = aiGetMaterialTextureCount( material, texType );
             texCount += matTexCount;
+            if( atlasPlan.materialAtlased && atlasPlan.materialAtlased[ i ] ){
+                // Accounted for in the atlas pages
+                continue;
+            }
             for( uint32_t texIdx = 0; texIdx < matTexCount; texIdx++ ){
                 struct aiString texPath;
                 enum aiTextureMapping texMapping;
@@ -520,33 +1011,83 @@ int getAllTextureSize( const struct aiScene *_scene, uint32_t *_textureCount,
                     return 1;
                 }
                 // Assume 8 bits per channel
-                texSize += ( x * y * c * sizeof( uint8_t ) );
+                PomTextureEncodeInfo encodeInfo;
+                if( pomTextureEncodeGetInfo( &bakeOptions.textureEncode, getTextureUsage( texType, c ),
+                                             x, y, c, &encodeInfo ) ){
+                    printf( "Failed to get texture encoding for file %s\n", texPath.data );
+                    return 1;
+                }
+                texSize += encodeInfo.encodedSizeBytes;
             }
         }
     }
+    // Atlas pages, one texture per used slot
+    for( uint32_t page = 0; page < atlasPlan.numPages; page++ ){
+        for( uint32_t texType = 1; texType <= AI_TEXTURE_TYPE_MAX; texType++ ){
+            uint32_t numChannels = atlasPlan.pageSlotChannels[ page ][ texType ];
+            if( !numChannels ){
+                continue;
+            }
+            PomTextureEncodeInfo encodeInfo;
+            if( pomTextureEncodeGetInfo( &bakeOptions.textureEncode, getTextureUsage( texType, numChannels ),
+                                         bakeOptions.atlasPageSize, atlasPlan.pageHeights[ page ],
+                                         numChannels, &encodeInfo ) ){
+                printf( "Failed to get texture encoding for atlas page %u\n", page );
+                return 1;
+            }
+            texSize += encodeInfo.encodedSizeBytes;
+        }
+    }
     *_textureCount = texCount;
     *_allTextureDataSize = texSize;
     pomMapClear( &texPathsMap );
     return 0;
 }
 
-int populateTextureData( const struct aiScene *_scene, uint8_t *_texDataBlock,
-                         PomModelTextureInfo *_texInfos, size_t *_bytesWritten ){
+// Load each unique texture in turn and stream it out to the file, so only one
+// decoded texture is resident at a time.
+int streamTextureData( const struct aiScene *_scene, PomModelStreamWriter *_writer,
+                       PomModelTextureInfo *_texInfos, uint32_t _numTexInfos,
+                       uint8_t **_texDataOffsets, size_t *_bytesWritten ){
+    // Maps texture path -> index of the first texture info that loaded it
     PomMapCtx texMapCtx;
-    pomMapInit( &texMapCtx, 0 );
     if( pomMapInit( &texMapCtx, 0 ) ){
         printf( "Failed to create texture path hashmap\n" );
         return 1;
     }
+    int err = 0;
     uint32_t currInfoIdx = 0;
-    uint8_t *currFreeTexBlock = _texDataBlock;
     size_t bytesWritten = 0;
+    // Atlas page/slot for each texture info, filled in once the pages are written
+    uint32_t *infoAtlasSlot = (uint32_t*) malloc( sizeof( uint32_t ) * ( _numTexInfos + 1 ) );
+    if( !infoAtlasSlot ){
+        printf( "Failed to allocate atlas slot lookup\n" );
+        pomMapClear( &texMapCtx );
+        return 1;
+    }
+    for( uint32_t i = 0; i < _numTexInfos; i++ ){
+        infoAtlasSlot[ i ] = UINT32_MAX;
+    }
     for( uint32_t i = 0; i < _scene->mNumMaterials; i++ ){
         const struct aiMaterial *material = _scene->mMaterials[ i ];
+        bool materialAtlased = atlasPlan.materialAtlased && atlasPlan.materialAtlased[ i ];
         for( uint32_t texType = 1; texType <= AI_TEXTURE_TYPE_MAX; texType++ ){
             uint32_t matTexCount = aiGetMaterialTextureCount( material, texType );
             for( uint32_t texIdx = 0; texIdx < matTexCount; texIdx++ ){
-                PomModelTextureInfo *currInfo = &_texInfos[ currInfoIdx++ ];
+                uint32_t infoIdx = currInfoIdx++;
+                PomModelTextureInfo *currInfo = &_texInfos[ infoIdx ];
+                currInfo->textureId = infoIdx;
+                currInfo->textureType = texType;
+                if( materialAtlased ){
+                    const PomAtlasRect *rect = &atlasPlan.materialRects[ i ];
+                    currInfo->isAtlas = 1;
+                    currInfo->atlasRegionX = rect->x;
+                    currInfo->atlasRegionY = rect->y;
+                    currInfo->atlasRegionWidth = rect->width;
+                    currInfo->atlasRegionHeight = rect->height;
+                    infoAtlasSlot[ infoIdx ] = rect->page * NUM_TEXTURE_SLOTS + texType;
+                    continue;
+                }
                 struct aiString texPath;
                 enum aiTextureMapping texMapping;
                 unsigned int texUvIndex;
@@ -560,12 +1101,21 @@ int populateTextureData( const struct aiScene *_scene, uint8_t *_texDataBlock,
                 // Check if we've already registered this texture
                 const char *pathExists = pomMapGet( &texMapCtx, texPath.data, NULL );
                 if( pathExists ){
-                    // Path has already been loaded
-                    uint32_t texOffsetBytes = (uint32_t) atoi( pathExists ); // Gross - TODO - change this 
-                    uint8_t* texDataLoc = _texDataBlock + texOffsetBytes;
-                    currInfo->dataOffset = texDataLoc;
+                    // Path has already been loaded, so share its data
+                    uint32_t loadedIdx = (uint32_t) atoi( pathExists ); // TODO - store ints in the map directly
+                    PomModelTextureInfo *loadedInfo = &_texInfos[ loadedIdx ];
+                    currInfo->dataType = loadedInfo->dataType;
+                    currInfo->dataUnitSizeBytes = loadedInfo->dataUnitSizeBytes;
+                    currInfo->dataBlockSizeBytes = loadedInfo->dataBlockSizeBytes;
+                    currInfo->width = loadedInfo->width;
+                    currInfo->height = loadedInfo->height;
+                    currInfo->numMipLevels = loadedInfo->numMipLevels;
+                    currInfo->isSrgb = loadedInfo->isSrgb;
+                    _texDataOffsets[ infoIdx ] = _texDataOffsets[ loadedIdx ];
                     continue;
                 }
+                char mapKey[ sizeof( texPath.data ) ];
+                memcpy( mapKey, texPath.data, sizeof( mapKey ) );
 
                 // Path has not yet been loaded
                 // Get dir-relative path. Fair to assume that adding the dir wont cause the
@@ -580,31 +1130,322 @@ int populateTextureData( const struct aiScene *_scene, uint8_t *_texDataBlock,
                 stbi_uc *imgData = stbi_load( texPath.data, &x, &y, &c, 0 );
                 if( !imgData ){
                     printf( "Failed to get texture information on file %s: %s\n", texPath.data, stbi_failure_reason() );
+                    err = 1;
+                    goto textureFailure;
+                }
+                PomTextureEncodeInfo encodeInfo;
+                if( pomTextureEncodeGetInfo( &bakeOptions.textureEncode, getTextureUsage( texType, c ),
+                                             x, y, c, &encodeInfo ) ){
+                    printf( "Failed to get texture encoding for file %s\n", texPath.data );
+                    stbi_image_free( imgData );
+                    err = 1;
+                    goto textureFailure;
+                }
+                // Encoded data (all mips) only lives as long as it takes to write it out
+                uint8_t *encodedData = (uint8_t*) malloc( encodeInfo.encodedSizeBytes );
+                if( !encodedData ||
+                    pomTextureEncode( &bakeOptions.textureEncode, &encodeInfo, imgData, encodedData ) ){
+                    printf( "Failed to encode texture data for file %s\n", texPath.data );
+                    free( encodedData );
                     stbi_image_free( imgData );
+                    err = 1;
+                    goto textureFailure;
+                }
+                stbi_image_free( imgData );
+
+                if( pomModelStreamWrite( _writer, encodedData, encodeInfo.encodedSizeBytes,
+                                         &_texDataOffsets[ infoIdx ] ) ){
+                    printf( "Failed to write texture data for file %s\n", texPath.data );
+                    free( encodedData );
+                    err = 1;
+                    goto textureFailure;
+                }
+                free( encodedData );
+                printf( "Texture %s: %dx%d, %u mips, format %u, %lu bytes\n", texPath.data, x, y,
+                        encodeInfo.numMipLevels, encodeInfo.dataType, encodeInfo.encodedSizeBytes );
+
+                char buff[ 16 ];
+                sprintf( buff, "%u", infoIdx );
+                pomMapSet( &texMapCtx, mapKey, &buff[ 0 ] );
+                currInfo->dataType = encodeInfo.dataType;
+                currInfo->dataUnitSizeBytes = encodeInfo.dataUnitSizeBytes;
+                currInfo->dataBlockSizeBytes = encodeInfo.encodedSizeBytes;
+                currInfo->width = encodeInfo.width;
+                currInfo->height = encodeInfo.height;
+                currInfo->numMipLevels = encodeInfo.numMipLevels;
+                currInfo->isSrgb = encodeInfo.isSrgb;
+                bytesWritten += encodeInfo.encodedSizeBytes;
+            }
+        }
+    }
+
+    size_t atlasBytesWritten = 0;
+    if( atlasPlan.numPages &&
+        streamAtlasPages( _scene, _writer, _texInfos, _numTexInfos, infoAtlasSlot,
+                          _texDataOffsets, &atlasBytesWritten ) ){
+        printf( "Failed to write texture atlases\n" );
+        err = 1;
+        goto textureFailure;
+    }
+    *_bytesWritten = bytesWritten + atlasBytesWritten;
+
+textureFailure:
+    free( infoAtlasSlot );
+    pomMapClear( &texMapCtx );
+    return err;
+}
+
+// Compose, encode and write each atlas page's texture for each slot in use
+int streamAtlasPages( const struct aiScene *_scene, PomModelStreamWriter *_writer,
+                      PomModelTextureInfo *_texInfos, uint32_t _numTexInfos,
+                      const uint32_t *_infoAtlasSlot, uint8_t **_texDataOffsets,
+                      size_t *_bytesWritten ){
+    size_t bytesWritten = 0;
+    uint32_t pageWidth = bakeOptions.atlasPageSize;
+    for( uint32_t page = 0; page < atlasPlan.numPages; page++ ){
+        uint32_t pageHeight = atlasPlan.pageHeights[ page ];
+        for( uint32_t texType = 1; texType <= AI_TEXTURE_TYPE_MAX; texType++ ){
+            uint32_t numChannels = atlasPlan.pageSlotChannels[ page ][ texType ];
+            if( !numChannels ){
+                continue;
+            }
+            uint8_t *atlasData = (uint8_t*) calloc( (size_t) pageWidth * pageHeight * numChannels, 1 );
+            if( !atlasData ){
+                printf( "Failed to allocate atlas page\n" );
+                return 1;
+            }
+            for( uint32_t i = 0; i < _scene->mNumMaterials; i++ ){
+                const PomAtlasRect *rect = &atlasPlan.materialRects[ i ];
+                const struct aiMaterial *material = _scene->mMaterials[ i ];
+                if( !atlasPlan.materialAtlased[ i ] || rect->page != page ||
+                    aiGetMaterialTextureCount( material, texType ) == 0 ){
+                    continue;
+                }
+                struct aiString texPath;
+                aiGetMaterialTexture( material, texType, 0, &texPath,
+                                      NULL, NULL, NULL, NULL, NULL, NULL );
+                char filePath[ sizeof( texPath.data ) * 2 ];
+                getTextureFilePath( &texPath, filePath, sizeof( filePath ) );
+                int x, y, c;
+                stbi_uc *imgData = stbi_load( filePath, &x, &y, &c, 0 );
+                if( !imgData ){
+                    printf( "Failed to load atlas texture %s: %s\n", filePath, stbi_failure_reason() );
+                    free( atlasData );
                     return 1;
                 }
-                // Copy image data to the block, and update the path cache
-                // Assume 8 bits per channel.
-                // At some point it'd be nice to be able to get stb image to write directly
-                // to our buffer since thats where it's going anyway, and we could avoid
-                // the memcpy.
-                size_t texSize = ( x * y * c * sizeof( uint8_t ) );
-                memcpy( currFreeTexBlock, imgData, texSize );
-                char buff[ 50 ];
-                uintptr_t ptrVal = (uintptr_t) currFreeTexBlock;
-                sprintf( buff, "%lu", ptrVal );    // Also gross - TODO - change this
-                pomMapSet( &texMapCtx, texPath.data, &buff[ 0 ] );
-                currInfo->dataOffset = currFreeTexBlock;
-                currFreeTexBlock += texSize;
-                bytesWritten += texSize;
+                pomAtlasBlit( atlasData, pageWidth, pageHeight, numChannels, imgData, x, y, c,
+                              rect->x, rect->y, bakeOptions.atlasPadding );
                 stbi_image_free( imgData );
             }
+
+            PomTextureEncodeInfo encodeInfo;
+            uint8_t *encodedData = NULL;
+            uint8_t *dataOffset;
+            if( pomTextureEncodeGetInfo( &bakeOptions.textureEncode, getTextureUsage( texType, numChannels ),
+                                         pageWidth, pageHeight, numChannels, &encodeInfo ) ||
+                !( encodedData = (uint8_t*) malloc( encodeInfo.encodedSizeBytes ) ) ||
+                pomTextureEncode( &bakeOptions.textureEncode, &encodeInfo, atlasData, encodedData ) ||
+                pomModelStreamWrite( _writer, encodedData, encodeInfo.encodedSizeBytes, &dataOffset ) ){
+                printf( "Failed to encode atlas page %u for texture type %u\n", page, texType );
+                free( encodedData );
+                free( atlasData );
+                return 1;
+            }
+            free( encodedData );
+            free( atlasData );
+            printf( "Atlas page %u, texture type %u: %ux%u, format %u, %lu bytes\n", page, texType,
+                    pageWidth, pageHeight, encodeInfo.dataType, encodeInfo.encodedSizeBytes );
+            bytesWritten += encodeInfo.encodedSizeBytes;
+
+            // Point every texture info in this page/slot at the atlas
+            uint32_t slot = page * NUM_TEXTURE_SLOTS + texType;
+            for( uint32_t i = 0; i < _numTexInfos; i++ ){
+                if( _infoAtlasSlot[ i ] != slot ){
+                    continue;
+                }
+                PomModelTextureInfo *texInfo = &_texInfos[ i ];
+                texInfo->dataType = encodeInfo.dataType;
+                texInfo->dataUnitSizeBytes = encodeInfo.dataUnitSizeBytes;
+                texInfo->dataBlockSizeBytes = encodeInfo.encodedSizeBytes;
+                texInfo->width = encodeInfo.width;
+                texInfo->height = encodeInfo.height;
+                texInfo->numMipLevels = encodeInfo.numMipLevels;
+                texInfo->isSrgb = encodeInfo.isSrgb;
+                _texDataOffsets[ i ] = dataOffset;
+            }
         }
     }
     *_bytesWritten = bytesWritten;
     return 0;
 }
 
+void getTextureFilePath( const struct aiString *_texPath, char *_filePath, size_t _filePathSize ){
+    snprintf( _filePath, _filePathSize, "%s%s", rawModelDir ? rawModelDir : "", _texPath->data );
+}
+
+// A material can be atlased if it has exactly one texture per slot, all the same
+// (small) size, all on the same UV channel, and every mesh using it keeps that
+// channel within [0, 1] (so no wrapping is needed).
+static bool isMaterialAtlasable( const struct aiScene *_scene, uint32_t _materialIdx,
+                                 uint32_t *_width, uint32_t *_height, uint32_t *_uvIndex,
+                                 uint32_t _slotChannels[ NUM_TEXTURE_SLOTS ] ){
+    const struct aiMaterial *material = _scene->mMaterials[ _materialIdx ];
+    uint32_t numTextures = 0;
+    for( uint32_t texType = 1; texType <= AI_TEXTURE_TYPE_MAX; texType++ ){
+        _slotChannels[ texType ] = 0;
+        uint32_t matTexCount = aiGetMaterialTextureCount( material, texType );
+        if( matTexCount == 0 ){
+            continue;
+        }
+        if( matTexCount > 1 ){
+            return false;
+        }
+        struct aiString texPath;
+        unsigned int uvIndex = 0;
+        aiGetMaterialTexture( material, texType, 0, &texPath,
+                              NULL, &uvIndex, NULL, NULL, NULL, NULL );
+        char filePath[ sizeof( texPath.data ) * 2 ];
+        getTextureFilePath( &texPath, filePath, sizeof( filePath ) );
+        int x, y, c;
+        if( !stbi_info( filePath, &x, &y, &c ) ){
+            return false;
+        }
+        if( (uint32_t) x > bakeOptions.atlasMaxTextureSize || (uint32_t) y > bakeOptions.atlasMaxTextureSize ){
+            return false;
+        }
+        if( numTextures == 0 ){
+            *_width = x;
+            *_height = y;
+            *_uvIndex = uvIndex;
+        }else if( *_width != (uint32_t) x || *_height != (uint32_t) y || *_uvIndex != uvIndex ){
+            return false;
+        }
+        _slotChannels[ texType ] = c;
+        numTextures++;
+    }
+    if( numTextures == 0 || *_uvIndex >= AI_MAX_NUMBER_OF_TEXTURECOORDS ){
+        return false;
+    }
+
+    bool hasMesh = false;
+    for( uint32_t i = 0; i < _scene->mNumMeshes; i++ ){
+        const struct aiMesh *mesh = _scene->mMeshes[ i ];
+        if( mesh->mMaterialIndex != _materialIdx ){
+            continue;
+        }
+        hasMesh = true;
+        if( mesh->mNumUVComponents[ *_uvIndex ] < 2 ){
+            return false;
+        }
+        const struct aiVector3D *uvs = mesh->mTextureCoords[ *_uvIndex ];
+        for( uint32_t v = 0; v < mesh->mNumVertices; v++ ){
+            if( uvs[ v ].x < -ATLAS_UV_EPSILON || uvs[ v ].x > 1.0f + ATLAS_UV_EPSILON ||
+                uvs[ v ].y < -ATLAS_UV_EPSILON || uvs[ v ].y > 1.0f + ATLAS_UV_EPSILON ){
+                return false;
+            }
+        }
+    }
+    return hasMesh;
+}
+
+int buildAtlasPlan( const struct aiScene *_scene, AtlasPlan *_plan ){
+    uint32_t numMaterials = _scene->mNumMaterials;
+    *_plan = (AtlasPlan){ 0 };
+    _plan->materialAtlased = (bool*) calloc( numMaterials + 1, sizeof( bool ) );
+    _plan->materialUvIndex = (uint32_t*) calloc( numMaterials + 1, sizeof( uint32_t ) );
+    _plan->materialRects = (PomAtlasRect*) calloc( numMaterials + 1, sizeof( PomAtlasRect ) );
+    _plan->pageHeights = (uint32_t*) calloc( numMaterials + 1, sizeof( uint32_t ) );
+    uint32_t ( *materialSlotChannels )[ NUM_TEXTURE_SLOTS ] =
+        calloc( numMaterials + 1, sizeof( *materialSlotChannels ) );
+    PomAtlasRect *packRects = (PomAtlasRect*) calloc( numMaterials + 1, sizeof( PomAtlasRect ) );
+    if( !_plan->materialAtlased || !_plan->materialUvIndex || !_plan->materialRects ||
+        !_plan->pageHeights || !materialSlotChannels || !packRects ){
+        printf( "Failed to allocate atlas plan\n" );
+        goto planFailure;
+    }
+
+    uint32_t numAtlased = 0;
+    for( uint32_t i = 0; i < numMaterials; i++ ){
+        uint32_t width, height;
+        if( !isMaterialAtlasable( _scene, i, &width, &height, &_plan->materialUvIndex[ i ],
+                                  materialSlotChannels[ i ] ) ){
+            continue;
+        }
+        _plan->materialAtlased[ i ] = true;
+        _plan->materialRects[ i ].width = width;
+        _plan->materialRects[ i ].height = height;
+        packRects[ numAtlased++ ] = _plan->materialRects[ i ];
+    }
+
+    if( pomAtlasPack( packRects, numAtlased, bakeOptions.atlasPageSize, bakeOptions.atlasPadding,
+                      &_plan->numPages, _plan->pageHeights ) ){
+        printf( "Failed to pack texture atlas\n" );
+        goto planFailure;
+    }
+    _plan->pageSlotChannels = calloc( _plan->numPages + 1, sizeof( *_plan->pageSlotChannels ) );
+    if( !_plan->pageSlotChannels ){
+        printf( "Failed to allocate atlas page slots\n" );
+        goto planFailure;
+    }
+    uint32_t packIdx = 0;
+    for( uint32_t i = 0; i < numMaterials; i++ ){
+        if( !_plan->materialAtlased[ i ] ){
+            continue;
+        }
+        _plan->materialRects[ i ] = packRects[ packIdx++ ];
+        uint32_t page = _plan->materialRects[ i ].page;
+        for( uint32_t texType = 1; texType <= AI_TEXTURE_TYPE_MAX; texType++ ){
+            uint32_t *pageChannels = &_plan->pageSlotChannels[ page ][ texType ];
+            if( materialSlotChannels[ i ][ texType ] > *pageChannels ){
+                *pageChannels = materialSlotChannels[ i ][ texType ];
+            }
+        }
+    }
+    printf( "Atlased %u of %u materials into %u pages\n", numAtlased, numMaterials, _plan->numPages );
+
+    free( packRects );
+    free( materialSlotChannels );
+    return 0;
+
+planFailure:
+    free( packRects );
+    free( materialSlotChannels );
+    destroyAtlasPlan( _plan );
+    return 1;
+}
+
+void destroyAtlasPlan( AtlasPlan *_plan ){
+    free( _plan->materialAtlased );
+    free( _plan->materialUvIndex );
+    free( _plan->materialRects );
+    free( _plan->pageHeights );
+    free( _plan->pageSlotChannels );
+    *_plan = (AtlasPlan){ 0 };
+}
+
+// Move the atlased UV channel of a populated mesh into its material's atlas region
+void remapAtlasUvs( const struct aiMesh *_mesh, const PomModelMeshInfo *_meshInfo,
+                    uint8_t *_meshData ){
+    uint32_t materialIdx = _mesh->mMaterialIndex;
+    uint32_t uvIndex = atlasPlan.materialUvIndex[ materialIdx ];
+    const PomAtlasRect *rect = &atlasPlan.materialRects[ materialIdx ];
+    float pageWidth = (float) bakeOptions.atlasPageSize;
+    float pageHeight = (float) atlasPlan.pageHeights[ rect->page ];
+
+    // Float offset of the UV channel within a vertex
+    uint32_t uvFloatOffset = _meshInfo->hasTangentSpace ? 12 : 6;
+    for( uint32_t i = 0; i < uvIndex; i++ ){
+        uvFloatOffset += _mesh->mNumUVComponents[ i ];
+    }
+    uint32_t strideFloats = _meshInfo->dataStride / sizeof( float );
+    float *vertexData = (float*) ( _meshData + _meshInfo->numIndices * sizeof( uint32_t ) );
+    for( uint32_t v = 0; v < _meshInfo->numVertices; v++ ){
+        float *uv = &vertexData[ v * strideFloats + uvFloatOffset ];
+        uv[ 0 ] = ( (float) rect->x + uv[ 0 ] * (float) rect->width ) / pageWidth;
+        uv[ 1 ] = ( (float) rect->y + uv[ 1 ] * (float) rect->height ) / pageHeight;
+    }
+}
+
 // Recursive function for counting models + submodel IDs
 int _rec_getModelInfoSize( const struct aiNode *_node, uint32_t *_numChildren, uint32_t *_numSubmodelIds ){
     for( uint32_t i = 0; i < _node->mNumChildren; i++ ){
@@ -638,12 +1479,12 @@ int _rec_populateModelInfo( const struct aiNode *_node, PomModelInfo **_modelInf
     if( _node->mNumMeshes ){
         // Populate an info block ourselves
         PomModelInfo *ourModelInfo = *_modelInfo;
-        // TODO - proper submodel count (ie use our submodels instead of assimp meshes)
         ourModelInfo->numSubmodels = _node->mNumMeshes;
         ourModelInfo->submodelIdsOffset = *_submodelIdArray;
         for( uint32_t i = 0; i < _node->mNumMeshes; i++ ){
-            // TODO - proper submodel lookup here
-            **_submodelIdArray = i;
+            // The output mesh each of the node's meshes ended up in, which for a merged mesh
+            // is shared with others
+            ( *_submodelIdArray )[ i ] = mergePlan.outputMeshIds[ _node->mMeshes[ i ] ];
         }
         // Move the submodel ID array to the next free location
         *_submodelIdArray += _node->mNumMeshes;
@@ -682,3 +1523,467 @@ int populateModelInfo( const struct aiScene *_scene, PomModelInfo *_modelInfoBlo
     return _rec_populateModelInfo( _scene->mRootNode, &_modelInfoBlock, 
                                    &_submodelIdArray, _bytesWritten );
 }
+
+// Baked mesh data, with any atlas UV remapping and vertex welding applied.
+// Welding is done on the baked vertices rather than with assimp's
+// JoinIdenticalVertices so that it sees the final (remapped) attributes and
+// can weld to within an epsilon.
+int buildMeshData( const struct aiMesh *_mesh, PomModelMeshInfo *_meshInfo,
+                   uint8_t *_dataBlock, size_t *_bytesWritten ){
+    if( populateMeshData( _mesh, _meshInfo, _dataBlock, _bytesWritten ) ){
+        return 1;
+    }
+    if( atlasPlan.materialAtlased && atlasPlan.materialAtlased[ _mesh->mMaterialIndex ] ){
+        remapAtlasUvs( _mesh, _meshInfo, _dataBlock );
+    }
+    if( bakeOptions.weldEnabled && _meshInfo->numVertices ){
+        uint32_t *indices = (uint32_t*) _dataBlock;
+        float *vertices = (float*) &indices[ _meshInfo->numIndices ];
+        uint32_t numWeldedVertices;
+        if( pomMeshWeld( weldThreadpool, bakeOptions.weldEpsilon,
+                         indices, _meshInfo->numIndices, vertices, _meshInfo->numVertices,
+                         _meshInfo->dataStride / sizeof( float ), &numWeldedVertices ) ){
+            printf( "ERR: Failed to weld mesh vertices\n" );
+            return 1;
+        }
+        _meshInfo->numVertices = numWeldedVertices;
+        _meshInfo->dataSize = ( sizeof( uint32_t ) * _meshInfo->numIndices ) +
+                              ( (size_t) _meshInfo->dataStride * numWeldedVertices );
+        *_bytesWritten = _meshInfo->dataSize;
+    }
+    return 0;
+}
+
+// FNV-1a
+static uint64_t hashBytes( const uint8_t *_data, size_t _size ){
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for( size_t i = 0; i < _size; i++ ){
+        hash ^= _data[ i ];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// Find meshes whose baked data and material match an earlier mesh. Meshes are
+// looked up by hash, size and material, then the candidate is rebuilt and
+// compared in full, so only two meshes are ever resident. Only the first mesh
+// with a given key is kept as a candidate, so a mesh whose hash collides with
+// a different earlier one is left unshared.
+int findDuplicateMeshes( const struct aiScene *_scene, size_t _maxMeshSize,
+                         uint32_t *_sourceMeshIds, uint32_t *_numDuplicates ){
+    uint32_t numMeshes = _scene->mNumMeshes;
+    int err = 0;
+    uint32_t numDuplicates = 0;
+    PomMapCtx meshKeyMap;
+    if( pomMapInit( &meshKeyMap, 0 ) ){
+        printf( "Failed to create mesh dedup map\n" );
+        return 1;
+    }
+    uint8_t *meshData = (uint8_t*) malloc( _maxMeshSize + 1 );
+    uint8_t *candidateData = (uint8_t*) malloc( _maxMeshSize + 1 );
+    if( !meshData || !candidateData ){
+        printf( "Failed to allocate mesh dedup memory\n" );
+        err = 1;
+        goto dedupFailure;
+    }
+
+    for( uint32_t i = 0; i < numMeshes; i++ ){
+        const struct aiMesh *mesh = _scene->mMeshes[ i ];
+        PomModelMeshInfo meshInfo;
+        size_t meshSize;
+        if( buildMeshData( mesh, &meshInfo, meshData, &meshSize ) ){
+            err = 1;
+            goto dedupFailure;
+        }
+        _sourceMeshIds[ i ] = i;
+        char meshKey[ 64 ];
+        snprintf( meshKey, sizeof( meshKey ), "%016llx:%zx:%x",
+                  (unsigned long long) hashBytes( meshData, meshSize ), meshSize,
+                  mesh->mMaterialIndex );
+        const char *candidateIdStr = pomMapGet( &meshKeyMap, meshKey, NULL );
+        if( !candidateIdStr ){
+            char buff[ 16 ];
+            sprintf( buff, "%u", i );
+            pomMapSet( &meshKeyMap, meshKey, &buff[ 0 ] );
+            continue;
+        }
+
+        uint32_t candidateId = (uint32_t) atoi( candidateIdStr );
+        PomModelMeshInfo candidateInfo;
+        size_t candidateSize;
+        if( buildMeshData( _scene->mMeshes[ candidateId ], &candidateInfo, candidateData,
+                           &candidateSize ) ){
+            err = 1;
+            goto dedupFailure;
+        }
+        if( candidateInfo.dataStride == meshInfo.dataStride && candidateSize == meshSize &&
+            memcmp( candidateData, meshData, candidateSize ) == 0 ){
+            _sourceMeshIds[ i ] = candidateId;
+            numDuplicates++;
+        }
+    }
+    *_numDuplicates = numDuplicates;
+
+dedupFailure:
+    free( candidateData );
+    free( meshData );
+    pomMapClear( &meshKeyMap );
+    return err;
+}
+
+static void _rec_countInstances( const struct aiNode *_node, const uint32_t *_sourceMeshIds,
+                                 uint32_t *_instanceCounts ){
+    for( uint32_t i = 0; i < _node->mNumMeshes; i++ ){
+        _instanceCounts[ _sourceMeshIds[ _node->mMeshes[ i ] ] ]++;
+    }
+    for( uint32_t i = 0; i < _node->mNumChildren; i++ ){
+        _rec_countInstances( _node->mChildren[ i ], _sourceMeshIds, _instanceCounts );
+    }
+}
+
+// Placement counts per output mesh. Merged meshes are only ever made from
+// meshes placed once with an identity transform, so they have a single placement.
+static void countOutputInstances( const struct aiScene *_scene, const uint32_t *_sourceMeshIds,
+                                  const MeshMergePlan *_mergePlan, uint32_t *_sourceCounts,
+                                  uint32_t *_instanceCounts ){
+    _rec_countInstances( _scene->mRootNode, _sourceMeshIds, _sourceCounts );
+    for( uint32_t i = 0; i < _mergePlan->numGroups; i++ ){
+        const MeshGroup *group = &_mergePlan->groups[ i ];
+        uint32_t sourceMesh = _mergePlan->members[ group->firstMember ];
+        if( group->numMembers > 1 ){
+            _instanceCounts[ i ] = 1;
+        }else if( _sourceMeshIds[ sourceMesh ] == sourceMesh ){
+            _instanceCounts[ i ] = _sourceCounts[ sourceMesh ];
+        }
+    }
+}
+
+// Get the number of meshes placed in the scene, and the total number of placements
+int getInstanceInfoSize( const struct aiScene *_scene, const uint32_t *_sourceMeshIds,
+                         const MeshMergePlan *_mergePlan, uint32_t *_numInstanceInfos,
+                         uint32_t *_numTransforms ){
+    uint32_t *sourceCounts = (uint32_t*) calloc( _scene->mNumMeshes + 1, sizeof( uint32_t ) );
+    uint32_t *instanceCounts = (uint32_t*) calloc( _mergePlan->numGroups + 1, sizeof( uint32_t ) );
+    if( !sourceCounts || !instanceCounts ){
+        printf( "Failed to allocate instance counts\n" );
+        free( sourceCounts );
+        free( instanceCounts );
+        return 1;
+    }
+    countOutputInstances( _scene, _sourceMeshIds, _mergePlan, sourceCounts, instanceCounts );
+    *_numInstanceInfos = 0;
+    *_numTransforms = 0;
+    for( uint32_t i = 0; i < _mergePlan->numGroups; i++ ){
+        if( instanceCounts[ i ] ){
+            *_numInstanceInfos += 1;
+            *_numTransforms += instanceCounts[ i ];
+        }
+    }
+    free( instanceCounts );
+    free( sourceCounts );
+    return 0;
+}
+
+static void _rec_populateInstanceTransforms( const struct aiNode *_node, const struct aiMatrix4x4 *_parentTransform,
+                                             const uint32_t *_sourceMeshIds, const MeshMergePlan *_mergePlan,
+                                             float **_transformCursors ){
+    struct aiMatrix4x4 worldTransform = *_parentTransform;
+    aiMultiplyMatrix4( &worldTransform, &_node->mTransformation );
+    // assimp matrices are row-major, ours are column-major
+    const float columnMajor[ 16 ] = {
+        worldTransform.a1, worldTransform.b1, worldTransform.c1, worldTransform.d1,
+        worldTransform.a2, worldTransform.b2, worldTransform.c2, worldTransform.d2,
+        worldTransform.a3, worldTransform.b3, worldTransform.c3, worldTransform.d3,
+        worldTransform.a4, worldTransform.b4, worldTransform.c4, worldTransform.d4
+    };
+    for( uint32_t i = 0; i < _node->mNumMeshes; i++ ){
+        uint32_t outputMeshId = _mergePlan->outputMeshIds[ _sourceMeshIds[ _node->mMeshes[ i ] ] ];
+        if( _mergePlan->groups[ outputMeshId ].numMembers > 1 ){
+            // Merged, the (identity) placement is written once for the whole mesh
+            continue;
+        }
+        float **cursor = &_transformCursors[ outputMeshId ];
+        memcpy( *cursor, columnMajor, sizeof( columnMajor ) );
+        *cursor += 16;
+    }
+    for( uint32_t i = 0; i < _node->mNumChildren; i++ ){
+        _rec_populateInstanceTransforms( _node->mChildren[ i ], &worldTransform,
+                                         _sourceMeshIds, _mergePlan, _transformCursors );
+    }
+}
+
+int populateInstanceInfo( const struct aiScene *_scene, const uint32_t *_sourceMeshIds,
+                          const MeshMergePlan *_mergePlan, PomModelInstanceInfo *_instanceInfos,
+                          float *_transforms, size_t *_bytesWritten ){
+    uint32_t numMeshes = _mergePlan->numGroups;
+    uint32_t *sourceCounts = (uint32_t*) calloc( _scene->mNumMeshes + 1, sizeof( uint32_t ) );
+    uint32_t *instanceCounts = (uint32_t*) calloc( numMeshes + 1, sizeof( uint32_t ) );
+    float **transformCursors = (float**) calloc( numMeshes + 1, sizeof( float* ) );
+    if( !sourceCounts || !instanceCounts || !transformCursors ){
+        printf( "Failed to allocate instance working memory\n" );
+        free( sourceCounts );
+        free( instanceCounts );
+        free( transformCursors );
+        return 1;
+    }
+    countOutputInstances( _scene, _sourceMeshIds, _mergePlan, sourceCounts, instanceCounts );
+
+    // Lay out each mesh's transforms contiguously
+    uint32_t numInstanceInfos = 0;
+    float *nextTransform = _transforms;
+    for( uint32_t i = 0; i < numMeshes; i++ ){
+        if( !instanceCounts[ i ] ){
+            continue;
+        }
+        _instanceInfos[ numInstanceInfos++ ] = (PomModelInstanceInfo){
+            .meshId = i,
+            .numInstances = instanceCounts[ i ],
+            .transformsOffset = nextTransform
+        };
+        transformCursors[ i ] = nextTransform;
+        if( _mergePlan->groups[ i ].numMembers > 1 ){
+            const float identityTransform[ 16 ] = {
+                1.0f, 0.0f, 0.0f, 0.0f,
+                0.0f, 1.0f, 0.0f, 0.0f,
+                0.0f, 0.0f, 1.0f, 0.0f,
+                0.0f, 0.0f, 0.0f, 1.0f
+            };
+            memcpy( nextTransform, identityTransform, sizeof( identityTransform ) );
+        }
+        nextTransform += 16 * instanceCounts[ i ];
+    }
+
+    struct aiMatrix4x4 identity;
+    aiIdentityMatrix4( &identity );
+    _rec_populateInstanceTransforms( _scene->mRootNode, &identity, _sourceMeshIds,
+                                     _mergePlan, transformCursors );
+
+    *_bytesWritten = ( sizeof( PomModelInstanceInfo ) * numInstanceInfos ) +
+                     ( sizeof( float ) * ( nextTransform - _transforms ) );
+    free( transformCursors );
+    free( instanceCounts );
+    free( sourceCounts );
+    return 0;
+}
+
+static bool isIdentityTransform( const struct aiMatrix4x4 *_transform ){
+    const float *elements = &_transform->a1;
+    for( uint32_t i = 0; i < 16; i++ ){
+        float expected = ( i % 5 == 0 ) ? 1.0f : 0.0f;
+        if( fabsf( elements[ i ] - expected ) > 1e-6f ){
+            return false;
+        }
+    }
+    return true;
+}
+
+static void _rec_findTransformedMeshes( const struct aiNode *_node, const struct aiMatrix4x4 *_parentTransform,
+                                        bool *_transformed ){
+    struct aiMatrix4x4 worldTransform = *_parentTransform;
+    aiMultiplyMatrix4( &worldTransform, &_node->mTransformation );
+    bool isIdentity = isIdentityTransform( &worldTransform );
+    for( uint32_t i = 0; i < _node->mNumMeshes; i++ ){
+        _transformed[ _node->mMeshes[ i ] ] |= !isIdentity;
+    }
+    for( uint32_t i = 0; i < _node->mNumChildren; i++ ){
+        _rec_findTransformedMeshes( _node->mChildren[ i ], &worldTransform, _transformed );
+    }
+}
+
+// Whether two meshes would bake to the same material and vertex layout
+static bool canMergeMeshes( const struct aiMesh *_a, const struct aiMesh *_b ){
+    if( _a->mMaterialIndex != _b->mMaterialIndex ){
+        return false;
+    }
+    bool aHasTangentSpace = ( _a->mBitangents ) && ( _a->mTangents );
+    bool bHasTangentSpace = ( _b->mBitangents ) && ( _b->mTangents );
+    if( aHasTangentSpace != bHasTangentSpace ){
+        return false;
+    }
+    for( uint32_t uvIdx = 0; uvIdx < AI_MAX_NUMBER_OF_TEXTURECOORDS; uvIdx++ ){
+        if( _a->mNumUVComponents[ uvIdx ] != _b->mNumUVComponents[ uvIdx ] ){
+            return false;
+        }
+    }
+    return true;
+}
+
+// Group static meshes by material and vertex layout. Without instancing the
+// graph is flattened, so every mesh is static. With instancing, only meshes
+// placed once with an identity transform are, since anything else needs its
+// own transform(s).
+int buildMeshMergePlan( const struct aiScene *_scene, const uint32_t *_sourceMeshIds,
+                        MeshMergePlan *_plan ){
+    uint32_t numMeshes = _scene->mNumMeshes;
+    int err = 0;
+    *_plan = (MeshMergePlan){ 0 };
+    _plan->groups = (MeshGroup*) calloc( numMeshes + 1, sizeof( MeshGroup ) );
+    _plan->members = (uint32_t*) calloc( numMeshes + 1, sizeof( uint32_t ) );
+    _plan->outputMeshIds = (uint32_t*) calloc( numMeshes + 1, sizeof( uint32_t ) );
+    bool *isStatic = (bool*) calloc( numMeshes + 1, sizeof( bool ) );
+    bool *assigned = (bool*) calloc( numMeshes + 1, sizeof( bool ) );
+    uint32_t *placementCounts = (uint32_t*) calloc( numMeshes + 1, sizeof( uint32_t ) );
+    bool *excluded = (bool*) calloc( numMeshes + 1, sizeof( bool ) );
+    if( !_plan->groups || !_plan->members || !_plan->outputMeshIds ||
+        !isStatic || !assigned || !placementCounts || !excluded ){
+        printf( "Failed to allocate mesh merge plan\n" );
+        err = 1;
+        goto planFailure;
+    }
+
+    if( bakeOptions.mergeEnabled ){
+        if( bakeOptions.instancingEnabled ){
+            struct aiMatrix4x4 identity;
+            aiIdentityMatrix4( &identity );
+            _rec_countInstances( _scene->mRootNode, _sourceMeshIds, placementCounts );
+            _rec_findTransformedMeshes( _scene->mRootNode, &identity, excluded );
+            // Meshes with duplicates share their data, so can't be merged either
+            for( uint32_t i = 0; i < numMeshes; i++ ){
+                excluded[ _sourceMeshIds[ i ] ] |= ( _sourceMeshIds[ i ] != i );
+            }
+        }
+        for( uint32_t i = 0; i < numMeshes; i++ ){
+            isStatic[ i ] = !bakeOptions.instancingEnabled ||
+                            ( _sourceMeshIds[ i ] == i && placementCounts[ i ] == 1 && !excluded[ i ] );
+        }
+    }
+
+    uint32_t numMembers = 0;
+    for( uint32_t i = 0; i < numMeshes; i++ ){
+        if( assigned[ i ] ){
+            continue;
+        }
+        uint32_t groupId = _plan->numGroups++;
+        MeshGroup *group = &_plan->groups[ groupId ];
+        group->firstMember = numMembers;
+        group->numMembers = 0;
+        for( uint32_t j = i; j < numMeshes; j++ ){
+            if( assigned[ j ] || ( j != i && !( isStatic[ i ] && isStatic[ j ] &&
+                                   canMergeMeshes( _scene->mMeshes[ i ], _scene->mMeshes[ j ] ) ) ) ){
+                continue;
+            }
+            assigned[ j ] = true;
+            _plan->members[ numMembers++ ] = j;
+            _plan->outputMeshIds[ j ] = groupId;
+            group->numMembers++;
+        }
+        if( group->numMembers > 1 ){
+            group->firstSubmodel = _plan->numSubmodels;
+            _plan->numSubmodels += group->numMembers;
+        }
+    }
+
+planFailure:
+    free( excluded );
+    free( placementCounts );
+    free( assigned );
+    free( isStatic );
+    if( err ){
+        destroyMeshMergePlan( _plan );
+    }
+    return err;
+}
+
+void destroyMeshMergePlan( MeshMergePlan *_plan ){
+    free( _plan->outputMeshIds );
+    free( _plan->members );
+    free( _plan->groups );
+    *_plan = (MeshMergePlan){ 0 };
+}
+
+// Write a merged mesh as all members' indices (rebased onto the merged
+// vertices) followed by all members' vertices, matching the single mesh layout.
+// Members are built one at a time, twice, so only one is ever resident.
+int streamMergedMesh( const struct aiScene *_scene, const MeshGroup *_group,
+                      uint32_t _meshId, PomModelStreamWriter *_writer, uint8_t *_scratchBlock,
+                      PomModelMeshInfo *_meshInfo, PomSubmodelInfo *_submodelInfos,
+                      uint8_t **_submodelIndexOffsets, uint8_t **_submodelVertexOffsets,
+                      uint8_t **_meshDataOffset, PomMeshStats *_meshStats,
+                      size_t *_bytesWritten ){
+    uint32_t numIndices = 0, numVertices = 0;
+    size_t bytesWritten = 0;
+    PomModelMeshInfo memberInfo;
+    for( uint32_t i = 0; i < _group->numMembers; i++ ){
+        uint32_t meshId = mergePlan.members[ _group->firstMember + i ];
+        const struct aiMesh *mesh = _scene->mMeshes[ meshId ];
+        size_t memberSize;
+        if( buildMeshData( mesh, &memberInfo, _scratchBlock, &memberSize ) ){
+            return 1;
+        }
+        uint32_t *indices = (uint32_t*) _scratchBlock;
+        for( uint32_t idx = 0; idx < memberInfo.numIndices; idx++ ){
+            indices[ idx ] += numVertices;
+        }
+        size_t indexBytes = sizeof( uint32_t ) * memberInfo.numIndices;
+        if( pomModelStreamWrite( _writer, _scratchBlock, indexBytes, &_submodelIndexOffsets[ i ] ) ){
+            return 1;
+        }
+        if( i == 0 ){
+            *_meshDataOffset = _submodelIndexOffsets[ i ];
+            *_meshInfo = memberInfo;
+        }
+        _submodelInfos[ i ] = (PomSubmodelInfo){
+            .submodelId = _group->firstSubmodel + i,
+            .nameOffset = NULL,
+            .materialId = mesh->mMaterialIndex,
+            .dataSize = memberSize - indexBytes,
+            .dataOffset = NULL,
+            .numIndices = memberInfo.numIndices,
+            .indexOffset = NULL,
+            .meshId = _meshId,
+            .firstIndex = numIndices,
+            .vertexOffset = numVertices,
+            .numVertices = memberInfo.numVertices
+        };
+        numIndices += memberInfo.numIndices;
+        numVertices += memberInfo.numVertices;
+        bytesWritten += indexBytes;
+    }
+
+    for( uint32_t i = 0; i < _group->numMembers; i++ ){
+        uint32_t meshId = mergePlan.members[ _group->firstMember + i ];
+        const struct aiMesh *mesh = _scene->mMeshes[ meshId ];
+        size_t memberSize;
+        if( buildMeshData( mesh, &memberInfo, _scratchBlock, &memberSize ) ){
+            return 1;
+        }
+        size_t indexBytes = sizeof( uint32_t ) * memberInfo.numIndices;
+        PomSubmodelInfo *submodelInfo = &_submodelInfos[ i ];
+        // Positions lead each vertex
+        const float *vertices = (const float*) ( _scratchBlock + indexBytes );
+        uint32_t strideFloats = memberInfo.dataStride / sizeof( float );
+        for( uint32_t axis = 0; axis < 3; axis++ ){
+            submodelInfo->boundsMin[ axis ] = memberInfo.numVertices ? vertices[ axis ] : 0.0f;
+            submodelInfo->boundsMax[ axis ] = submodelInfo->boundsMin[ axis ];
+        }
+        for( uint32_t v = 1; v < memberInfo.numVertices; v++ ){
+            const float *position = &vertices[ v * strideFloats ];
+            for( uint32_t axis = 0; axis < 3; axis++ ){
+                submodelInfo->boundsMin[ axis ] = fminf( submodelInfo->boundsMin[ axis ], position[ axis ] );
+                submodelInfo->boundsMax[ axis ] = fmaxf( submodelInfo->boundsMax[ axis ], position[ axis ] );
+            }
+        }
+        if( _meshStats &&
+            pomMeshStatsAnalyse( (const uint32_t*) _scratchBlock, memberInfo.numIndices, vertices,
+                                 memberInfo.numVertices, strideFloats, _meshStats ) ){
+            return 1;
+        }
+        if( pomModelStreamWrite( _writer, _scratchBlock + indexBytes, memberSize - indexBytes,
+                                 &_submodelVertexOffsets[ i ] ) ){
+            return 1;
+        }
+        bytesWritten += memberSize - indexBytes;
+    }
+
+    _meshInfo->meshId = _meshId;
+    _meshInfo->sourceMeshId = _meshId;
+    _meshInfo->nameOffset = NULL;
+    _meshInfo->numIndices = numIndices;
+    _meshInfo->numVertices = numVertices;
+    _meshInfo->dataBlockOffset = NULL;
+    _meshInfo->dataSize = bytesWritten;
+    _meshInfo->firstSubmodel = _group->firstSubmodel;
+    _meshInfo->numSubmodels = _group->numMembers;
+    *_bytesWritten = bytesWritten;
+    return 0;
+}
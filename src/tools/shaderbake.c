@@ -2,80 +2,625 @@
 
 #include "common.h"
 #include "pomShaderFormat.h"
+#include "pomProgramFormat.h"
 #include <shaderc/shaderc.h>
 #include <string.h>
-#include "cmore/linkedlist.h"
-#include "cmore/pstring.h"
+#include "spirvreflect.h"
 #include <stdlib.h>
 #include <limits.h>
+#include <threads.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
 
 #define LOG( lvl, log, ... ) LOG_MODULE( lvl, ShaderBake, log, ##__VA_ARGS__ )
 
+// Bump when anything affecting the compiled output changes, so stale cache
+// entries are never picked up
+#define SHADER_CACHE_KEY_VERSION "shaderbake-2"
+#define SPIRV_MAGIC_NUMBER 0x07230203
+#define MAX_INCLUDE_DEPTH 16
+#define MAX_BAKE_THREADS 64
+#define MAX_VARIANT_AXES 8
+#define MAX_VARIANT_VALUES 8
+// Every combination of axis values is compiled, so keep an eye on the total
+#define MAX_SHADER_VARIANTS 64
+
+typedef struct ShaderBakeJob ShaderBakeJob;
+typedef struct ShaderBakeBatch ShaderBakeBatch;
+typedef struct ShaderInclude ShaderInclude;
+typedef struct ShaderVariantAxis ShaderVariantAxis;
+
+struct ShaderBakeJob{
+    const char *shaderPath;
+    char *outputPath;
+    int result;
+};
+
+// Jobs are handed out through nextJob, so each worker just takes the next one
+// until they run out
+struct ShaderBakeBatch{
+    ShaderBakeJob *jobs;
+    uint32_t numJobs;
+    atomic_uint nextJob;
+    const char *cacheDir;
+};
+
+// Declared in the source as `// POM_VARIANT <MACRO> <VALUE> <VALUE>...`
+struct ShaderVariantAxis{
+    char name[ 64 ];
+    uint32_t numValues;
+    char values[ MAX_VARIANT_VALUES ][ 32 ];
+};
+
+struct ShaderInclude{
+    shaderc_include_result result;
+    char *path;
+    char *content;
+};
+
 static char* loadFile( const char *_path, size_t *_sourceLength );
-static uint32_t *compileShader( const char *_shaderSrc, size_t _shaderSourceLength,
-                                const char *_sourceName,
-                                size_t *_shaderBlobSizeBytes );
-static int parseShaderInterface( char *_shaderSource, size_t _sourceLength,
-                                 PomShaderFormat *_format );
+static uint32_t *compileShader( shaderc_compiler_t _compiler, const char *_shaderSrc,
+                                size_t _shaderSourceLength, const char *_sourceName,
+                                const char *_defines, size_t *_shaderBlobSizeBytes );
 // Take the scattered data we've dynamically allocated and turn it into a nice contiguous block.
-// Returns number of bytes in the block on success, 0 on failure
+// Returns number of bytes in the block on success, 0 on failure, leaving _format as it was
 static size_t contiguifyData( PomShaderFormat *_format );
-
+static int bakeShader( shaderc_compiler_t _compiler, const char *_shaderPath,
+                       const char *_outputPath, const char *_cacheDir );
+static int bakeWorker( void *_args );
+static int linkProgram( const char *_outputPath, char **_stagePaths, uint32_t _numStages );
+
+static void printUsage( void ){
+    LOG( ERR, "Usage: shaderbake [options] <shader glsl path> <blob output path>\n"
+              "       shaderbake [options] --batch <output dir> <shader glsl path>...\n"
+              "       shaderbake --link <program output path> <shader blob path>...\n"
+              "Batch mode writes each shader to <output dir>/<shader file name>.psf\n"
+              "Link mode bundles already baked stages into one program, with their vertex\n"
+              "input and descriptor layouts merged ahead of time\n"
+              "Every combination of the `// POM_VARIANT <MACRO> <VALUE>...` axes a shader\n"
+              "declares is compiled into its blob\n"
+              "Options:\n"
+              "  --cache=<dir>  Reuse SPIR-V compiled by earlier runs, keyed on the source,\n"
+              "                 its includes and the compile options\n"
+              "  --jobs=<n>     Number of shaders compiled at once in batch mode (default 4)" );
+}
 
 int main( int argc, char * argv[] ){
     int toRet = 0;
-    if( argc != 3 ){
-        LOG( ERR, "Usage: shaderbake <shader glsl path> <blob output path>" );
-        toRet = 1;
-        goto initialisationError;
+    const char *cacheDir = NULL;
+    uint32_t numThreads = 4;
+    bool batchMode = false;
+    bool linkMode = false;
+    int argIdx = 1;
+    for( ; argIdx < argc && strncmp( argv[ argIdx ], "--", 2 ) == 0; argIdx++ ){
+        const char *arg = argv[ argIdx ];
+        if( strcmp( arg, "--batch" ) == 0 ){
+            batchMode = true;
+        }else if( strcmp( arg, "--link" ) == 0 ){
+            linkMode = true;
+        }else if( strncmp( arg, "--cache=", strlen( "--cache=" ) ) == 0 ){
+            cacheDir = arg + strlen( "--cache=" );
+        }else if( sscanf( arg, "--jobs=%u", &numThreads ) == 1 ){
+            continue;
+        }else{
+            LOG( ERR, "Unknown option %s", arg );
+            printUsage();
+            return 1;
+        }
+    }
+    int numPaths = argc - argIdx;
+    if( linkMode ){
+        if( batchMode || numPaths < 2 ){
+            printUsage();
+            return 1;
+        }
+        return linkProgram( argv[ argIdx ], &argv[ argIdx + 1 ], numPaths - 1 );
+    }
+    if( ( !batchMode && numPaths != 2 ) || ( batchMode && numPaths < 2 ) ){
+        printUsage();
+        return 1;
+    }
+    if( cacheDir && mkdir( cacheDir, 0755 ) && errno != EEXIST ){
+        LOG( WARN, "Failed to create shader cache directory %s, compiling without cache", cacheDir );
+        cacheDir = NULL;
     }
-    char *shaderPath = argv[ 1 ];
-    const char *outputPath = argv[ 2 ];
-    LOG( INFO, "Baking shader %s", shaderPath );
+
+    if( !batchMode ){
+        shaderc_compiler_t compiler = shaderc_compiler_initialize();
+        if( !compiler ){
+            LOG( ERR, "Failed to create shader compiler" );
+            return 1;
+        }
+        toRet = bakeShader( compiler, argv[ argIdx ], argv[ argIdx + 1 ], cacheDir );
+        shaderc_compiler_release( compiler );
+        return toRet;
+    }
+
+    const char *outputDir = argv[ argIdx ];
+    ShaderBakeBatch batch = {
+        .jobs = (ShaderBakeJob*) calloc( numPaths, sizeof( ShaderBakeJob ) ),
+        .numJobs = 0,
+        .cacheDir = cacheDir
+    };
+    atomic_init( &batch.nextJob, 0 );
+    if( !batch.jobs ){
+        LOG( ERR, "Failed to allocate shader batch" );
+        return 1;
+    }
+    for( int i = argIdx + 1; i < argc; i++ ){
+        const char *shaderPath = argv[ i ];
+        const char *fileName = strrchr( shaderPath, '/' );
+        fileName = fileName ? fileName + 1 : shaderPath;
+        size_t outputPathSize = strlen( outputDir ) + strlen( fileName ) + sizeof( "/.psf" );
+        ShaderBakeJob *job = &batch.jobs[ batch.numJobs++ ];
+        job->shaderPath = shaderPath;
+        job->outputPath = (char*) malloc( outputPathSize );
+        job->result = 1;
+        if( !job->outputPath ){
+            LOG( ERR, "Failed to allocate shader output path" );
+            toRet = 1;
+            goto batchCleanup;
+        }
+        snprintf( job->outputPath, outputPathSize, "%s/%s.psf", outputDir, fileName );
+    }
+
+    // Each worker has its own compiler, since a shaderc compiler isn't safe to share
+    if( numThreads > batch.numJobs ){
+        numThreads = batch.numJobs;
+    }
+    if( numThreads > MAX_BAKE_THREADS ){
+        numThreads = MAX_BAKE_THREADS;
+    }
+    if( numThreads == 0 ){
+        numThreads = 1;
+    }
+    thrd_t threads[ MAX_BAKE_THREADS ];
+    uint32_t numStarted = 0;
+    for( ; numStarted < numThreads - 1; numStarted++ ){
+        if( thrd_create( &threads[ numStarted ], bakeWorker, &batch ) != thrd_success ){
+            LOG( WARN, "Failed to start shader bake thread, continuing with %u", numStarted + 1 );
+            break;
+        }
+    }
+    // The main thread does its share too
+    bakeWorker( &batch );
+    for( uint32_t i = 0; i < numStarted; i++ ){
+        thrd_join( threads[ i ], NULL );
+    }
+
+    uint32_t numFailed = 0;
+    for( uint32_t i = 0; i < batch.numJobs; i++ ){
+        if( batch.jobs[ i ].result ){
+            LOG( ERR, "Failed to bake shader %s", batch.jobs[ i ].shaderPath );
+            numFailed++;
+        }
+    }
+    LOG( INFO, "Baked %u of %u shaders", batch.numJobs - numFailed, batch.numJobs );
+    toRet = numFailed ? 1 : 0;
+
+batchCleanup:
+    for( uint32_t i = 0; i < batch.numJobs; i++ ){
+        free( batch.jobs[ i ].outputPath );
+    }
+    free( batch.jobs );
+    return toRet;
+}
+
+int linkProgram( const char *_outputPath, char **_stagePaths, uint32_t _numStages ){
+    if( _numStages > POM_PROGRAM_MAX_STAGES ){
+        LOG( ERR, "Programs can have at most %u stages", POM_PROGRAM_MAX_STAGES );
+        return 1;
+    }
+    PomShaderFormat *stageFormats[ POM_PROGRAM_MAX_STAGES ] = { NULL };
+    int toRet = 1;
+    for( uint32_t i = 0; i < _numStages; i++ ){
+        if( !pomShaderFormatLoad( _stagePaths[ i ], &stageFormats[ i ] ) ){
+            LOG( ERR, "Failed to load shader blob %s", _stagePaths[ i ] );
+            goto linkCleanup;
+        }
+    }
+    PomProgramFormat *program;
+    size_t programSize = pomProgramFormatBuild( stageFormats, _numStages, &program );
+    if( !programSize ){
+        LOG( ERR, "Failed to link program %s", _outputPath );
+        goto linkCleanup;
+    }
+    if( pomProgramFormatWrite( _outputPath, program ) != programSize ){
+        LOG( ERR, "Failed to write program %s", _outputPath );
+    }else{
+        LOG( INFO, "Linked %u stages into %s (%lu bytes)", _numStages, _outputPath, programSize );
+        toRet = 0;
+    }
+    free( program );
+
+linkCleanup:
+    for( uint32_t i = 0; i < _numStages; i++ ){
+        free( stageFormats[ i ] );
+    }
+    return toRet;
+}
+
+int bakeWorker( void *_args ){
+    ShaderBakeBatch *batch = (ShaderBakeBatch*) _args;
+    shaderc_compiler_t compiler = shaderc_compiler_initialize();
+    if( !compiler ){
+        LOG( ERR, "Failed to create shader compiler" );
+        return 1;
+    }
+    uint32_t jobIdx;
+    while( ( jobIdx = atomic_fetch_add( &batch->nextJob, 1 ) ) < batch->numJobs ){
+        ShaderBakeJob *job = &batch->jobs[ jobIdx ];
+        job->result = bakeShader( compiler, job->shaderPath, job->outputPath, batch->cacheDir );
+    }
+    shaderc_compiler_release( compiler );
+    return 0;
+}
+
+// FNV-1a, continuing from _hash
+static uint64_t hashBytes( uint64_t _hash, const void *_data, size_t _size ){
+    const uint8_t *data = (const uint8_t*) _data;
+    for( size_t i = 0; i < _size; i++ ){
+        _hash ^= data[ i ];
+        _hash *= 0x100000001B3ULL;
+    }
+    return _hash;
+}
+
+// Includes are resolved relative to the including file
+static char *getIncludePath( const char *_requestingSource, const char *_requestedSource,
+                             size_t _requestedLength ){
+    const char *dirEnd = strrchr( _requestingSource, '/' );
+    size_t dirLength = dirEnd ? (size_t) ( dirEnd - _requestingSource ) + 1 : 0;
+    char *path = (char*) malloc( dirLength + _requestedLength + 1 );
+    if( !path ){
+        return NULL;
+    }
+    memcpy( path, _requestingSource, dirLength );
+    memcpy( path + dirLength, _requestedSource, _requestedLength );
+    path[ dirLength + _requestedLength ] = '\0';
+    return path;
+}
+
+// Hash the contents of every file _source includes, recursively. Done on the
+// raw text so the cache key is known before anything is compiled.
+static uint64_t _rec_hashIncludes( uint64_t _hash, const char *_sourcePath, const char *_source,
+                                   uint32_t _depth ){
+    if( _depth > MAX_INCLUDE_DEPTH ){
+        return _hash;
+    }
+    const char *line = _source;
+    while( line && *line ){
+        const char *directive = line + strspn( line, " \t" );
+        if( strncmp( directive, "#include", strlen( "#include" ) ) == 0 ){
+            const char *nameStart = directive + strlen( "#include" );
+            nameStart += strspn( nameStart, " \t" );
+            char closing = ( *nameStart == '<' ) ? '>' : '"';
+            const char *nameEnd = ( *nameStart == '<' || *nameStart == '"' ) ?
+                                  strchr( nameStart + 1, closing ) : NULL;
+            const char *lineEnd = strchr( nameStart, '\n' );
+            if( nameEnd && ( !lineEnd || nameEnd < lineEnd ) ){
+                size_t nameLength = nameEnd - ( nameStart + 1 );
+                _hash = hashBytes( _hash, nameStart + 1, nameLength );
+                char *includePath = getIncludePath( _sourcePath, nameStart + 1, nameLength );
+                size_t includeLength;
+                char *includeSource = includePath ? loadFile( includePath, &includeLength ) : NULL;
+                if( includeSource ){
+                    _hash = hashBytes( _hash, includeSource, includeLength );
+                    _hash = _rec_hashIncludes( _hash, includePath, includeSource, _depth + 1 );
+                }
+                free( includeSource );
+                free( includePath );
+            }
+        }
+        line = strchr( line, '\n' );
+        line = line ? line + 1 : NULL;
+    }
+    return _hash;
+}
+
+static uint64_t getShaderCacheKey( const char *_shaderPath, const char *_shaderSrc,
+                                   size_t _shaderSourceLength ){
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    hash = hashBytes( hash, SHADER_CACHE_KEY_VERSION, strlen( SHADER_CACHE_KEY_VERSION ) );
+    hash = hashBytes( hash, _shaderSrc, _shaderSourceLength );
+    return _rec_hashIncludes( hash, _shaderPath, _shaderSrc, 0 );
+}
+
+// Returns the cached SPIR-V, or NULL if there's no valid cache entry
+static uint32_t *loadCachedShader( const char *_cacheDir, uint64_t _key, size_t *_sizeBytes ){
+    char cachePath[ PATH_MAX ];
+    snprintf( cachePath, sizeof( cachePath ), "%s/%016lx.spv", _cacheDir, (unsigned long) _key );
+    FILE *cacheFile = fopen( cachePath, "rb" );
+    if( !cacheFile ){
+        return NULL;
+    }
+    fseek( cacheFile, 0, SEEK_END );
+    long fileSize = ftell( cacheFile );
+    fseek( cacheFile, 0, SEEK_SET );
+    uint32_t *bytecode = NULL;
+    if( fileSize >= (long) sizeof( uint32_t ) && fileSize % sizeof( uint32_t ) == 0 ){
+        bytecode = (uint32_t*) malloc( fileSize );
+    }
+    if( bytecode && ( fread( bytecode, 1, fileSize, cacheFile ) != (size_t) fileSize ||
+                      bytecode[ 0 ] != SPIRV_MAGIC_NUMBER ) ){
+        LOG( WARN, "Ignoring invalid shader cache entry %s", cachePath );
+        free( bytecode );
+        bytecode = NULL;
+    }
+    fclose( cacheFile );
+    *_sizeBytes = (size_t) fileSize;
+    return bytecode;
+}
+
+// Written to a temporary file first and renamed into place, so concurrent
+// bakes never see a partial entry
+static void storeCachedShader( const char *_cacheDir, uint64_t _key, const uint32_t *_bytecode,
+                               size_t _sizeBytes ){
+    char cachePath[ PATH_MAX ];
+    char tempPath[ PATH_MAX ];
+    snprintf( cachePath, sizeof( cachePath ), "%s/%016lx.spv", _cacheDir, (unsigned long) _key );
+    snprintf( tempPath, sizeof( tempPath ), "%s.%ld.%p.tmp", cachePath, (long) getpid(), (void*) _bytecode );
+    FILE *tempFile = fopen( tempPath, "wb" );
+    if( !tempFile ){
+        LOG( WARN, "Failed to create shader cache entry %s", tempPath );
+        return;
+    }
+    size_t written = fwrite( _bytecode, 1, _sizeBytes, tempFile );
+    if( fclose( tempFile ) || written != _sizeBytes || rename( tempPath, cachePath ) ){
+        LOG( WARN, "Failed to write shader cache entry %s", cachePath );
+        remove( tempPath );
+    }
+}
+
+// Parameters of the line's variant declaration, or NULL if it has none. The declaration
+// has to open a // comment, so the name can't be picked up from code or other comments
+static const char *findVariantDeclaration( const char *_line, size_t _lineLength ){
+    const char *lineEnd = _line + _lineLength;
+    const char *comment = strstr( _line, "//" );
+    if( !comment || comment >= lineEnd ){
+        return NULL;
+    }
+    const char *keyword = comment + 2;
+    keyword += strspn( keyword, " \t" );
+    const size_t keywordLength = strlen( "POM_VARIANT" );
+    if( (size_t) ( lineEnd - keyword ) < keywordLength ||
+        strncmp( keyword, "POM_VARIANT", keywordLength ) ){
+        return NULL;
+    }
+    const char *params = keyword + keywordLength;
+    if( params != lineEnd && *params != ' ' && *params != '\t' ){
+        // Some longer name
+        return NULL;
+    }
+    return params;
+}
+
+// Collect the POM_VARIANT axes declared in the source.
+// Returns 0 on success, 1 if a declaration is mangled or there are too many variants
+static int parseVariantAxes( const char *_shaderSrc, ShaderVariantAxis *_axes, uint32_t *_numAxes,
+                             uint32_t *_numVariants ){
+    *_numAxes = 0;
+    *_numVariants = 1;
+    const char *line = _shaderSrc;
+    while( line && *line ){
+        size_t lineLength = strcspn( line, "\r\n" );
+        const char *param = findVariantDeclaration( line, lineLength );
+        if( param ){
+            if( *_numAxes == MAX_VARIANT_AXES ){
+                LOG( ERR, "Too many variant axes, at most %u are supported", MAX_VARIANT_AXES );
+                return 1;
+            }
+            ShaderVariantAxis *axis = &_axes[ *_numAxes ];
+            axis->numValues = 0;
+            const char *lineEnd = line + lineLength;
+            // First parameter is the macro name, the rest are its values
+            int paramIdx = 0;
+            for( ;; paramIdx++ ){
+                param += strspn( param, " \t" );
+                if( param >= lineEnd ){
+                    break;
+                }
+                size_t paramLength = strcspn( param, " \t\r\n" );
+                if( paramIdx == 0 ){
+                    if( paramLength >= sizeof( axis->name ) ){
+                        LOG( ERR, "Variant macro name too long" );
+                        return 1;
+                    }
+                    memcpy( axis->name, param, paramLength );
+                    axis->name[ paramLength ] = '\0';
+                }else{
+                    if( axis->numValues == MAX_VARIANT_VALUES ||
+                        paramLength >= sizeof( axis->values[ 0 ] ) ){
+                        LOG( ERR, "Too many or too long values for variant %s", axis->name );
+                        return 1;
+                    }
+                    char *value = axis->values[ axis->numValues++ ];
+                    memcpy( value, param, paramLength );
+                    value[ paramLength ] = '\0';
+                }
+                param += paramLength;
+            }
+            if( axis->numValues == 0 ){
+                LOG( ERR, "Mangled variant declaration, need a macro name and at least one value" );
+                return 1;
+            }
+            *_numVariants *= axis->numValues;
+            if( *_numVariants > MAX_SHADER_VARIANTS ){
+                LOG( ERR, "Shader declares more than %u variants", MAX_SHADER_VARIANTS );
+                return 1;
+            }
+            ( *_numAxes )++;
+        }
+        line = strchr( line, '\n' );
+        line = line ? line + 1 : NULL;
+    }
+    return 0;
+}
+
+// Build the `NAME=VALUE` definitions for a variant. The last axis varies
+// fastest, so variant 0 has every axis at its first value.
+// Returns a newly allocated string, or NULL on failure
+static char *getVariantDefines( const ShaderVariantAxis *_axes, uint32_t _numAxes,
+                                uint32_t _variantIdx ){
+    size_t definesSize = 1;
+    for( uint32_t i = 0; i < _numAxes; i++ ){
+        definesSize += sizeof( _axes[ i ].name ) + sizeof( _axes[ i ].values[ 0 ] ) + 1;
+    }
+    char *defines = (char*) calloc( definesSize, sizeof( char ) );
+    if( !defines ){
+        return NULL;
+    }
+    uint32_t valueIndices[ MAX_VARIANT_AXES ];
+    for( uint32_t i = _numAxes; i-- > 0; ){
+        valueIndices[ i ] = _variantIdx % _axes[ i ].numValues;
+        _variantIdx /= _axes[ i ].numValues;
+    }
+    size_t definesLength = 0;
+    for( uint32_t i = 0; i < _numAxes; i++ ){
+        definesLength += snprintf( defines + definesLength, definesSize - definesLength, "%s%s=%s",
+                                   i ? " " : "", _axes[ i ].name,
+                                   _axes[ i ].values[ valueIndices[ i ] ] );
+    }
+    return defines;
+}
+
+static void freeVariants( PomShaderVariantInfo *_variants, uint32_t _numVariants ){
+    if( !_variants ){
+        return;
+    }
+    for( uint32_t i = 0; i < _numVariants; i++ ){
+        free( _variants[ i ].definesOffset );
+        free( _variants[ i ].shaderBytecodeOffset );
+    }
+    free( _variants );
+}
+
+static void freeInterface( PomShaderFormat *_format ){
+    for( uint32_t i = 0; i < _format->numAttributeInfo; i++ ){
+        free( _format->attributeInfoOffset[ i ].nameOffset );
+    }
+    for( uint32_t i = 0; i < _format->numDescriptorInfo; i++ ){
+        free( _format->descriptorInfoOffset[ i ].nameOffset );
+    }
+    for( uint32_t i = 0; i < _format->numPushConstantInfo; i++ ){
+        free( _format->pushConstantInfoOffset[ i ].nameOffset );
+    }
+    free( _format->attributeInfoOffset );
+    free( _format->descriptorInfoOffset );
+    free( _format->pushConstantInfoOffset );
+}
+
+int bakeShader( shaderc_compiler_t _compiler, const char *_shaderPath,
+                const char *_outputPath, const char *_cacheDir ){
+    int toRet = 0;
+    LOG( INFO, "Baking shader %s", _shaderPath );
 
     // Start by loading the shader source
     size_t shaderSourceLength = 0;
-    char *shaderSrc = loadFile( shaderPath, &shaderSourceLength );
+    char *shaderSrc = loadFile( _shaderPath, &shaderSourceLength );
     if( !shaderSrc ){
         // No need to log, loadFile should have done that
         toRet = 1;
         goto initialisationError;
     }
 
-    // Compile the shader to bytecode
-    size_t shaderBinarySizeBytes;
-    uint32_t *shaderBytecode = compileShader( shaderSrc, shaderSourceLength, shaderPath,
-                                              &shaderBinarySizeBytes );
-    if( !shaderBytecode ){
-        // No need to log
+    // Every combination of the declared variant axes gets its own module
+    ShaderVariantAxis variantAxes[ MAX_VARIANT_AXES ];
+    uint32_t numVariantAxes;
+    uint32_t numVariants;
+    if( parseVariantAxes( shaderSrc, variantAxes, &numVariantAxes, &numVariants ) ){
+        LOG( ERR, "Failed to parse shader variants" );
+        toRet = 1;
+        goto postSourceLoadError;
+    }
+    PomShaderVariantInfo *variants =
+        (PomShaderVariantInfo*) calloc( numVariants, sizeof( PomShaderVariantInfo ) );
+    if( !variants ){
+        LOG( ERR, "Failed to allocate shader variants" );
         toRet = 1;
         goto postSourceLoadError;
     }
+    uint64_t sourceCacheKey = 0;
+    if( _cacheDir ){
+        sourceCacheKey = getShaderCacheKey( _shaderPath, shaderSrc, shaderSourceLength );
+    }
+    for( uint32_t i = 0; i < numVariants; i++ ){
+        PomShaderVariantInfo *variant = &variants[ i ];
+        variant->definesOffset = getVariantDefines( variantAxes, numVariantAxes, i );
+        if( !variant->definesOffset ){
+            LOG( ERR, "Failed to allocate variant definitions" );
+            freeVariants( variants, numVariants );
+            toRet = 1;
+            goto postSourceLoadError;
+        }
+        // Compile the variant to bytecode, unless an identical compile is cached
+        uint64_t cacheKey = 0;
+        if( _cacheDir ){
+            cacheKey = hashBytes( sourceCacheKey, variant->definesOffset,
+                                  strlen( variant->definesOffset ) );
+            variant->shaderBytecodeOffset =
+                loadCachedShader( _cacheDir, cacheKey, &variant->shaderBytecodeSizeBytes );
+            if( variant->shaderBytecodeOffset ){
+                LOG( INFO, "Using cached SPIR-V for %s [%s]", _shaderPath, variant->definesOffset );
+            }
+        }
+        if( !variant->shaderBytecodeOffset ){
+            variant->shaderBytecodeOffset =
+                compileShader( _compiler, shaderSrc, shaderSourceLength, _shaderPath,
+                               variant->definesOffset, &variant->shaderBytecodeSizeBytes );
+            if( !variant->shaderBytecodeOffset ){
+                // No need to log
+                freeVariants( variants, numVariants );
+                toRet = 1;
+                goto postSourceLoadError;
+            }
+            if( _cacheDir ){
+                storeCachedShader( _cacheDir, cacheKey, variant->shaderBytecodeOffset,
+                                   variant->shaderBytecodeSizeBytes );
+            }
+        }
+    }
     
     PomShaderFormat format = { 0 };
-    format.shaderNameOffset = shaderPath;
-    format.shaderBytecodeOffset = shaderBytecode;
-    format.shaderBytecodeSizeBytes = shaderBinarySizeBytes;
+    format.shaderNameOffset = (char*) _shaderPath;
+    format.numVariantInfo = numVariants;
+    format.variantInfoOffset = variants;
+    // The top-level bytecode is the default variant, which contiguifyData points
+    // at variant 0's copy
+    format.shaderBytecodeOffset = variants[ 0 ].shaderBytecodeOffset;
+    format.shaderBytecodeSizeBytes = variants[ 0 ].shaderBytecodeSizeBytes;
     
-    // Parse for attributes and descriptors
-    if( parseShaderInterface( shaderSrc, shaderSourceLength, &format ) ){
-        LOG( ERR, "Failed to parse shader interface" );
-        toRet = 1;
-        goto finalStageError;
+    void *dataBlock = NULL;
+    // Reflect attributes, descriptors and push constants from every variant
+    for( uint32_t i = 0; i < numVariants; i++ ){
+        if( pomSpirvReflect( variants[ i ].shaderBytecodeOffset, variants[ i ].shaderBytecodeSizeBytes,
+                             &format ) ){
+            LOG( ERR, "Failed to reflect shader interface of %s [%s]", _shaderPath,
+                 variants[ i ].definesOffset );
+            freeInterface( &format );
+            freeVariants( variants, numVariants );
+            toRet = 1;
+            goto postSourceLoadError;
+        }
     }
 
     // Transfer all the data we've created so far into a contiguous block
     size_t dataBlockSize = contiguifyData( &format );
     if( !dataBlockSize ){
         LOG( ERR, "Failed to contiguify shader data" );
+        freeInterface( &format );
+        freeVariants( variants, numVariants );
         toRet = 1;
         goto postSourceLoadError;
     }
     format.dataBlockSize = dataBlockSize;
 
     size_t expectedSize = sizeof( PomShaderFormat ) + dataBlockSize;
-    void *dataBlock = (void*) format.shaderNameOffset;
-    if( pomShaderFormatWrite( outputPath, &format, dataBlock ) !=
+    dataBlock = (void*) format.shaderNameOffset;
+    if( pomShaderFormatWrite( _outputPath, &format, dataBlock ) !=
             expectedSize ){
         LOG( ERR, "Did not write expected number of bytes to output file" );
         toRet = 1;
@@ -91,23 +636,77 @@ initialisationError:
     return toRet;
 }
 
-uint32_t *compileShader( const char *_shaderSrc, size_t _shaderSourceLength, const char *_sourceName,
-                         size_t *_shaderBlobSizeBytes ){
-    shaderc_compiler_t compiler = shaderc_compiler_initialize();
-    if( !compiler ){
-        LOG( ERR, "Failed to create shader compiler" );
+static shaderc_include_result *resolveInclude( void *_userData, const char *_requestedSource,
+                                               int _type, const char *_requestingSource,
+                                               size_t _includeDepth ){
+    (void) _userData;
+    (void) _type;
+    (void) _includeDepth;
+    ShaderInclude *include = (ShaderInclude*) calloc( 1, sizeof( ShaderInclude ) );
+    if( !include ){
         return NULL;
     }
+    size_t contentLength = 0;
+    include->path = getIncludePath( _requestingSource, _requestedSource, strlen( _requestedSource ) );
+    include->content = include->path ? loadFile( include->path, &contentLength ) : NULL;
+    if( include->content ){
+        include->result.source_name = include->path;
+        include->result.source_name_length = strlen( include->path );
+        include->result.content = include->content;
+        include->result.content_length = contentLength;
+    }else{
+        // An empty source name tells shaderc the include failed, with content as the error
+        include->result.source_name = "";
+        include->result.source_name_length = 0;
+        include->result.content = "Failed to load include file";
+        include->result.content_length = strlen( include->result.content );
+    }
+    include->result.user_data = include;
+    return &include->result;
+}
+
+static void releaseInclude( void *_userData, shaderc_include_result *_result ){
+    (void) _userData;
+    ShaderInclude *include = (ShaderInclude*) _result->user_data;
+    free( include->content );
+    free( include->path );
+    free( include );
+}
+
+uint32_t *compileShader( shaderc_compiler_t _compiler, const char *_shaderSrc,
+                         size_t _shaderSourceLength, const char *_sourceName,
+                         const char *_defines, size_t *_shaderBlobSizeBytes ){
+    shaderc_compile_options_t options = shaderc_compile_options_initialize();
+    if( !options ){
+        LOG( ERR, "Failed to create shader compile options" );
+        return NULL;
+    }
+    shaderc_compile_options_set_include_callbacks( options, resolveInclude, releaseInclude, NULL );
+    shaderc_compile_options_set_optimization_level( options, shaderc_optimization_level_performance );
+    // _defines is a space-separated list of NAME=VALUE
+    const char *define = _defines;
+    while( *define ){
+        define += strspn( define, " " );
+        size_t defineLength = strcspn( define, " " );
+        const char *equals = memchr( define, '=', defineLength );
+        if( equals ){
+            shaderc_compile_options_add_macro_definition( options, define, equals - define, equals + 1,
+                                                          defineLength - ( equals - define ) - 1 );
+        }else if( defineLength ){
+            shaderc_compile_options_add_macro_definition( options, define, defineLength, NULL, 0 );
+        }
+        define += defineLength;
+    }
     // TODO - Allow entry point selection
-    // TODO - Allow options
     // Note that we always infer shader type from source - i.e. we require a pragma annotation
     shaderc_compilation_result_t compileResult =
-        shaderc_compile_into_spv( compiler, _shaderSrc, _shaderSourceLength,
-                                  shaderc_glsl_infer_from_source, _sourceName, "main", NULL );
-    uint32_t numErrors = shaderc_result_get_num_errors( compileResult );
-    uint32_t numWarnings = shaderc_result_get_num_errors( compileResult );
+        shaderc_compile_into_spv( _compiler, _shaderSrc, _shaderSourceLength,
+                                  shaderc_glsl_infer_from_source, _sourceName, "main", options );
+    size_t numErrors = shaderc_result_get_num_errors( compileResult );
+    size_t numWarnings = shaderc_result_get_num_warnings( compileResult );
     uint32_t *toReturn;
-    LOG( INFO, "Shader Compile, %u errors, %u warnings", numErrors, numWarnings );
+    LOG( INFO, "Shader Compile %s [%s], %lu errors, %lu warnings", _sourceName, _defines,
+         numErrors, numWarnings );
     shaderc_compilation_status compileStatus = shaderc_result_get_compilation_status( compileResult );
     if( compileStatus != shaderc_compilation_status_success ){
         if( compileStatus == shaderc_compilation_status_invalid_stage ){
@@ -130,7 +729,7 @@ uint32_t *compileShader( const char *_shaderSrc, size_t _shaderSourceLength, con
         memcpy( toReturn, compiledShader, shaderLength );
     }
     shaderc_result_release( compileResult );
-    shaderc_compiler_release( compiler );
+    shaderc_compile_options_release( options );
     return toReturn;
 }
 
@@ -177,454 +776,16 @@ char * loadFile( const char *_path, size_t *_sourceLength ){
     return fileStr;
 }
 
-// Takes an input source string and an existing pointer to a line & length within that string.
-// Sets line to the next line in the string, and sets lineLength to the string length of the line.
-// Returns 0 if no error, 1 if EOF, 2 if error
-static int _getNextLine( char *_sourceString, size_t _sourceLength,
-                         char ** line, size_t *_lineLength ){
-    // Bounds check
-    if( *line < _sourceString ){
-        // Weird error
-        LOG( ERR, "Invalid line pointer for _getNextLine" );
-        return 2;
-    }
-    // Check if we're at EOF (EoS?)
-    char * nextLineStart = *line + *_lineLength;
-    size_t nextLineOffset = nextLineStart - _sourceString;
-    if(  nextLineOffset >= _sourceLength ){
-        // End of string
-        return 2;
-    }
-    // Find the next non-EOL character (or EOF)
-    do{
-        char c = *nextLineStart;
-        if( c == '\n' || c == '\r' ){
-            // Ignore these
-            continue;
-        }
-        else if( c == '\0' ){
-            // EOS
-            return 1;
-        }
-        else{
-            // Found start of next line
-            break;
-        }
-    }while( nextLineStart++ );
-
-    // Now find the length of this string
-    size_t lineLen = 0;
-    do{
-        char c = nextLineStart[ lineLen ];
-        if( c == '\n' || c == '\r' || c == '\0' ){
-            break;
-        }
-        lineLen++;
-    }while( lineLen );
-    
-    *_lineLength = lineLen;
-    *line = nextLineStart;
-    return 0;
-}
-
-// Take a given start of parameter, and scan to find the start of the next parameter.
-// Returns 0 if success, or 1 if EOL found before next parameter.
-// Call with _attrStart pointing to start of a parameter. 
-// If successful, _paramStart will be set to the start of the next parameter.
-// _lastParamLen is set to the number of characters in the last parameter
-static int _findNextParameter( char ** _paramStart, size_t *_lastParamLen ){
-    char *paramStart = *_paramStart;
-    size_t lastParamLen = 0;
-    while( ++paramStart && ++lastParamLen ){
-        if( *paramStart == ' ' ){
-            break;
-        }else if( *paramStart == '\0' ){
-            // EOL found
-            *_lastParamLen = lastParamLen;
-            return 1;
-        }
-    }
-    *_lastParamLen = lastParamLen;
-    // If we get here, paramStart points to the space immediately following the last parameter.
-    // Scan for the start of the next parameter now
-    while( paramStart++ ){
-        if( *paramStart == '\0' ){
-            // EOL
-            return 1;
-        }else if( *paramStart != ' ' ){
-            break;
-        }
-    }
-    // Next param start found
-    *_paramStart = paramStart;
-    return 0;
-}
-
-static PomShaderDataTypes _parseAttrDataType( const char * _typeStr, size_t _typeLen ){
-    if( strlen( "SHADER_FLOAT" ) == _typeLen && !strncmp( "SHADER_FLOAT", _typeStr, _typeLen ) ){
-        return SHADER_FLOAT;
-    }
-    if( strlen( "SHADER_INT8" ) == _typeLen && !strncmp( "SHADER_INT8", _typeStr, _typeLen ) ){
-        return SHADER_INT8;
-    }
-    if( strlen( "SHADER_INT16" ) == _typeLen && !strncmp( "SHADER_INT16", _typeStr, _typeLen ) ){
-        return SHADER_INT16;
-    }
-    if( strlen( "SHADER_INT32" ) == _typeLen && !strncmp( "SHADER_INT32", _typeStr, _typeLen ) ){
-        return SHADER_INT32;
-    }
-    if( strlen( "SHADER_INT64" ) == _typeLen && !strncmp( "SHADER_INT64", _typeStr, _typeLen ) ){
-        return SHADER_INT64;
-    }
-    if( strlen( "SHADER_VEC2" ) == _typeLen && !strncmp( "SHADER_VEC2", _typeStr, _typeLen ) ){
-        return SHADER_VEC2;
-    }
-    if( strlen( "SHADER_VEC3" ) == _typeLen && !strncmp( "SHADER_VEC3", _typeStr, _typeLen ) ){
-        return SHADER_VEC3;
-    }
-    if( strlen( "SHADER_VEC4" ) == _typeLen && !strncmp( "SHADER_VEC4", _typeStr, _typeLen ) ){
-        return SHADER_INT8;
-    }
-
-    return SHADER_DATATYPE_UNKNOWN;
-}
-
-// Attempt to parse a given line that may contain a valid Attribute declaration.
-// Return 0 if valid declaraion was found, 1 if no valid declaration, and 2 if mangled declaration
-static int _parseAttributeLine( char *_attrLine, PomShaderAttributeInfo *_attrInfo ){
-    char *attrStart;
-    if( !pomStringFind( _attrLine, "POM_ATTRIBUTE", &attrStart ) ){
-        // Could not find attribute keyword
-        return 1;
-    }
-    // attrStart points to the start of POM_DESCRIPTOR in the line.
-    // Format should be `POM_ATTRIBUTE <NAME(string)> <LOCATION(uint)> <TYPE(enum)>
-    
-    // Lets first attempt to get offsets to these points in the string
-    size_t attrDeclParamLen = strlen( "POM_ATTRIBUTE" );
-    size_t nameLen;
-    size_t locationLen;
-    size_t typeLen;
-
-    char *nameStart = attrStart;
-    if( _findNextParameter( &nameStart, &attrDeclParamLen ) ){
-        LOG( WARN, "Failed to find name in attribute declaration" );
-        return 2;
-    }
-    // Quick assertion on the parameter length
-    if( attrDeclParamLen != strlen( "POM_ATTRIBUTE" ) ){
-        LOG( WARN, "_findNextParameter not working as expected" );
-    }
-    
-    char *locationStart = nameStart;
-    if( _findNextParameter( &locationStart, &nameLen ) ){
-        LOG( WARN, "Failed to find location in attribute declaration" );
-        return 2;
-    }
-    
-    char *typeStart = locationStart;
-    if( _findNextParameter( &typeStart, &locationLen ) ){
-        LOG( WARN, "Failed to find type in attribute declaration" );
-        return 2;
-    }
-
-    char *eolStart = typeStart;
-    // Doesn't matter if next call fails, just need length of type parameter
-    _findNextParameter( &eolStart, &typeLen );
-    
-
-    // Now start parsing the parameters.
-
-    // Try to parse the location string
-    char locationBuffer[ 11 ];
-    if( locationLen > 10 ){
-        LOG( WARN, "Location parameter incorrectly extracted" );
-        return 2;
-    }
-    memcpy( locationBuffer, locationStart, locationLen );
-    locationBuffer[ locationLen ] = '\0';
-    long int parsedLocation = strtol( locationBuffer, NULL, 10 );
-    // strtol returns 0, LONG_MAX, or LONG_MIN if error occurred. Need to check for these.
-    if( parsedLocation == LONG_MAX || parsedLocation < 0 ||
-        ( parsedLocation == 0 && locationBuffer[ 0 ] != '0' ) ){
-        LOG( WARN, "Failed to parse location parameter" );
-        return 2;
-    }
-    // Location should be nicely parsed now
-    // TODO - can also check for endptr in strtol to make sure all the string was a number
-    _attrInfo->location = (uint32_t) parsedLocation;
-
-    // Next parse the data type
-    _attrInfo->dataType = _parseAttrDataType( typeStart, typeLen );
-    if( _attrInfo->dataType == SHADER_DATATYPE_UNKNOWN ){
-        LOG( WARN, "Failed to parse attribute datatype" );
-        return 2;
-    }
-
-    // Name requires no parsing, we'll just copy the string to new memory
-    // TODO - don't forget to free this later
-    _attrInfo->nameOffset = (char*) calloc( nameLen + 1, sizeof( char ) );
-    memcpy( _attrInfo->nameOffset, nameStart, sizeof( char ) * nameLen );
-
-    return 0;
-}
-
-static PomShaderDataTypes _parseDescriptorType( const char * _typeStr, size_t _typeLen ){
-    if( strlen( "SAMPLER" ) == _typeLen && !strncmp( "SAMPLER", _typeStr, _typeLen ) ){
-        return VK_DESCRIPTOR_TYPE_SAMPLER;
-    }
-    if( strlen( "COMBINED_IMAGE_SAMPLER" ) == _typeLen && !strncmp( "COMBINED_IMAGE_SAMPLER", _typeStr, _typeLen ) ){
-        return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    }
-    if( strlen( "SAMPLED_IMAGE" ) == _typeLen && !strncmp( "SAMPLED_IMAGE", _typeStr, _typeLen ) ){
-        return VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-    }
-    if( strlen( "STORAGE_IMAGE" ) == _typeLen && !strncmp( "STORAGE_IMAGE", _typeStr, _typeLen ) ){
-        return VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-    }
-    if( strlen( "UNIFORM_TEXEL_BUFFER" ) == _typeLen && !strncmp( "UNIFORM_TEXEL_BUFFER", _typeStr, _typeLen ) ){
-        return VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
-    }
-    if( strlen( "STORAGE_TEXEL_BUFFER" ) == _typeLen && !strncmp( "STORAGE_TEXEL_BUFFER", _typeStr, _typeLen ) ){
-        return VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER;
-    }
-    if( strlen( "UNIFORM_BUFFER" ) == _typeLen && !strncmp( "UNIFORM_BUFFER", _typeStr, _typeLen ) ){
-        return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    }
-    if( strlen( "STORAGE_BUFFER" ) == _typeLen && !strncmp( "STORAGE_BUFFER", _typeStr, _typeLen ) ){
-        return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    }
-    if( strlen( "UNIFORM_BUFFER_DYNAMIC" ) == _typeLen && !strncmp( "UNIFORM_BUFFER_DYNAMIC", _typeStr, _typeLen ) ){
-        return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-    }
-    if( strlen( "STORAGE_BUFFER_DYNAMIC" ) == _typeLen && !strncmp( "STORAGE_BUFFER_DYNAMIC", _typeStr, _typeLen ) ){
-        return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
-    }
-    if( strlen( "INPUT_ATTACHMENT" ) == _typeLen && !strncmp( "INPUT_ATTACHMENT", _typeStr, _typeLen ) ){
-        return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-    }
-    if( strlen( "INLINE_UNIFORM_BLOCK_EXT" ) == _typeLen && !strncmp( "INLINE_UNIFORM_BLOCK_EXT", _typeStr, _typeLen ) ){
-        return VK_DESCRIPTOR_TYPE_INLINE_UNIFORM_BLOCK_EXT;
-    }
-    if( strlen( "ACCELERATION_STRUCTURE_NV" ) == _typeLen && !strncmp( "ACCELERATION_STRUCTURE_NV", _typeStr, _typeLen ) ){
-        return VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV;
-    }
-
-    return VK_DESCRIPTOR_TYPE_MAX_ENUM;
-}
-
-// Attempt to parse a given line that may contain a valid Descriptor declaration.
-// Return 0 if valid declaraion was found, 1 if no valid declaration, and 2 if mangled declaration
-static int _parseDescriptorLine( char *_descLine, PomShaderDescriptorInfo *_descInfo ){
-    char *descStart;
-    if( !pomStringFind( _descLine, "POM_DESCRIPTOR", &descStart ) ){
-        // Could not find decriptor keyword
-        return 1;
-    }
-    // descStart points to the start of POM_DESCRIPTOR in the line.
-    // Format should be:
-    // `POM_DESCRIPTOR <NAME(string)> <DESCRIPTOR_TYPE(enum)> <SET(uint)> <BINDING(uint)> <SIZE_UNPADDED(size_t)>
-    
-    // Lets first attempt to get offsets to these points in the string
-    size_t descDeclParamLen = strlen( "POM_DESCRIPTOR" );
-    size_t nameLen;
-    size_t typeLen;
-    size_t setLen;
-    size_t bindingLen;
-    size_t sizeLen;
-
-    char *nameStart = descStart;
-    if( _findNextParameter( &nameStart, &descDeclParamLen ) ){
-        LOG( WARN, "Failed to find name in attribute declaration" );
-        return 2;
-    }
-    // Quick assertion on the parameter length
-    if( descDeclParamLen != strlen( "POM_DESCRIPTOR" ) ){
-        LOG( WARN, "_findNextParameter not working as expected" );
-    }
-    
-    char *typeStart = nameStart;
-    if( _findNextParameter( &typeStart, &nameLen ) ){
-        LOG( WARN, "Failed to find type in attribute declaration" );
-        return 2;
-    }
-    
-    char *setStart = typeStart;
-    if( _findNextParameter( &setStart, &typeLen ) ){
-        LOG( WARN, "Failed to find set in attribute declaration" );
-        return 2;
-    }
-
-    char *bindingStart = setStart;
-    if( _findNextParameter( &bindingStart, &setLen ) ){
-        LOG( WARN, "Failed to find binding in attribute declaration" );
-        return 2;
-    }
-
-    char *sizeStart = bindingStart;
-    if( _findNextParameter( &sizeStart, &bindingLen ) ){
-        LOG( WARN, "Failed to find size in attribute declaration" );
-        return 2;
-    }
-
-    char *eolStart = sizeStart;
-    // Doesn't matter if next call fails, just need length of type parameter
-    _findNextParameter( &eolStart, &sizeLen );
-    
-
-    // Now start parsing the parameters.
-
-    // Try to parse the set string
-    char setBuffer[ 11 ];
-    if( setLen > 10 ){
-        LOG( WARN, "Set parameter incorrectly extracted" );
-        return 2;
-    }
-    memcpy( setBuffer, setStart, setLen );
-    setBuffer[ setLen ] = '\0';
-    long int parsedSet = strtol( setBuffer, NULL, 10 );
-    // strtol returns 0, LONG_MAX, or LONG_MIN if error occurred. Need to check for these.
-    if( parsedSet == LONG_MAX || parsedSet < 0 ||
-        ( parsedSet == 0 && setBuffer[ 0 ] != '0' ) ){
-        LOG( WARN, "Failed to parse set parameter" );
-        return 2;
-    }
-    // Set should be nicely parsed now
-    // TODO - can also check for endptr in strtol to make sure all the string was a number
-    _descInfo->set = (uint32_t) parsedSet;
-
-    // Similarly, try to parse the binding string
-    char bindingBuffer[ 11 ];
-    if( bindingLen > 10 ){
-        LOG( WARN, "Binding parameter incorrectly extracted" );
-        return 2;
-    }
-    memcpy( bindingBuffer, bindingStart, bindingLen );
-    bindingBuffer[ bindingLen ] = '\0';
-    long int parsedBinding = strtol( bindingBuffer, NULL, 10 );
-    // strtol returns 0, LONG_MAX, or LONG_MIN if error occurred. Need to check for these.
-    if( parsedBinding == LONG_MAX || parsedBinding < 0 ||
-        ( parsedBinding == 0 && bindingBuffer[ 0 ] != '0' ) ){
-        LOG( WARN, "Failed to parse binding parameter" );
-        return 2;
-    }
-    // Set should be nicely parsed now
-    // TODO - can also check for endptr in strtol to make sure all the string was a number
-    _descInfo->binding = (uint32_t) parsedBinding;
-
-    // Next parse the data type
-    _descInfo->type = _parseDescriptorType( typeStart, typeLen );
-    if( _descInfo->type == VK_DESCRIPTOR_TYPE_MAX_ENUM ){
-        LOG( WARN, "Failed to parse descriptor type" );
-        return 2;
-    }
-
-
-    // Name requires no parsing, we'll just copy the string to new memory
-    // TODO - don't forget to free this later
-    _descInfo->nameOffset = (char*) calloc( nameLen + 1, sizeof( char ) );
-    memcpy( _descInfo->nameOffset, nameStart, sizeof( char ) * nameLen );
-
-    return 0;
-}
-
-
-
-static int parseShaderInterface( char *_shaderSource, size_t _sourceLength,
-                                 PomShaderFormat *_format ){
-    int toReturn = 0;
-    PomLinkedListCtx attrInfoList = { 0 };
-    PomLinkedListCtx descInfoList = { 0 };
-
-    pomLinkedListInit( &attrInfoList );
-    pomLinkedListInit( &descInfoList );
-
-
-    // Need to have *info structs ready to go, so create initial ones here
-    PomShaderAttributeInfo *nextAttrInfo =
-        (PomShaderAttributeInfo*) calloc( 1, sizeof( PomShaderAttributeInfo ) );
-    PomShaderDescriptorInfo *nextDescInfo =
-        (PomShaderDescriptorInfo*) calloc( 1, sizeof( PomShaderDescriptorInfo ) );
-    // Read the source in line-by-line
-    char * currLine = _shaderSource;
-    size_t lineLength = 0;
-    int nextLineRet;
-    while( ( nextLineRet = _getNextLine( _shaderSource, _sourceLength, &currLine, &lineLength ) ) != 2 ){
-        // Set EOL to nullchar so that we can treat this line as it's own string. Set back when done
-        char eolChar = currLine[ lineLength ];
-        currLine[ lineLength ] = '\0';
-
-        // currLine is now a null-terminated string representing the current line, and can be
-        // treated as such
-
-        // Check for attribute declaration
-        int parseAttrRet = _parseAttributeLine( currLine, nextAttrInfo );
-        if( parseAttrRet == 0 ){
-            LOG( DEBUG, "Adding attribute info for %s", nextAttrInfo->nameOffset );
-            pomLinkedListAdd( &attrInfoList, (PllKeyType) nextAttrInfo );
-            nextAttrInfo = (PomShaderAttributeInfo*) calloc( 1, sizeof( PomShaderAttributeInfo ) );
-        } else if( parseAttrRet == 2 ){
-            // Should probably give a better warning here
-            LOG( WARN, "Mangled descriptor declaration" );
-        }
-
-        // Check for descriptor declaration
-        int parseDescRet = _parseDescriptorLine( currLine, nextDescInfo );
-        if( parseDescRet == 0 ){
-            LOG( DEBUG, "Adding descriptor info for %s", nextDescInfo->nameOffset );
-            pomLinkedListAdd( &descInfoList, (PllKeyType) nextDescInfo );
-            nextDescInfo = (PomShaderDescriptorInfo*) calloc( 1, sizeof( PomShaderDescriptorInfo ) );
-        } else if( parseDescRet == 2 ){
-            LOG( WARN, "Mangled descriptor declaration" );
-        }
-
-        
-        // Reset the EOL char
-        if( nextLineRet != 1 ){
-        currLine[ lineLength ] = eolChar;
-        }
-        if( nextLineRet == 1 ){
-            // Last line, can break
-            break;
-        }
-    }
-    free( nextAttrInfo );
-    free( nextDescInfo );
-
-    // Now copy any info declarations we found into a single block
-    size_t infoBlockSize = ( attrInfoList.size * sizeof( PomShaderAttributeInfo ) ) +
-                           ( descInfoList.size * sizeof( PomShaderDescriptorInfo ) );
-
-    uint8_t *infoBlock = (void*) malloc( infoBlockSize );
-    uint8_t *currOffset = infoBlock;
-    _format->attributeInfoOffset = (PomShaderAttributeInfo*) currOffset;
-    _format->numAttributeInfo = attrInfoList.size;
-
-    PllKeyType nKey;
-    while( pomLinkedListPopFront( &attrInfoList, &nKey ) ){
-        PomShaderAttributeInfo *attrInfo = (PomShaderAttributeInfo*) nKey;
-        memcpy( currOffset, attrInfo, sizeof( PomShaderAttributeInfo ) );
-        currOffset += sizeof( PomShaderAttributeInfo );
-    }
-
-    _format->descriptorInfoOffset = (PomShaderDescriptorInfo*) currOffset;
-    _format->numDescriptorInfo = descInfoList.size;
-    while( pomLinkedListPopFront( &descInfoList, &nKey ) ){
-        PomShaderDescriptorInfo *descInfo = (PomShaderDescriptorInfo*) nKey;
-        memcpy( currOffset, descInfo, sizeof( PomShaderDescriptorInfo ) );
-        currOffset += sizeof( PomShaderDescriptorInfo );
-    }
-
-    pomLinkedListClear( &attrInfoList );
-    pomLinkedListClear( &descInfoList );
-    return toReturn;
-}
-
 static size_t contiguifyData( PomShaderFormat *_format ){
     // Find the total size required
     const size_t attribInfoSize = _format->numAttributeInfo * sizeof( PomShaderAttributeInfo );
     const size_t descInfoSize = _format->numDescriptorInfo * sizeof( PomShaderDescriptorInfo );
-    const size_t shaderSize = _format->shaderBytecodeSizeBytes;
+    const size_t pushInfoSize = _format->numPushConstantInfo * sizeof( PomShaderPushConstantInfo );
+    const size_t variantInfoSize = _format->numVariantInfo * sizeof( PomShaderVariantInfo );
+    size_t shaderSize = 0;
+    for( uint32_t i = 0; i < _format->numVariantInfo; i++ ){
+        shaderSize += _format->variantInfoOffset[ i ].shaderBytecodeSizeBytes;
+    }
     const size_t shaderNameLen = strlen( _format->shaderNameOffset ) + 1;
     size_t nameStringSize = shaderNameLen;
     // Count the string length for each attribute information
@@ -635,55 +796,87 @@ static size_t contiguifyData( PomShaderFormat *_format ){
     for( uint32_t i = 0; i < _format->numDescriptorInfo; i++ ){
         nameStringSize += strlen( _format->descriptorInfoOffset[ i ].nameOffset ) + 1;
     }
+    for( uint32_t i = 0; i < _format->numPushConstantInfo; i++ ){
+        nameStringSize += strlen( _format->pushConstantInfoOffset[ i ].nameOffset ) + 1;
+    }
+    for( uint32_t i = 0; i < _format->numVariantInfo; i++ ){
+        nameStringSize += strlen( _format->variantInfoOffset[ i ].definesOffset ) + 1;
+    }
+    // Pad the strings so the infos and bytecode that follow stay aligned
+    const size_t stringPadding = ( 8 - ( nameStringSize % 8 ) ) % 8;
 
-    const size_t totalBlockSize = attribInfoSize + descInfoSize + nameStringSize + shaderSize;
-    uint8_t *dataBlock = (void*) malloc( totalBlockSize );
-    uint8_t *currOffset = dataBlock;
+    const size_t totalBlockSize = attribInfoSize + descInfoSize + pushInfoSize + variantInfoSize +
+                                  nameStringSize + stringPadding + shaderSize;
+    uint8_t *dataBlock = (uint8_t*) calloc( totalBlockSize, sizeof( uint8_t ) );
+    if( !dataBlock ){
+        LOG( ERR, "Failed to allocate contiguous shader data block" );
+        return 0;
+    }
 
-    // Start copying data into our new block.
-    // Start with strings, freeing as necessary
-    
+    // Copy the Attribute, Descriptor, Push Constant and Variant infos over first, after the
+    // strings. Their pointers are moved into the block as the data is copied, leaving the
+    // scattered originals untouched until everything's in place
+    uint8_t *infoOffset = dataBlock + nameStringSize + stringPadding;
+    PomShaderAttributeInfo *attrInfoBlock = (PomShaderAttributeInfo*) infoOffset;
+    memcpy( attrInfoBlock, _format->attributeInfoOffset, attribInfoSize );
+    infoOffset += attribInfoSize;
+
+    PomShaderDescriptorInfo *descInfoBlock = (PomShaderDescriptorInfo*) infoOffset;
+    memcpy( descInfoBlock, _format->descriptorInfoOffset, descInfoSize );
+    infoOffset += descInfoSize;
+
+    PomShaderPushConstantInfo *pushInfoBlock = (PomShaderPushConstantInfo*) infoOffset;
+    memcpy( pushInfoBlock, _format->pushConstantInfoOffset, pushInfoSize );
+    infoOffset += pushInfoSize;
+
+    PomShaderVariantInfo *variantInfoBlock = (PomShaderVariantInfo*) infoOffset;
+    memcpy( variantInfoBlock, _format->variantInfoOffset, variantInfoSize );
+
+    // Now the strings
+    uint8_t *currOffset = dataBlock;
     memcpy( currOffset, _format->shaderNameOffset, shaderNameLen );
-    _format->shaderNameOffset = (char*) dataBlock;
     currOffset += shaderNameLen;
     for( uint32_t i = 0; i < _format->numAttributeInfo; i++ ){
-        PomShaderAttributeInfo *attrInfo = &_format->attributeInfoOffset[ i ];
+        PomShaderAttributeInfo *attrInfo = &attrInfoBlock[ i ];
         const size_t attrNameLen = strlen( attrInfo->nameOffset ) + 1;
         memcpy( currOffset, attrInfo->nameOffset, attrNameLen );
-        free( attrInfo->nameOffset );
         attrInfo->nameOffset = (char*) currOffset;
         currOffset += attrNameLen;
     }
     for( uint32_t i = 0; i < _format->numDescriptorInfo; i++ ){
-        PomShaderDescriptorInfo *descInfo = &_format->descriptorInfoOffset[ i ];
+        PomShaderDescriptorInfo *descInfo = &descInfoBlock[ i ];
         const size_t descNameLen = strlen( descInfo->nameOffset ) + 1;
         memcpy( currOffset, descInfo->nameOffset, descNameLen );
-        free( descInfo->nameOffset );
         descInfo->nameOffset = (char*) currOffset;
         currOffset += descNameLen;
     }
-    // Now copy over the Attribute and Descriptor infos
-    PomShaderAttributeInfo *oldAttrDescBlock = _format->attributeInfoOffset;
-    PomShaderAttributeInfo *attrInfoBlock = (PomShaderAttributeInfo*) currOffset;
-    memcpy( attrInfoBlock, _format->attributeInfoOffset, attribInfoSize );
-    _format->attributeInfoOffset = attrInfoBlock;
-    currOffset += attribInfoSize;
-
-    PomShaderDescriptorInfo *descInfoBlock = (PomShaderDescriptorInfo*) currOffset;
-    memcpy( descInfoBlock, _format->descriptorInfoOffset, descInfoSize );
-    _format->descriptorInfoOffset = descInfoBlock;
-    currOffset += descInfoSize;
-
-    // All temp copies of attribute info and descriptor info are in the same data block, pointed to
-    // by the original location in format, so free that now
-    free( oldAttrDescBlock );
-
-    // Finally, copy the shader bytecode over
-    uint32_t *shaderBytecodeBlock = (uint32_t*) currOffset;
-    memcpy( shaderBytecodeBlock, _format->shaderBytecodeOffset, shaderSize );
-    free( _format->shaderBytecodeOffset );
-    _format->shaderBytecodeOffset = shaderBytecodeBlock;
-    currOffset += shaderSize;
+    for( uint32_t i = 0; i < _format->numPushConstantInfo; i++ ){
+        PomShaderPushConstantInfo *pushInfo = &pushInfoBlock[ i ];
+        const size_t pushNameLen = strlen( pushInfo->nameOffset ) + 1;
+        memcpy( currOffset, pushInfo->nameOffset, pushNameLen );
+        pushInfo->nameOffset = (char*) currOffset;
+        currOffset += pushNameLen;
+    }
+    for( uint32_t i = 0; i < _format->numVariantInfo; i++ ){
+        PomShaderVariantInfo *variantInfo = &variantInfoBlock[ i ];
+        const size_t definesLen = strlen( variantInfo->definesOffset ) + 1;
+        memcpy( currOffset, variantInfo->definesOffset, definesLen );
+        variantInfo->definesOffset = (char*) currOffset;
+        currOffset += definesLen;
+    }
+    currOffset += stringPadding;
+    // Skip the infos copied above
+    currOffset += attribInfoSize + descInfoSize + pushInfoSize + variantInfoSize;
+
+    // Finally, copy the bytecode of each variant over
+    for( uint32_t i = 0; i < _format->numVariantInfo; i++ ){
+        PomShaderVariantInfo *variantInfo = &variantInfoBlock[ i ];
+        uint32_t *shaderBytecodeBlock = (uint32_t*) currOffset;
+        memcpy( shaderBytecodeBlock, variantInfo->shaderBytecodeOffset,
+                variantInfo->shaderBytecodeSizeBytes );
+        variantInfo->shaderBytecodeOffset = shaderBytecodeBlock;
+        currOffset += variantInfo->shaderBytecodeSizeBytes;
+    }
 
     size_t bytesCopied = currOffset - dataBlock;
 
@@ -693,5 +886,17 @@ static size_t contiguifyData( PomShaderFormat *_format ){
         free( dataBlock );
         return 0;
     }
+
+    // Everything's in the block, so the originals can go. The shader name is the caller's
+    freeInterface( _format );
+    freeVariants( _format->variantInfoOffset, _format->numVariantInfo );
+    _format->shaderNameOffset = (char*) dataBlock;
+    _format->attributeInfoOffset = attrInfoBlock;
+    _format->descriptorInfoOffset = descInfoBlock;
+    _format->pushConstantInfoOffset = pushInfoBlock;
+    _format->variantInfoOffset = variantInfoBlock;
+    // The top-level bytecode is the default variant's, so just points at that
+    _format->shaderBytecodeOffset = variantInfoBlock[ 0 ].shaderBytecodeOffset;
+    _format->shaderBytecodeSizeBytes = variantInfoBlock[ 0 ].shaderBytecodeSizeBytes;
     return totalBlockSize;
 }
\ No newline at end of file
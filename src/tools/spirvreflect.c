@@ -0,0 +1,671 @@
+#include "common.h"
+#include "spirvreflect.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define LOG( lvl, log, ... ) LOG_MODULE( lvl, SpirvReflect, log, ##__VA_ARGS__ )
+
+#define SPIRV_MAGIC_NUMBER 0x07230203
+#define SPIRV_HEADER_WORDS 5
+// Deeper than any real shader's types nest
+#define SPIRV_MAX_TYPE_DEPTH 64
+
+// Only the parts of the SPIR-V spec we need to read interfaces
+typedef enum SpirvOp{
+    SPIRV_OP_NAME = 5,
+    SPIRV_OP_ENTRY_POINT = 15,
+    SPIRV_OP_TYPE_INT = 21,
+    SPIRV_OP_TYPE_FLOAT = 22,
+    SPIRV_OP_TYPE_VECTOR = 23,
+    SPIRV_OP_TYPE_MATRIX = 24,
+    SPIRV_OP_TYPE_IMAGE = 25,
+    SPIRV_OP_TYPE_SAMPLER = 26,
+    SPIRV_OP_TYPE_SAMPLED_IMAGE = 27,
+    SPIRV_OP_TYPE_ARRAY = 28,
+    SPIRV_OP_TYPE_RUNTIME_ARRAY = 29,
+    SPIRV_OP_TYPE_STRUCT = 30,
+    SPIRV_OP_TYPE_POINTER = 32,
+    SPIRV_OP_CONSTANT = 43,
+    SPIRV_OP_VARIABLE = 59,
+    SPIRV_OP_DECORATE = 71,
+    SPIRV_OP_MEMBER_DECORATE = 72,
+    SPIRV_OP_TYPE_ACCELERATION_STRUCTURE = 5341
+}SpirvOp;
+
+typedef enum SpirvDecoration{
+    SPIRV_DECORATION_BLOCK = 2,
+    SPIRV_DECORATION_BUFFER_BLOCK = 3,
+    SPIRV_DECORATION_ARRAY_STRIDE = 6,
+    SPIRV_DECORATION_MATRIX_STRIDE = 7,
+    SPIRV_DECORATION_BUILTIN = 11,
+    SPIRV_DECORATION_LOCATION = 30,
+    SPIRV_DECORATION_BINDING = 33,
+    SPIRV_DECORATION_DESCRIPTOR_SET = 34,
+    SPIRV_DECORATION_OFFSET = 35
+}SpirvDecoration;
+
+typedef enum SpirvStorageClass{
+    SPIRV_STORAGE_UNIFORM_CONSTANT = 0,
+    SPIRV_STORAGE_INPUT = 1,
+    SPIRV_STORAGE_UNIFORM = 2,
+    SPIRV_STORAGE_PUSH_CONSTANT = 9,
+    SPIRV_STORAGE_STORAGE_BUFFER = 12
+}SpirvStorageClass;
+
+typedef enum SpirvIdFlags{
+    SPIRV_ID_HAS_SET = 1 << 0,
+    SPIRV_ID_HAS_BINDING = 1 << 1,
+    SPIRV_ID_HAS_LOCATION = 1 << 2,
+    SPIRV_ID_BUILTIN = 1 << 3,
+    SPIRV_ID_BLOCK = 1 << 4,
+    SPIRV_ID_BUFFER_BLOCK = 1 << 5
+}SpirvIdFlags;
+
+// Image dimensionalities that change the descriptor type
+#define SPIRV_DIM_BUFFER 5
+#define SPIRV_DIM_SUBPASS_DATA 6
+// Image `Sampled` operand value for storage images
+#define SPIRV_IMAGE_STORAGE 2
+
+typedef struct SpirvId SpirvId;
+typedef struct SpirvModule SpirvModule;
+
+struct SpirvId{
+    // Instruction defining the id, for types, constants and variables
+    const uint32_t *instruction;
+    const char *name;
+    uint32_t set;
+    uint32_t binding;
+    uint32_t location;
+    uint32_t arrayStride;
+    uint32_t flags;
+};
+
+struct SpirvModule{
+    const uint32_t *words;
+    size_t numWords;
+    uint32_t idBound;
+    SpirvId *ids;
+    VkShaderStageFlagBits stage;
+};
+
+static VkShaderStageFlagBits _stageFromExecutionModel( uint32_t _executionModel ){
+    switch( _executionModel ){
+        case 0:
+            return VK_SHADER_STAGE_VERTEX_BIT;
+        case 1:
+            return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+        case 2:
+            return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+        case 3:
+            return VK_SHADER_STAGE_GEOMETRY_BIT;
+        case 4:
+            return VK_SHADER_STAGE_FRAGMENT_BIT;
+        case 5:
+            return VK_SHADER_STAGE_COMPUTE_BIT;
+        default:
+            return VK_SHADER_STAGE_FLAG_BITS_MAX_ENUM;
+    }
+}
+
+// Walk the instruction stream once, recording what each id is and how it's decorated.
+// Returns 0 on success, 1 if the module is malformed
+static int _parseModule( const uint32_t *_spirv, size_t _sizeBytes, SpirvModule *_module ){
+    size_t numWords = _sizeBytes / sizeof( uint32_t );
+    if( numWords < SPIRV_HEADER_WORDS || _spirv[ 0 ] != SPIRV_MAGIC_NUMBER ){
+        LOG( ERR, "Not a SPIR-V module" );
+        return 1;
+    }
+    *_module = (SpirvModule){
+        .words = _spirv,
+        .numWords = numWords,
+        .idBound = _spirv[ 3 ],
+        .ids = (SpirvId*) calloc( _spirv[ 3 ], sizeof( SpirvId ) ),
+        .stage = VK_SHADER_STAGE_FLAG_BITS_MAX_ENUM
+    };
+    if( !_module->ids ){
+        LOG( ERR, "Failed to allocate SPIR-V id table" );
+        return 1;
+    }
+
+    size_t wordIdx = SPIRV_HEADER_WORDS;
+    while( wordIdx < numWords ){
+        const uint32_t *instruction = &_spirv[ wordIdx ];
+        uint32_t wordCount = instruction[ 0 ] >> 16;
+        uint32_t opcode = instruction[ 0 ] & 0xFFFF;
+        if( wordCount == 0 || wordIdx + wordCount > numWords ){
+            LOG( ERR, "Malformed SPIR-V instruction at word %lu", (unsigned long) wordIdx );
+            return 1;
+        }
+        wordIdx += wordCount;
+
+        // Result id is the first operand for types, and the second for constants/variables.
+        // Operands read later are checked to be present here, once
+        uint32_t targetId = 0;
+        uint32_t minWords = 2;
+        switch( opcode ){
+            case SPIRV_OP_ENTRY_POINT:
+                if( wordCount > 1 ){
+                    _module->stage = _stageFromExecutionModel( instruction[ 1 ] );
+                }
+                continue;
+            case SPIRV_OP_NAME:
+            case SPIRV_OP_DECORATE:
+                if( wordCount < 3 || instruction[ 1 ] >= _module->idBound ){
+                    continue;
+                }
+                SpirvId *id = &_module->ids[ instruction[ 1 ] ];
+                if( opcode == SPIRV_OP_NAME ){
+                    // Only take names terminated within the instruction
+                    const char *name = (const char*) &instruction[ 2 ];
+                    if( memchr( name, '\0', ( wordCount - 2 ) * sizeof( uint32_t ) ) ){
+                        id->name = name;
+                    }
+                    continue;
+                }
+                uint32_t value = wordCount > 3 ? instruction[ 3 ] : 0;
+                switch( instruction[ 2 ] ){
+                    case SPIRV_DECORATION_BLOCK:
+                        id->flags |= SPIRV_ID_BLOCK;
+                        break;
+                    case SPIRV_DECORATION_BUFFER_BLOCK:
+                        id->flags |= SPIRV_ID_BUFFER_BLOCK;
+                        break;
+                    case SPIRV_DECORATION_ARRAY_STRIDE:
+                        id->arrayStride = value;
+                        break;
+                    case SPIRV_DECORATION_BUILTIN:
+                        id->flags |= SPIRV_ID_BUILTIN;
+                        break;
+                    case SPIRV_DECORATION_LOCATION:
+                        id->flags |= SPIRV_ID_HAS_LOCATION;
+                        id->location = value;
+                        break;
+                    case SPIRV_DECORATION_BINDING:
+                        id->flags |= SPIRV_ID_HAS_BINDING;
+                        id->binding = value;
+                        break;
+                    case SPIRV_DECORATION_DESCRIPTOR_SET:
+                        id->flags |= SPIRV_ID_HAS_SET;
+                        id->set = value;
+                        break;
+                    default:
+                        break;
+                }
+                continue;
+            case SPIRV_OP_TYPE_IMAGE:
+                minWords = 9;
+                targetId = instruction[ 1 ];
+                break;
+            case SPIRV_OP_TYPE_VECTOR:
+            case SPIRV_OP_TYPE_MATRIX:
+            case SPIRV_OP_TYPE_ARRAY:
+            case SPIRV_OP_TYPE_POINTER:
+                minWords = 4;
+                targetId = instruction[ 1 ];
+                break;
+            case SPIRV_OP_TYPE_INT:
+            case SPIRV_OP_TYPE_FLOAT:
+            case SPIRV_OP_TYPE_SAMPLED_IMAGE:
+            case SPIRV_OP_TYPE_RUNTIME_ARRAY:
+                minWords = 3;
+                targetId = instruction[ 1 ];
+                break;
+            case SPIRV_OP_TYPE_SAMPLER:
+            case SPIRV_OP_TYPE_STRUCT:
+            case SPIRV_OP_TYPE_ACCELERATION_STRUCTURE:
+                targetId = instruction[ 1 ];
+                break;
+            case SPIRV_OP_CONSTANT:
+            case SPIRV_OP_VARIABLE:
+                minWords = 4;
+                targetId = wordCount > 2 ? instruction[ 2 ] : UINT32_MAX;
+                break;
+            default:
+                continue;
+        }
+        if( wordCount < minWords ){
+            LOG( ERR, "Truncated SPIR-V instruction at word %lu",
+                 (unsigned long) ( wordIdx - wordCount ) );
+            return 1;
+        }
+        if( targetId >= _module->idBound ){
+            LOG( ERR, "SPIR-V id out of bounds" );
+            return 1;
+        }
+        _module->ids[ targetId ].instruction = instruction;
+    }
+    return 0;
+}
+
+static const uint32_t *_getInstruction( const SpirvModule *_module, uint32_t _id ){
+    return _id < _module->idBound ? _module->ids[ _id ].instruction : NULL;
+}
+
+static uint32_t _getOpcode( const uint32_t *_instruction ){
+    return _instruction ? _instruction[ 0 ] & 0xFFFF : 0;
+}
+
+// Member decorations are looked up as needed rather than stored, there's rarely many
+static bool _getMemberDecoration( const SpirvModule *_module, uint32_t _structId, uint32_t _member,
+                                  uint32_t _decoration, uint32_t *_value ){
+    size_t wordIdx = SPIRV_HEADER_WORDS;
+    while( wordIdx < _module->numWords ){
+        const uint32_t *instruction = &_module->words[ wordIdx ];
+        uint32_t wordCount = instruction[ 0 ] >> 16;
+        if( ( instruction[ 0 ] & 0xFFFF ) == SPIRV_OP_MEMBER_DECORATE && wordCount > 4 &&
+            instruction[ 1 ] == _structId && instruction[ 2 ] == _member &&
+            instruction[ 3 ] == _decoration ){
+            *_value = instruction[ 4 ];
+            return true;
+        }
+        wordIdx += wordCount;
+    }
+    return false;
+}
+
+// Size of a type as laid out in a buffer. _matrixStride is the stride of the member
+// the type belongs to, if it's a matrix. Runtime arrays and opaque types have no fixed
+// size, so are 0. Fails on undefined types and on nesting deeper than any real shader's,
+// which a malformed module could make cyclic
+static int _getTypeSize( const SpirvModule *_module, uint32_t _typeId, uint32_t _matrixStride,
+                         uint32_t _depth, uint32_t *_size ){
+    if( _depth > SPIRV_MAX_TYPE_DEPTH ){
+        LOG( ERR, "SPIR-V type %u nested too deeply", _typeId );
+        return 1;
+    }
+    const uint32_t *type = _getInstruction( _module, _typeId );
+    if( !type ){
+        LOG( ERR, "SPIR-V type %u undefined", _typeId );
+        return 1;
+    }
+    uint32_t elementSize = 0;
+    switch( _getOpcode( type ) ){
+        case SPIRV_OP_TYPE_INT:
+        case SPIRV_OP_TYPE_FLOAT:
+            *_size = type[ 2 ] / 8;
+            return 0;
+        case SPIRV_OP_TYPE_VECTOR:
+            if( _getTypeSize( _module, type[ 2 ], 0, _depth + 1, &elementSize ) ){
+                return 1;
+            }
+            *_size = type[ 3 ] * elementSize;
+            return 0;
+        case SPIRV_OP_TYPE_MATRIX:
+            if( !_matrixStride &&
+                _getTypeSize( _module, type[ 2 ], 0, _depth + 1, &elementSize ) ){
+                return 1;
+            }
+            *_size = type[ 3 ] * ( _matrixStride ? _matrixStride : elementSize );
+            return 0;
+        case SPIRV_OP_TYPE_ARRAY:{
+            const uint32_t *length = _getInstruction( _module, type[ 3 ] );
+            if( _getOpcode( length ) != SPIRV_OP_CONSTANT ){
+                *_size = 0;
+                return 0;
+            }
+            uint32_t stride = _module->ids[ _typeId ].arrayStride;
+            if( !stride && _getTypeSize( _module, type[ 2 ], _matrixStride, _depth + 1, &stride ) ){
+                return 1;
+            }
+            *_size = length[ 3 ] * stride;
+            return 0;
+        }
+        case SPIRV_OP_TYPE_STRUCT:{
+            // Unpadded, i.e. up to the end of the last member
+            uint32_t numMembers = ( type[ 0 ] >> 16 ) - 2;
+            uint32_t size = 0;
+            for( uint32_t i = 0; i < numMembers; i++ ){
+                uint32_t offset = 0;
+                uint32_t memberMatrixStride = 0;
+                _getMemberDecoration( _module, _typeId, i, SPIRV_DECORATION_OFFSET, &offset );
+                _getMemberDecoration( _module, _typeId, i, SPIRV_DECORATION_MATRIX_STRIDE,
+                                      &memberMatrixStride );
+                uint32_t memberSize;
+                if( _getTypeSize( _module, type[ 2 + i ], memberMatrixStride, _depth + 1,
+                                  &memberSize ) ){
+                    return 1;
+                }
+                if( offset + memberSize > size ){
+                    size = offset + memberSize;
+                }
+            }
+            *_size = size;
+            return 0;
+        }
+        default:
+            *_size = 0;
+            return 0;
+    }
+}
+
+static PomShaderDataTypes _getAttributeDataType( const SpirvModule *_module, uint32_t _typeId ){
+    const uint32_t *type = _getInstruction( _module, _typeId );
+    switch( _getOpcode( type ) ){
+        case SPIRV_OP_TYPE_FLOAT:
+            return type[ 2 ] == 32 ? SHADER_FLOAT : SHADER_DATATYPE_UNKNOWN;
+        case SPIRV_OP_TYPE_INT:
+            switch( type[ 2 ] ){
+                case 8:
+                    return SHADER_INT8;
+                case 16:
+                    return SHADER_INT16;
+                case 32:
+                    return SHADER_INT32;
+                case 64:
+                    return SHADER_INT64;
+                default:
+                    return SHADER_DATATYPE_UNKNOWN;
+            }
+        case SPIRV_OP_TYPE_VECTOR:
+            if( _getAttributeDataType( _module, type[ 2 ] ) != SHADER_FLOAT ){
+                return SHADER_DATATYPE_UNKNOWN;
+            }
+            switch( type[ 3 ] ){
+                case 2:
+                    return SHADER_VEC2;
+                case 3:
+                    return SHADER_VEC3;
+                case 4:
+                    return SHADER_VEC4;
+                default:
+                    return SHADER_DATATYPE_UNKNOWN;
+            }
+        default:
+            return SHADER_DATATYPE_UNKNOWN;
+    }
+}
+
+static VkDescriptorType _getDescriptorType( const SpirvModule *_module, uint32_t _storageClass,
+                                            uint32_t _typeId ){
+    const uint32_t *type = _getInstruction( _module, _typeId );
+    switch( _storageClass ){
+        case SPIRV_STORAGE_UNIFORM:
+            return ( _module->ids[ _typeId ].flags & SPIRV_ID_BUFFER_BLOCK ) ?
+                       VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        case SPIRV_STORAGE_STORAGE_BUFFER:
+            return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        case SPIRV_STORAGE_UNIFORM_CONSTANT:
+            break;
+        default:
+            return VK_DESCRIPTOR_TYPE_MAX_ENUM;
+    }
+    switch( _getOpcode( type ) ){
+        case SPIRV_OP_TYPE_SAMPLER:
+            return VK_DESCRIPTOR_TYPE_SAMPLER;
+        case SPIRV_OP_TYPE_SAMPLED_IMAGE:
+            return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        case SPIRV_OP_TYPE_IMAGE:
+            if( type[ 3 ] == SPIRV_DIM_BUFFER ){
+                return type[ 7 ] == SPIRV_IMAGE_STORAGE ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER :
+                                                          VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+            }
+            if( type[ 3 ] == SPIRV_DIM_SUBPASS_DATA ){
+                return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+            }
+            return type[ 7 ] == SPIRV_IMAGE_STORAGE ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE :
+                                                      VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        case SPIRV_OP_TYPE_ACCELERATION_STRUCTURE:
+            return VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV;
+        default:
+            return VK_DESCRIPTOR_TYPE_MAX_ENUM;
+    }
+}
+
+// Blocks are named after their type (e.g. CameraUBO), everything else after the variable
+static char *_copyName( const SpirvModule *_module, uint32_t _variableId, uint32_t _typeId ){
+    const char *name = NULL;
+    if( _module->ids[ _typeId ].flags & ( SPIRV_ID_BLOCK | SPIRV_ID_BUFFER_BLOCK ) ){
+        name = _module->ids[ _typeId ].name;
+    }
+    if( !name || !*name ){
+        name = _module->ids[ _variableId ].name;
+    }
+    char unnamed[ 32 ];
+    if( !name || !*name ){
+        // Names may have been stripped, so fall back to something unique
+        snprintf( unnamed, sizeof( unnamed ), "unnamed_%u", _variableId );
+        name = unnamed;
+    }
+    size_t nameLen = strlen( name ) + 1;
+    char *nameCopy = (char*) malloc( nameLen );
+    if( nameCopy ){
+        memcpy( nameCopy, name, nameLen );
+    }
+    return nameCopy;
+}
+
+static int _addAttribute( const SpirvModule *_module, uint32_t _variableId, uint32_t _typeId,
+                          PomShaderFormat *_format ){
+    const SpirvId *variable = &_module->ids[ _variableId ];
+    PomShaderDataTypes dataType = _getAttributeDataType( _module, _typeId );
+    for( uint32_t i = 0; i < _format->numAttributeInfo; i++ ){
+        PomShaderAttributeInfo *existing = &_format->attributeInfoOffset[ i ];
+        if( existing->location == variable->location ){
+            if( existing->dataType != dataType ){
+                LOG( ERR, "Variants disagree on the type of attribute %u", variable->location );
+                return 1;
+            }
+            return 0;
+        }
+    }
+    if( dataType == SHADER_DATATYPE_UNKNOWN ){
+        LOG( ERR, "Unsupported type for vertex attribute at location %u", variable->location );
+        return 1;
+    }
+    PomShaderAttributeInfo *attrInfos = (PomShaderAttributeInfo*)
+        realloc( _format->attributeInfoOffset,
+                 ( _format->numAttributeInfo + 1 ) * sizeof( PomShaderAttributeInfo ) );
+    if( !attrInfos ){
+        LOG( ERR, "Failed to allocate attribute info" );
+        return 1;
+    }
+    _format->attributeInfoOffset = attrInfos;
+    // Insert in location order
+    uint32_t insertIdx = _format->numAttributeInfo;
+    while( insertIdx > 0 && attrInfos[ insertIdx - 1 ].location > variable->location ){
+        attrInfos[ insertIdx ] = attrInfos[ insertIdx - 1 ];
+        insertIdx--;
+    }
+    attrInfos[ insertIdx ] = (PomShaderAttributeInfo){
+        .nameOffset = _copyName( _module, _variableId, _typeId ),
+        .dataType = dataType,
+        .location = variable->location
+    };
+    _format->numAttributeInfo++;
+    return attrInfos[ insertIdx ].nameOffset ? 0 : 1;
+}
+
+static int _addDescriptor( const SpirvModule *_module, uint32_t _variableId, uint32_t _storageClass,
+                           uint32_t _typeId, PomShaderFormat *_format ){
+    const SpirvId *variable = &_module->ids[ _variableId ];
+    if( !( variable->flags & SPIRV_ID_HAS_BINDING ) ){
+        LOG( ERR, "Descriptor %u has no binding", _variableId );
+        return 1;
+    }
+    // Arrays of descriptors take up one binding with a count
+    uint32_t count = 1;
+    const uint32_t *type = _getInstruction( _module, _typeId );
+    if( _getOpcode( type ) == SPIRV_OP_TYPE_ARRAY ){
+        const uint32_t *length = _getInstruction( _module, type[ 3 ] );
+        count = _getOpcode( length ) == SPIRV_OP_CONSTANT ? length[ 3 ] : 1;
+        _typeId = type[ 2 ];
+    }else if( _getOpcode( type ) == SPIRV_OP_TYPE_RUNTIME_ARRAY ){
+        // TODO - support descriptor indexing
+        LOG( ERR, "Runtime array of descriptors at binding %u is unsupported", variable->binding );
+        return 1;
+    }
+    VkDescriptorType descType = _getDescriptorType( _module, _storageClass, _typeId );
+    if( descType == VK_DESCRIPTOR_TYPE_MAX_ENUM ){
+        LOG( ERR, "Unsupported descriptor type for binding %u", variable->binding );
+        return 1;
+    }
+    // Sets are 0 unless the shader says otherwise
+    uint32_t set = variable->set;
+    uint32_t sizeBytes;
+    if( _getTypeSize( _module, _typeId, 0, 0, &sizeBytes ) ){
+        return 1;
+    }
+
+    for( uint32_t i = 0; i < _format->numDescriptorInfo; i++ ){
+        PomShaderDescriptorInfo *existing = &_format->descriptorInfoOffset[ i ];
+        if( existing->set == set && existing->binding == variable->binding ){
+            if( existing->type != descType || existing->count != count ){
+                LOG( ERR, "Variants disagree on descriptor at set %u binding %u", set,
+                     variable->binding );
+                return 1;
+            }
+            if( sizeBytes > existing->unpaddedSizeBytes ){
+                existing->unpaddedSizeBytes = sizeBytes;
+            }
+            return 0;
+        }
+    }
+    PomShaderDescriptorInfo *descInfos = (PomShaderDescriptorInfo*)
+        realloc( _format->descriptorInfoOffset,
+                 ( _format->numDescriptorInfo + 1 ) * sizeof( PomShaderDescriptorInfo ) );
+    if( !descInfos ){
+        LOG( ERR, "Failed to allocate descriptor info" );
+        return 1;
+    }
+    _format->descriptorInfoOffset = descInfos;
+    // Insert in set, then binding order
+    uint32_t insertIdx = _format->numDescriptorInfo;
+    while( insertIdx > 0 &&
+           ( descInfos[ insertIdx - 1 ].set > set ||
+             ( descInfos[ insertIdx - 1 ].set == set &&
+               descInfos[ insertIdx - 1 ].binding > variable->binding ) ) ){
+        descInfos[ insertIdx ] = descInfos[ insertIdx - 1 ];
+        insertIdx--;
+    }
+    descInfos[ insertIdx ] = (PomShaderDescriptorInfo){
+        .nameOffset = _copyName( _module, _variableId, _typeId ),
+        .unpaddedSizeBytes = sizeBytes,
+        .set = set,
+        .binding = variable->binding,
+        .type = descType,
+        .count = count
+    };
+    _format->numDescriptorInfo++;
+    return descInfos[ insertIdx ].nameOffset ? 0 : 1;
+}
+
+// GLSL allows one push constant block per stage, so there's one range per stage
+static int _addPushConstant( const SpirvModule *_module, uint32_t _variableId, uint32_t _typeId,
+                             PomShaderFormat *_format ){
+    const uint32_t *type = _getInstruction( _module, _typeId );
+    if( _getOpcode( type ) != SPIRV_OP_TYPE_STRUCT ){
+        LOG( ERR, "Push constant is not a block" );
+        return 1;
+    }
+    // Range starts at the first member, which needn't be at offset 0
+    uint32_t numMembers = ( type[ 0 ] >> 16 ) - 2;
+    uint32_t rangeStart = UINT32_MAX;
+    for( uint32_t i = 0; i < numMembers; i++ ){
+        uint32_t offset = 0;
+        _getMemberDecoration( _module, _typeId, i, SPIRV_DECORATION_OFFSET, &offset );
+        if( offset < rangeStart ){
+            rangeStart = offset;
+        }
+    }
+    if( rangeStart == UINT32_MAX ){
+        rangeStart = 0;
+    }
+    uint32_t rangeEnd;
+    if( _getTypeSize( _module, _typeId, 0, 0, &rangeEnd ) ){
+        return 1;
+    }
+
+    if( _format->numPushConstantInfo ){
+        // Variants may use different parts of the block
+        PomShaderPushConstantInfo *existing = &_format->pushConstantInfoOffset[ 0 ];
+        uint32_t existingEnd = existing->offset + existing->sizeBytes;
+        if( rangeStart > existing->offset ){
+            rangeStart = existing->offset;
+        }
+        if( rangeEnd < existingEnd ){
+            rangeEnd = existingEnd;
+        }
+        existing->offset = rangeStart;
+        existing->sizeBytes = rangeEnd - rangeStart;
+        return 0;
+    }
+    PomShaderPushConstantInfo *pushInfo =
+        (PomShaderPushConstantInfo*) malloc( sizeof( PomShaderPushConstantInfo ) );
+    if( !pushInfo ){
+        LOG( ERR, "Failed to allocate push constant info" );
+        return 1;
+    }
+    *pushInfo = (PomShaderPushConstantInfo){
+        .nameOffset = _copyName( _module, _variableId, _typeId ),
+        .offset = rangeStart,
+        .sizeBytes = rangeEnd - rangeStart
+    };
+    _format->pushConstantInfoOffset = pushInfo;
+    _format->numPushConstantInfo = 1;
+    return pushInfo->nameOffset ? 0 : 1;
+}
+
+int pomSpirvReflect( const uint32_t *_spirv, size_t _sizeBytes, PomShaderFormat *_format ){
+    SpirvModule module = { 0 };
+    int err = 0;
+    if( _parseModule( _spirv, _sizeBytes, &module ) ){
+        err = 1;
+        goto reflectCleanup;
+    }
+    if( module.stage == VK_SHADER_STAGE_FLAG_BITS_MAX_ENUM ){
+        LOG( ERR, "SPIR-V module has no supported entry point" );
+        err = 1;
+        goto reflectCleanup;
+    }
+    if( _format->shaderStage && _format->shaderStage != module.stage ){
+        LOG( ERR, "Variants are for different shader stages" );
+        err = 1;
+        goto reflectCleanup;
+    }
+    _format->shaderStage = module.stage;
+
+    for( uint32_t id = 0; id < module.idBound && !err; id++ ){
+        const uint32_t *variable = module.ids[ id ].instruction;
+        if( _getOpcode( variable ) != SPIRV_OP_VARIABLE ){
+            continue;
+        }
+        uint32_t storageClass = variable[ 3 ];
+        const uint32_t *pointer = _getInstruction( &module, variable[ 1 ] );
+        if( _getOpcode( pointer ) != SPIRV_OP_TYPE_POINTER ){
+            continue;
+        }
+        uint32_t typeId = pointer[ 3 ];
+        if( typeId >= module.idBound ){
+            LOG( ERR, "SPIR-V id out of bounds" );
+            err = 1;
+            break;
+        }
+        switch( storageClass ){
+            case SPIRV_STORAGE_INPUT:
+                // Only vertex inputs are attributes, and builtins are supplied by the pipeline
+                if( module.stage == VK_SHADER_STAGE_VERTEX_BIT &&
+                    ( module.ids[ id ].flags & SPIRV_ID_HAS_LOCATION ) &&
+                    !( module.ids[ id ].flags & SPIRV_ID_BUILTIN ) ){
+                    err = _addAttribute( &module, id, typeId, _format );
+                }
+                break;
+            case SPIRV_STORAGE_UNIFORM_CONSTANT:
+            case SPIRV_STORAGE_UNIFORM:
+            case SPIRV_STORAGE_STORAGE_BUFFER:
+                err = _addDescriptor( &module, id, storageClass, typeId, _format );
+                break;
+            case SPIRV_STORAGE_PUSH_CONSTANT:
+                err = _addPushConstant( &module, id, typeId, _format );
+                break;
+            default:
+                break;
+        }
+    }
+
+reflectCleanup:
+    free( module.ids );
+    return err;
+}
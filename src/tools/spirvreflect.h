@@ -0,0 +1,16 @@
+#ifndef POM_SPIRV_REFLECT_H
+#define POM_SPIRV_REFLECT_H
+
+#include "pomShaderFormat.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Read the stage, vertex attributes, descriptors and push constants out of a SPIR-V
+// module and add them to _format. Calling this for each variant of a shader merges
+// their interfaces, so the infos describe every variant. Attributes are kept sorted
+// by location and descriptors by set then binding.
+// Infos and their names are allocated individually, to be freed by the caller.
+// Returns 0 on success, 1 on failure
+int pomSpirvReflect( const uint32_t *_spirv, size_t _sizeBytes, PomShaderFormat *_format );
+
+#endif // POM_SPIRV_REFLECT_H
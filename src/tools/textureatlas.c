@@ -0,0 +1,157 @@
+#include "common.h"
+#include "textureatlas.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG( level, log, ... ) LOG_MODULE( level, TextureAtlas, log, ##__VA_ARGS__ )
+
+#define ALIGN_4( x ) ( ( ( x ) + 3 ) & ~3u )
+
+typedef struct AtlasShelf AtlasShelf;
+
+struct AtlasShelf{
+    uint32_t y;
+    uint32_t height;
+    uint32_t nextX;
+};
+
+static const PomAtlasRect *sortRects;
+
+static int compareRectHeight( const void *_a, const void *_b ){
+    uint32_t a = *(const uint32_t*) _a, b = *(const uint32_t*) _b;
+    // Tallest first, then widest, then original order to keep things deterministic
+    if( sortRects[ a ].height != sortRects[ b ].height ){
+        return sortRects[ a ].height > sortRects[ b ].height ? -1 : 1;
+    }
+    if( sortRects[ a ].width != sortRects[ b ].width ){
+        return sortRects[ a ].width > sortRects[ b ].width ? -1 : 1;
+    }
+    return ( a > b ) - ( a < b );
+}
+
+int pomAtlasPack( PomAtlasRect *_rects, uint32_t _numRects, uint32_t _pageSize,
+                  uint32_t _padding, uint32_t *_numPages, uint32_t *_pageHeights ){
+    *_numPages = 0;
+    if( _numRects == 0 ){
+        return 0;
+    }
+    // Regions are only 4-texel aligned if their gutters are
+    _padding = ALIGN_4( _padding );
+    uint32_t *order = (uint32_t*) malloc( sizeof( uint32_t ) * _numRects );
+    // Worst case is one shelf per rect
+    AtlasShelf *shelves = (AtlasShelf*) malloc( sizeof( AtlasShelf ) * _numRects );
+    if( !order || !shelves ){
+        LOG( ERR, "Failed to allocate atlas packing memory" );
+        free( order );
+        free( shelves );
+        return 1;
+    }
+    for( uint32_t i = 0; i < _numRects; i++ ){
+        order[ i ] = i;
+    }
+    sortRects = _rects;
+    qsort( order, _numRects, sizeof( uint32_t ), compareRectHeight );
+
+    int err = 0;
+    uint32_t numShelves = 0, pageIdx = 0, pageUsedHeight = 0;
+    for( uint32_t i = 0; i < _numRects; i++ ){
+        PomAtlasRect *rect = &_rects[ order[ i ] ];
+        uint32_t paddedWidth = ALIGN_4( rect->width + 2 * _padding );
+        uint32_t paddedHeight = ALIGN_4( rect->height + 2 * _padding );
+        if( paddedWidth > _pageSize || paddedHeight > _pageSize ){
+            LOG( ERR, "Region %ux%u does not fit in a %u atlas page", rect->width, rect->height, _pageSize );
+            err = 1;
+            goto packFailure;
+        }
+
+        // First shelf on the current page with room
+        AtlasShelf *shelf = NULL;
+        for( uint32_t s = 0; s < numShelves; s++ ){
+            if( shelves[ s ].height >= paddedHeight && shelves[ s ].nextX + paddedWidth <= _pageSize ){
+                shelf = &shelves[ s ];
+                break;
+            }
+        }
+        if( !shelf ){
+            if( pageUsedHeight + paddedHeight > _pageSize ){
+                // Start a new page
+                _pageHeights[ pageIdx++ ] = pageUsedHeight;
+                numShelves = 0;
+                pageUsedHeight = 0;
+            }
+            shelf = &shelves[ numShelves++ ];
+            *shelf = (AtlasShelf){
+                .y = pageUsedHeight,
+                .height = paddedHeight,
+                .nextX = 0
+            };
+            pageUsedHeight += paddedHeight;
+        }
+        rect->x = shelf->nextX + _padding;
+        rect->y = shelf->y + _padding;
+        rect->page = pageIdx;
+        shelf->nextX += paddedWidth;
+    }
+    _pageHeights[ pageIdx ] = pageUsedHeight;
+    *_numPages = pageIdx + 1;
+
+packFailure:
+    free( shelves );
+    free( order );
+    return err;
+}
+
+static inline void fetchTexel( const uint8_t *_src, uint32_t _srcChannels, uint8_t _rgba[ 4 ] ){
+    switch( _srcChannels ){
+        case 1:
+            _rgba[ 0 ] = _rgba[ 1 ] = _rgba[ 2 ] = _src[ 0 ]; _rgba[ 3 ] = 255;
+            break;
+        case 2:
+            _rgba[ 0 ] = _rgba[ 1 ] = _rgba[ 2 ] = _src[ 0 ]; _rgba[ 3 ] = _src[ 1 ];
+            break;
+        case 3:
+            _rgba[ 0 ] = _src[ 0 ]; _rgba[ 1 ] = _src[ 1 ]; _rgba[ 2 ] = _src[ 2 ]; _rgba[ 3 ] = 255;
+            break;
+        default:
+            memcpy( _rgba, _src, 4 );
+            break;
+    }
+}
+
+void pomAtlasBlit( uint8_t *_atlas, uint32_t _atlasWidth, uint32_t _atlasHeight, uint32_t _atlasChannels,
+                   const uint8_t *_src, uint32_t _srcWidth, uint32_t _srcHeight, uint32_t _srcChannels,
+                   uint32_t _x, uint32_t _y, uint32_t _padding ){
+    // Fill the whole gutter pomAtlasPack left
+    _padding = ALIGN_4( _padding );
+    int32_t startY = (int32_t) _y - (int32_t) _padding, endY = (int32_t) ( _y + _srcHeight + _padding );
+    int32_t startX = (int32_t) _x - (int32_t) _padding, endX = (int32_t) ( _x + _srcWidth + _padding );
+    for( int32_t ay = startY; ay < endY; ay++ ){
+        if( ay < 0 || ay >= (int32_t) _atlasHeight ){
+            continue;
+        }
+        // Clamp into the source so the gutter replicates the edges
+        int32_t sy = ay - (int32_t) _y;
+        sy = sy < 0 ? 0 : ( sy >= (int32_t) _srcHeight ? (int32_t) _srcHeight - 1 : sy );
+        for( int32_t ax = startX; ax < endX; ax++ ){
+            if( ax < 0 || ax >= (int32_t) _atlasWidth ){
+                continue;
+            }
+            int32_t sx = ax - (int32_t) _x;
+            sx = sx < 0 ? 0 : ( sx >= (int32_t) _srcWidth ? (int32_t) _srcWidth - 1 : sx );
+            uint8_t rgba[ 4 ];
+            fetchTexel( &_src[ ( (size_t) sy * _srcWidth + sx ) * _srcChannels ], _srcChannels, rgba );
+            uint8_t *dst = &_atlas[ ( (size_t) ay * _atlasWidth + ax ) * _atlasChannels ];
+            switch( _atlasChannels ){
+                case 1:
+                    dst[ 0 ] = rgba[ 0 ];
+                    break;
+                case 2:
+                    dst[ 0 ] = rgba[ 0 ]; dst[ 1 ] = rgba[ 3 ];
+                    break;
+                default:
+                    memcpy( dst, rgba, _atlasChannels );
+                    break;
+            }
+        }
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef POM_TEXTURE_ATLAS_H
+#define POM_TEXTURE_ATLAS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct PomAtlasRect PomAtlasRect;
+
+// A region to be packed. width/height are the unpadded size in texels; x/y/page
+// are filled in by pomAtlasPack and give the unpadded region's position.
+struct PomAtlasRect{
+    uint32_t width;
+    uint32_t height;
+    uint32_t x;
+    uint32_t y;
+    uint32_t page;
+};
+
+// Shelf-pack rects into square pages of _pageSize texels. Each rect gets _padding
+// texels of gutter on every side, rounded up to a multiple of 4, and positions are
+// kept 4-texel aligned so regions line up with compression blocks. _pageHeights
+// receives the used height of each page (also 4-texel aligned) and must hold
+// _numRects entries.
+int pomAtlasPack( PomAtlasRect *_rects, uint32_t _numRects, uint32_t _pageSize,
+                  uint32_t _padding, uint32_t *_numPages, uint32_t *_pageHeights );
+
+// Copy a texture into an atlas page, filling the gutter (_padding, rounded up as by
+// pomAtlasPack) by replicating edge texels
+// so mip filtering doesn't pull in neighbouring regions. Source texels are converted
+// to the atlas channel count (1/2 channel sources are treated as grey/grey + alpha).
+void pomAtlasBlit( uint8_t *_atlas, uint32_t _atlasWidth, uint32_t _atlasHeight, uint32_t _atlasChannels,
+                   const uint8_t *_src, uint32_t _srcWidth, uint32_t _srcHeight, uint32_t _srcChannels,
+                   uint32_t _x, uint32_t _y, uint32_t _padding );
+
+#endif // POM_TEXTURE_ATLAS_H
@@ -0,0 +1,753 @@
+#include "common.h"
+#include "textureencode.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define LOG( level, log, ... ) LOG_MODULE( level, TextureEncode, log, ##__VA_ARGS__ )
+
+#define KAISER_RADIUS 3.0f
+#define KAISER_ALPHA 4.0f
+
+typedef struct TexelImage TexelImage;
+
+// Working image, always RGBA floats. Colour textures are held in linear space.
+struct TexelImage{
+    uint32_t width;
+    uint32_t height;
+    float *texels;
+};
+
+static float srgbToLinearTable[ 256 ];
+static bool srgbTableInitialised = false;
+
+static void initSrgbTable( void ){
+    if( srgbTableInitialised ){
+        return;
+    }
+    for( uint32_t i = 0; i < 256; i++ ){
+        float c = (float) i / 255.0f;
+        srgbToLinearTable[ i ] = ( c <= 0.04045f ) ? c / 12.92f : powf( ( c + 0.055f ) / 1.055f, 2.4f );
+    }
+    srgbTableInitialised = true;
+}
+
+static inline float linearToSrgb( float _c ){
+    if( _c <= 0.0031308f ){
+        return _c * 12.92f;
+    }
+    return 1.055f * powf( _c, 1.0f / 2.4f ) - 0.055f;
+}
+
+static inline uint8_t unormToU8( float _c ){
+    if( _c <= 0.0f ) return 0;
+    if( _c >= 1.0f ) return 255;
+    return (uint8_t) ( _c * 255.0f + 0.5f );
+}
+
+static inline uint32_t maxU32( uint32_t _a, uint32_t _b ){
+    return _a > _b ? _a : _b;
+}
+
+static inline int32_t clampI32( int32_t _v, int32_t _min, int32_t _max ){
+    return _v < _min ? _min : ( _v > _max ? _max : _v );
+}
+
+static size_t getBlockSizeBytes( PomModelTextureDataType _dataType ){
+    switch( _dataType ){
+        case POM_TEXTURE_DATA_BC1:
+        case POM_TEXTURE_DATA_BC4:
+            return 8;
+        case POM_TEXTURE_DATA_BC3:
+        case POM_TEXTURE_DATA_BC5:
+        case POM_TEXTURE_DATA_BC7:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+static size_t getLevelSizeBytes( const PomTextureEncodeInfo *_info, uint32_t _width, uint32_t _height ){
+    if( _info->dataType == POM_TEXTURE_DATA_RAW_U8 ){
+        return (size_t) _width * _height * _info->dataUnitSizeBytes;
+    }
+    size_t blocksX = ( _width + 3 ) / 4;
+    size_t blocksY = ( _height + 3 ) / 4;
+    return blocksX * blocksY * _info->dataUnitSizeBytes;
+}
+
+int pomTextureEncodeGetInfo( const PomTextureEncodeOptions *_options, PomTextureUsage _usage,
+                             uint32_t _width, uint32_t _height, uint32_t _numChannels,
+                             PomTextureEncodeInfo *_info ){
+    if( _width == 0 || _height == 0 || _numChannels == 0 || _numChannels > 4 ){
+        LOG( ERR, "Invalid texture dimensions %ux%u, %u channels", _width, _height, _numChannels );
+        return 1;
+    }
+    // Single/dual channel textures can't sensibly be normal maps
+    if( _usage == POM_TEXTURE_USAGE_NORMAL && _numChannels < 3 ){
+        _usage = POM_TEXTURE_USAGE_DATA;
+    }
+
+    PomModelTextureDataType dataType = POM_TEXTURE_DATA_RAW_U8;
+    if( _options->compress ){
+        if( _usage == POM_TEXTURE_USAGE_NORMAL ){
+            // XY only, Z is reconstructed when sampling
+            dataType = POM_TEXTURE_DATA_BC5;
+        }else if( _numChannels == 1 ){
+            dataType = POM_TEXTURE_DATA_BC4;
+        }else if( _numChannels == 2 && _usage == POM_TEXTURE_USAGE_DATA ){
+            dataType = POM_TEXTURE_DATA_BC5;
+        }else if( _options->preferBc7 ){
+            dataType = POM_TEXTURE_DATA_BC7;
+        }else if( _numChannels == 3 ){
+            dataType = POM_TEXTURE_DATA_BC1;
+        }else{
+            // Colour + alpha (grey + alpha also ends up here)
+            dataType = POM_TEXTURE_DATA_BC3;
+        }
+    }
+
+    uint32_t numMipLevels = 1;
+    if( _options->generateMips ){
+        uint32_t maxDim = maxU32( _width, _height );
+        while( maxDim > 1 ){
+            maxDim >>= 1;
+            numMipLevels++;
+        }
+    }
+
+    *_info = (PomTextureEncodeInfo){
+        .dataType = dataType,
+        .usage = _usage,
+        .width = _width,
+        .height = _height,
+        .numSrcChannels = _numChannels,
+        .numMipLevels = numMipLevels,
+        .dataUnitSizeBytes = ( dataType == POM_TEXTURE_DATA_RAW_U8 ) ? _numChannels :
+                                                                        getBlockSizeBytes( dataType ),
+        .isSrgb = ( _usage == POM_TEXTURE_USAGE_COLOUR ) &&
+                  ( dataType != POM_TEXTURE_DATA_BC4 ) && ( dataType != POM_TEXTURE_DATA_BC5 ),
+        .encodedSizeBytes = 0
+    };
+
+    size_t totalSize = 0;
+    uint32_t levelWidth = _width, levelHeight = _height;
+    for( uint32_t i = 0; i < numMipLevels; i++ ){
+        totalSize += getLevelSizeBytes( _info, levelWidth, levelHeight );
+        levelWidth = maxU32( 1, levelWidth / 2 );
+        levelHeight = maxU32( 1, levelHeight / 2 );
+    }
+    _info->encodedSizeBytes = totalSize;
+    return 0;
+}
+
+/*
+* Mip generation
+*/
+
+// Expand source texels to RGBA8 (still in the source colour space)
+static void expandToRgba8( const uint8_t *_src, uint32_t _numTexels, uint32_t _numChannels,
+                           uint8_t *_dst ){
+    for( uint32_t i = 0; i < _numTexels; i++ ){
+        const uint8_t *s = &_src[ i * _numChannels ];
+        uint8_t *d = &_dst[ i * 4 ];
+        switch( _numChannels ){
+            case 1:
+                d[ 0 ] = d[ 1 ] = d[ 2 ] = s[ 0 ]; d[ 3 ] = 255;
+                break;
+            case 2:
+                d[ 0 ] = d[ 1 ] = d[ 2 ] = s[ 0 ]; d[ 3 ] = s[ 1 ];
+                break;
+            case 3:
+                d[ 0 ] = s[ 0 ]; d[ 1 ] = s[ 1 ]; d[ 2 ] = s[ 2 ]; d[ 3 ] = 255;
+                break;
+            default:
+                memcpy( d, s, 4 );
+                break;
+        }
+    }
+}
+
+static int loadTexelImage( const PomTextureEncodeInfo *_info, const uint8_t *_rgba8, TexelImage *_image ){
+    size_t numTexels = (size_t) _info->width * _info->height;
+    float *texels = (float*) malloc( numTexels * 4 * sizeof( float ) );
+    if( !texels ){
+        LOG( ERR, "Failed to allocate working image" );
+        return 1;
+    }
+    bool isColour = _info->usage == POM_TEXTURE_USAGE_COLOUR;
+    for( size_t i = 0; i < numTexels; i++ ){
+        for( uint32_t c = 0; c < 3; c++ ){
+            uint8_t v = _rgba8[ i * 4 + c ];
+            texels[ i * 4 + c ] = isColour ? srgbToLinearTable[ v ] : (float) v / 255.0f;
+        }
+        // Alpha is always linear
+        texels[ i * 4 + 3 ] = (float) _rgba8[ i * 4 + 3 ] / 255.0f;
+    }
+    *_image = (TexelImage){
+        .width = _info->width,
+        .height = _info->height,
+        .texels = texels
+    };
+    return 0;
+}
+
+static void storeTexelImage( const PomTextureEncodeInfo *_info, const TexelImage *_image, uint8_t *_rgba8 ){
+    size_t numTexels = (size_t) _image->width * _image->height;
+    bool isColour = _info->usage == POM_TEXTURE_USAGE_COLOUR;
+    for( size_t i = 0; i < numTexels; i++ ){
+        const float *t = &_image->texels[ i * 4 ];
+        for( uint32_t c = 0; c < 3; c++ ){
+            _rgba8[ i * 4 + c ] = unormToU8( isColour ? linearToSrgb( t[ c ] ) : t[ c ] );
+        }
+        _rgba8[ i * 4 + 3 ] = unormToU8( t[ 3 ] );
+    }
+}
+
+// Zeroth-order modified Bessel function of the first kind
+static float besselI0( float _x ){
+    float sum = 1.0f, term = 1.0f;
+    float halfX = _x * 0.5f;
+    for( uint32_t k = 1; k < 32; k++ ){
+        term *= ( halfX / (float) k ) * ( halfX / (float) k );
+        sum += term;
+        if( term < sum * 1e-8f ){
+            break;
+        }
+    }
+    return sum;
+}
+
+static float filterWeight( PomMipFilter _filter, float _x ){
+    if( _filter == POM_MIP_FILTER_BOX ){
+        return ( fabsf( _x ) <= 0.5f ) ? 1.0f : 0.0f;
+    }
+    // Kaiser-windowed sinc
+    float absX = fabsf( _x );
+    if( absX >= KAISER_RADIUS ){
+        return 0.0f;
+    }
+    float sinc = 1.0f;
+    if( absX > 1e-5f ){
+        float piX = (float) M_PI * _x;
+        sinc = sinf( piX ) / piX;
+    }
+    float r = _x / KAISER_RADIUS;
+    float window = besselI0( KAISER_ALPHA * sqrtf( 1.0f - r * r ) ) / besselI0( KAISER_ALPHA );
+    return sinc * window;
+}
+
+static float filterRadius( PomMipFilter _filter ){
+    return ( _filter == POM_MIP_FILTER_BOX ) ? 0.5f : KAISER_RADIUS;
+}
+
+// Resample one row/column of RGBA texels. Coordinates outside the source are clamped.
+static void resampleLine( PomMipFilter _filter, const float *_src, uint32_t _srcCount, size_t _srcStride,
+                          float *_dst, uint32_t _dstCount, size_t _dstStride ){
+    float scale = (float) _srcCount / (float) _dstCount;
+    float support = filterRadius( _filter ) * scale;
+    for( uint32_t i = 0; i < _dstCount; i++ ){
+        float centre = ( (float) i + 0.5f ) * scale;
+        int32_t start = (int32_t) floorf( centre - support );
+        int32_t end = (int32_t) ceilf( centre + support );
+        float accum[ 4 ] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        float weightSum = 0.0f;
+        for( int32_t s = start; s <= end; s++ ){
+            float weight = filterWeight( _filter, ( (float) s + 0.5f - centre ) / scale );
+            if( weight == 0.0f ){
+                continue;
+            }
+            int32_t srcIdx = clampI32( s, 0, (int32_t) _srcCount - 1 );
+            const float *texel = &_src[ (size_t) srcIdx * _srcStride ];
+            for( uint32_t c = 0; c < 4; c++ ){
+                accum[ c ] += texel[ c ] * weight;
+            }
+            weightSum += weight;
+        }
+        float *dstTexel = &_dst[ (size_t) i * _dstStride ];
+        for( uint32_t c = 0; c < 4; c++ ){
+            dstTexel[ c ] = ( weightSum != 0.0f ) ? accum[ c ] / weightSum : 0.0f;
+        }
+    }
+}
+
+static int downsampleImage( PomMipFilter _filter, const TexelImage *_src, TexelImage *_dst ){
+    uint32_t dstWidth = maxU32( 1, _src->width / 2 );
+    uint32_t dstHeight = maxU32( 1, _src->height / 2 );
+    float *horizontal = (float*) malloc( (size_t) dstWidth * _src->height * 4 * sizeof( float ) );
+    float *dstTexels = (float*) malloc( (size_t) dstWidth * dstHeight * 4 * sizeof( float ) );
+    if( !horizontal || !dstTexels ){
+        LOG( ERR, "Failed to allocate mip working memory" );
+        free( horizontal );
+        free( dstTexels );
+        return 1;
+    }
+    // Separable; filter rows first, then columns
+    for( uint32_t y = 0; y < _src->height; y++ ){
+        resampleLine( _filter, &_src->texels[ (size_t) y * _src->width * 4 ], _src->width, 4,
+                      &horizontal[ (size_t) y * dstWidth * 4 ], dstWidth, 4 );
+    }
+    for( uint32_t x = 0; x < dstWidth; x++ ){
+        resampleLine( _filter, &horizontal[ (size_t) x * 4 ], _src->height, (size_t) dstWidth * 4,
+                      &dstTexels[ (size_t) x * 4 ], dstHeight, (size_t) dstWidth * 4 );
+    }
+    free( horizontal );
+    *_dst = (TexelImage){
+        .width = dstWidth,
+        .height = dstHeight,
+        .texels = dstTexels
+    };
+    return 0;
+}
+
+static void renormaliseNormals( TexelImage *_image ){
+    size_t numTexels = (size_t) _image->width * _image->height;
+    for( size_t i = 0; i < numTexels; i++ ){
+        float *t = &_image->texels[ i * 4 ];
+        float n[ 3 ] = { t[ 0 ] * 2.0f - 1.0f, t[ 1 ] * 2.0f - 1.0f, t[ 2 ] * 2.0f - 1.0f };
+        float len = sqrtf( n[ 0 ] * n[ 0 ] + n[ 1 ] * n[ 1 ] + n[ 2 ] * n[ 2 ] );
+        if( len < 1e-6f ){
+            continue;
+        }
+        for( uint32_t c = 0; c < 3; c++ ){
+            t[ c ] = ( n[ c ] / len ) * 0.5f + 0.5f;
+        }
+    }
+}
+
+/*
+* Block compression
+*/
+
+// Principal axis of a set of points via power iteration. Falls back to the
+// diagonal for degenerate blocks.
+static void getPrincipalAxis( float _points[ 16 ][ 4 ], uint32_t _numComponents,
+                              float _mean[ 4 ], float _axis[ 4 ] ){
+    float cov[ 4 ][ 4 ] = { { 0 } };
+    for( uint32_t c = 0; c < 4; c++ ){
+        _mean[ c ] = 0.0f;
+    }
+    for( uint32_t i = 0; i < 16; i++ ){
+        for( uint32_t c = 0; c < _numComponents; c++ ){
+            _mean[ c ] += _points[ i ][ c ] / 16.0f;
+        }
+    }
+    for( uint32_t i = 0; i < 16; i++ ){
+        for( uint32_t a = 0; a < _numComponents; a++ ){
+            for( uint32_t b = 0; b < _numComponents; b++ ){
+                cov[ a ][ b ] += ( _points[ i ][ a ] - _mean[ a ] ) * ( _points[ i ][ b ] - _mean[ b ] );
+            }
+        }
+    }
+    float axis[ 4 ] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    for( uint32_t iter = 0; iter < 8; iter++ ){
+        float next[ 4 ] = { 0 };
+        float maxComponent = 0.0f;
+        for( uint32_t a = 0; a < _numComponents; a++ ){
+            for( uint32_t b = 0; b < _numComponents; b++ ){
+                next[ a ] += cov[ a ][ b ] * axis[ b ];
+            }
+            maxComponent = fmaxf( maxComponent, fabsf( next[ a ] ) );
+        }
+        if( maxComponent < 1e-6f ){
+            break;
+        }
+        for( uint32_t a = 0; a < _numComponents; a++ ){
+            axis[ a ] = next[ a ] / maxComponent;
+        }
+    }
+    for( uint32_t c = 0; c < 4; c++ ){
+        _axis[ c ] = ( c < _numComponents ) ? axis[ c ] : 0.0f;
+    }
+}
+
+// Find the points with the smallest and largest projection onto the principal axis
+static void getAxisExtents( float _points[ 16 ][ 4 ], uint32_t _numComponents,
+                            float _min[ 4 ], float _max[ 4 ] ){
+    float mean[ 4 ], axis[ 4 ];
+    getPrincipalAxis( _points, _numComponents, mean, axis );
+    float minProj = INFINITY, maxProj = -INFINITY;
+    uint32_t minIdx = 0, maxIdx = 0;
+    for( uint32_t i = 0; i < 16; i++ ){
+        float proj = 0.0f;
+        for( uint32_t c = 0; c < _numComponents; c++ ){
+            proj += ( _points[ i ][ c ] - mean[ c ] ) * axis[ c ];
+        }
+        if( proj < minProj ){ minProj = proj; minIdx = i; }
+        if( proj > maxProj ){ maxProj = proj; maxIdx = i; }
+    }
+    memcpy( _min, _points[ minIdx ], sizeof( float ) * 4 );
+    memcpy( _max, _points[ maxIdx ], sizeof( float ) * 4 );
+}
+
+static inline uint16_t packRgb565( const float _c[ 4 ] ){
+    uint32_t r = (uint32_t) clampI32( (int32_t) ( _c[ 0 ] * 31.0f / 255.0f + 0.5f ), 0, 31 );
+    uint32_t g = (uint32_t) clampI32( (int32_t) ( _c[ 1 ] * 63.0f / 255.0f + 0.5f ), 0, 63 );
+    uint32_t b = (uint32_t) clampI32( (int32_t) ( _c[ 2 ] * 31.0f / 255.0f + 0.5f ), 0, 31 );
+    return (uint16_t) ( ( r << 11 ) | ( g << 5 ) | b );
+}
+
+static inline void unpackRgb565( uint16_t _c, int32_t _out[ 3 ] ){
+    int32_t r = ( _c >> 11 ) & 0x1F, g = ( _c >> 5 ) & 0x3F, b = _c & 0x1F;
+    _out[ 0 ] = ( r << 3 ) | ( r >> 2 );
+    _out[ 1 ] = ( g << 2 ) | ( g >> 4 );
+    _out[ 2 ] = ( b << 3 ) | ( b >> 2 );
+}
+
+// Pick the nearest 4-colour palette entry for each texel. Returns the total squared error.
+static uint32_t chooseBc1Indices( float _points[ 16 ][ 4 ], uint16_t _c0, uint16_t _c1,
+                                  uint32_t *_indices ){
+    int32_t palette[ 4 ][ 3 ];
+    unpackRgb565( _c0, palette[ 0 ] );
+    unpackRgb565( _c1, palette[ 1 ] );
+    for( uint32_t c = 0; c < 3; c++ ){
+        palette[ 2 ][ c ] = ( 2 * palette[ 0 ][ c ] + palette[ 1 ][ c ] ) / 3;
+        palette[ 3 ][ c ] = ( palette[ 0 ][ c ] + 2 * palette[ 1 ][ c ] ) / 3;
+    }
+    uint32_t indices = 0, totalError = 0;
+    for( uint32_t i = 0; i < 16; i++ ){
+        uint32_t bestIdx = 0, bestError = UINT32_MAX;
+        for( uint32_t p = 0; p < 4; p++ ){
+            uint32_t error = 0;
+            for( uint32_t c = 0; c < 3; c++ ){
+                int32_t diff = (int32_t) _points[ i ][ c ] - palette[ p ][ c ];
+                error += (uint32_t) ( diff * diff );
+            }
+            if( error < bestError ){
+                bestError = error;
+                bestIdx = p;
+            }
+        }
+        indices |= bestIdx << ( i * 2 );
+        totalError += bestError;
+    }
+    *_indices = indices;
+    return totalError;
+}
+
+// Least-squares fit of the endpoints given a set of indices
+static bool refineBc1Endpoints( float _points[ 16 ][ 4 ], uint32_t _indices,
+                                float _c0[ 4 ], float _c1[ 4 ] ){
+    static const float weights0[ 4 ] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+    float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+    float ax[ 3 ] = { 0 }, bx[ 3 ] = { 0 };
+    for( uint32_t i = 0; i < 16; i++ ){
+        uint32_t idx = ( _indices >> ( i * 2 ) ) & 0x3;
+        float a = weights0[ idx ], b = 1.0f - a;
+        aa += a * a;
+        bb += b * b;
+        ab += a * b;
+        for( uint32_t c = 0; c < 3; c++ ){
+            ax[ c ] += a * _points[ i ][ c ];
+            bx[ c ] += b * _points[ i ][ c ];
+        }
+    }
+    float det = aa * bb - ab * ab;
+    if( fabsf( det ) < 1e-6f ){
+        return false;
+    }
+    float invDet = 1.0f / det;
+    for( uint32_t c = 0; c < 3; c++ ){
+        _c0[ c ] = ( ax[ c ] * bb - bx[ c ] * ab ) * invDet;
+        _c1[ c ] = ( bx[ c ] * aa - ax[ c ] * ab ) * invDet;
+    }
+    return true;
+}
+
+static void encodeBc1Block( float _points[ 16 ][ 4 ], uint8_t *_out ){
+    float minColour[ 4 ], maxColour[ 4 ];
+    getAxisExtents( _points, 3, minColour, maxColour );
+    uint16_t c0 = packRgb565( maxColour );
+    uint16_t c1 = packRgb565( minColour );
+    uint32_t indices = 0;
+    uint32_t error = chooseBc1Indices( _points, c0, c1, &indices );
+
+    float refined0[ 4 ], refined1[ 4 ];
+    if( c0 != c1 && refineBc1Endpoints( _points, indices, refined0, refined1 ) ){
+        uint16_t r0 = packRgb565( refined0 );
+        uint16_t r1 = packRgb565( refined1 );
+        uint32_t refinedIndices;
+        uint32_t refinedError = chooseBc1Indices( _points, r0, r1, &refinedIndices );
+        if( refinedError < error ){
+            c0 = r0;
+            c1 = r1;
+            indices = refinedIndices;
+        }
+    }
+
+    if( c0 < c1 ){
+        // c0 > c1 selects 4-colour mode, so swap endpoints and remap 0<->1, 2<->3
+        uint16_t tmp = c0;
+        c0 = c1;
+        c1 = tmp;
+        indices ^= 0x55555555;
+    }else if( c0 == c1 ){
+        indices = 0;
+    }
+
+    _out[ 0 ] = c0 & 0xFF;
+    _out[ 1 ] = c0 >> 8;
+    _out[ 2 ] = c1 & 0xFF;
+    _out[ 3 ] = c1 >> 8;
+    for( uint32_t i = 0; i < 4; i++ ){
+        _out[ 4 + i ] = ( indices >> ( i * 8 ) ) & 0xFF;
+    }
+}
+
+// Single channel block, shared by BC3 alpha, BC4 and BC5
+static void encodeBc4Block( const uint8_t _values[ 16 ], uint8_t *_out ){
+    uint8_t minVal = 255, maxVal = 0;
+    for( uint32_t i = 0; i < 16; i++ ){
+        if( _values[ i ] < minVal ) minVal = _values[ i ];
+        if( _values[ i ] > maxVal ) maxVal = _values[ i ];
+    }
+    _out[ 0 ] = maxVal;
+    _out[ 1 ] = minVal;
+    uint64_t indices = 0;
+    if( maxVal != minVal ){
+        // a0 > a1, so 8-value interpolation
+        int32_t palette[ 8 ];
+        palette[ 0 ] = maxVal;
+        palette[ 1 ] = minVal;
+        for( int32_t k = 1; k < 7; k++ ){
+            palette[ k + 1 ] = ( ( 7 - k ) * maxVal + k * minVal ) / 7;
+        }
+        for( uint32_t i = 0; i < 16; i++ ){
+            uint32_t bestIdx = 0;
+            int32_t bestError = INT32_MAX;
+            for( uint32_t p = 0; p < 8; p++ ){
+                int32_t error = abs( (int32_t) _values[ i ] - palette[ p ] );
+                if( error < bestError ){
+                    bestError = error;
+                    bestIdx = p;
+                }
+            }
+            indices |= (uint64_t) bestIdx << ( i * 3 );
+        }
+    }
+    for( uint32_t i = 0; i < 6; i++ ){
+        _out[ 2 + i ] = ( indices >> ( i * 8 ) ) & 0xFF;
+    }
+}
+
+typedef struct BitWriter{
+    uint8_t *data;
+    uint32_t bitPos;
+}BitWriter;
+
+static void writeBits( BitWriter *_writer, uint32_t _value, uint32_t _numBits ){
+    for( uint32_t i = 0; i < _numBits; i++ ){
+        if( ( _value >> i ) & 0x1 ){
+            _writer->data[ _writer->bitPos / 8 ] |= (uint8_t) ( 1 << ( _writer->bitPos % 8 ) );
+        }
+        _writer->bitPos++;
+    }
+}
+
+// Quantise an endpoint to 7 bits + shared p-bit, picking the p-bit with the least error
+static void quantiseBc7Endpoint( const float _colour[ 4 ], uint32_t _quantised[ 4 ], uint32_t *_pBit ){
+    float bestError = INFINITY;
+    for( uint32_t p = 0; p < 2; p++ ){
+        uint32_t q[ 4 ];
+        float error = 0.0f;
+        for( uint32_t c = 0; c < 4; c++ ){
+            int32_t v = (int32_t) floorf( ( _colour[ c ] - (float) p ) / 2.0f + 0.5f );
+            q[ c ] = (uint32_t) clampI32( v, 0, 127 );
+            float diff = _colour[ c ] - (float) ( ( q[ c ] << 1 ) | p );
+            error += diff * diff;
+        }
+        if( error < bestError ){
+            bestError = error;
+            memcpy( _quantised, q, sizeof( q ) );
+            *_pBit = p;
+        }
+    }
+}
+
+// BC7 mode 6: single subset, RGBA 7.7.7.7 endpoints with unique p-bits, 4-bit indices
+static void encodeBc7Block( float _points[ 16 ][ 4 ], uint8_t *_out ){
+    static const uint32_t weights[ 16 ] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+    float minColour[ 4 ], maxColour[ 4 ];
+    getAxisExtents( _points, 4, minColour, maxColour );
+
+    uint32_t endpoints[ 2 ][ 4 ], pBits[ 2 ];
+    quantiseBc7Endpoint( minColour, endpoints[ 0 ], &pBits[ 0 ] );
+    quantiseBc7Endpoint( maxColour, endpoints[ 1 ], &pBits[ 1 ] );
+
+    int32_t palette[ 16 ][ 4 ];
+    for( uint32_t c = 0; c < 4; c++ ){
+        int32_t e0 = (int32_t) ( ( endpoints[ 0 ][ c ] << 1 ) | pBits[ 0 ] );
+        int32_t e1 = (int32_t) ( ( endpoints[ 1 ][ c ] << 1 ) | pBits[ 1 ] );
+        for( uint32_t i = 0; i < 16; i++ ){
+            palette[ i ][ c ] = ( ( 64 - (int32_t) weights[ i ] ) * e0 + (int32_t) weights[ i ] * e1 + 32 ) >> 6;
+        }
+    }
+    uint32_t indices[ 16 ];
+    for( uint32_t i = 0; i < 16; i++ ){
+        uint32_t bestIdx = 0, bestError = UINT32_MAX;
+        for( uint32_t p = 0; p < 16; p++ ){
+            uint32_t error = 0;
+            for( uint32_t c = 0; c < 4; c++ ){
+                int32_t diff = (int32_t) _points[ i ][ c ] - palette[ p ][ c ];
+                error += (uint32_t) ( diff * diff );
+            }
+            if( error < bestError ){
+                bestError = error;
+                bestIdx = p;
+            }
+        }
+        indices[ i ] = bestIdx;
+    }
+    // The anchor index has an implicit 0 MSB, so flip the endpoints if needed
+    if( indices[ 0 ] & 0x8 ){
+        uint32_t tmpEndpoint[ 4 ];
+        memcpy( tmpEndpoint, endpoints[ 0 ], sizeof( tmpEndpoint ) );
+        memcpy( endpoints[ 0 ], endpoints[ 1 ], sizeof( tmpEndpoint ) );
+        memcpy( endpoints[ 1 ], tmpEndpoint, sizeof( tmpEndpoint ) );
+        uint32_t tmpPBit = pBits[ 0 ];
+        pBits[ 0 ] = pBits[ 1 ];
+        pBits[ 1 ] = tmpPBit;
+        for( uint32_t i = 0; i < 16; i++ ){
+            indices[ i ] = 15 - indices[ i ];
+        }
+    }
+
+    memset( _out, 0, 16 );
+    BitWriter writer = { .data = _out, .bitPos = 0 };
+    writeBits( &writer, 1 << 6, 7 ); // Mode 6
+    for( uint32_t c = 0; c < 4; c++ ){
+        writeBits( &writer, endpoints[ 0 ][ c ], 7 );
+        writeBits( &writer, endpoints[ 1 ][ c ], 7 );
+    }
+    writeBits( &writer, pBits[ 0 ], 1 );
+    writeBits( &writer, pBits[ 1 ], 1 );
+    writeBits( &writer, indices[ 0 ], 3 );
+    for( uint32_t i = 1; i < 16; i++ ){
+        writeBits( &writer, indices[ i ], 4 );
+    }
+}
+
+static void encodeBlockLevel( const PomTextureEncodeInfo *_info, const uint8_t *_rgba8,
+                              uint32_t _width, uint32_t _height, uint8_t *_dst ){
+    uint32_t blocksX = ( _width + 3 ) / 4;
+    uint32_t blocksY = ( _height + 3 ) / 4;
+    for( uint32_t by = 0; by < blocksY; by++ ){
+        for( uint32_t bx = 0; bx < blocksX; bx++ ){
+            // Gather the block, replicating edge texels for partial blocks
+            float points[ 16 ][ 4 ];
+            uint8_t channels[ 4 ][ 16 ];
+            for( uint32_t i = 0; i < 16; i++ ){
+                uint32_t x = bx * 4 + ( i % 4 ), y = by * 4 + ( i / 4 );
+                x = x < _width ? x : _width - 1;
+                y = y < _height ? y : _height - 1;
+                const uint8_t *texel = &_rgba8[ ( (size_t) y * _width + x ) * 4 ];
+                for( uint32_t c = 0; c < 4; c++ ){
+                    points[ i ][ c ] = (float) texel[ c ];
+                    channels[ c ][ i ] = texel[ c ];
+                }
+            }
+            uint8_t *out = &_dst[ ( (size_t) by * blocksX + bx ) * _info->dataUnitSizeBytes ];
+            switch( _info->dataType ){
+                case POM_TEXTURE_DATA_BC1:
+                    encodeBc1Block( points, out );
+                    break;
+                case POM_TEXTURE_DATA_BC3:
+                    encodeBc4Block( channels[ 3 ], out );
+                    encodeBc1Block( points, out + 8 );
+                    break;
+                case POM_TEXTURE_DATA_BC4:
+                    encodeBc4Block( channels[ 0 ], out );
+                    break;
+                case POM_TEXTURE_DATA_BC5:
+                    // Two channel sources were expanded as grey + alpha
+                    encodeBc4Block( channels[ 0 ], out );
+                    encodeBc4Block( channels[ _info->numSrcChannels == 2 ? 3 : 1 ], out + 8 );
+                    break;
+                case POM_TEXTURE_DATA_BC7:
+                    encodeBc7Block( points, out );
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+static void encodeRawLevel( const PomTextureEncodeInfo *_info, const uint8_t *_rgba8,
+                            uint32_t _width, uint32_t _height, uint8_t *_dst ){
+    size_t numTexels = (size_t) _width * _height;
+    uint32_t numChannels = _info->numSrcChannels;
+    for( size_t i = 0; i < numTexels; i++ ){
+        const uint8_t *s = &_rgba8[ i * 4 ];
+        uint8_t *d = &_dst[ i * numChannels ];
+        switch( numChannels ){
+            case 1:
+                d[ 0 ] = s[ 0 ];
+                break;
+            case 2:
+                d[ 0 ] = s[ 0 ]; d[ 1 ] = s[ 3 ];
+                break;
+            default:
+                memcpy( d, s, numChannels );
+                break;
+        }
+    }
+}
+
+int pomTextureEncode( const PomTextureEncodeOptions *_options, const PomTextureEncodeInfo *_info,
+                      const uint8_t *_srcData, uint8_t *_dstData ){
+    initSrgbTable();
+    int err = 0;
+    size_t numTexels = (size_t) _info->width * _info->height;
+    // Every subsequent level is smaller, so this is reused for the whole chain
+    uint8_t *levelRgba = (uint8_t*) malloc( numTexels * 4 );
+    if( !levelRgba ){
+        LOG( ERR, "Failed to allocate texture level memory" );
+        return 1;
+    }
+    expandToRgba8( _srcData, (uint32_t) numTexels, _info->numSrcChannels, levelRgba );
+
+    TexelImage currImage = { 0 };
+    if( _info->numMipLevels > 1 && loadTexelImage( _info, levelRgba, &currImage ) ){
+        free( levelRgba );
+        return 1;
+    }
+
+    uint8_t *dst = _dstData;
+    uint32_t levelWidth = _info->width, levelHeight = _info->height;
+    for( uint32_t level = 0; level < _info->numMipLevels; level++ ){
+        if( level > 0 ){
+            TexelImage nextImage;
+            if( downsampleImage( _options->mipFilter, &currImage, &nextImage ) ){
+                err = 1;
+                goto encodeFailure;
+            }
+            free( currImage.texels );
+            currImage = nextImage;
+            if( _info->usage == POM_TEXTURE_USAGE_NORMAL ){
+                renormaliseNormals( &currImage );
+            }
+            storeTexelImage( _info, &currImage, levelRgba );
+            levelWidth = currImage.width;
+            levelHeight = currImage.height;
+        }
+
+        if( _info->dataType == POM_TEXTURE_DATA_RAW_U8 ){
+            encodeRawLevel( _info, levelRgba, levelWidth, levelHeight, dst );
+        }else{
+            encodeBlockLevel( _info, levelRgba, levelWidth, levelHeight, dst );
+        }
+        dst += getLevelSizeBytes( _info, levelWidth, levelHeight );
+    }
+
+    if( (size_t) ( dst - _dstData ) != _info->encodedSizeBytes ){
+        LOG( ERR, "Encoded texture size mismatch, wrote %lu, expected %lu",
+             (size_t) ( dst - _dstData ), _info->encodedSizeBytes );
+        err = 1;
+    }
+
+encodeFailure:
+    free( currImage.texels );
+    free( levelRgba );
+    return err;
+}
@@ -0,0 +1,55 @@
+#ifndef POM_TEXTURE_ENCODE_H
+#define POM_TEXTURE_ENCODE_H
+
+#include "pomModelFormat.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct PomTextureEncodeOptions PomTextureEncodeOptions;
+typedef struct PomTextureEncodeInfo PomTextureEncodeInfo;
+
+typedef enum PomMipFilter{
+    POM_MIP_FILTER_BOX = 0,
+    POM_MIP_FILTER_KAISER = 1
+}PomMipFilter;
+
+// How the texel data is interpreted, which decides filtering and block format
+typedef enum PomTextureUsage{
+    POM_TEXTURE_USAGE_COLOUR = 0, // sRGB colour, filtered in linear space
+    POM_TEXTURE_USAGE_NORMAL = 1, // Tangent-space normals, renormalised per mip
+    POM_TEXTURE_USAGE_DATA   = 2  // Anything else, filtered as-is
+}PomTextureUsage;
+
+struct PomTextureEncodeOptions{
+    bool generateMips;
+    bool compress;
+    // Use BC7 rather than BC1/BC3 for colour textures. Better quality, slower bake.
+    bool preferBc7;
+    PomMipFilter mipFilter;
+};
+
+struct PomTextureEncodeInfo{
+    PomModelTextureDataType dataType;
+    PomTextureUsage usage;
+    uint32_t width;
+    uint32_t height;
+    uint32_t numSrcChannels;
+    uint32_t numMipLevels;
+    uint32_t dataUnitSizeBytes;
+    bool isSrgb;
+    size_t encodedSizeBytes;
+};
+
+// Work out the output format and size for a texture without needing its data,
+// so the output can be sized before anything is decoded.
+int pomTextureEncodeGetInfo( const PomTextureEncodeOptions *_options, PomTextureUsage _usage,
+                             uint32_t _width, uint32_t _height, uint32_t _numChannels,
+                             PomTextureEncodeInfo *_info );
+
+// Generate the mip chain for _srcData and encode every level into _dstData,
+// which must be at least _info->encodedSizeBytes long.
+int pomTextureEncode( const PomTextureEncodeOptions *_options, const PomTextureEncodeInfo *_info,
+                      const uint8_t *_srcData, uint8_t *_dstData );
+
+#endif // POM_TEXTURE_ENCODE_H
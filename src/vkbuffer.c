@@ -7,10 +7,26 @@
 ** Buffer defs
 ***************/
 
+// Which memory category a buffer's memory counts towards, going by what it's used for
+static PomVkMemoryCategory _pomBufferMemoryCategory( VkBufferUsageFlags _usage ){
+    if( _usage & ( VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT ) ){
+        return POM_VK_MEMORY_CATEGORY_GEOMETRY;
+    }
+    if( _usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT ){
+        return POM_VK_MEMORY_CATEGORY_UNIFORM;
+    }
+    if( _usage == VK_BUFFER_USAGE_TRANSFER_SRC_BIT ){
+        return POM_VK_MEMORY_CATEGORY_STAGING;
+    }
+    return POM_VK_MEMORY_CATEGORY_OTHER;
+}
+
 int pomVkBufferCreate( PomVkBufferCtx *_buffCtx, VkBufferUsageFlags _usage,
                        VkDeviceSize _bSizeBytes, uint32_t _numQueueFamilies,
                        const uint32_t* _queueFamilies,
-                       VkMemoryPropertyFlags _memFlags ){
+                       VkMemoryPropertyFlags _memFlags,
+                       VkMemoryPropertyFlags _desiredMemFlags,
+                       const char *_site ){
     if( _buffCtx->initialised ){
         LOG( WARN, "Attempting to reinitialise buffer" );
         return 1;
@@ -44,9 +60,14 @@ int pomVkBufferCreate( PomVkBufferCtx *_buffCtx, VkBufferUsageFlags _usage,
     // Get memory requirements
     vkGetBufferMemoryRequirements( *dev, _buffCtx->buffer, &_buffCtx->memoryRequirements );
     _buffCtx->memoryFlags = _memFlags;
+    _buffCtx->desiredMemoryFlags = _desiredMemFlags;
+    _buffCtx->allocationSite = _site;
     _buffCtx->initialised = true;
     atomic_store( &_buffCtx->inUse, false );
     _buffCtx->bufferInfo = createInfo;
+    _buffCtx->movedFromBuffer = VK_NULL_HANDLE;
+    _buffCtx->movedFromMemCtx = (PomVkMemoryCtx){ 0 };
+    _buffCtx->mapped = NULL;
     return 0;
 }
 
@@ -111,22 +132,106 @@ int pomVkBufferBind( PomVkBufferCtx *_buffCtx, VkDeviceSize _offset ){
     if( !_buffCtx->memCtx.initialised ){
         // Memory not allocated
         VkMemoryPropertyFlags memFlags = _buffCtx->memoryFlags;
+        VkMemoryPropertyFlags desiredFlags = _buffCtx->desiredMemoryFlags;
         VkMemoryRequirements *memReq = &_buffCtx->memoryRequirements;
-        if( pomVkAllocateMemory( &_buffCtx->memCtx, memFlags, memReq, memReq ) ){
+        PomVkMemoryCategory category = _pomBufferMemoryCategory( _buffCtx->bufferInfo.usage );
+        if( pomVkAllocateMemory( &_buffCtx->memCtx, POM_VK_MEMORY_RESOURCE_LINEAR, category,
+                                 memFlags, desiredFlags, memReq, _buffCtx->allocationSite ) ){
             LOG( ERR, "Failed to allocate buffer memory" );
             return 1;
         }
     }
     atomic_store( &_buffCtx->inUse, true );
-    if( vkBindBufferMemory( *dev, _buffCtx->buffer, _buffCtx->memCtx.memory, _offset ) != VK_SUCCESS ){
+    if( vkBindBufferMemory( *dev, _buffCtx->buffer, _buffCtx->memCtx.memory,
+                            _buffCtx->memCtx.offset + _offset ) != VK_SUCCESS ){
         LOG( ERR, "Failed to bind buffer memory" );
         atomic_store( &_buffCtx->inUse, false );
         return 1;
     }
+    _buffCtx->bindOffset = _offset;
+    _buffCtx->mapped = pomVkMemoryGetMapped( &_buffCtx->memCtx );
+    if( _buffCtx->mapped ){
+        _buffCtx->mapped += _offset;
+    }
+    _buffCtx->dirtyBegin = 0;
+    _buffCtx->dirtyEnd = 0;
     atomic_store( &_buffCtx->bound, true );
     return 0;
 }
 
+int pomVkBufferMoveBegin( PomVkBufferCtx *_buffCtx, VkCommandBuffer _cmdBuffer ){
+    if( !_buffCtx->initialised || !atomic_load( &_buffCtx->bound ) ){
+        LOG( ERR, "Attempting to move unbound buffer" );
+        return 1;
+    }
+    if( _buffCtx->movedFromBuffer != VK_NULL_HANDLE ){
+        LOG( WARN, "Attempting to move buffer with a move already in progress" );
+        return 1;
+    }
+    const VkBufferUsageFlags transferUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                                             VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    if( ( _buffCtx->bufferInfo.usage & transferUsage ) != transferUsage ||
+        _buffCtx->childViews.head ){
+        // Can't copy it, or has views we'd have to recreate
+        return 2;
+    }
+    VkDevice *dev = pomGetLogicalDevice();
+    if( !dev ){
+        LOG( ERR, "Attempting to move buffer with no valid device" );
+        return 1;
+    }
+
+    // Find somewhere to move to before creating anything, as usually there's nowhere.
+    // A buffer created from the same info has the same requirements as the current one
+    PomVkMemoryCtx newMemCtx = { 0 };
+    int allocRet = pomVkMemoryDefragmentAllocate( &_buffCtx->memCtx, &_buffCtx->memoryRequirements,
+                                                  &newMemCtx );
+    if( allocRet ){
+        return allocRet;
+    }
+    VkBuffer newBuffer;
+    if( vkCreateBuffer( *dev, &_buffCtx->bufferInfo, NULL, &newBuffer ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to create buffer to move into" );
+        pomVkFreeMemory( &newMemCtx );
+        return 1;
+    }
+    if( vkBindBufferMemory( *dev, newBuffer, newMemCtx.memory, newMemCtx.offset ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to bind buffer memory to move into" );
+        pomVkFreeMemory( &newMemCtx );
+        vkDestroyBuffer( *dev, newBuffer, NULL );
+        return 1;
+    }
+    VkBufferCopy copyRegion = {
+        .srcOffset = 0,
+        .dstOffset = 0,
+        .size = _buffCtx->bufferInfo.size
+    };
+    vkCmdCopyBuffer( _cmdBuffer, _buffCtx->buffer, newBuffer, 1, &copyRegion );
+
+    _buffCtx->movedFromBuffer = _buffCtx->buffer;
+    _buffCtx->movedFromMemCtx = _buffCtx->memCtx;
+    _buffCtx->buffer = newBuffer;
+    _buffCtx->memCtx = newMemCtx;
+    _buffCtx->bindOffset = 0;
+    _buffCtx->mapped = pomVkMemoryGetMapped( &newMemCtx );
+    return 0;
+}
+
+int pomVkBufferMoveEnd( PomVkBufferCtx *_buffCtx ){
+    if( _buffCtx->movedFromBuffer == VK_NULL_HANDLE ){
+        return 2;
+    }
+    VkDevice *dev = pomGetLogicalDevice();
+    if( !dev ){
+        LOG( ERR, "Attempting to end buffer move with no valid device" );
+        return 1;
+    }
+    vkDestroyBuffer( *dev, _buffCtx->movedFromBuffer, NULL );
+    pomVkFreeMemory( &_buffCtx->movedFromMemCtx );
+    _buffCtx->movedFromBuffer = VK_NULL_HANDLE;
+    return 0;
+}
+
 int pomVkBufferUnbind( PomVkBufferCtx *_buffCtx ){
     // TODO - unbind handling
     // Vulkan doesn't have a vkBufferUnbindMemory type call.
@@ -144,6 +249,46 @@ int pomVkBufferUnbind( PomVkBufferCtx *_buffCtx ){
     return 0;
 }
 
+void *pomVkBufferGetMapped( PomVkBufferCtx *_buffCtx ){
+    if( !_buffCtx->initialised || !atomic_load( &_buffCtx->bound ) ){
+        return NULL;
+    }
+    return _buffCtx->mapped;
+}
+
+void pomVkBufferMarkDirty( PomVkBufferCtx *_buffCtx, VkDeviceSize _offset, VkDeviceSize _size ){
+    if( !_size ){
+        return;
+    }
+    if( _buffCtx->dirtyBegin == _buffCtx->dirtyEnd ){
+        _buffCtx->dirtyBegin = _offset;
+        _buffCtx->dirtyEnd = _offset + _size;
+        return;
+    }
+    // One range covering both, since a single bigger flush beats several small ones
+    if( _offset < _buffCtx->dirtyBegin ){
+        _buffCtx->dirtyBegin = _offset;
+    }
+    if( _offset + _size > _buffCtx->dirtyEnd ){
+        _buffCtx->dirtyEnd = _offset + _size;
+    }
+}
+
+int pomVkBufferFlush( PomVkBufferCtx *_buffCtx ){
+    if( !_buffCtx->mapped ){
+        LOG( ERR, "Attempting to flush unmapped buffer" );
+        return 1;
+    }
+    if( _buffCtx->dirtyBegin == _buffCtx->dirtyEnd ){
+        return 0;
+    }
+    int ret = pomVkMemoryFlush( &_buffCtx->memCtx, _buffCtx->bindOffset + _buffCtx->dirtyBegin,
+                                _buffCtx->dirtyEnd - _buffCtx->dirtyBegin );
+    _buffCtx->dirtyBegin = 0;
+    _buffCtx->dirtyEnd = 0;
+    return ret;
+}
+
 
 /******************
  * BufferView defs
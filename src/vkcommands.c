@@ -35,7 +35,7 @@ int pomCommandPoolCreate(){
     
     VkCommandPoolCreateInfo commandPoolInfo ={
         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-        .queueFamilyIndex = 0
+        .queueFamilyIndex = gfxIdx
     };
 
     if( vkCreateCommandPool( *dev, &commandPoolInfo, NULL, &commandsCtx.commandPool ) != VK_SUCCESS ){
@@ -77,14 +77,14 @@ int pomCommandBuffersCreate(){
         LOG( ERR, "Attempting to create command buffers without available logical device" );
         return 1;
     }
-    uint32_t numFramebuffers;
-    VkFramebuffer *swapchainBuffers = pomSwapchainFramebuffersGet( &numFramebuffers );
-    if( !swapchainBuffers ){
-        LOG( ERR, "Attempting to create command buffers without valid framebuffers" );
+    // One per swapchain image. There may be no framebuffers to count when rendering dynamically
+    uint32_t numImages;
+    if( !pomGetSwapchainImages( &numImages ) ){
+        LOG( ERR, "Attempting to create command buffers without swapchain images" );
         return 1;
     }
-    commandsCtx.commandBuffers = (VkCommandBuffer*) malloc( sizeof( VkCommandBuffer ) * numFramebuffers );
-    commandsCtx.numBuffers = numFramebuffers;
+    commandsCtx.commandBuffers = (VkCommandBuffer*) malloc( sizeof( VkCommandBuffer ) * numImages );
+    commandsCtx.numBuffers = numImages;
 
     VkCommandBufferAllocateInfo commandBufferInfo = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
@@ -119,6 +119,60 @@ int pomCommandBuffersDestroy(){
     return 0;
 }
 
+int pomCommandBuffersRecreate(){
+    if( !commandsCtx.initialisedBuffers ){
+        LOG( ERR, "Attempting to recreate uninitialised command buffers" );
+        return 1;
+    }
+    VkDevice *dev = pomGetLogicalDevice();
+    if( !dev ){
+        LOG( ERR, "Attempting to recreate command buffers without available logical device" );
+        return 1;
+    }
+    // The pool stays, just the buffers go back to it
+    vkFreeCommandBuffers( *dev, commandsCtx.commandPool, commandsCtx.numBuffers,
+                          commandsCtx.commandBuffers );
+    free( commandsCtx.commandBuffers );
+    commandsCtx.commandBuffers = NULL;
+    commandsCtx.numBuffers = 0;
+    commandsCtx.initialisedBuffers = false;
+    return pomCommandBuffersCreate();
+}
+
+int pomCommandBuffersReset(){
+    if( !commandsCtx.initialisedBuffers ){
+        LOG( ERR, "Attempting to reset uninitialised command buffers" );
+        return 1;
+    }
+    VkDevice *dev = pomGetLogicalDevice();
+    if( !dev ){
+        LOG( ERR, "Attempting to reset command buffers without available logical device" );
+        return 1;
+    }
+    if( vkResetCommandPool( *dev, commandsCtx.commandPool, 0 ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to reset command pool" );
+        return 1;
+    }
+    return 0;
+}
+
+void pomRecordViewportScissor( VkCommandBuffer _cmdBuffer, const VkExtent2D *_extent ){
+    VkViewport viewport = {
+        .x = 0,
+        .y = 0,
+        .width = _extent->width,
+        .height = _extent->height,
+        .minDepth = 0.0f,
+        .maxDepth = 1.0f
+    };
+    VkRect2D scissor = {
+        .offset = (VkOffset2D){ .x = 0, .y = 0 },
+        .extent = *_extent
+    };
+    vkCmdSetViewport( _cmdBuffer, 0, 1, &viewport );
+    vkCmdSetScissor( _cmdBuffer, 0, 1, &scissor );
+}
+
 VkCommandBuffer *pomCommandBuffersGet( uint32_t *numBuffers ){
     if( !commandsCtx.initialisedBuffers ){
         LOG( ERR, "Attempting to get uninitialised command buffers" );
@@ -128,6 +182,83 @@ VkCommandBuffer *pomCommandBuffersGet( uint32_t *numBuffers ){
     return commandsCtx.commandBuffers;
 }
 
+int pomCommandBufferOneShotBegin( VkCommandBuffer *_cmdBuffer ){
+    if( !commandsCtx.initialisedPool ){
+        LOG( ERR, "Attempting to allocate one-shot command buffer without a command pool" );
+        return 1;
+    }
+    VkDevice *dev = pomGetLogicalDevice();
+    if( !dev ){
+        LOG( ERR, "Attempting to allocate one-shot command buffer without available logical device" );
+        return 1;
+    }
+    VkCommandBufferAllocateInfo commandBufferInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = commandsCtx.commandPool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1
+    };
+    if( vkAllocateCommandBuffers( *dev, &commandBufferInfo, _cmdBuffer ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to allocate one-shot command buffer" );
+        return 1;
+    }
+    VkCommandBufferBeginInfo beginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    };
+    if( vkBeginCommandBuffer( *_cmdBuffer, &beginInfo ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to begin one-shot command buffer" );
+        vkFreeCommandBuffers( *dev, commandsCtx.commandPool, 1, _cmdBuffer );
+        return 1;
+    }
+    return 0;
+}
+
+int pomCommandBufferOneShotSubmit( VkCommandBuffer _cmdBuffer ){
+    VkDevice *dev = pomGetLogicalDevice();
+    uint32_t gfxIdx;
+    VkQueue *gfxQueue = pomDeviceGetGraphicsQueue( &gfxIdx );
+    if( !dev || !gfxQueue ){
+        LOG( ERR, "Attempting to submit one-shot command buffer without available device" );
+        return 1;
+    }
+    int ret = 1;
+    VkFence fence = VK_NULL_HANDLE;
+    VkFenceCreateInfo fenceInfo = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO
+    };
+    VkSubmitInfo submitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &_cmdBuffer
+    };
+    if( vkEndCommandBuffer( _cmdBuffer ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to end one-shot command buffer" );
+    }else if( vkCreateFence( *dev, &fenceInfo, NULL, &fence ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to create one-shot command buffer fence" );
+    }else if( vkQueueSubmit( *gfxQueue, 1, &submitInfo, fence ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to submit one-shot command buffer" );
+    }else if( vkWaitForFences( *dev, 1, &fence, VK_TRUE, UINT64_MAX ) != VK_SUCCESS ){
+        LOG( ERR, "Failed waiting for one-shot command buffer" );
+    }else{
+        ret = 0;
+    }
+    if( fence != VK_NULL_HANDLE ){
+        vkDestroyFence( *dev, fence, NULL );
+    }
+    vkFreeCommandBuffers( *dev, commandsCtx.commandPool, 1, &_cmdBuffer );
+    return ret;
+}
+
+void pomCommandBufferOneShotDiscard( VkCommandBuffer _cmdBuffer ){
+    VkDevice *dev = pomGetLogicalDevice();
+    if( !dev ){
+        LOG( ERR, "Attempting to discard one-shot command buffer without available logical device" );
+        return;
+    }
+    vkFreeCommandBuffers( *dev, commandsCtx.commandPool, 1, &_cmdBuffer );
+}
+
 int pomRecordDefaultCommands( VkRenderPass *_renderPass, PomPipelineCtx *_pipelineCtx ){
     if( !commandsCtx.initialisedBuffers ){
         LOG( ERR, "Attempting to record commands with uninitialised command buffers" );
@@ -160,7 +291,11 @@ int pomRecordDefaultCommands( VkRenderPass *_renderPass, PomPipelineCtx *_pipeli
             return 1;
         }
 
-        VkClearValue clearValue = {{{ 0.5f, 0.5f, 0.5f, 1.0f }}};
+        // Colour, then depth
+        VkClearValue clearValues[] = {
+            {{{ 0.5f, 0.5f, 0.5f, 1.0f }}},
+            { .depthStencil = { 1.0f, 0 } }
+        };
 
         VkRenderPassBeginInfo renderPassBeginInfo = {
             .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
@@ -168,12 +303,13 @@ int pomRecordDefaultCommands( VkRenderPass *_renderPass, PomPipelineCtx *_pipeli
             .renderArea.extent = *swapchainExtent,
             .renderArea.offset = (VkOffset2D){ .x = 0, .y = 0 },
             .renderPass = *_renderPass,
-            .pClearValues = &clearValue,
-            .clearValueCount = 1
+            .pClearValues = clearValues,
+            .clearValueCount = sizeof( clearValues ) / sizeof( VkClearValue )
         };
 
         vkCmdBeginRenderPass( commandsCtx.commandBuffers[ i ], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE );
         vkCmdBindPipeline( commandsCtx.commandBuffers[ i ], VK_PIPELINE_BIND_POINT_GRAPHICS, _pipelineCtx->pipeline );
+        pomRecordViewportScissor( commandsCtx.commandBuffers[ i ], swapchainExtent );
         vkCmdDraw( commandsCtx.commandBuffers[ i ], 3, 1, 0, 0 );
         vkCmdEndRenderPass( commandsCtx.commandBuffers[ i ] );
 
@@ -0,0 +1,132 @@
+#include "vkdefragment.h"
+#include "vkcommands.h"
+#include "vkupload.h"
+#include <stdlib.h>
+#include <time.h>
+
+#define LOG( lvl, log, ... ) LOG_MODULE( lvl, VkDefragment, log, ##__VA_ARGS__ )
+
+// Before anything has been measured, assume copies run at 1 byte per nanosecond (~1GB/s),
+// which undersells most devices
+#define DEFRAGMENT_INITIAL_NS_PER_BYTE 1.0
+
+typedef struct PomVkDefragmentCtx PomVkDefragmentCtx;
+struct PomVkDefragmentCtx{
+    // Model to consider first on the next step
+    uint32_t nextModel;
+    // Measured cost of copies, to decide how many fit in a step
+    double nsPerByte;
+};
+
+static PomVkDefragmentCtx defragmentCtx = {
+    .nextModel = 0,
+    .nsPerByte = DEFRAGMENT_INITIAL_NS_PER_BYTE
+};
+
+static uint64_t _pomTimeNs(){
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return (uint64_t) t.tv_sec * 1000000000ull + (uint64_t) t.tv_nsec;
+}
+
+int pomVkDefragmentStep( PomVkModelCtx *_models, uint32_t _numModels, uint32_t _budgetUs,
+                         uint32_t *_numMoved ){
+    *_numMoved = 0;
+    if( !_numModels || !_budgetUs || !pomVkMemoryCanDefragment() ){
+        return 0;
+    }
+    const uint64_t budgetNs = (uint64_t) _budgetUs * 1000;
+    const uint64_t startNs = _pomTimeNs();
+    // A move copies what's in the old buffer, so uploads into it have to land first, or
+    // they'd be lost with it
+    if( pomVkUploadWaitIdle() ){
+        LOG( ERR, "Failed to wait for uploads before defragmenting" );
+        return 1;
+    }
+    PomVkModelCtx **movedModels = (PomVkModelCtx**) malloc( sizeof( PomVkModelCtx* ) * _numModels );
+    if( !movedModels ){
+        LOG( ERR, "Failed to allocate defragment move list" );
+        return 1;
+    }
+    VkCommandBuffer cmdBuffer;
+    if( pomCommandBufferOneShotBegin( &cmdBuffer ) ){
+        LOG( ERR, "Failed to begin defragment command buffer" );
+        free( movedModels );
+        return 1;
+    }
+
+    // Record moves until the copies so far would use up what's left of the budget.
+    // Every model is considered at most once per step
+    int ret = 0;
+    uint32_t numMoved = 0;
+    VkDeviceSize bytesMoved = 0;
+    uint32_t numVisited = 0;
+    for( ; numVisited < _numModels; numVisited++ ){
+        uint64_t copyEstimateNs = (uint64_t) ( bytesMoved * defragmentCtx.nsPerByte );
+        if( _pomTimeNs() - startNs + copyEstimateNs >= budgetNs ){
+            break;
+        }
+        PomVkModelCtx *model = &_models[ ( defragmentCtx.nextModel + numVisited ) % _numModels ];
+        PomVkBufferCtx *buffer = &model->modelBuffer;
+        if( !model->initialised || !atomic_load( &buffer->bound ) ){
+            continue;
+        }
+        int moveRet = pomVkBufferMoveBegin( buffer, cmdBuffer );
+        if( moveRet == 1 ){
+            LOG( ERR, "Failed to move model buffer" );
+            ret = 1;
+            break;
+        }
+        if( moveRet == 0 ){
+            movedModels[ numMoved++ ] = model;
+            bytesMoved += buffer->bufferInfo.size;
+        }
+    }
+    defragmentCtx.nextModel = ( defragmentCtx.nextModel + numVisited ) % _numModels;
+    if( !numMoved ){
+        // Nothing was movable, which is the usual case once memory is compact
+        pomCommandBufferOneShotDiscard( cmdBuffer );
+        free( movedModels );
+        return ret;
+    }
+
+    // Copies have to land before anything reads the buffers again
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+                         VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_HOST_READ_BIT |
+                         VK_ACCESS_HOST_WRITE_BIT
+    };
+    vkCmdPipelineBarrier( cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                          VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                          VK_PIPELINE_STAGE_HOST_BIT,
+                          0, 1, &barrier, 0, NULL, 0, NULL );
+    uint64_t submitNs = _pomTimeNs();
+    if( pomCommandBufferOneShotSubmit( cmdBuffer ) ){
+        // Can't tell whether the copies happened, so leave the old buffers alone rather than
+        // freeing memory the device may still be using
+        LOG( ERR, "Failed to submit defragment copies" );
+        free( movedModels );
+        return 1;
+    }
+    if( bytesMoved ){
+        defragmentCtx.nsPerByte = (double) ( _pomTimeNs() - submitNs ) / (double) bytesMoved;
+    }
+
+    // Old buffers are free to go, and freeing their memory is what gives emptied blocks back
+    for( uint32_t i = 0; i < numMoved; i++ ){
+        PomVkModelCtx *model = movedModels[ i ];
+        // The model's descriptor lives in the frame ring, so doesn't move with its buffer
+        if( pomVkBufferMoveEnd( &model->modelBuffer ) == 1 ){
+            LOG( ERR, "Failed to finish moving model buffer" );
+            ret = 1;
+        }
+    }
+    free( movedModels );
+    if( numMoved ){
+        LOG( DEBUG, "Moved %u model buffer(s), %lu bytes", numMoved, bytesMoved );
+    }
+    *_numMoved = numMoved;
+    return ret;
+}
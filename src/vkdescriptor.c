@@ -1,5 +1,7 @@
 #include "vkdescriptor.h"
 #include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
 
 #define LOG( lvl, log, ... ) LOG_MODULE( lvl, VkDescriptor, log, ##__VA_ARGS__ )
 
@@ -11,15 +13,40 @@ int pomVkDescriptorCreate( PomVkDescriptorCtx *_descriptorCtx,
         LOG( WARN, "Attempting to reinitialised VkDescriptor" );
         return 1;
     }
-    if( !_memoryInfo ){
+    _descriptorCtx->uboDeviceMemory.ringCtx = NULL;
+    _descriptorCtx->frameBufferInfos = NULL;
+    if( _memoryInfo && _memoryInfo->ringCtx ){
+        // Lives in the ring, at an offset decided by each frame's update
+        PomVkRingBufferCtx *ringCtx = _memoryInfo->ringCtx;
+        _descriptorCtx->frameBufferInfos = (VkDescriptorBufferInfo*) malloc(
+            sizeof( VkDescriptorBufferInfo ) * ringCtx->numFrames );
+        if( !_descriptorCtx->frameBufferInfos ){
+            LOG( ERR, "Failed to allocate descriptor frame buffer infos" );
+            return 1;
+        }
+        for( uint32_t i = 0; i < ringCtx->numFrames; i++ ){
+            _descriptorCtx->frameBufferInfos[ i ] = (VkDescriptorBufferInfo){
+                .buffer = ringCtx->bufferCtx.buffer,
+                .offset = 0,
+                .range = _ubo->dataSize
+            };
+        }
+        _descriptorCtx->uboDeviceMemory.ringCtx = ringCtx;
+        _descriptorCtx->uboDeviceMemory.bufferCtx = &ringCtx->bufferCtx;
+        _descriptorCtx->uboDeviceMemory.uboOffset = 0;
+        _descriptorCtx->uboDeviceMemory.bufferCtxOwned.initialised = false;
+    }
+    else if( !_memoryInfo ){
         // TODO - allocate memory here
         _descriptorCtx->uboDeviceMemory.bufferCtx = &_descriptorCtx->uboDeviceMemory.bufferCtxOwned;
         _descriptorCtx->uboDeviceMemory.uboOffset = 0;
-        VkMemoryPropertyFlags uboBufferFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                               VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        // Written through a persistent mapping, so needs to be host-visible. Updates are
+        // flushed, so coherent memory is only preferred
         if( pomVkBufferCreate( _descriptorCtx->uboDeviceMemory.bufferCtx,
                                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                               _ubo->dataSize, 1, NULL, uboBufferFlags ) ){
+                               _ubo->dataSize, 1, NULL, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                               POM_VK_MEMORY_SITE ) ){
             LOG( ERR, "Failed to create UBO buffer" );
             return 1;
         }
@@ -53,6 +80,8 @@ int pomVkDescriptorDestroy( PomVkDescriptorCtx *_descriptorCtx ){
         LOG( WARN, "Attempting to destroy uninitialised VkDescriptor" );
         return 1;
     }
+    free( _descriptorCtx->frameBufferInfos );
+    _descriptorCtx->frameBufferInfos = NULL;
     if( !_descriptorCtx->uboDeviceMemory.bufferCtxOwned.initialised ){
         // Nothing to do
         _descriptorCtx->initialised = false;
@@ -74,30 +103,111 @@ VkDescriptorBufferInfo* pomVkDescriptorGetBufferInfo( PomVkDescriptorCtx *_descr
     return &_descriptorCtx->descriptorBufferInfo;
 }
 
+VkDescriptorBufferInfo* pomVkDescriptorGetFrameBufferInfo( PomVkDescriptorCtx *_descriptorCtx,
+                                                          uint32_t _frameIdx ){
+    if( !_descriptorCtx->initialised ){
+        LOG( ERR, "Attempting to get descriptor buffer info for uninitialised descriptor" );
+        return NULL;
+    }
+    PomVkRingBufferCtx *ringCtx = _descriptorCtx->uboDeviceMemory.ringCtx;
+    if( !ringCtx ){
+        return &_descriptorCtx->descriptorBufferInfo;
+    }
+    if( _frameIdx >= ringCtx->numFrames ){
+        LOG( ERR, "Attempting to get descriptor buffer info for frame %u of %u",
+             _frameIdx, ringCtx->numFrames );
+        return NULL;
+    }
+    return &_descriptorCtx->frameBufferInfos[ _frameIdx ];
+}
+
+int pomVkDescriptorRefreshBufferInfo( PomVkDescriptorCtx *_descriptorCtx ){
+    if( !_descriptorCtx->initialised ){
+        LOG( ERR, "Attempting to refresh buffer info of uninitialised descriptor" );
+        return 1;
+    }
+    PomVkRingBufferCtx *ringCtx = _descriptorCtx->uboDeviceMemory.ringCtx;
+    if( ringCtx ){
+        // Ring buffers only move when resized, which may change the number of frames
+        VkDescriptorBufferInfo *frameBufferInfos = (VkDescriptorBufferInfo*) realloc(
+            _descriptorCtx->frameBufferInfos, sizeof( VkDescriptorBufferInfo ) * ringCtx->numFrames );
+        if( !frameBufferInfos ){
+            LOG( ERR, "Failed to reallocate descriptor frame buffer infos" );
+            return 1;
+        }
+        // Each frame's data is found again by its next update
+        for( uint32_t i = 0; i < ringCtx->numFrames; i++ ){
+            frameBufferInfos[ i ] = (VkDescriptorBufferInfo){
+                .buffer = ringCtx->bufferCtx.buffer,
+                .offset = 0,
+                .range = _descriptorCtx->uboMainMemory.dataSize
+            };
+        }
+        _descriptorCtx->frameBufferInfos = frameBufferInfos;
+        return 0;
+    }
+    _descriptorCtx->descriptorBufferInfo.buffer = _descriptorCtx->uboDeviceMemory.bufferCtx->buffer;
+    return 0;
+}
+
 // Update the memory in VRAM with the memory in main memory
-int pomVkDescriptorUpdate( PomVkDescriptorCtx *_descriptorCtx, VkDevice _device ){
+int pomVkDescriptorUpdate( PomVkDescriptorCtx *_descriptorCtx, VkDevice UNUSED(_device) ){
     // TODO - add staging support? Or maybe push constants. Either way, just memcpy for now
     if( !_descriptorCtx->initialised ){
         LOG( ERR, "Attempting to update uninitialised descriptor" );
         return 1;
     }
-    void *deviceData;
     PomVkDescriptorMemoryInfo *uboDeviceMemoryCtx = &_descriptorCtx->uboDeviceMemory;
-    VkDeviceMemory deviceMemory = uboDeviceMemoryCtx->bufferCtx->memCtx.memory;
-    PomVkUniformBufferObject *uboMainMemory = &_descriptorCtx->uboMainMemory;
-
-    if( vkMapMemory( _device, deviceMemory, uboDeviceMemoryCtx->uboOffset, uboMainMemory->dataSize,
-                     0, &deviceData ) != VK_SUCCESS ){
-        LOG( ERR, "Failed to map descriptor memory" );
+    if( uboDeviceMemoryCtx->ringCtx ){
+        LOG( ERR, "Ring buffer descriptors are updated per frame" );
         return 1;
     }
-    memcpy( deviceData, _descriptorCtx->uboMainMemory.data, _descriptorCtx->uboMainMemory.dataSize );
-    vkUnmapMemory( _device, deviceMemory );
-    return 0;
+    PomVkBufferCtx *bufferCtx = uboDeviceMemoryCtx->bufferCtx;
+    uint8_t *deviceData = pomVkBufferGetMapped( bufferCtx );
+    if( !deviceData ){
+        LOG( ERR, "Descriptor memory is not host-visible" );
+        return 1;
+    }
+    memcpy( deviceData + uboDeviceMemoryCtx->uboOffset, _descriptorCtx->uboMainMemory.data,
+            _descriptorCtx->uboMainMemory.dataSize );
+    pomVkBufferMarkDirty( bufferCtx, uboDeviceMemoryCtx->uboOffset,
+                          _descriptorCtx->uboMainMemory.dataSize );
+    return pomVkBufferFlush( bufferCtx );
 }
 
 
 
+int pomVkDescriptorUpdateFrame( PomVkDescriptorCtx *_descriptorCtx, uint32_t _frameIdx ){
+    if( !_descriptorCtx->initialised ){
+        LOG( ERR, "Attempting to update uninitialised descriptor" );
+        return 1;
+    }
+    PomVkRingBufferCtx *ringCtx = _descriptorCtx->uboDeviceMemory.ringCtx;
+    if( !ringCtx ){
+        return pomVkDescriptorUpdate( _descriptorCtx, VK_NULL_HANDLE );
+    }
+    if( _frameIdx != ringCtx->frameIdx ){
+        LOG( ERR, "Attempting to update descriptor for frame %u during frame %u",
+             _frameIdx, ringCtx->frameIdx );
+        return 1;
+    }
+    const PomVkUniformBufferObject *ubo = &_descriptorCtx->uboMainMemory;
+    VkDeviceSize offset;
+    void *deviceData = pomVkRingBufferAllocate( ringCtx, ubo->dataSize, &offset );
+    if( !deviceData ){
+        LOG( ERR, "Failed to allocate descriptor data from ring buffer" );
+        return 1;
+    }
+    // Flushed along with the rest of the frame by pomVkRingBufferFlush
+    memcpy( deviceData, ubo->data, ubo->dataSize );
+    VkDescriptorBufferInfo *frameBufferInfo = &_descriptorCtx->frameBufferInfos[ _frameIdx ];
+    if( frameBufferInfo->offset != offset ){
+        frameBufferInfo->offset = offset;
+        return 2;
+    }
+    return 0;
+}
+
 /************
  * Descriptor pool defs
  * *********/
@@ -139,6 +249,7 @@ int pomVkDescriptorPoolDestroy( PomVkDescriptorPoolCtx *_poolCtx, VkDevice _devi
         return 1;
     }
     vkDestroyDescriptorPool( _device, _poolCtx->descriptorPool, NULL );
+    _poolCtx->initialised = false;
     return 0;
 }
 
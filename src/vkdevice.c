@@ -7,6 +7,7 @@
 #include "config.h"
 #include <string.h>
 #include "pomIO.h"
+#include "vkpipelinecache.h"
 
 #define LOG( log, ... ) LOG_MODULE( DEBUG, vkdevice, log, ##__VA_ARGS__ )
 #define LOG_WARN( log, ... ) LOG_MODULE( WARN, vkdevice, log, ##__VA_ARGS__ )
@@ -30,6 +31,7 @@ struct VkQueueFamilyRequirement{
 const char * const requiredExtensions[] = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
+#define NUM_REQUIRED_EXTENSIONS ( sizeof( requiredExtensions ) / sizeof( const char * const ) )
 
 uint16_t gfxFeatureCheck( VkPhysicalDevice *_phyDev, uint32_t qIdx ){
     // Check if the queue can do presentation
@@ -100,6 +102,10 @@ struct SwapchainInfo{
     VkExtent2D extent;
 
     VkSwapchainKHR swapchain;
+    // Kept for recreating the swapchain
+    uint32_t minImageCount;
+    VkSharingMode sharingMode;
+    uint32_t queueFamilyIndices[ 2 ];
 
     VkImage *swapchainImages;
     uint32_t numSwapchainImages;
@@ -122,10 +128,44 @@ struct VkDeviceCtx{
     VkPhysicalDeviceCtx physicalDeviceCtx;
     VkDevice logicalDevice;
     VkQueue mainGfxQueue;
+    uint32_t gfxQueueFamily;
+    // May be the graphics queue, where the device has no separate transfer family
+    VkQueue transferQueue;
+    uint32_t transferQueueFamily;
+
+    bool dynamicRenderingEnabled;
+    PFN_vkCmdBeginRenderingKHR cmdBeginRendering;
+    PFN_vkCmdEndRenderingKHR cmdEndRendering;
+
+    VkPhysicalDeviceMemoryProperties memProps;
+    bool memoryBudgetEnabled;
 };
 
 VkDeviceCtx vkDeviceCtx = { 0 };
 
+// Pick the swapchain extent from the current surface capabilities
+static void swapchainChooseExtent( SwapchainInfo *_swapchainInfo ){
+    const VkSurfaceCapabilitiesKHR *surfaceCaps = &_swapchainInfo->surfaceCaps;
+    VkExtent2D *chosenExtent = &_swapchainInfo->extent;
+    if( surfaceCaps->currentExtent.width != UINT32_MAX ){
+        // Swapchain extent must be set to surface resolution
+        *chosenExtent = surfaceCaps->currentExtent;
+    }else{
+        // Set swapchain extent to window resolution, bound by
+        // instance limits
+        VkExtent2D min = surfaceCaps->minImageExtent;
+        VkExtent2D max = surfaceCaps->maxImageExtent;
+        *chosenExtent = *pomIoGetWindowExtent();
+       
+        chosenExtent->width = chosenExtent->width > max.width ? 
+                                max.width : chosenExtent->width < min.width ?
+                                min.width : chosenExtent->width;
+        chosenExtent->height = chosenExtent->height > max.height ? 
+                                max.height : chosenExtent->height < min.height ?
+                                min.height : chosenExtent->height;
+    }
+}
+
 static uint16_t swapchainEligibility( VkPhysicalDeviceCtx *_phyDevCtx ){
 
     VkSurfaceKHR *surface = pomIoGetSurface();
@@ -179,24 +219,7 @@ static uint16_t swapchainEligibility( VkPhysicalDeviceCtx *_phyDevCtx ){
     }
 
     // Set the extent
-    VkExtent2D *chosenExtent = &_phyDevCtx->swapchainInfo.extent;
-    if( surfaceCaps->currentExtent.width != UINT32_MAX ){
-        // Swapchain extent must be set to surface resolution
-        *chosenExtent = surfaceCaps->currentExtent;
-    }else{
-        // Set swapchain extent to window resolution, bound by
-        // instance limits
-        VkExtent2D min = surfaceCaps->minImageExtent;
-        VkExtent2D max = surfaceCaps->maxImageExtent;
-        *chosenExtent = *pomIoGetWindowExtent();
-       
-        chosenExtent->width = chosenExtent->width > max.width ? 
-                                max.width : chosenExtent->width < min.width ?
-                                min.width : chosenExtent->width;
-        chosenExtent->height = chosenExtent->height > max.height ? 
-                                max.height : chosenExtent->height < min.height ?
-                                min.height : chosenExtent->height;
-    }
+    swapchainChooseExtent( &_phyDevCtx->swapchainInfo );
 
     _phyDevCtx->swapchainInfo.chosenSurfaceFormat = *chosenFormat;
     _phyDevCtx->swapchainInfo.chosenPresentMode = chosenPresentMode;
@@ -206,6 +229,66 @@ static uint16_t swapchainEligibility( VkPhysicalDeviceCtx *_phyDevCtx ){
 }
 
 
+// Create the swapchain at the chosen extent and fetch its images, retiring _oldSwapchain if
+// there is one. The old swapchain is left for the caller to destroy
+static int swapchainCreate( SwapchainInfo *_swapchainInfo, VkSwapchainKHR _oldSwapchain ){
+    const VkSurfaceCapabilitiesKHR *surfaceCaps = &_swapchainInfo->surfaceCaps;
+    VkSwapchainCreateInfoKHR createSwapchain = { 0 };
+    createSwapchain.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    createSwapchain.surface = *pomIoGetSurface();
+    createSwapchain.minImageCount = _swapchainInfo->minImageCount;
+    createSwapchain.imageFormat = _swapchainInfo->chosenSurfaceFormat.format;
+    createSwapchain.imageColorSpace = _swapchainInfo->chosenSurfaceFormat.colorSpace;
+    createSwapchain.imageExtent = _swapchainInfo->extent;
+    createSwapchain.imageArrayLayers = 1;
+    createSwapchain.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    createSwapchain.preTransform = surfaceCaps->currentTransform;
+    createSwapchain.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    createSwapchain.presentMode = _swapchainInfo->chosenPresentMode;
+    createSwapchain.clipped = VK_TRUE;
+    createSwapchain.oldSwapchain = _oldSwapchain;
+    createSwapchain.imageSharingMode = _swapchainInfo->sharingMode;
+    if( _swapchainInfo->sharingMode == VK_SHARING_MODE_CONCURRENT ){
+        createSwapchain.queueFamilyIndexCount = 2;
+        createSwapchain.pQueueFamilyIndices = _swapchainInfo->queueFamilyIndices;
+    }else{
+        createSwapchain.queueFamilyIndexCount = 0;
+        createSwapchain.pQueueFamilyIndices = NULL;
+    }
+
+    VkSwapchainKHR swapchain;
+    if( vkCreateSwapchainKHR( vkDeviceCtx.logicalDevice,
+                              &createSwapchain, NULL,
+                              &swapchain ) != VK_SUCCESS ){
+        LOG_ERR( "Unable to create swapchain" );
+        return 1;
+    }
+
+    // Now get the swapchain images
+    uint32_t numSwapchainImages = 0;
+    vkGetSwapchainImagesKHR( vkDeviceCtx.logicalDevice, swapchain,
+                             &numSwapchainImages, NULL );
+    if( !numSwapchainImages ){
+        LOG_ERR( "Could not get swapchain images" );
+        vkDestroySwapchainKHR( vkDeviceCtx.logicalDevice, swapchain, NULL );
+        return 1;
+    }
+    VkImage *swapchainImages = (VkImage*) malloc( sizeof( VkImage ) * numSwapchainImages );
+    if( !swapchainImages ){
+        LOG_ERR( "Could not allocate swapchain image handles" );
+        vkDestroySwapchainKHR( vkDeviceCtx.logicalDevice, swapchain, NULL );
+        return 1;
+    }
+    vkGetSwapchainImagesKHR( vkDeviceCtx.logicalDevice, swapchain,
+                             &numSwapchainImages, swapchainImages );
+
+    free( _swapchainInfo->swapchainImages );
+    _swapchainInfo->swapchain = swapchain;
+    _swapchainInfo->swapchainImages = swapchainImages;
+    _swapchainInfo->numSwapchainImages = numSwapchainImages;
+    return 0;
+}
+
 // Return 0 if ineligible, and a score >0 if eligible
 static uint16_t phyDeviceElgibility( VkPhysicalDeviceCtx *_phyDevCtx ){
     // TODO - expand this function to actually score the device
@@ -408,6 +491,60 @@ int pomPickPhysicalDevice(){
     return 0;
 }
 
+static bool deviceHasExtension( VkPhysicalDevice _phyDev, const char *_extension ){
+    uint32_t devExtCount = 0;
+    vkEnumerateDeviceExtensionProperties( _phyDev, NULL, &devExtCount, NULL );
+    VkExtensionProperties *devExtProps = (VkExtensionProperties*) malloc( sizeof( VkExtensionProperties ) * devExtCount );
+    if( !devExtProps ){
+        return false;
+    }
+    vkEnumerateDeviceExtensionProperties( _phyDev, NULL, &devExtCount, devExtProps );
+    bool found = false;
+    for( uint32_t i = 0; i < devExtCount && !found; i++ ){
+        found = strcmp( devExtProps[ i ].extensionName, _extension ) == 0;
+    }
+    free( devExtProps );
+    return found;
+}
+
+// Check the extension and its feature are both there
+static bool dynamicRenderingSupported( VkPhysicalDevice _phyDev ){
+    if( !deviceHasExtension( _phyDev, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME ) ){
+        return false;
+    }
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR
+    };
+    VkPhysicalDeviceFeatures2 features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &dynamicRenderingFeatures
+    };
+    vkGetPhysicalDeviceFeatures2( _phyDev, &features );
+    return dynamicRenderingFeatures.dynamicRendering == VK_TRUE;
+}
+
+// Pick the queue family for uploads. Families with transfer but neither graphics nor compute
+// are usually backed by dedicated copy engines, which can run alongside rendering; failing
+// that, take any non-graphics family with transfer, then the graphics family itself
+static uint32_t pickTransferQueueFamily( const VkPhysicalDeviceCtx *_phyDevCtx, uint32_t _gfxFamily ){
+    const VkQueueFamilyProperties *qProps = _phyDevCtx->queueFamiliesCtx.queueFamilyProperties;
+    uint32_t picked = _gfxFamily;
+    uint32_t pickedScore = 0;
+    for( uint32_t i = 0; i < _phyDevCtx->queueFamiliesCtx.numFamilies; i++ ){
+        VkQueueFlags flags = qProps[ i ].queueFlags;
+        if( !( flags & VK_QUEUE_TRANSFER_BIT ) || ( flags & VK_QUEUE_GRAPHICS_BIT ) ||
+            !qProps[ i ].queueCount ){
+            continue;
+        }
+        uint32_t score = ( flags & VK_QUEUE_COMPUTE_BIT ) ? 1 : 2;
+        if( score > pickedScore ){
+            picked = i;
+            pickedScore = score;
+        }
+    }
+    return picked;
+}
+
 int pomCreateLogicalDevice(){
     // At this point we have a physical device selected,
     // with a context for it that specifies the queue families
@@ -435,7 +572,7 @@ int pomCreateLogicalDevice(){
     // First specify the queues to be created
     float queuePriority = 1.0f;
     uint32_t queueFamilyCount = 0;
-    VkDeviceQueueCreateInfo vkQueueCreateInfoBlock[ sizeof( queueFamRequirements ) / sizeof( VkQueueFamilyRequirement ) ] = { { 0 } };
+    VkDeviceQueueCreateInfo vkQueueCreateInfoBlock[ sizeof( queueFamRequirements ) / sizeof( VkQueueFamilyRequirement ) + 1 ] = { { 0 } };
     VkDeviceQueueCreateInfo * nextFreeQueueInfo = &vkQueueCreateInfoBlock[ 0 ];
     for( int i = 0; i < numReq; i++ ){
         const VkQueueFamilyRequirementFound *queueReqFound = &phyDevCtx->queueReqFound[ i ];
@@ -452,21 +589,63 @@ int pomCreateLogicalDevice(){
         // Point to next queue info struct in the block
         nextFreeQueueInfo = nextFreeQueueInfo + 1;
     }
+    uint32_t gfxQueueFamily = phyDevCtx->queueReqFound[ 0 ].devQueueIdx;
+    uint32_t transferQueueFamily = pickTransferQueueFamily( phyDevCtx, gfxQueueFamily );
+    bool transferQueueUnique = true;
+    for( uint32_t i = 0; i < queueFamilyCount; i++ ){
+        if( vkQueueCreateInfoBlock[ i ].queueFamilyIndex == transferQueueFamily ){
+            transferQueueUnique = false;
+        }
+    }
+    if( transferQueueUnique ){
+        nextFreeQueueInfo->sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        nextFreeQueueInfo->queueCount = 1;
+        nextFreeQueueInfo->queueFamilyIndex = transferQueueFamily;
+        nextFreeQueueInfo->pQueuePriorities = &queuePriority;
+        queueFamilyCount++;
+    }
 
     // Now set up required device features
     // TODO - set this up properly
     VkPhysicalDeviceFeatures vkDeviceFeatures = { 0 };
 
+    // Then the optional extensions
+    const char *enabledExtensions[ NUM_REQUIRED_EXTENSIONS + 2 ];
+    memcpy( enabledExtensions, requiredExtensions, sizeof( requiredExtensions ) );
+    uint32_t numEnabledExtensions = NUM_REQUIRED_EXTENSIONS;
+
+    const char *cDynamicRendering = pomMapGetSet( &systemConfig.mapCtx, CONFIG_DYNAMIC_RENDERING_KEY,
+                                                  DEFAULT_DYNAMIC_RENDERING );
+    bool dynamicRendering = false;
+    if( atoi( cDynamicRendering ) ){
+        dynamicRendering = dynamicRenderingSupported( phyDevCtx->phyDev );
+        if( !dynamicRendering ){
+            LOG_WARN( "Dynamic rendering not supported by device, using render passes" );
+        }
+    }
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
+        .dynamicRendering = VK_TRUE
+    };
+    if( dynamicRendering ){
+        enabledExtensions[ numEnabledExtensions++ ] = VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME;
+    }
+    bool memoryBudget = deviceHasExtension( phyDevCtx->phyDev, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME );
+    if( memoryBudget ){
+        enabledExtensions[ numEnabledExtensions++ ] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+    }
+
     // Now create the actual device
     VkDeviceCreateInfo vkDevCreateInfo = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = dynamicRendering ? &dynamicRenderingFeatures : NULL,
         .queueCreateInfoCount = queueFamilyCount,
         .pQueueCreateInfos = vkQueueCreateInfoBlock,
         .pEnabledFeatures = &vkDeviceFeatures,
         .enabledLayerCount = 0,
         .ppEnabledLayerNames = NULL,
-        .enabledExtensionCount = sizeof( requiredExtensions ) / sizeof( const char * const ),
-        .ppEnabledExtensionNames = requiredExtensions
+        .enabledExtensionCount = numEnabledExtensions,
+        .ppEnabledExtensionNames = enabledExtensions
 
     };
     
@@ -476,7 +655,31 @@ int pomCreateLogicalDevice(){
         return 1;
     }
     LOG( "Logical device created" );
-    vkGetDeviceQueue( vkDeviceCtx.logicalDevice, phyDevCtx->queueReqFound[ 0 ].devQueueIdx, 0, &vkDeviceCtx.mainGfxQueue );
+    vkGetDeviceQueue( vkDeviceCtx.logicalDevice, gfxQueueFamily, 0, &vkDeviceCtx.mainGfxQueue );
+    vkDeviceCtx.gfxQueueFamily = gfxQueueFamily;
+    vkGetDeviceQueue( vkDeviceCtx.logicalDevice, transferQueueFamily, 0, &vkDeviceCtx.transferQueue );
+    vkDeviceCtx.transferQueueFamily = transferQueueFamily;
+    LOG( "Using queue family %u for transfers%s", transferQueueFamily,
+         transferQueueFamily == gfxQueueFamily ? " (shared with graphics)" : "" );
+
+    if( dynamicRendering ){
+        // Extension commands aren't exported by the loader
+        vkDeviceCtx.cmdBeginRendering = (PFN_vkCmdBeginRenderingKHR)
+            vkGetDeviceProcAddr( vkDeviceCtx.logicalDevice, "vkCmdBeginRenderingKHR" );
+        vkDeviceCtx.cmdEndRendering = (PFN_vkCmdEndRenderingKHR)
+            vkGetDeviceProcAddr( vkDeviceCtx.logicalDevice, "vkCmdEndRenderingKHR" );
+        dynamicRendering = vkDeviceCtx.cmdBeginRendering && vkDeviceCtx.cmdEndRendering;
+        if( !dynamicRendering ){
+            LOG_WARN( "Failed to load dynamic rendering commands, using render passes" );
+        }
+    }
+    vkDeviceCtx.dynamicRenderingEnabled = dynamicRendering;
+    LOG( "Dynamic rendering %s", dynamicRendering ? "enabled" : "disabled" );
+
+    // Memory types and heaps don't change over the device's lifetime
+    vkGetPhysicalDeviceMemoryProperties( phyDevCtx->phyDev, &vkDeviceCtx.memProps );
+    vkDeviceCtx.memoryBudgetEnabled = memoryBudget;
+    LOG( "Memory budget %s", memoryBudget ? "enabled" : "unavailable" );
 
     devCtx->logicalDeviceCreated = true;
 
@@ -488,75 +691,127 @@ int pomCreateLogicalDevice(){
         imageCount = surfaceCaps->maxImageCount;
     }
 
-    VkSwapchainCreateInfoKHR createSwapchain = { 0 };
-    createSwapchain.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-    createSwapchain.surface = *pomIoGetSurface();
-    createSwapchain.minImageCount = imageCount;
-    createSwapchain.imageFormat = swapchainInfo->chosenSurfaceFormat.format;
-    createSwapchain.imageColorSpace = swapchainInfo->chosenSurfaceFormat.colorSpace;
-    createSwapchain.imageExtent = swapchainInfo->extent;
-    createSwapchain.imageArrayLayers = 1;
-    createSwapchain.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-    createSwapchain.preTransform = surfaceCaps->currentTransform;
-    createSwapchain.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-    createSwapchain.presentMode = swapchainInfo->chosenPresentMode;
-    createSwapchain.clipped = VK_TRUE;
-    createSwapchain.oldSwapchain = VK_NULL_HANDLE;
+    swapchainInfo->minImageCount = imageCount;
 
     // Check if we need concurrent access to this swapchain
     // TODO - do a proper check instead of just checking 1st and 2nd indices
     VkQueueFamilyRequirementFound *queueReqFound = &vkDeviceCtx.physicalDeviceCtx.queueReqFound[ 0 ];
-    uint32_t queueFamilyIndices[] = { queueReqFound[ 0 ].devQueueIdx, queueReqFound[ 1 ].devQueueIdx };
+    swapchainInfo->queueFamilyIndices[ 0 ] = queueReqFound[ 0 ].devQueueIdx;
+    swapchainInfo->queueFamilyIndices[ 1 ] = queueReqFound[ 1 ].devQueueIdx;
     if( queueIdUnique[ 0 ] && queueIdUnique[ 1 ] ){
         // Swapchain will be accessed from 2 different queue families
-        createSwapchain.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-        createSwapchain.queueFamilyIndexCount = 2;
-        createSwapchain.pQueueFamilyIndices = queueFamilyIndices;
+        swapchainInfo->sharingMode = VK_SHARING_MODE_CONCURRENT;
     }else{
         // Swapchain will be accessed from a single queue family
-        createSwapchain.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        createSwapchain.queueFamilyIndexCount = 0;
-        createSwapchain.pQueueFamilyIndices = NULL;    
+        swapchainInfo->sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     }
 
-    if( vkCreateSwapchainKHR( vkDeviceCtx.logicalDevice,
-                              &createSwapchain, NULL,
-                              &swapchainInfo->swapchain ) != VK_SUCCESS ){
-        LOG_ERR( "Unable to create swapchain" );
+    if( swapchainCreate( swapchainInfo, VK_NULL_HANDLE ) ){
         return 1;
     }
 
-    // Now get the swapchain images
-    uint32_t numSwapchainImages = 0;
-    vkGetSwapchainImagesKHR( vkDeviceCtx.logicalDevice, swapchainInfo->swapchain,
-                             &numSwapchainImages, NULL );
-    if( !numSwapchainImages ){
-        LOG_ERR( "Could not get swapchain images" );
+    // Pipelines can be created without a cache, just more slowly
+    const char *pipelineCachePath = pomMapGetSet( &systemConfig.mapCtx, CONFIG_PIPELINE_CACHE_KEY,
+                                                  DEFAULT_PIPELINE_CACHE_PATH );
+    if( pomPipelineCacheCreate( pipelineCachePath ) ){
+        LOG_WARN( "Failed to create pipeline cache, pipelines will be compiled from scratch" );
+    }
+
+    return 0;
+}
+
+int pomSwapchainRecreate(){
+    if( !vkDeviceCtx.logicalDeviceCreated ){
+        LOG_ERR( "Attempting to recreate swapchain without logical device" );
         return 1;
     }
-    swapchainInfo->swapchainImages = (VkImage*) malloc( sizeof( VkImage ) * numSwapchainImages );
-    vkGetSwapchainImagesKHR( vkDeviceCtx.logicalDevice, swapchainInfo->swapchain,
-                             &numSwapchainImages, swapchainInfo->swapchainImages );
+    SwapchainInfo *swapchainInfo = &vkDeviceCtx.physicalDeviceCtx.swapchainInfo;
+    VkSurfaceKHR *surface = pomIoGetSurface();
+    if( !surface ){
+        LOG_ERR( "Attempting to recreate swapchain without render surface" );
+        return 1;
+    }
+    // The surface's extent (and maybe transform) has changed; the format and present
+    // mode chosen with the device still stand
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR( vkDeviceCtx.physicalDeviceCtx.phyDev, *surface,
+                                               &swapchainInfo->surfaceCaps );
+    swapchainChooseExtent( swapchainInfo );
+    if( !swapchainInfo->extent.width || !swapchainInfo->extent.height ){
+        // Minimised. There's nothing to present to until the window is restored
+        return 2;
+    }
+
+    VkSwapchainKHR oldSwapchain = swapchainInfo->swapchain;
+    uint32_t oldNumImages = swapchainInfo->numSwapchainImages;
+    if( swapchainCreate( swapchainInfo, oldSwapchain ) ){
+        LOG_ERR( "Failed to recreate swapchain" );
+        return 1;
+    }
+    vkDestroySwapchainKHR( vkDeviceCtx.logicalDevice, oldSwapchain, NULL );
+    if( swapchainInfo->numSwapchainImages != oldNumImages ){
+        LOG( "Swapchain image count changed from %u to %u", oldNumImages,
+             swapchainInfo->numSwapchainImages );
+    }
+    LOG( "Swapchain recreated at %ux%u", swapchainInfo->extent.width,
+         swapchainInfo->extent.height );
+    return 0;
+}
+
+bool pomDeviceDynamicRenderingEnabled(){
+    return vkDeviceCtx.logicalDeviceCreated && vkDeviceCtx.dynamicRenderingEnabled;
+}
+
+void pomDeviceCmdBeginRendering( VkCommandBuffer _cmdBuffer, const VkRenderingInfoKHR *_renderingInfo ){
+    vkDeviceCtx.cmdBeginRendering( _cmdBuffer, _renderingInfo );
+}
 
-    swapchainInfo->numSwapchainImages = numSwapchainImages;
+const VkPhysicalDeviceMemoryProperties * pomDeviceGetMemoryProperties(){
+    if( !vkDeviceCtx.logicalDeviceCreated ){
+        return NULL;
+    }
+    return &vkDeviceCtx.memProps;
+}
 
+int pomDeviceGetMemoryBudget( VkDeviceSize *_heapBudgets, VkDeviceSize *_heapUsages ){
+    if( !vkDeviceCtx.logicalDeviceCreated || !vkDeviceCtx.memoryBudgetEnabled ){
+        return 1;
+    }
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProps = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT
+    };
+    VkPhysicalDeviceMemoryProperties2 memProps2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+        .pNext = &budgetProps
+    };
+    vkGetPhysicalDeviceMemoryProperties2( vkDeviceCtx.physicalDeviceCtx.phyDev, &memProps2 );
+    uint32_t numHeaps = vkDeviceCtx.memProps.memoryHeapCount;
+    memcpy( _heapBudgets, budgetProps.heapBudget, numHeaps * sizeof( VkDeviceSize ) );
+    memcpy( _heapUsages, budgetProps.heapUsage, numHeaps * sizeof( VkDeviceSize ) );
     return 0;
 }
 
+void pomDeviceCmdEndRendering( VkCommandBuffer _cmdBuffer ){
+    vkDeviceCtx.cmdEndRendering( _cmdBuffer );
+}
+
 VkFormat * pomGetSwapchainImageFormat(){
     return &vkDeviceCtx.physicalDeviceCtx.swapchainInfo.chosenSurfaceFormat.format;
 }
 
 
 VkQueue * pomDeviceGetGraphicsQueue( uint32_t *idx ){
-    // TODO - proper idx support
-    *idx = 0;
+    *idx = vkDeviceCtx.gfxQueueFamily;
     return &vkDeviceCtx.mainGfxQueue;
 }
 
+VkQueue * pomDeviceGetTransferQueue( uint32_t *idx ){
+    *idx = vkDeviceCtx.transferQueueFamily;
+    return &vkDeviceCtx.transferQueue;
+}
+
 VkQueue * pomDeviceGetPresentQueue( uint32_t *idx ){
-    // TODO - proper idx support
-    *idx = 0;
+    // TODO - separate present queue
+    *idx = vkDeviceCtx.gfxQueueFamily;
     return &vkDeviceCtx.mainGfxQueue;
 }
 
@@ -597,11 +852,17 @@ int pomDestroyLogicalDevice(){
         return 1;
     }
 
+    // Save the cache while the device is still around to hand us its data
+    if( pomPipelineCacheGet() != VK_NULL_HANDLE ){
+        pomPipelineCacheDestroy();
+    }
     free( vkDeviceCtx.physicalDeviceCtx.swapchainInfo.swapchainImages );
     vkDestroySwapchainKHR( vkDeviceCtx.logicalDevice, vkDeviceCtx.physicalDeviceCtx.swapchainInfo.swapchain, NULL );
     vkDestroyDevice( vkDeviceCtx.logicalDevice, NULL );
 
     vkDeviceCtx.logicalDeviceCreated = false;
+    vkDeviceCtx.dynamicRenderingEnabled = false;
+    vkDeviceCtx.memoryBudgetEnabled = false;
 
     return 0;
 }
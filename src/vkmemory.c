@@ -1,33 +1,500 @@
 #include "vkmemory.h"
+#include "vkmemorytlsf.h"
 #include "vkdevice.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <threads.h>
 
 #define LOG( lvl, log, ... ) LOG_MODULE( lvl, VkMemory, log, ##__VA_ARGS__ )
 
-static int findMemoryType( uint32_t *_index, VkMemoryPropertyFlags _memFlags,
-                           VkMemoryRequirements *_memReqs ){
+// Leftovers smaller than this stay part of the allocation rather than becoming a free range
+#define MEMORY_MIN_RANGE_SIZE 64
+#define MEMORY_DEFAULT_BLOCK_SIZE ( (VkDeviceSize) 64 * 1024 * 1024 )
+// Heaps up to this size get blocks of an eighth of the heap instead
+#define MEMORY_SMALL_HEAP_SIZE ( (VkDeviceSize) 1024 * 1024 * 1024 )
+#define MEMORY_NUM_POOLS ( VK_MAX_MEMORY_TYPES * POM_VK_MEMORY_NUM_RESOURCE_TYPES )
+// Without VK_EXT_memory_budget, assume we can have this share of each heap to ourselves
+#define MEMORY_DEFAULT_BUDGET_PERCENT 80
+
+typedef struct PomVkMemoryPool PomVkMemoryPool;
+typedef struct PomVkMemoryManagerCtx PomVkMemoryManagerCtx;
+typedef struct PomVkMemoryCounter PomVkMemoryCounter;
+
+struct PomVkMemoryBlock{
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    // Bytes of the block handed out to allocations
+    VkDeviceSize usedBytes;
+    void *mapped;
+    uint32_t memoryTypeIndex;
+    uint32_t numAllocations;
+    // Holds a single allocation, and is freed along with it
+    bool dedicated;
+    PomVkMemoryPool *pool;
+    PomVkMemoryBlock *prev;
+    PomVkMemoryBlock *next;
+    PomVkMemoryRange *firstRange;
+
+    PomVkMemoryTlsf freeIndex;
+};
+
+// Blocks of one memory type holding one type of resource
+struct PomVkMemoryPool{
+    PomVkMemoryBlock *blocks;
+    uint32_t numSharedBlocks;
+};
+
+struct PomVkMemoryCounter{
+    VkDeviceSize bytes;
+    VkDeviceSize peakBytes;
+    uint32_t numAllocations;
+};
+
+struct PomVkMemoryManagerCtx{
+    bool initialised;
+    mtx_t mutex;
+    VkPhysicalDeviceMemoryProperties memProps;
+    uint32_t maxAllocations;
+    uint32_t numDeviceAllocations;
+    // Granularity of flushes of non-coherent memory
+    VkDeviceSize nonCoherentAtomSize;
+    PomVkMemoryPool pools[ MEMORY_NUM_POOLS ];
+
+    // Bytes of each heap allocated to our blocks
+    VkDeviceSize heapAllocated[ VK_MAX_MEMORY_HEAPS ];
+    // Budget and usage of each heap as of the last block allocation or free
+    VkDeviceSize heapBudgets[ VK_MAX_MEMORY_HEAPS ];
+    VkDeviceSize heapUsages[ VK_MAX_MEMORY_HEAPS ];
+
+    // Live allocations, tallied three ways
+    PomVkMemoryCounter typeCounters[ VK_MAX_MEMORY_TYPES ];
+    PomVkMemoryCounter heapCounters[ VK_MAX_MEMORY_HEAPS ];
+    PomVkMemoryCounter categoryCounters[ POM_VK_MEMORY_NUM_CATEGORIES ];
+};
+
+static PomVkMemoryManagerCtx memoryManagerCtx = { 0 };
+
+static const char *categoryNames[ POM_VK_MEMORY_NUM_CATEGORIES ] = {
+    [ POM_VK_MEMORY_CATEGORY_GEOMETRY ] = "geometry",
+    [ POM_VK_MEMORY_CATEGORY_UNIFORM ] = "uniform",
+    [ POM_VK_MEMORY_CATEGORY_IMAGE ] = "image",
+    [ POM_VK_MEMORY_CATEGORY_STAGING ] = "staging",
+    [ POM_VK_MEMORY_CATEGORY_OTHER ] = "other"
+};
+
+static VkDeviceSize _pomAlignUp( VkDeviceSize _value, VkDeviceSize _alignment ){
+    return ( _value + _alignment - 1 ) & ~( _alignment - 1 );
+}
+
+/*******************
+ * Budget
+ *******************/
+
+static void _pomUpdateBudget(){
+    if( !pomDeviceGetMemoryBudget( memoryManagerCtx.heapBudgets, memoryManagerCtx.heapUsages ) ){
+        return;
+    }
+    // Without the extension we can only see our own usage
+    const VkPhysicalDeviceMemoryProperties *memProps = &memoryManagerCtx.memProps;
+    for( uint32_t i = 0; i < memProps->memoryHeapCount; i++ ){
+        memoryManagerCtx.heapBudgets[ i ] = memProps->memoryHeaps[ i ].size / 100 * MEMORY_DEFAULT_BUDGET_PERCENT;
+        memoryManagerCtx.heapUsages[ i ] = memoryManagerCtx.heapAllocated[ i ];
+    }
+}
+
+/*******************
+ * Accounting
+ *******************/
+
+static void _pomCounterAdd( PomVkMemoryCounter *_counter, VkDeviceSize _size ){
+    _counter->bytes += _size;
+    _counter->numAllocations++;
+    if( _counter->bytes > _counter->peakBytes ){
+        _counter->peakBytes = _counter->bytes;
+    }
+}
+
+static void _pomCounterRemove( PomVkMemoryCounter *_counter, VkDeviceSize _size ){
+    _counter->bytes -= _size;
+    _counter->numAllocations--;
+}
+
+// Record a range of _block as allocated. Call with the manager mutex held
+static void _pomAccountAllocation( PomVkMemoryBlock *_block, PomVkMemoryRange *_range,
+                                   PomVkMemoryCategory _category, const char *_site ){
+    _range->category = _category;
+    _range->site = _site;
+    uint32_t heapIndex = memoryManagerCtx.memProps.memoryTypes[ _block->memoryTypeIndex ].heapIndex;
+    _pomCounterAdd( &memoryManagerCtx.typeCounters[ _block->memoryTypeIndex ], _range->size );
+    _pomCounterAdd( &memoryManagerCtx.heapCounters[ heapIndex ], _range->size );
+    _pomCounterAdd( &memoryManagerCtx.categoryCounters[ _category ], _range->size );
+}
+
+// Record an allocated range as about to be freed. Call with the manager mutex held
+static void _pomAccountFree( PomVkMemoryBlock *_block, PomVkMemoryRange *_range ){
+    uint32_t heapIndex = memoryManagerCtx.memProps.memoryTypes[ _block->memoryTypeIndex ].heapIndex;
+    _pomCounterRemove( &memoryManagerCtx.typeCounters[ _block->memoryTypeIndex ], _range->size );
+    _pomCounterRemove( &memoryManagerCtx.heapCounters[ heapIndex ], _range->size );
+    _pomCounterRemove( &memoryManagerCtx.categoryCounters[ _range->category ], _range->size );
+}
+
+static void _pomStatsFromCounter( PomVkMemoryStats *_stats, const PomVkMemoryCounter *_counter ){
+    *_stats = (PomVkMemoryStats){
+        .allocatedBytes = _counter->bytes,
+        .peakAllocatedBytes = _counter->peakBytes,
+        .numAllocations = _counter->numAllocations
+    };
+}
+
+// Add the blocks of a memory type to _stats, tracking the largest free range seen in
+// _largestFree. Call with the manager mutex held
+static void _pomStatsAddBlocks( PomVkMemoryStats *_stats, uint32_t _memoryTypeIndex,
+                                VkDeviceSize *_largestFree ){
+    for( uint32_t i = 0; i < POM_VK_MEMORY_NUM_RESOURCE_TYPES; i++ ){
+        PomVkMemoryPool *pool =
+            &memoryManagerCtx.pools[ _memoryTypeIndex * POM_VK_MEMORY_NUM_RESOURCE_TYPES + i ];
+        for( PomVkMemoryBlock *block = pool->blocks; block; block = block->next ){
+            _stats->numBlocks++;
+            _stats->blockBytes += block->size;
+            for( PomVkMemoryRange *range = block->firstRange; range; range = range->nextPhysical ){
+                if( !range->free ){
+                    continue;
+                }
+                _stats->freeBytes += range->size;
+                if( range->size > *_largestFree ){
+                    *_largestFree = range->size;
+                }
+            }
+        }
+    }
+}
+
+static void _pomStatsSetFragmentation( PomVkMemoryStats *_stats, VkDeviceSize _largestFree ){
+    _stats->fragmentation = _stats->freeBytes ?
+        1.0f - (float) _largestFree / (float) _stats->freeBytes : 0.0f;
+}
+
+static void _pomLogStats( const char *_name, uint32_t _index, const PomVkMemoryStats *_stats ){
+    LOG( INFO, "%s %u: %u allocation(s), %lu bytes (peak %lu) in %u block(s) of %lu bytes, "
+               "%lu free, %.2f fragmented",
+         _name, _index, _stats->numAllocations, _stats->allocatedBytes, _stats->peakAllocatedBytes,
+         _stats->numBlocks, _stats->blockBytes, _stats->freeBytes, _stats->fragmentation );
+}
+
+/*******************
+ * Blocks
+ *******************/
+
+// Split the range at _splitSize, returning the free remainder (already indexed), or NULL
+// if it couldn't be allocated
+static PomVkMemoryRange *_pomBlockSplitRange( PomVkMemoryBlock *_block, PomVkMemoryRange *_range,
+                                              VkDeviceSize _splitSize ){
+    PomVkMemoryRange *remainder = (PomVkMemoryRange*) calloc( 1, sizeof( PomVkMemoryRange ) );
+    if( !remainder ){
+        return NULL;
+    }
+    remainder->offset = _range->offset + _splitSize;
+    remainder->size = _range->size - _splitSize;
+    remainder->prevPhysical = _range;
+    remainder->nextPhysical = _range->nextPhysical;
+    if( _range->nextPhysical ){
+        _range->nextPhysical->prevPhysical = remainder;
+    }
+    _range->nextPhysical = remainder;
+    _range->size = _splitSize;
+    pomVkMemoryTlsfInsertFree( &_block->freeIndex, remainder );
+    return remainder;
+}
+
+static PomVkMemoryRange *_pomBlockAllocate( PomVkMemoryBlock *_block, VkDeviceSize _size,
+                                            VkDeviceSize _alignment ){
+    // Any range this big can be aligned without running short
+    PomVkMemoryRange *range = pomVkMemoryTlsfFindFree( &_block->freeIndex, _size + _alignment - 1 );
+    if( !range ){
+        return NULL;
+    }
+    pomVkMemoryTlsfRemoveFree( &_block->freeIndex, range );
+
+    VkDeviceSize padding = _pomAlignUp( range->offset, _alignment ) - range->offset;
+    if( padding ){
+        // Give the padding back as its own free range, and allocate from what follows.
+        // The range before can't be free, as free neighbours are always merged
+        PomVkMemoryRange *aligned = _pomBlockSplitRange( _block, range, padding );
+        if( !aligned ){
+            pomVkMemoryTlsfInsertFree( &_block->freeIndex, range );
+            return NULL;
+        }
+        pomVkMemoryTlsfRemoveFree( &_block->freeIndex, aligned );
+        pomVkMemoryTlsfInsertFree( &_block->freeIndex, range );
+        range = aligned;
+    }
+    if( range->size - _size >= MEMORY_MIN_RANGE_SIZE ){
+        // Failing to split just leaves the allocation a little bigger than asked for
+        _pomBlockSplitRange( _block, range, _size );
+    }
+    _block->numAllocations++;
+    _block->usedBytes += range->size;
+    return range;
+}
+
+static void _pomBlockFree( PomVkMemoryBlock *_block, PomVkMemoryRange *_range ){
+    _block->usedBytes -= _range->size;
+    PomVkMemoryRange *prev = _range->prevPhysical;
+    if( prev && prev->free ){
+        pomVkMemoryTlsfRemoveFree( &_block->freeIndex, prev );
+        prev->size += _range->size;
+        prev->nextPhysical = _range->nextPhysical;
+        if( _range->nextPhysical ){
+            _range->nextPhysical->prevPhysical = prev;
+        }
+        free( _range );
+        _range = prev;
+    }
+    PomVkMemoryRange *next = _range->nextPhysical;
+    if( next && next->free ){
+        pomVkMemoryTlsfRemoveFree( &_block->freeIndex, next );
+        _range->size += next->size;
+        _range->nextPhysical = next->nextPhysical;
+        if( next->nextPhysical ){
+            next->nextPhysical->prevPhysical = _range;
+        }
+        free( next );
+    }
+    pomVkMemoryTlsfInsertFree( &_block->freeIndex, _range );
+    _block->numAllocations--;
+}
+
+static PomVkMemoryBlock *_pomBlockCreate( VkDevice _dev, PomVkMemoryPool *_pool,
+                                          uint32_t _memoryTypeIndex, VkDeviceSize _size,
+                                          bool _dedicated ){
+    if( memoryManagerCtx.numDeviceAllocations >= memoryManagerCtx.maxAllocations ){
+        LOG( ERR, "Device memory allocation limit (%u) reached", memoryManagerCtx.maxAllocations );
+        return NULL;
+    }
+    PomVkMemoryBlock *block = (PomVkMemoryBlock*) calloc( 1, sizeof( PomVkMemoryBlock ) );
+    PomVkMemoryRange *range = (PomVkMemoryRange*) calloc( 1, sizeof( PomVkMemoryRange ) );
+    if( !block || !range ){
+        LOG( ERR, "Failed to allocate memory block context" );
+        free( block );
+        free( range );
+        return NULL;
+    }
+    VkMemoryAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = _size,
+        .memoryTypeIndex = _memoryTypeIndex
+    };
+    if( vkAllocateMemory( _dev, &allocInfo, NULL, &block->memory ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to allocate %lu byte memory block", _size );
+        free( block );
+        free( range );
+        return NULL;
+    }
+    VkMemoryPropertyFlags typeFlags =
+        memoryManagerCtx.memProps.memoryTypes[ _memoryTypeIndex ].propertyFlags;
+    if( ( typeFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT ) &&
+        vkMapMemory( _dev, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped ) != VK_SUCCESS ){
+        LOG( WARN, "Failed to map host-visible memory block" );
+        block->mapped = NULL;
+    }
+    memoryManagerCtx.numDeviceAllocations++;
+    uint32_t heapIndex = memoryManagerCtx.memProps.memoryTypes[ _memoryTypeIndex ].heapIndex;
+    memoryManagerCtx.heapAllocated[ heapIndex ] += _size;
+    _pomUpdateBudget();
+
+    block->size = _size;
+    block->memoryTypeIndex = _memoryTypeIndex;
+    block->dedicated = _dedicated;
+    block->pool = _pool;
+    range->offset = 0;
+    range->size = _size;
+    block->firstRange = range;
+    pomVkMemoryTlsfInsertFree( &block->freeIndex, range );
+
+    block->next = _pool->blocks;
+    if( _pool->blocks ){
+        _pool->blocks->prev = block;
+    }
+    _pool->blocks = block;
+    if( !_dedicated ){
+        _pool->numSharedBlocks++;
+    }
+    LOG( DEBUG, "Allocated %s %lu byte block of memory type %u",
+         _dedicated ? "dedicated" : "shared", _size, _memoryTypeIndex );
+    return block;
+}
+
+static void _pomBlockDestroy( VkDevice _dev, PomVkMemoryBlock *_block ){
+    PomVkMemoryPool *pool = _block->pool;
+    if( _block->prev ){
+        _block->prev->next = _block->next;
+    }else{
+        pool->blocks = _block->next;
+    }
+    if( _block->next ){
+        _block->next->prev = _block->prev;
+    }
+    if( !_block->dedicated ){
+        pool->numSharedBlocks--;
+    }
+
+    PomVkMemoryRange *range = _block->firstRange;
+    while( range ){
+        PomVkMemoryRange *next = range->nextPhysical;
+        free( range );
+        range = next;
+    }
+    if( _block->mapped ){
+        vkUnmapMemory( _dev, _block->memory );
+    }
+    vkFreeMemory( _dev, _block->memory, NULL );
+    memoryManagerCtx.numDeviceAllocations--;
+    uint32_t heapIndex = memoryManagerCtx.memProps.memoryTypes[ _block->memoryTypeIndex ].heapIndex;
+    memoryManagerCtx.heapAllocated[ heapIndex ] -= _block->size;
+    _pomUpdateBudget();
+    free( _block );
+}
+
+static VkDeviceSize _pomPreferredBlockSize( uint32_t _memoryTypeIndex ){
+    const VkPhysicalDeviceMemoryProperties *memProps = &memoryManagerCtx.memProps;
+    uint32_t heapIndex = memProps->memoryTypes[ _memoryTypeIndex ].heapIndex;
+    VkDeviceSize heapSize = memProps->memoryHeaps[ heapIndex ].size;
+    // A few default-sized blocks would use up a small heap (integrated GPU carve-outs,
+    // host-visible device memory windows) on their own
+    if( heapSize <= MEMORY_SMALL_HEAP_SIZE ){
+        return heapSize / 8;
+    }
+    return MEMORY_DEFAULT_BLOCK_SIZE;
+}
+
+/*******************
+ * Manager
+ *******************/
+
+int pomVkMemoryManagerCreate(){
+    if( memoryManagerCtx.initialised ){
+        LOG( WARN, "Attempting to re-initialise memory manager" );
+        return 1;
+    }
     VkPhysicalDevice *phyDev = pomGetPhysicalDevice();
-    if( !phyDev ){
-        LOG( ERR, "Attempting to allocated memory with no available physical device" );
+    const VkPhysicalDeviceMemoryProperties *memProps = pomDeviceGetMemoryProperties();
+    if( !phyDev || !memProps ){
+        LOG( ERR, "Attempting to create memory manager with no available device" );
         return 1;
     }
-    // TODO - cache this
-    VkPhysicalDeviceMemoryProperties memProps;
-    vkGetPhysicalDeviceMemoryProperties( *phyDev, &memProps );
-    
+    if( mtx_init( &memoryManagerCtx.mutex, mtx_plain ) != thrd_success ){
+        LOG( ERR, "Failed to create memory manager mutex" );
+        return 1;
+    }
+    memoryManagerCtx.memProps = *memProps;
+    VkPhysicalDeviceProperties devProps;
+    vkGetPhysicalDeviceProperties( *phyDev, &devProps );
+    memoryManagerCtx.maxAllocations = devProps.limits.maxMemoryAllocationCount;
+    memoryManagerCtx.nonCoherentAtomSize = devProps.limits.nonCoherentAtomSize ?
+                                           devProps.limits.nonCoherentAtomSize : 1;
+    memoryManagerCtx.numDeviceAllocations = 0;
+    for( uint32_t i = 0; i < MEMORY_NUM_POOLS; i++ ){
+        memoryManagerCtx.pools[ i ] = (PomVkMemoryPool){ 0 };
+    }
+    for( uint32_t i = 0; i < VK_MAX_MEMORY_HEAPS; i++ ){
+        memoryManagerCtx.heapAllocated[ i ] = 0;
+        memoryManagerCtx.heapCounters[ i ] = (PomVkMemoryCounter){ 0 };
+    }
+    for( uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++ ){
+        memoryManagerCtx.typeCounters[ i ] = (PomVkMemoryCounter){ 0 };
+    }
+    for( uint32_t i = 0; i < POM_VK_MEMORY_NUM_CATEGORIES; i++ ){
+        memoryManagerCtx.categoryCounters[ i ] = (PomVkMemoryCounter){ 0 };
+    }
+    _pomUpdateBudget();
+    memoryManagerCtx.initialised = true;
+    return 0;
+}
+
+int pomVkMemoryManagerDestroy(){
+    if( !memoryManagerCtx.initialised ){
+        LOG( WARN, "Attempting to destroy uninitialised memory manager" );
+        return 1;
+    }
+    VkDevice *dev = pomGetLogicalDevice();
+    if( !dev ){
+        LOG( ERR, "Logical device destroyed before memory manager" );
+        return 1;
+    }
+    pomVkMemoryLogStats();
+    uint32_t numLeaked = 0;
+    for( uint32_t i = 0; i < MEMORY_NUM_POOLS; i++ ){
+        PomVkMemoryPool *pool = &memoryManagerCtx.pools[ i ];
+        while( pool->blocks ){
+            PomVkMemoryBlock *block = pool->blocks;
+            for( PomVkMemoryRange *range = block->firstRange; range; range = range->nextPhysical ){
+                if( !range->free ){
+                    LOG( WARN, "Leaked %lu byte %s allocation of memory type %u, made at %s",
+                         range->size, categoryNames[ range->category ], block->memoryTypeIndex,
+                         range->site ? range->site : "unknown" );
+                }
+            }
+            numLeaked += block->numAllocations;
+            _pomBlockDestroy( *dev, block );
+        }
+    }
+    if( numLeaked ){
+        LOG( WARN, "%u memory allocation(s) still live at memory manager destruction", numLeaked );
+    }
+    mtx_destroy( &memoryManagerCtx.mutex );
+    memoryManagerCtx = (PomVkMemoryManagerCtx){ 0 };
+    return 0;
+}
+
+// Flags that make a memory type unusable for resources that didn't ask for them. Lazily
+// allocated memory can only back transient attachments, and protected memory needs
+// protected queues
+#define MEMORY_RESTRICTED_FLAGS ( VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT | VK_MEMORY_PROPERTY_PROTECTED_BIT )
+
+// Score a memory type meeting the requirements, higher being better. In order of priority:
+// whether the allocation fits in the heap's remaining budget, how many desired flags it has
+// (device-local counting double), and how few flags it has that weren't asked for, since
+// those tend to come at a price (small BAR heaps for host-visible device-local memory,
+// slower writes for host-cached memory)
+static uint32_t _pomScoreMemoryType( uint32_t _typeIndex, VkMemoryPropertyFlags _memFlags,
+                                     VkMemoryPropertyFlags _desiredFlags, VkDeviceSize _size ){
+    const VkMemoryType *memType = &memoryManagerCtx.memProps.memoryTypes[ _typeIndex ];
+    VkDeviceSize budget = memoryManagerCtx.heapBudgets[ memType->heapIndex ];
+    VkDeviceSize usage = memoryManagerCtx.heapUsages[ memType->heapIndex ];
+    bool fitsBudget = usage + _size <= budget;
+
+    VkMemoryPropertyFlags desiredFound = memType->propertyFlags & _desiredFlags;
+    uint32_t desiredScore = __builtin_popcount( desiredFound );
+    if( desiredFound & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT ){
+        desiredScore++;
+    }
+    VkMemoryPropertyFlags unwanted = memType->propertyFlags & ~( _memFlags | _desiredFlags );
+    uint32_t unwantedScore = 32 - __builtin_popcount( unwanted );
+
+    return 1 + ( fitsBudget ? 1u << 16 : 0 ) + ( desiredScore << 8 ) + unwantedScore;
+}
+
+// Find the best memory type out of _typeBits with all of _memFlags. Ties go to the bigger heap
+static int findMemoryType( uint32_t *_index, uint32_t _typeBits, VkMemoryPropertyFlags _memFlags,
+                           VkMemoryPropertyFlags _desiredFlags, VkDeviceSize _size ){
+    const VkPhysicalDeviceMemoryProperties *memProps = &memoryManagerCtx.memProps;
     uint32_t cMaxScore = 0;
     uint32_t cMaxIdx = 0;
-    for( uint32_t i = 0; i < memProps.memoryTypeCount; i++ ){
-        VkMemoryType *cType = &memProps.memoryTypes[ i ];
-        uint32_t mScore = 0;
-        if( ( ( cType->propertyFlags & _memFlags ) == _memFlags ) &&
-            ( _memReqs->memoryTypeBits & (1<<i) ) ){
-            // Memory type meets requirements
-            // TODO - check for desired properties and make real score
-            mScore = 1;
-            if( mScore > cMaxScore ){
-                cMaxScore = mScore;
-                cMaxIdx = i;
-            }
+    VkDeviceSize cMaxHeapSize = 0;
+    for( uint32_t i = 0; i < memProps->memoryTypeCount; i++ ){
+        const VkMemoryType *cType = &memProps->memoryTypes[ i ];
+        if( !( _typeBits & ( 1u << i ) ) || ( cType->propertyFlags & _memFlags ) != _memFlags ){
+            continue;
+        }
+        if( cType->propertyFlags & MEMORY_RESTRICTED_FLAGS & ~( _memFlags | _desiredFlags ) ){
+            continue;
+        }
+        uint32_t mScore = _pomScoreMemoryType( i, _memFlags, _desiredFlags, _size );
+        VkDeviceSize heapSize = memProps->memoryHeaps[ cType->heapIndex ].size;
+        if( mScore > cMaxScore || ( mScore == cMaxScore && heapSize > cMaxHeapSize ) ){
+            cMaxScore = mScore;
+            cMaxIdx = i;
+            cMaxHeapSize = heapSize;
         }
     }
     if( cMaxScore == 0 ){
@@ -36,33 +503,101 @@ static int findMemoryType( uint32_t *_index, VkMemoryPropertyFlags _memFlags,
     *_index = cMaxIdx;
     return 0;
 }
+
+// Allocate from the pool of one memory type, creating a block if none has room. Call with
+// the manager mutex held
+static PomVkMemoryRange *_pomPoolAllocate( VkDevice _dev, uint32_t _memoryTypeIndex,
+                                           PomVkMemoryResourceType _resourceType,
+                                           const VkMemoryRequirements *_memReq,
+                                           PomVkMemoryBlock **_block ){
+    VkDeviceSize alignment = _memReq->alignment ? _memReq->alignment : 1;
+    PomVkMemoryPool *pool =
+        &memoryManagerCtx.pools[ _memoryTypeIndex * POM_VK_MEMORY_NUM_RESOURCE_TYPES + _resourceType ];
+    VkDeviceSize blockSize = _pomPreferredBlockSize( _memoryTypeIndex );
+
+    PomVkMemoryBlock *block = NULL;
+    PomVkMemoryRange *range = NULL;
+    if( _memReq->size > blockSize / 2 ){
+        // Would leave too little of a shared block for anything else
+        block = _pomBlockCreate( _dev, pool, _memoryTypeIndex, _memReq->size, true );
+        range = block ? _pomBlockAllocate( block, _memReq->size, 1 ) : NULL;
+    }else{
+        for( block = pool->blocks; block && !range; block = range ? block : block->next ){
+            if( !block->dedicated ){
+                range = _pomBlockAllocate( block, _memReq->size, alignment );
+            }
+        }
+        if( !range ){
+            block = _pomBlockCreate( _dev, pool, _memoryTypeIndex, blockSize, false );
+            range = block ? _pomBlockAllocate( block, _memReq->size, alignment ) : NULL;
+        }
+    }
+    if( !range && block && !block->numAllocations ){
+        _pomBlockDestroy( _dev, block );
+    }
+    *_block = block;
+    return range;
+}
+
 int pomVkAllocateMemory( PomVkMemoryCtx *_memCtx,
-                         VkMemoryPropertyFlags _memFlags, 
+                         PomVkMemoryResourceType _resourceType,
+                         PomVkMemoryCategory _category,
+                         VkMemoryPropertyFlags _memFlags,
+                         VkMemoryPropertyFlags _desiredFlags,
                          VkMemoryRequirements *_memReq,
-                         VkMemoryRequirements *UNUSED(_memDesired) ){
+                         const char *_site ){
     VkDevice *dev = pomGetLogicalDevice();
     if( !dev ){
         LOG( ERR, "Attempting to allocate memory with no available device" );
+        return 1;
+    }
+    if( !memoryManagerCtx.initialised ){
+        LOG( ERR, "Attempting to allocate memory with uninitialised memory manager" );
+        return 1;
     }
     if( _memCtx->initialised ){
         LOG( WARN, "Attempting to reallocate memory" );
         return 1;
     }
-
-    VkMemoryAllocateInfo allocInfo ={
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = _memReq->size
-    };
-
-    if( findMemoryType( &allocInfo.memoryTypeIndex, _memFlags, _memReq ) ){
-        LOG( ERR, "Failed to find suitable memory type" );
+    if( !_memReq->size ){
+        LOG( ERR, "Attempting to allocate zero bytes of memory" );
+        return 1;
+    }
+    if( _category >= POM_VK_MEMORY_NUM_CATEGORIES ){
+        LOG( ERR, "Attempting to allocate memory of unknown category" );
         return 1;
     }
 
-    if( vkAllocateMemory( *dev, &allocInfo, NULL, &_memCtx->memory ) != VK_SUCCESS ){
-        LOG( ERR, "Failed to allocate memory" );
+    mtx_lock( &memoryManagerCtx.mutex );
+    PomVkMemoryBlock *block = NULL;
+    PomVkMemoryRange *range = NULL;
+    uint32_t typeBits = _memReq->memoryTypeBits;
+    uint32_t memoryTypeIndex;
+    while( !range ){
+        if( findMemoryType( &memoryTypeIndex, typeBits, _memFlags, _desiredFlags, _memReq->size ) ){
+            break;
+        }
+        range = _pomPoolAllocate( *dev, memoryTypeIndex, _resourceType, _memReq, &block );
+        if( !range ){
+            // The heap may be full, so fall back to the next best type
+            LOG( WARN, "Failed to allocate from memory type %u, trying others", memoryTypeIndex );
+            typeBits &= ~( 1u << memoryTypeIndex );
+        }
+    }
+    if( range ){
+        _pomAccountAllocation( block, range, _category, _site );
+    }
+    mtx_unlock( &memoryManagerCtx.mutex );
+    if( !range ){
+        LOG( ERR, "Failed to allocate %lu bytes of memory", _memReq->size );
         return 1;
     }
+
+    _memCtx->memory = block->memory;
+    _memCtx->offset = range->offset;
+    _memCtx->size = range->size;
+    _memCtx->block = block;
+    _memCtx->range = range;
     _memCtx->initialised = true;
     return 0;
 }
@@ -71,11 +606,215 @@ int pomVkFreeMemory( PomVkMemoryCtx *_memCtx ){
     VkDevice *dev = pomGetLogicalDevice();
     if( !dev ){
         LOG( ERR, "Attempting to free memory with no available device" );
+        return 1;
     }
     if( !_memCtx->initialised ){
         LOG( WARN, "Attempting to free unallocated memory" );
         return 1;
     }
-    vkFreeMemory( *dev, _memCtx->memory, NULL );
+    PomVkMemoryBlock *block = _memCtx->block;
+    mtx_lock( &memoryManagerCtx.mutex );
+    _pomAccountFree( block, _memCtx->range );
+    _pomBlockFree( block, _memCtx->range );
+    // Keep one empty shared block around, so a pool that empties and refills doesn't
+    // keep going back to the driver
+    if( !block->numAllocations && ( block->dedicated || block->pool->numSharedBlocks > 1 ) ){
+        _pomBlockDestroy( *dev, block );
+    }
+    mtx_unlock( &memoryManagerCtx.mutex );
+    *_memCtx = (PomVkMemoryCtx){ 0 };
+    return 0;
+}
+
+bool pomVkMemoryCanDefragment(){
+    if( !memoryManagerCtx.initialised ){
+        return false;
+    }
+    // Allocations only move into strictly fuller shared blocks, so there's nothing to do
+    // until some pool's shared blocks differ in use
+    bool canDefragment = false;
+    mtx_lock( &memoryManagerCtx.mutex );
+    for( uint32_t i = 0; i < MEMORY_NUM_POOLS && !canDefragment; i++ ){
+        bool anyShared = false;
+        VkDeviceSize minUsed = 0, maxUsed = 0;
+        for( PomVkMemoryBlock *block = memoryManagerCtx.pools[ i ].blocks; block; block = block->next ){
+            if( block->dedicated ){
+                continue;
+            }
+            if( !anyShared || block->usedBytes < minUsed ){
+                minUsed = block->usedBytes;
+            }
+            if( !anyShared || block->usedBytes > maxUsed ){
+                maxUsed = block->usedBytes;
+            }
+            anyShared = true;
+        }
+        canDefragment = minUsed != maxUsed;
+    }
+    mtx_unlock( &memoryManagerCtx.mutex );
+    return canDefragment;
+}
+
+int pomVkMemoryDefragmentAllocate( const PomVkMemoryCtx *_memCtx,
+                                   const VkMemoryRequirements *_memReq,
+                                   PomVkMemoryCtx *_newMemCtx ){
+    if( !_memCtx->initialised ){
+        LOG( ERR, "Attempting to defragment unallocated memory" );
+        return 1;
+    }
+    if( _newMemCtx->initialised ){
+        LOG( WARN, "Attempting to defragment into allocated memory" );
+        return 1;
+    }
+    PomVkMemoryBlock *srcBlock = _memCtx->block;
+    if( srcBlock->dedicated ){
+        // Already has a block to itself, so moving it wouldn't free anything
+        return 2;
+    }
+    VkDeviceSize alignment = _memReq->alignment ? _memReq->alignment : 1;
+    mtx_lock( &memoryManagerCtx.mutex );
+    // Only ever moving into fuller blocks means allocations can't bounce back and forth
+    // between blocks, and the emptiest blocks drain first
+    PomVkMemoryBlock *block = srcBlock->pool->blocks;
+    PomVkMemoryRange *range = NULL;
+    for( ; block && !range; block = range ? block : block->next ){
+        if( block != srcBlock && !block->dedicated && block->usedBytes > srcBlock->usedBytes ){
+            range = _pomBlockAllocate( block, _memReq->size, alignment );
+        }
+    }
+    if( range ){
+        // Counts as a new allocation until the old one is freed, so a move shows in the peak
+        _pomAccountAllocation( block, range, _memCtx->range->category, _memCtx->range->site );
+    }
+    mtx_unlock( &memoryManagerCtx.mutex );
+    if( !range ){
+        return 2;
+    }
+    _newMemCtx->memory = block->memory;
+    _newMemCtx->offset = range->offset;
+    _newMemCtx->size = range->size;
+    _newMemCtx->block = block;
+    _newMemCtx->range = range;
+    _newMemCtx->initialised = true;
+    return 0;
+}
+
+void *pomVkMemoryGetMapped( const PomVkMemoryCtx *_memCtx ){
+    if( !_memCtx->initialised || !_memCtx->block->mapped ){
+        return NULL;
+    }
+    return (uint8_t*) _memCtx->block->mapped + _memCtx->offset;
+}
+
+int pomVkMemoryFlush( const PomVkMemoryCtx *_memCtx, VkDeviceSize _offset, VkDeviceSize _size ){
+    if( !_memCtx->initialised || !_memCtx->block->mapped ){
+        LOG( ERR, "Attempting to flush unmapped memory" );
+        return 1;
+    }
+    const PomVkMemoryBlock *block = _memCtx->block;
+    VkMemoryPropertyFlags typeFlags =
+        memoryManagerCtx.memProps.memoryTypes[ block->memoryTypeIndex ].propertyFlags;
+    if( ( typeFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT ) || !_size ){
+        return 0;
+    }
+    VkDevice *dev = pomGetLogicalDevice();
+    if( !dev ){
+        LOG( ERR, "Attempting to flush memory with no available device" );
+        return 1;
+    }
+    // Flushing past the ends of the allocation only writes back neighbours' data early
+    VkDeviceSize atomSize = memoryManagerCtx.nonCoherentAtomSize;
+    VkDeviceSize start = ( _memCtx->offset + _offset ) & ~( atomSize - 1 );
+    VkDeviceSize end = _pomAlignUp( _memCtx->offset + _offset + _size, atomSize );
+    VkMappedMemoryRange range = {
+        .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+        .memory = block->memory,
+        .offset = start,
+        // Rounding up may run past the end of the block, which only the whole size may do
+        .size = ( end >= block->size ) ? VK_WHOLE_SIZE : end - start
+    };
+    if( vkFlushMappedMemoryRanges( *dev, 1, &range ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to flush mapped memory" );
+        return 1;
+    }
+    return 0;
+}
+
+int pomVkMemoryGetTypeStats( uint32_t _memoryTypeIndex, PomVkMemoryStats *_stats ){
+    if( !memoryManagerCtx.initialised ){
+        LOG( ERR, "Attempting to get memory statistics with uninitialised memory manager" );
+        return 1;
+    }
+    if( _memoryTypeIndex >= memoryManagerCtx.memProps.memoryTypeCount ){
+        LOG( ERR, "Attempting to get statistics of non-existent memory type %u", _memoryTypeIndex );
+        return 1;
+    }
+    VkDeviceSize largestFree = 0;
+    mtx_lock( &memoryManagerCtx.mutex );
+    _pomStatsFromCounter( _stats, &memoryManagerCtx.typeCounters[ _memoryTypeIndex ] );
+    _pomStatsAddBlocks( _stats, _memoryTypeIndex, &largestFree );
+    mtx_unlock( &memoryManagerCtx.mutex );
+    _pomStatsSetFragmentation( _stats, largestFree );
     return 0;
-}
\ No newline at end of file
+}
+
+int pomVkMemoryGetHeapStats( uint32_t _heapIndex, PomVkMemoryStats *_stats ){
+    if( !memoryManagerCtx.initialised ){
+        LOG( ERR, "Attempting to get memory statistics with uninitialised memory manager" );
+        return 1;
+    }
+    const VkPhysicalDeviceMemoryProperties *memProps = &memoryManagerCtx.memProps;
+    if( _heapIndex >= memProps->memoryHeapCount ){
+        LOG( ERR, "Attempting to get statistics of non-existent memory heap %u", _heapIndex );
+        return 1;
+    }
+    VkDeviceSize largestFree = 0;
+    mtx_lock( &memoryManagerCtx.mutex );
+    _pomStatsFromCounter( _stats, &memoryManagerCtx.heapCounters[ _heapIndex ] );
+    for( uint32_t i = 0; i < memProps->memoryTypeCount; i++ ){
+        if( memProps->memoryTypes[ i ].heapIndex == _heapIndex ){
+            _pomStatsAddBlocks( _stats, i, &largestFree );
+        }
+    }
+    mtx_unlock( &memoryManagerCtx.mutex );
+    _pomStatsSetFragmentation( _stats, largestFree );
+    return 0;
+}
+
+int pomVkMemoryGetCategoryStats( PomVkMemoryCategory _category, PomVkMemoryStats *_stats ){
+    if( !memoryManagerCtx.initialised ){
+        LOG( ERR, "Attempting to get memory statistics with uninitialised memory manager" );
+        return 1;
+    }
+    if( _category >= POM_VK_MEMORY_NUM_CATEGORIES ){
+        LOG( ERR, "Attempting to get statistics of unknown memory category" );
+        return 1;
+    }
+    mtx_lock( &memoryManagerCtx.mutex );
+    _pomStatsFromCounter( _stats, &memoryManagerCtx.categoryCounters[ _category ] );
+    mtx_unlock( &memoryManagerCtx.mutex );
+    return 0;
+}
+
+void pomVkMemoryLogStats(){
+    if( !memoryManagerCtx.initialised ){
+        return;
+    }
+    PomVkMemoryStats stats;
+    for( uint32_t i = 0; i < memoryManagerCtx.memProps.memoryHeapCount; i++ ){
+        if( !pomVkMemoryGetHeapStats( i, &stats ) && stats.peakAllocatedBytes ){
+            _pomLogStats( "Heap", i, &stats );
+        }
+    }
+    for( uint32_t i = 0; i < memoryManagerCtx.memProps.memoryTypeCount; i++ ){
+        if( !pomVkMemoryGetTypeStats( i, &stats ) && stats.peakAllocatedBytes ){
+            _pomLogStats( "Memory type", i, &stats );
+        }
+    }
+    for( uint32_t i = 0; i < POM_VK_MEMORY_NUM_CATEGORIES; i++ ){
+        if( !pomVkMemoryGetCategoryStats( (PomVkMemoryCategory) i, &stats ) && stats.peakAllocatedBytes ){
+            LOG( INFO, "Category %s: %u allocation(s), %lu bytes (peak %lu)", categoryNames[ i ],
+                 stats.numAllocations, stats.allocatedBytes, stats.peakAllocatedBytes );
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#include "vkmemorytlsf.h"
+
+static uint32_t _pomMsb64( uint64_t _value ){
+    return 63 - __builtin_clzll( _value );
+}
+
+void pomVkMemoryTlsfMapping( VkDeviceSize _size, uint32_t *_fl, uint32_t *_sl ){
+    uint32_t msb = _pomMsb64( _size );
+    if( msb < TLSF_SL_LOG2 ){
+        // Sizes below the first power-of-two class share class 0, one subclass per size
+        *_fl = 0;
+        *_sl = (uint32_t) _size;
+        return;
+    }
+    *_fl = msb - TLSF_SL_LOG2 + 1;
+    *_sl = (uint32_t) ( _size >> ( msb - TLSF_SL_LOG2 ) ) & ( TLSF_SL_COUNT - 1 );
+}
+
+void pomVkMemoryTlsfInsertFree( PomVkMemoryTlsf *_tlsf, PomVkMemoryRange *_range ){
+    uint32_t fl, sl;
+    pomVkMemoryTlsfMapping( _range->size, &fl, &sl );
+    PomVkMemoryRange *head = _tlsf->freeLists[ fl ][ sl ];
+    _range->prevFree = NULL;
+    _range->nextFree = head;
+    if( head ){
+        head->prevFree = _range;
+    }
+    _tlsf->freeLists[ fl ][ sl ] = _range;
+    _tlsf->slBitmaps[ fl ] |= 1u << sl;
+    _tlsf->flBitmap |= (uint64_t) 1 << fl;
+    _range->free = true;
+}
+
+void pomVkMemoryTlsfRemoveFree( PomVkMemoryTlsf *_tlsf, PomVkMemoryRange *_range ){
+    uint32_t fl, sl;
+    pomVkMemoryTlsfMapping( _range->size, &fl, &sl );
+    if( _range->prevFree ){
+        _range->prevFree->nextFree = _range->nextFree;
+    }else{
+        _tlsf->freeLists[ fl ][ sl ] = _range->nextFree;
+    }
+    if( _range->nextFree ){
+        _range->nextFree->prevFree = _range->prevFree;
+    }
+    if( !_tlsf->freeLists[ fl ][ sl ] ){
+        _tlsf->slBitmaps[ fl ] &= ~( 1u << sl );
+        if( !_tlsf->slBitmaps[ fl ] ){
+            _tlsf->flBitmap &= ~( (uint64_t) 1 << fl );
+        }
+    }
+    _range->prevFree = NULL;
+    _range->nextFree = NULL;
+    _range->free = false;
+}
+
+PomVkMemoryRange *pomVkMemoryTlsfFindFree( PomVkMemoryTlsf *_tlsf, VkDeviceSize _size ){
+    uint32_t fl, sl;
+    // Ranges in _size's own subclass may be smaller than it, so aren't searched below. Its
+    // first range may still fit, which matters when it's the only one (dedicated blocks)
+    pomVkMemoryTlsfMapping( _size, &fl, &sl );
+    PomVkMemoryRange *head = _tlsf->freeLists[ fl ][ sl ];
+    if( head && head->size >= _size ){
+        return head;
+    }
+
+    // Round up to the next subclass, so that every range in the class found is big enough
+    uint32_t msb = _pomMsb64( _size );
+    if( msb >= TLSF_SL_LOG2 ){
+        VkDeviceSize roundUp = ( (VkDeviceSize) 1 << ( msb - TLSF_SL_LOG2 ) ) - 1;
+        if( _size > UINT64_MAX - roundUp ){
+            return NULL;
+        }
+        _size += roundUp;
+    }
+    pomVkMemoryTlsfMapping( _size, &fl, &sl );
+    if( fl >= TLSF_FL_COUNT ){
+        return NULL;
+    }
+
+    uint32_t slMap = _tlsf->slBitmaps[ fl ] & ( ~0u << sl );
+    if( !slMap ){
+        // Nothing left in this class, so take the smallest larger class
+        uint64_t flMap = ( fl + 1 < 64 ) ? _tlsf->flBitmap & ( ~(uint64_t) 0 << ( fl + 1 ) ) : 0;
+        if( !flMap ){
+            return NULL;
+        }
+        fl = __builtin_ctzll( flMap );
+        slMap = _tlsf->slBitmaps[ fl ];
+    }
+    sl = __builtin_ctz( slMap );
+    return _tlsf->freeLists[ fl ][ sl ];
+}
@@ -1,47 +1,47 @@
 #include "vkmodel.h"
 #include "vkdevice.h"
-#include <string.h>
+#include "vkupload.h"
 
 #define LOG( lvl, log, ... ) LOG_MODULE( lvl, VkModel, log, ##__VA_ARGS__ )
 
 // We'll just look at the first submodel/mesh in the model.
 // TODO - handle actual models, not just meshes
-int pomVkModelCreate( PomVkModelCtx *_modelCtx, PomModelMeshInfo *_meshInfo ){
+int pomVkModelCreate( PomVkModelCtx *_modelCtx, PomModelMeshInfo *_meshInfo,
+                      PomVkRingBufferCtx *_frameRing ){
     if( _modelCtx->initialised ){
         LOG( WARN, "Attempting to reinitialised model" );
         return 1;
     }
-    // Model buffer will be vertex + index in one
+    if( !_frameRing ){
+        LOG( ERR, "Attempting to create model without a frame ring for its matrix" );
+        return 1;
+    }
+    // Model buffer will be vertex + index in one. Filled by upload, and moved by the defragmenter
     VkBufferUsageFlags bufferFlags = VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
                                      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
-                                     VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-
-    const size_t uboAlignment = 0x20; // TODO - get this from PhysicalDeviceLimits.minUniformBufferOffsetAlignment
-    const size_t boundaryMask = SIZE_MAX - ( uboAlignment - 1 );
+                                     VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                                     VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 
     _modelCtx->modelMeshInfo = _meshInfo;
-    const size_t modelSize = _meshInfo->dataSize;
-    const size_t alignedUboOffset = ( ( modelSize - 1 ) + uboAlignment ) & boundaryMask;
-    const size_t uboPadding = alignedUboOffset - modelSize;
-    const size_t descriptorDataSize = sizeof( Mat4x4 );
-    const size_t modelBufferSize = modelSize + uboPadding + descriptorDataSize;
+    const size_t modelBufferSize = _meshInfo->dataSize;
     if( pomVkBufferCreate( &_modelCtx->modelBuffer, bufferFlags, 
-                           modelBufferSize, 1, NULL, 
-                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT ) ){
+                           modelBufferSize, 1, NULL, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                           0, POM_VK_MEMORY_SITE ) ){
         LOG( ERR, "Failed to create model buffer" );
         return 1;
     }
-    // Model buffer laid out in memory as <indices><vertices><padding><descriptor data>
+    // Model buffer laid out in memory as <indices><vertices>
 
-    // Set up model descriptor
+    // Set up model descriptor, starting with the model untransformed. The matrix is written
+    // to the frame ring every frame
+    _modelCtx->transformationMatrix = mat4x4Identity();
     PomVkUniformBufferObject ubo = {
         .data = &_modelCtx->transformationMatrix,
         .dataSize = sizeof( Mat4x4 )
     };
 
     PomVkDescriptorMemoryInfo memInfo ={
-        .bufferCtx = &_modelCtx->modelBuffer,
-        .uboOffset = alignedUboOffset
+        .ringCtx = _frameRing
     };
 
     if( pomVkDescriptorCreate( &_modelCtx->modelDescriptorCtx, &ubo, &memInfo ) ){
@@ -71,6 +71,26 @@ int pomVkModelDestroy( PomVkModelCtx *_modelCtx ){
     return 0;
 }
 
+int pomVkModelSetSubmodels( PomVkModelCtx *_modelCtx, const PomSubmodelInfo *_submodels,
+                            uint32_t _numSubmodels ){
+    if( !_modelCtx->initialised ){
+        LOG( ERR, "Attempting to set submodels of uninitialised model" );
+        return 1;
+    }
+    const PomModelMeshInfo *meshInfo = _modelCtx->modelMeshInfo;
+    for( uint32_t i = 0; i < _numSubmodels; i++ ){
+        const PomSubmodelInfo *submodel = &_submodels[ i ];
+        if( submodel->firstIndex > meshInfo->numIndices ||
+            submodel->numIndices > meshInfo->numIndices - submodel->firstIndex ){
+            LOG( ERR, "Submodel %u indices lie outside the model's mesh", i );
+            return 1;
+        }
+    }
+    _modelCtx->submodels = _numSubmodels ? _submodels : NULL;
+    _modelCtx->numSubmodels = _numSubmodels;
+    return 0;
+}
+
 // Indicate that model must be available to the GPU.
 int pomVkModelActivate( PomVkModelCtx *_modelCtx ){
     if( !_modelCtx->initialised ){
@@ -95,28 +115,15 @@ int pomVkModelActivate( PomVkModelCtx *_modelCtx ){
         return 0;
     }
     // If we get here, we've bound the buffer and need to send our
-    // model data to it.
-    // TODO - updload model data
-    VkDevice *dev = pomGetLogicalDevice();
-    if( !dev ){
-        LOG( ERR, "Attempting to activate model with no available device" );
+    // model data to it. It's ready for drawing once the upload is submitted
+    // TODO - handle index buffer
+    VkDeviceSize modelMeshSize = _modelCtx->modelMeshInfo->dataSize;
+    if( pomVkUploadBuffer( &_modelCtx->modelBuffer, 0, _modelCtx->modelMeshInfo->dataBlockOffset,
+                           modelMeshSize ) ){
+        LOG( ERR, "Failed to upload model data" );
         return 1;
     }
-    // After binding the buffer we're guaranteed the memory was allocated.
-    // TODO - staging buffers
-    // TODO - handle index buffer
-    size_t bufferSize = _modelCtx->modelBuffer.bufferInfo.size;
-    size_t modelMeshSize = _modelCtx->modelMeshInfo->dataSize;
-    VkDeviceMemory deviceMemory = _modelCtx->modelBuffer.memCtx.memory;
-    void* data;
-    vkMapMemory( *dev, deviceMemory,
-                 0, bufferSize, 0, &data );
-    memcpy( data, _modelCtx->modelMeshInfo->dataBlockOffset, (size_t) modelMeshSize );
-    
-    vkUnmapMemory( *dev, deviceMemory );
-    
-    // Update the descriptor data too
-    pomVkDescriptorUpdate( &_modelCtx->modelDescriptorCtx, *dev );
+
     _modelCtx->active = true;
     return 0;
 }
@@ -138,11 +145,11 @@ int pomVkModelDeactivate( PomVkModelCtx *_modelCtx ){
     return 0;
 }
 
-int pomVkModelUpdateDescriptors( PomVkModelCtx *_modelCtx, VkDevice _device ){
+int pomVkModelUpdateDescriptors( PomVkModelCtx *_modelCtx, uint32_t _frameIdx ){
     // For now just update the only descriptor we have. This might change to a more complex
     // function later on that selectively updates some descriptors, or updates different types
     // of descriptors.
-    return pomVkDescriptorUpdate( &_modelCtx->modelDescriptorCtx, _device );
+    return pomVkDescriptorUpdateFrame( &_modelCtx->modelDescriptorCtx, _frameIdx );
 }
 
 PomVkDescriptorCtx* pomVkModelGetDescriptor( PomVkModelCtx *_modelCtx ){
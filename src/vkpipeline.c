@@ -1,13 +1,36 @@
 #include "vkpipeline.h"
 #include "common.h"
 #include "vkdevice.h"
+#include "vkpipelinecache.h"
+#include "vkpipelineregistry.h"
+#include "vkpresentation.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <threads.h>
+#include <stdatomic.h>
 
 #define LOG( level, log, ... ) LOG_MODULE( level, vkpipeline, log, ##__VA_ARGS__ )
 
+typedef struct PomPipelineBatchCtx PomPipelineBatchCtx;
+
+// Items are handed out through nextItem, so each thread just takes the next one until
+// they run out
+struct PomPipelineBatchCtx{
+    PomPipelineBatchItem *items;
+    uint32_t numItems;
+    atomic_uint nextItem;
+    atomic_uint numDone;
+    mtx_t doneMutex;
+    cnd_t doneCond;
+    // Helper jobs may only start after the batch is done, so the context is freed by
+    // whichever of them (or the caller) lets go of it last. Their job structs are the
+    // caller's, as the threadpool may still hold them after the last one finishes
+    atomic_uint refCount;
+};
+
 /**************
  * Shader defs
 ***************/
@@ -69,76 +92,151 @@ static int pomCreateShaderModule( VkShaderModule *_module, const char *_shaderPa
     return err;
 }
 
-static VkFormat _pomFormatFromDataType( PomShaderDataTypes _dataType ){
-    switch( _dataType ){
-        case SHADER_FLOAT:
-            return VK_FORMAT_R32_SFLOAT;
-        case SHADER_INT8:
-            return VK_FORMAT_R8_SINT;
-        case SHADER_INT16:
-            return VK_FORMAT_R16_SINT;
-        case SHADER_INT32:
-            return VK_FORMAT_R32_SINT;
-        case SHADER_INT64:
-            return VK_FORMAT_R64_SINT;
-        case SHADER_VEC2:
-            return VK_FORMAT_R32G32_SFLOAT;
-        case SHADER_VEC3:
-            return VK_FORMAT_R32G32B32_SFLOAT;
-        case SHADER_VEC4:
-            return VK_FORMAT_R32G32B32A32_SFLOAT;
-        default:
-            return VK_FORMAT_UNDEFINED;
-    }
-    return VK_FORMAT_UNDEFINED;
-}
-
-static size_t _pomSizeFromDataType( PomShaderDataTypes _dataType ){
-    // TODO - verify these values; alignment may be an issue
-    switch( _dataType ){
-        case SHADER_FLOAT:
-            return sizeof( float );
-        case SHADER_INT8:
-            return sizeof( int8_t );
-        case SHADER_INT16:
-            return sizeof( int16_t );
-        case SHADER_INT32:
-            return sizeof( int32_t );
-        case SHADER_INT64:
-            return sizeof( int64_t );
-        case SHADER_VEC2:
-            return 2 * sizeof( float );
-        case SHADER_VEC3:
-            return 3 * sizeof( float );
-        case SHADER_VEC4:
-            return 4 * sizeof( float );
-        default:
-            LOG( ERR, "Failed to get format data size" );
-            return 0;
-    }
-    LOG( ERR, "Failed to get format data size" );
-    return 0;
-}
-
-static int pomCreateShaderModule2( VkShaderModule *_module, VkDevice _dev, PomShaderFormat *_format ){
-    uint32_t *shaderData = _format->shaderBytecodeOffset;
+static int pomCreateProgramModule( VkShaderModule *_module, VkDevice _dev, const PomProgramFormat *_program,
+                                   VkShaderStageFlagBits _stage, const char *_variantDefines ){
+    const PomProgramStageInfo *stageInfo = pomProgramFormatGetStage( _program, _stage );
+    if( !stageInfo ){
+        LOG( ERR, "Program has no stage %u", _stage );
+        return 1;
+    }
+    const char *stageName = pomProgramFormatGetString( _program, stageInfo->nameOffset );
+    const PomProgramVariantInfo *variant =
+        pomProgramFormatFindVariant( _program, stageInfo, _variantDefines );
+    if( !variant ){
+        LOG( ERR, "No variant of %s matches \"%s\"", stageName, _variantDefines );
+        return 1;
+    }
+    LOG( DEBUG, "Using variant [%s] of %s",
+         pomProgramFormatGetString( _program, variant->definesOffset ), stageName );
+    // Bytecode is used in place, straight out of the program
     VkShaderModuleCreateInfo moduleInfo = {
         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        .codeSize = _format->shaderBytecodeSizeBytes,
-        .pCode = shaderData
+        .codeSize = variant->bytecodeSizeBytes,
+        .pCode = pomProgramFormatGetBytecode( _program, variant )
     };
 
     if( vkCreateShaderModule( _dev, &moduleInfo, NULL, _module ) != VK_SUCCESS ){
-        LOG( ERR, "Failed to create shader module for %s", _format->shaderNameOffset );
+        LOG( ERR, "Failed to create shader module for %s", stageName );
         return 1;
     }
     return 0;
 }
 
+// Build a program in memory from the separately baked vertex and fragment stages
+static int _pomShaderBuildProgram( ShaderInfo *_shaderInfo ){
+    PomShaderFormat *stageFormats[ 2 ] = { NULL, NULL };
+    int toRet = 1;
+    if( !pomShaderFormatLoad( _shaderInfo->vertexShaderPath, &stageFormats[ 0 ] ) ){
+        LOG( ERR, "Failed to load vertex shader blob" );
+        goto buildCleanup;
+    }
+    if( !pomShaderFormatLoad( _shaderInfo->fragmentShaderPath, &stageFormats[ 1 ] ) ){
+        LOG( ERR, "Failed to load fragment shader blob" );
+        goto buildCleanup;
+    }
+    PomProgramFormat *program;
+    if( !pomProgramFormatBuild( stageFormats, 2, &program ) ){
+        LOG( ERR, "Failed to build program from shader blobs" );
+        goto buildCleanup;
+    }
+    _shaderInfo->program = program;
+    _shaderInfo->programMapped = false;
+    toRet = 0;
+
+buildCleanup:
+    // The program holds its own copy of everything
+    free( stageFormats[ 0 ] );
+    free( stageFormats[ 1 ] );
+    return toRet;
+}
+
+static void _pomShaderReleaseProgram( ShaderInfo *_shaderInfo ){
+    if( !_shaderInfo->program ){
+        return;
+    }
+    if( _shaderInfo->programMapped ){
+        pomProgramFormatUnmap( _shaderInfo->program );
+    }else{
+        free( (void*) _shaderInfo->program );
+    }
+    _shaderInfo->program = NULL;
+}
+
+// Create one layout per descriptor set from the program's merged bindings.
+// Set 0 is rendergroup-local, and sets 1+ are model-local
+static int _pomShaderCreateSetLayouts( ShaderInfo *_shaderInfo, VkDevice _dev ){
+    ShaderDescriptorSetCtx *setCtx = &_shaderInfo->shaderInputAttributes.descriptorSetLayoutCtx;
+    *setCtx = (ShaderDescriptorSetCtx){ 0 };
+    const PomProgramFormat *program = _shaderInfo->program;
+    uint32_t numSets = program->numSets;
+    if( numSets == 0 ){
+        return 0;
+    }
+
+    setCtx->layouts = (VkDescriptorSetLayout*) calloc( numSets, sizeof( VkDescriptorSetLayout ) );
+    setCtx->layoutInfos =
+        (ShaderDescriptorSetLayoutInfo*) calloc( numSets, sizeof( ShaderDescriptorSetLayoutInfo ) );
+    VkDescriptorSetLayoutBinding *bindings = (VkDescriptorSetLayoutBinding*)
+        calloc( program->numBindings ? program->numBindings : 1, sizeof( VkDescriptorSetLayoutBinding ) );
+    if( !setCtx->layouts || !setCtx->layoutInfos || !bindings ){
+        LOG( ERR, "Failed to allocate descriptor set layouts" );
+        free( setCtx->layouts );
+        free( setCtx->layoutInfos );
+        free( bindings );
+        return 1;
+    }
+
+    const PomProgramBindingInfo *bindingInfos = pomProgramFormatGetBindings( program );
+    for( uint32_t i = 0; i < program->numBindings; i++ ){
+        bindings[ i ] = (VkDescriptorSetLayoutBinding){
+            .binding = bindingInfos[ i ].binding,
+            .descriptorType = bindingInfos[ i ].type,
+            .descriptorCount = bindingInfos[ i ].count,
+            .stageFlags = bindingInfos[ i ].stageFlags,
+            .pImmutableSamplers = NULL
+        };
+    }
+
+    const PomProgramSetInfo *setInfos = pomProgramFormatGetSets( program );
+    for( uint32_t set = 0; set < numSets; set++ ){
+        ShaderDescriptorSetLayoutInfo *layoutInfo = &setCtx->layoutInfos[ set ];
+        layoutInfo->numBindings = setInfos[ set ].numBindings;
+        layoutInfo->bindings = &bindings[ setInfos[ set ].firstBinding ];
+
+        VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            .bindingCount = layoutInfo->numBindings,
+            .pBindings = layoutInfo->bindings
+        };
+        if( vkCreateDescriptorSetLayout( _dev, &layoutCreateInfo, NULL,
+                                         &setCtx->layouts[ set ] ) != VK_SUCCESS ){
+            LOG( ERR, "Failed to create descriptor set layout for set %u", set );
+            goto layoutError;
+        }
+        setCtx->numLayouts++;
+    }
+
+    setCtx->numRenderGroupLocalLayouts = 1;
+    setCtx->renderGroupSetLayouts = setCtx->layouts;
+    setCtx->numModelLocalLayouts = numSets - 1;
+    setCtx->modelSetLayouts = numSets > 1 ? &setCtx->layouts[ 1 ] : NULL;
+    return 0;
+
+layoutError:
+    for( uint32_t i = 0; i < setCtx->numLayouts; i++ ){
+        vkDestroyDescriptorSetLayout( _dev, setCtx->layouts[ i ], NULL );
+    }
+    free( setCtx->layouts );
+    free( setCtx->layoutInfos );
+    free( bindings );
+    *setCtx = (ShaderDescriptorSetCtx){ 0 };
+    return 1;
+}
+
 int pomShaderCreate( ShaderInfo *_shaderInfo ){
-    // TODO - add input attribute/binding description loading from shader
-    if( !_shaderInfo->vertexShaderPath || !_shaderInfo->fragmentShaderPath ){
-        LOG( ERR, "Shader requires vertex and fragment stages" );
+    if( !_shaderInfo->programPath &&
+        ( !_shaderInfo->vertexShaderPath || !_shaderInfo->fragmentShaderPath ) ){
+        LOG( ERR, "Shader requires a program, or vertex and fragment stages" );
         return 1;
     }
     VkDevice * dev = pomGetLogicalDevice();
@@ -148,41 +246,42 @@ int pomShaderCreate( ShaderInfo *_shaderInfo ){
     }
     uint8_t currStage = 0;
 
-    if( !pomShaderFormatLoad( _shaderInfo->vertexShaderPath, &_shaderInfo->shaderFormats[ 0 ] ) ){
-        LOG( ERR, "Failed to load vertex shader blob" );
-        return 1;
-    }
-    // Create vertex module
-    VkShaderModule vertexModule;
-    if( pomCreateShaderModule2( &vertexModule, *dev, _shaderInfo->shaderFormats[ 0 ] ) ){
-        LOG( ERR, "Could not create vertex module of shader" );
-        return 1;
-    }
-    VkPipelineShaderStageCreateInfo *vertexStageInfo = &_shaderInfo->shaderStages[ currStage++ ];
-
-    if( !pomShaderFormatLoad( _shaderInfo->fragmentShaderPath, &_shaderInfo->shaderFormats[ 1 ] ) ){
-        LOG( ERR, "Failed to load fragment shader blob" );
-        return 1;
-    }
-    // Create fragment module
-    VkShaderModule fragmentModule;
-    if( pomCreateShaderModule2( &fragmentModule, *dev, _shaderInfo->shaderFormats[ 1 ] ) ){
-        LOG( ERR, "Could not create fragment module of shader" );
-        vkDestroyShaderModule( *dev, fragmentModule, NULL );
+    // Prefer the baked program, which needs no parsing. Otherwise build one from the stage blobs
+    _shaderInfo->program = NULL;
+    if( _shaderInfo->programPath ){
+        if( !pomProgramFormatMap( _shaderInfo->programPath, &_shaderInfo->program ) ){
+            LOG( ERR, "Failed to map shader program %s", _shaderInfo->programPath );
+            return 1;
+        }
+        _shaderInfo->programMapped = true;
+    }else if( _pomShaderBuildProgram( _shaderInfo ) ){
         return 1;
     }
-    VkPipelineShaderStageCreateInfo *fragmentStageInfo = &_shaderInfo->shaderStages[ currStage++ ];
+    const PomProgramFormat *program = _shaderInfo->program;
 
-    // Create vertex/fragment stages
+    // Create vertex/fragment modules and stages
     // Limit ourselves to `main` entry point for now
     // TODO - add support for specifying entry point
-    *vertexStageInfo = (VkPipelineShaderStageCreateInfo) {
+    VkShaderModule vertexModule;
+    if( pomCreateProgramModule( &vertexModule, *dev, program, VK_SHADER_STAGE_VERTEX_BIT,
+                                _shaderInfo->variantDefines ) ){
+        LOG( ERR, "Could not create vertex module of shader" );
+        goto shaderError;
+    }
+    _shaderInfo->shaderStages[ currStage++ ] = (VkPipelineShaderStageCreateInfo) {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
         .stage = VK_SHADER_STAGE_VERTEX_BIT,
         .module = vertexModule,
         .pName = "main"
     };
-    *fragmentStageInfo = (VkPipelineShaderStageCreateInfo) {
+
+    VkShaderModule fragmentModule;
+    if( pomCreateProgramModule( &fragmentModule, *dev, program, VK_SHADER_STAGE_FRAGMENT_BIT,
+                                _shaderInfo->variantDefines ) ){
+        LOG( ERR, "Could not create fragment module of shader" );
+        goto shaderError;
+    }
+    _shaderInfo->shaderStages[ currStage++ ] = (VkPipelineShaderStageCreateInfo) {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
         .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
         .module = fragmentModule,
@@ -194,12 +293,9 @@ int pomShaderCreate( ShaderInfo *_shaderInfo ){
         VkShaderModule tessModule;
         if( pomCreateShaderModule( &tessModule, _shaderInfo->tesselationShaderPath, dev ) ){
             LOG( ERR, "Could not create tesselation module of shader" );
-            vkDestroyShaderModule( *dev, vertexModule, NULL );
-            vkDestroyShaderModule( *dev, fragmentModule, NULL );
-            return 1;
+            goto shaderError;
         }
-        VkPipelineShaderStageCreateInfo *tessStageInfo = &_shaderInfo->shaderStages[ currStage++ ];
-        *tessStageInfo = (VkPipelineShaderStageCreateInfo) {
+        _shaderInfo->shaderStages[ currStage++ ] = (VkPipelineShaderStageCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
             .stage = VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT,
             .module = tessModule,
@@ -208,18 +304,13 @@ int pomShaderCreate( ShaderInfo *_shaderInfo ){
     }
 
     // Now check if we should create the geometry module/stage
-    // Check if we should create the tesselation module/stage
     if( _shaderInfo->geometryShaderPath ){
         VkShaderModule geometryModule;
         if( pomCreateShaderModule( &geometryModule, _shaderInfo->geometryShaderPath, dev ) ){
-            LOG( ERR, "Could not create tesselation module of shader" );
-            for( uint8_t i = 0; i < currStage; i++ ){
-                vkDestroyShaderModule( *dev, _shaderInfo->shaderStages[ i ].module, NULL );
-            }
-            return 1;
+            LOG( ERR, "Could not create geometry module of shader" );
+            goto shaderError;
         }
-        VkPipelineShaderStageCreateInfo *geometryStageInfo = &_shaderInfo->shaderStages[ currStage++ ];
-        *geometryStageInfo = (VkPipelineShaderStageCreateInfo) {
+        _shaderInfo->shaderStages[ currStage++ ] = (VkPipelineShaderStageCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
             .stage = VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT,
             .module = geometryModule,
@@ -230,92 +321,38 @@ int pomShaderCreate( ShaderInfo *_shaderInfo ){
     // Set up interface
     // TODO - extend to other stages, not just Vertex
     ShaderInterfaceInfo *shaderInterface = &_shaderInfo->shaderInputAttributes;
-    size_t attributeStride = 0;
-    for( uint32_t i = 0; i < _shaderInfo->shaderFormats[ 0 ]->numAttributeInfo; i++ ){
-        PomShaderAttributeInfo *attrInfo = &_shaderInfo->shaderFormats[ 0 ]->attributeInfoOffset[ i ];
-        attributeStride += _pomSizeFromDataType( attrInfo->dataType );
-        shaderInterface->inputAttribs[ i ].binding = 0;
-        shaderInterface->inputAttribs[ i ].location = attrInfo->location;
-        shaderInterface->inputAttribs[ i ].offset = 0;
-        shaderInterface->inputAttribs[ i ].format = _pomFormatFromDataType( attrInfo->dataType );
-        
+    if( program->numVertexAttributes > 16 ||
+        program->numPushConstantRanges > sizeof( shaderInterface->pushConstantRanges ) / sizeof( VkPushConstantRange ) ){
+        LOG( ERR, "Program interface too large for shader" );
+        goto shaderError;
     }
+    memcpy( shaderInterface->inputAttribs, pomProgramFormatGetVertexAttributes( program ),
+            program->numVertexAttributes * sizeof( VkVertexInputAttributeDescription ) );
     shaderInterface->inputBinding.binding = 0;
-    shaderInterface->inputBinding.stride = attributeStride;
+    shaderInterface->inputBinding.stride = program->vertexStrideBytes;
     shaderInterface->inputBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-    shaderInterface->numInputs = _shaderInfo->shaderFormats[ 0 ]->numAttributeInfo;
-    shaderInterface->totalStride = attributeStride;
-
-    // Set up descriptors
-    // TODO - Set destinction handling. For now, descriptors put in different sets
-    // TODO - For now, RG-local descriptor is set 0, model-local is 1+
-    uint32_t numDescriptors = _shaderInfo->shaderFormats[ 0 ]->numDescriptorInfo;
-    ShaderDescriptorSetCtx *setCtx = &shaderInterface->descriptorSetLayoutCtx;
-    if( numDescriptors > 0 ){
-        VkDescriptorSetLayout *setLayouts = 
-            (VkDescriptorSetLayout*) malloc( numDescriptors * sizeof( VkDescriptorSetLayout ) );
-        setCtx->layouts = setLayouts;
-        setCtx->numLayouts = numDescriptors;
-        setCtx->numRenderGroupLocalLayouts = 1;
-        setCtx->renderGroupSetLayouts = setLayouts;
-        PomShaderDescriptorInfo *rgLocalDescInfo = 
-            &_shaderInfo->shaderFormats[ 0 ]->descriptorInfoOffset[ 0 ];
-        VkDescriptorSetLayoutBinding renderGroupLocalLayoutBinding = {
-            .binding = rgLocalDescInfo->binding,
-            .descriptorType = rgLocalDescInfo->type,
-            .descriptorCount = 1,
-            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-            .pImmutableSamplers = NULL
-        };
-        VkDescriptorSetLayoutCreateInfo rgLayoutCreateInfo = {
-            .bindingCount = 1,
-            .pBindings = &renderGroupLocalLayoutBinding,
-            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO
-        };
-        if( vkCreateDescriptorSetLayout( *dev, &rgLayoutCreateInfo, NULL, &setLayouts[ 0 ] ) !=
-                VK_SUCCESS ){
-            LOG( ERR, "Failed to create descriptor set layout for descriptor %s",\
-                 rgLocalDescInfo->nameOffset );
-            // TODO - cleanup here
-            return 1;
-        }
+    shaderInterface->numInputs = program->numVertexAttributes;
+    shaderInterface->totalStride = program->vertexStrideBytes;
 
-        uint32_t modelLocalDescriptorCount = numDescriptors - 1;
-        setCtx->numModelLocalLayouts = modelLocalDescriptorCount;
-        if( modelLocalDescriptorCount > 0 ){
-            setCtx->modelSetLayouts = &setLayouts[ 1 ];
-            VkDescriptorSetLayoutCreateInfo modelLayoutCreateInfo = {
-                .bindingCount = 1,
-                .pBindings = NULL,
-                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO
-            };
-            for( uint32_t i = 0; i < modelLocalDescriptorCount; i++ ){
-                PomShaderDescriptorInfo *modelLocalDescInfo = 
-                    &_shaderInfo->shaderFormats[ 0 ]->descriptorInfoOffset[ 1 + i ];
-                VkDescriptorSetLayoutBinding modelUboLayoutBinding = {
-                    .binding = modelLocalDescInfo->binding,
-                    .descriptorType = modelLocalDescInfo->type,
-                    .descriptorCount = 1,
-                    .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-                    .pImmutableSamplers = NULL
-                };
-                modelLayoutCreateInfo.pBindings = &modelUboLayoutBinding;
-                if( vkCreateDescriptorSetLayout( *dev, &modelLayoutCreateInfo,
-                                                 NULL, &setLayouts[ i + 1 ] ) != VK_SUCCESS ){
-                    LOG( ERR, "Failed to create descriptor set layout for descriptor %s",\
-                         modelLocalDescInfo->nameOffset );
-                    // TODO - resource cleanup here
-                    return 1;
-                }
-
-            }
-        }
+    // Set up descriptors and push constants, already merged across stages in the program
+    if( _pomShaderCreateSetLayouts( _shaderInfo, *dev ) ){
+        LOG( ERR, "Failed to create descriptor set layouts of shader" );
+        goto shaderError;
     }
-    
+    shaderInterface->numPushConstantRanges = program->numPushConstantRanges;
+    memcpy( shaderInterface->pushConstantRanges, pomProgramFormatGetPushConstantRanges( program ),
+            program->numPushConstantRanges * sizeof( VkPushConstantRange ) );
 
     _shaderInfo->numStages = currStage;
     _shaderInfo->initialised = true;
     return 0;
+
+shaderError:
+    for( uint8_t i = 0; i < currStage; i++ ){
+        vkDestroyShaderModule( *dev, _shaderInfo->shaderStages[ i ].module, NULL );
+    }
+    _pomShaderReleaseProgram( _shaderInfo );
+    return 1;
 }
 
 int pomShaderDestroy( ShaderInfo *_shaderInfo ){
@@ -331,7 +368,17 @@ int pomShaderDestroy( ShaderInfo *_shaderInfo ){
     for( uint8_t i = 0; i < _shaderInfo->numStages; i++ ){
         vkDestroyShaderModule( *dev, _shaderInfo->shaderStages[ i ].module, NULL );
     }
-    free( _shaderInfo->shaderInputAttributes.descriptorSetLayoutCtx.layouts );
+    ShaderDescriptorSetCtx *setCtx = &_shaderInfo->shaderInputAttributes.descriptorSetLayoutCtx;
+    for( uint32_t i = 0; i < setCtx->numLayouts; i++ ){
+        vkDestroyDescriptorSetLayout( *dev, setCtx->layouts[ i ], NULL );
+    }
+    if( setCtx->numLayouts ){
+        // Bindings of every set share the one allocation
+        free( setCtx->layoutInfos[ 0 ].bindings );
+    }
+    free( setCtx->layoutInfos );
+    free( setCtx->layouts );
+    _pomShaderReleaseProgram( _shaderInfo );
     _shaderInfo->initialised = false;
 
     return 0;
@@ -365,30 +412,59 @@ int pomRenderPassCreate( VkRenderPass *_renderPass ){
         .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
     };
 
+    VkFormat depthFormat = pomSwapchainDepthFormatGet();
+    if( depthFormat == VK_FORMAT_UNDEFINED ){
+        LOG( ERR, "No depth format available for RenderPass" );
+        return 1;
+    }
+    // Depth only matters within the pass, so it's never stored
+    VkAttachmentDescription depthAttachment = {
+        .format = depthFormat,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+    };
+
     VkAttachmentReference colorAttachmentRef = {
         .attachment = 0,
         .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
     };
 
+    VkAttachmentReference depthAttachmentRef = {
+        .attachment = 1,
+        .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+    };
+
     VkSubpassDescription subpass = {
         .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
         .colorAttachmentCount = 1,
-        .pColorAttachments = &colorAttachmentRef
+        .pColorAttachments = &colorAttachmentRef,
+        .pDepthStencilAttachment = &depthAttachmentRef
     };
 
+    // The depth image is shared between frames, so the clear must also wait on the
+    // previous frame's depth tests
     VkSubpassDependency dependency = {
         .srcSubpass = VK_SUBPASS_EXTERNAL,
         .dstSubpass = 0,
-        .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-        .srcAccessMask = 0,
-        .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-        .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+        .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+        .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                         VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
     };
 
+    VkAttachmentDescription attachments[] = { colourAttachment, depthAttachment };
     VkRenderPassCreateInfo renderPassInfo = {
         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-        .attachmentCount = 1,
-        .pAttachments = &colourAttachment,
+        .attachmentCount = sizeof( attachments ) / sizeof( VkAttachmentDescription ),
+        .pAttachments = attachments,
         .subpassCount = 1,
         .pSubpasses = &subpass,
         .dependencyCount = 1,
@@ -422,11 +498,31 @@ int pomRenderPassDestroy( VkRenderPass *_renderPass ){
  * Pipeline defs
 ****************/
 
-int pomPipelineCreate( PomPipelineCtx *_pipelineCtx, const ShaderInfo *_shaderInfo, VkRenderPass *_renderPass ){
+void pomPipelineStateSplitDepthPrepass( const PomPipelineState *_state,
+                                        PomPipelineState *_prepassState,
+                                        PomPipelineState *_mainState ){
+    *_prepassState = *_state;
+    _prepassState->depthTestEnable = VK_TRUE;
+    _prepassState->depthWriteEnable = VK_TRUE;
+    _prepassState->depthOnly = VK_TRUE;
+    _prepassState->blendEnable = VK_FALSE;
+    _prepassState->colourWriteMask = 0;
+
+    // The prepass runs the same vertex shader over the same vertices, so the depths match exactly
+    *_mainState = *_state;
+    _mainState->depthTestEnable = VK_TRUE;
+    _mainState->depthWriteEnable = VK_FALSE;
+    _mainState->depthCompareOp = VK_COMPARE_OP_EQUAL;
+}
+
+int pomPipelineCreate( PomPipelineCtx *_pipelineCtx, const ShaderInfo *_shaderInfo,
+                       const PomPipelineState *_state, VkRenderPass *_renderPass ){
     if( !_shaderInfo->initialised ){
         LOG( ERR, "Attempting to create pipeline with uninitialised shaders" );
         return 1;
     }
+    _pipelineCtx->state = _state ? *_state : POM_PIPELINE_STATE_DEFAULT;
+    const PomPipelineState *state = &_pipelineCtx->state;
     // Create vertex input info.
 
     // For now, we have only 1 binding description per pipeline
@@ -444,43 +540,36 @@ int pomPipelineCreate( PomPipelineCtx *_pipelineCtx, const ShaderInfo *_shaderIn
     VkPipelineInputAssemblyStateCreateInfo inputAssemblyInfo = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
         .primitiveRestartEnable = VK_FALSE,
-        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST
-    };
-
-    // Need swapchain extent here
-    VkExtent2D *swapchainExtent = pomGetSwapchainExtent();
-    VkViewport viewport = {
-        .x = 0,
-        .y = 0,
-        .width = swapchainExtent->width,
-        .height = swapchainExtent->height,
-        .minDepth = 0.0f,
-        .maxDepth = 1.0f
+        .topology = state->topology
     };
 
-    VkRect2D scissors;
-    scissors.extent = *swapchainExtent;
-    scissors.offset = (VkOffset2D) { .x=0, .y=0 };
-
+    // Viewport and scissor are set when recording, so pipelines outlive swapchain resizes
     VkPipelineViewportStateCreateInfo viewportState = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
         .scissorCount = 1,
-        .pScissors = &scissors,
+        .pScissors = NULL,
         .viewportCount = 1,
-        .pViewports = &viewport
+        .pViewports = NULL
+    };
+
+    const VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dynamicStateInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .dynamicStateCount = sizeof( dynamicStates ) / sizeof( VkDynamicState ),
+        .pDynamicStates = dynamicStates
     };
 
     VkPipelineRasterizationStateCreateInfo rasteriserInfo = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-        .cullMode = VK_CULL_MODE_NONE,
+        .cullMode = state->cullMode,
         .depthBiasClamp = 0.0f,
         .depthBiasConstantFactor = 0.0f,
         .depthBiasEnable = VK_FALSE,
         .depthBiasSlopeFactor = 0.0f,
         .depthClampEnable = VK_FALSE,
-        .frontFace = VK_FRONT_FACE_CLOCKWISE,
+        .frontFace = state->frontFace,
         .lineWidth = 1.0f,
-        .polygonMode = VK_POLYGON_MODE_FILL,
+        .polygonMode = state->polygonMode,
         .rasterizerDiscardEnable = VK_FALSE
     };
     
@@ -495,16 +584,29 @@ int pomPipelineCreate( PomPipelineCtx *_pipelineCtx, const ShaderInfo *_shaderIn
     };
     
     VkPipelineColorBlendAttachmentState colourBlendAttachment = {
-        .alphaBlendOp = VK_BLEND_OP_ADD,
-        .blendEnable = VK_FALSE,
-        .colorBlendOp = VK_BLEND_OP_ADD,
-        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-                          VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
-        .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
-        .dstColorBlendFactor = VK_BLEND_FACTOR_ZERO,
-        .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
-        .srcColorBlendFactor = VK_BLEND_FACTOR_ONE
+        .alphaBlendOp = state->alphaBlendOp,
+        .blendEnable = state->blendEnable,
+        .colorBlendOp = state->colourBlendOp,
+        .colorWriteMask = state->colourWriteMask,
+        .dstAlphaBlendFactor = state->dstAlphaBlendFactor,
+        .dstColorBlendFactor = state->dstColourBlendFactor,
+        .srcAlphaBlendFactor = state->srcAlphaBlendFactor,
+        .srcColorBlendFactor = state->srcColourBlendFactor
+    };
+
+    // Nothing in the fragment stage should write depth or discard, or early depth testing
+    // is lost
+    VkPipelineDepthStencilStateCreateInfo depthStencilInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+        .depthTestEnable = state->depthTestEnable,
+        .depthWriteEnable = state->depthWriteEnable,
+        .depthCompareOp = state->depthCompareOp,
+        .depthBoundsTestEnable = VK_FALSE,
+        .stencilTestEnable = VK_FALSE,
+        .minDepthBounds = 0.0f,
+        .maxDepthBounds = 1.0f
     };
+    bool useDepth = state->depthTestEnable || state->depthWriteEnable;
 
     VkPipelineColorBlendStateCreateInfo colourBlending = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
@@ -522,7 +624,8 @@ int pomPipelineCreate( PomPipelineCtx *_pipelineCtx, const ShaderInfo *_shaderIn
 
     VkPipelineLayoutCreateInfo pipelineLayoutInfo = { 0 };
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.pushConstantRangeCount = 0;
+    pipelineLayoutInfo.pushConstantRangeCount = _shaderInfo->shaderInputAttributes.numPushConstantRanges;
+    pipelineLayoutInfo.pPushConstantRanges = _shaderInfo->shaderInputAttributes.pushConstantRanges;
     pipelineLayoutInfo.setLayoutCount = shaderLayouts->numLayouts;
     pipelineLayoutInfo.pSetLayouts = shaderLayouts->layouts;
 
@@ -531,19 +634,46 @@ int pomPipelineCreate( PomPipelineCtx *_pipelineCtx, const ShaderInfo *_shaderIn
         LOG( ERR, "Attempting to create pipeline with no available logical device" );
         return 1;
     }
+
+    VkPipelineShaderStageCreateInfo stages[ 4 ];
+    uint32_t numStages = 0;
+    for( uint8_t i = 0; i < _shaderInfo->numStages; i++ ){
+        if( state->depthOnly && _shaderInfo->shaderStages[ i ].stage == VK_SHADER_STAGE_FRAGMENT_BIT ){
+            continue;
+        }
+        stages[ numStages++ ] = _shaderInfo->shaderStages[ i ];
+    }
+
+    // Without a render pass, the pipeline only needs to know the formats it renders to
+    bool dynamicRendering = *_renderPass == VK_NULL_HANDLE;
+    VkPipelineRenderingCreateInfoKHR renderingInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR,
+        .viewMask = 0,
+        .colorAttachmentCount = 1,
+        .pColorAttachmentFormats = &state->colourFormat,
+        .depthAttachmentFormat = state->depthFormat,
+        .stencilAttachmentFormat = VK_FORMAT_UNDEFINED
+    };
+    if( dynamicRendering &&
+        ( !pomDeviceDynamicRenderingEnabled() || state->colourFormat == VK_FORMAT_UNDEFINED ) ){
+        LOG( ERR, "Attempting to create pipeline without RenderPass or dynamic rendering formats" );
+        return 1;
+    }
+
     VkGraphicsPipelineCreateInfo *pipelineInfo = &_pipelineCtx->graphicsPipelineInfo;
     *pipelineInfo = (VkGraphicsPipelineCreateInfo){
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .pNext = dynamicRendering ? &renderingInfo : NULL,
         .basePipelineHandle = VK_NULL_HANDLE,
         .basePipelineIndex = -1,
         .pColorBlendState = &colourBlending,
-        .pDepthStencilState = NULL,
-        .pDynamicState = NULL,
+        .pDepthStencilState = useDepth ? &depthStencilInfo : NULL,
+        .pDynamicState = &dynamicStateInfo,
         .pInputAssemblyState = &inputAssemblyInfo,
         .pMultisampleState = &multisamplingInfo,
         .pRasterizationState = &rasteriserInfo,
-        .stageCount = _shaderInfo->numStages,
-        .pStages = _shaderInfo->shaderStages,
+        .stageCount = numStages,
+        .pStages = stages,
         .pTessellationState = NULL,
         .pVertexInputState = &vertexInputInfo,
         .pViewportState = &viewportState,
@@ -560,13 +690,14 @@ int pomPipelineCreate( PomPipelineCtx *_pipelineCtx, const ShaderInfo *_shaderIn
     }
     pipelineInfo->layout = layout;
 
-    if( vkCreateGraphicsPipelines( *dev, VK_NULL_HANDLE, 1,
+    if( vkCreateGraphicsPipelines( *dev, pomPipelineCacheGet(), 1,
                                    pipelineInfo, NULL, &_pipelineCtx->pipeline ) != VK_SUCCESS ){
         LOG( ERR, "Failed to create graphics pipeline" );
         vkDestroyPipelineLayout( *dev, pipelineInfo->layout, NULL );
         return 1;
     }
 
+    _pipelineCtx->pipelineType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
     _pipelineCtx->initialised = true;
     return 0;
 }
@@ -589,6 +720,114 @@ int pomPipelineDestroy( PomPipelineCtx *_pipeline ){
         vkDestroyPipelineLayout( *dev, _pipeline->computePipelineInfo.layout, NULL );
     }
     vkDestroyPipeline( *dev, _pipeline->pipeline, NULL );
+    _pipeline->initialised = false;
 
     return 0;
-}
\ No newline at end of file
+}
+
+static int _pomPipelineBatchBuild( PomPipelineBatchItem *_item ){
+    _item->pipelineCtx = pomPipelineRegistryAcquire( _item->shaderInfo, _item->state,
+                                                     _item->renderPass );
+    if( !_item->pipelineCtx ){
+        LOG( ERR, "Failed to acquire pipeline of pipeline batch item" );
+        return 1;
+    }
+    return 0;
+}
+
+static void _pomPipelineBatchWork( PomPipelineBatchCtx *_batch ){
+    uint32_t itemIdx;
+    while( ( itemIdx = atomic_fetch_add( &_batch->nextItem, 1 ) ) < _batch->numItems ){
+        PomPipelineBatchItem *item = &_batch->items[ itemIdx ];
+        item->result = _pomPipelineBatchBuild( item );
+        if( atomic_fetch_add( &_batch->numDone, 1 ) + 1 == _batch->numItems ){
+            mtx_lock( &_batch->doneMutex );
+            cnd_broadcast( &_batch->doneCond );
+            mtx_unlock( &_batch->doneMutex );
+        }
+    }
+}
+
+static void _pomPipelineBatchRelease( PomPipelineBatchCtx *_batch ){
+    if( atomic_fetch_sub( &_batch->refCount, 1 ) == 1 ){
+        mtx_destroy( &_batch->doneMutex );
+        cnd_destroy( &_batch->doneCond );
+        free( _batch );
+    }
+}
+
+static void _pomPipelineBatchHelper( void *_args ){
+    PomPipelineBatchCtx *batch = (PomPipelineBatchCtx*) _args;
+    _pomPipelineBatchWork( batch );
+    _pomPipelineBatchRelease( batch );
+}
+
+int pomPipelineCreateBatch( PomPipelineBatchItem *_items, uint32_t _numItems,
+                            PomThreadpoolCtx *_threadpool, PomThreadpoolJob *_helperJobs,
+                            uint32_t _numHelperJobs ){
+    if( !_numItems ){
+        return 0;
+    }
+    PomPipelineBatchCtx *batch = (PomPipelineBatchCtx*) calloc( 1, sizeof( PomPipelineBatchCtx ) );
+    if( !batch ){
+        LOG( ERR, "Failed to allocate pipeline batch" );
+        return 1;
+    }
+    if( mtx_init( &batch->doneMutex, mtx_plain ) != thrd_success ){
+        LOG( ERR, "Failed to create pipeline batch mutex" );
+        free( batch );
+        return 1;
+    }
+    if( cnd_init( &batch->doneCond ) != thrd_success ){
+        LOG( ERR, "Failed to create pipeline batch condition" );
+        mtx_destroy( &batch->doneMutex );
+        free( batch );
+        return 1;
+    }
+    batch->items = _items;
+    batch->numItems = _numItems;
+    atomic_init( &batch->nextItem, 0 );
+    atomic_init( &batch->numDone, 0 );
+    atomic_init( &batch->refCount, 1 );
+
+    // The calling thread takes a share, so one less helper than items is enough
+    uint32_t numHelpers = _numItems - 1;
+    if( !_threadpool ){
+        numHelpers = 0;
+    }
+    if( numHelpers > _numHelperJobs ){
+        numHelpers = _numHelperJobs;
+    }
+    for( uint32_t i = 0; i < numHelpers; i++ ){
+        PomThreadpoolJob *job = &_helperJobs[ i ];
+        job->func = _pomPipelineBatchHelper;
+        job->args = batch;
+        atomic_fetch_add( &batch->refCount, 1 );
+        if( pomThreadpoolScheduleJob( _threadpool, job ) ){
+            // Not fatal, there's just less help
+            LOG( WARN, "Failed to schedule pipeline batch helper" );
+            atomic_fetch_sub( &batch->refCount, 1 );
+            break;
+        }
+    }
+
+    _pomPipelineBatchWork( batch );
+    mtx_lock( &batch->doneMutex );
+    while( atomic_load( &batch->numDone ) < batch->numItems ){
+        cnd_wait( &batch->doneCond, &batch->doneMutex );
+    }
+    mtx_unlock( &batch->doneMutex );
+    _pomPipelineBatchRelease( batch );
+
+    uint32_t numFailed = 0;
+    for( uint32_t i = 0; i < _numItems; i++ ){
+        if( _items[ i ].result ){
+            numFailed++;
+        }
+    }
+    if( numFailed ){
+        LOG( ERR, "Failed to create %u of %u pipelines in batch", numFailed, _numItems );
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,225 @@
+#include "vkpipelinecache.h"
+#include "vkdevice.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#define LOG( level, log, ... ) LOG_MODULE( level, vkpipelinecache, log, ##__VA_ARGS__ )
+
+typedef struct PomPipelineCacheHeader PomPipelineCacheHeader;
+typedef struct PomPipelineCacheCtx PomPipelineCacheCtx;
+
+// Layout of VK_PIPELINE_CACHE_HEADER_VERSION_ONE, which starts all cache data
+struct PomPipelineCacheHeader{
+    uint32_t headerSize;
+    uint32_t headerVersion;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint8_t pipelineCacheUUID[ VK_UUID_SIZE ];
+};
+
+struct PomPipelineCacheCtx{
+    VkPipelineCache cache;
+    char *cachePath;
+    bool initialised;
+};
+
+static PomPipelineCacheCtx pipelineCacheCtx = { 0 };
+
+// Check cache data was written by the device (and driver) we're running on.
+// Drivers should reject foreign data themselves, but not all of them do so gracefully
+static bool _pomPipelineCacheDataValid( const uint8_t *_data, size_t _dataSize ){
+    if( _dataSize < sizeof( PomPipelineCacheHeader ) ){
+        LOG( WARN, "Pipeline cache data too small to hold header" );
+        return false;
+    }
+    PomPipelineCacheHeader header;
+    memcpy( &header, _data, sizeof( PomPipelineCacheHeader ) );
+    if( header.headerSize < sizeof( PomPipelineCacheHeader ) || header.headerSize > _dataSize ||
+        header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ){
+        LOG( WARN, "Pipeline cache header invalid" );
+        return false;
+    }
+
+    VkPhysicalDeviceProperties devProps;
+    vkGetPhysicalDeviceProperties( *pomGetPhysicalDevice(), &devProps );
+    if( header.vendorID != devProps.vendorID || header.deviceID != devProps.deviceID ){
+        LOG( INFO, "Pipeline cache written by a different device, discarding" );
+        return false;
+    }
+    if( memcmp( header.pipelineCacheUUID, devProps.pipelineCacheUUID, VK_UUID_SIZE ) ){
+        LOG( INFO, "Pipeline cache written by a different driver version, discarding" );
+        return false;
+    }
+    return true;
+}
+
+// Read the whole cache file. Returns NULL if there's no usable file
+static uint8_t *_pomPipelineCacheLoadFile( const char *_path, size_t *_dataSize ){
+    FILE *cacheFile = fopen( _path, "rb" );
+    if( !cacheFile ){
+        LOG( INFO, "No pipeline cache at %s, starting empty", _path );
+        return NULL;
+    }
+    fseek( cacheFile, 0, SEEK_END );
+    long fSize = ftell( cacheFile );
+    fseek( cacheFile, 0, SEEK_SET );
+    if( fSize <= 0 ){
+        fclose( cacheFile );
+        return NULL;
+    }
+
+    uint8_t *data = (uint8_t*) malloc( fSize );
+    if( !data ){
+        LOG( ERR, "Failed to allocate %ld bytes for pipeline cache", fSize );
+        fclose( cacheFile );
+        return NULL;
+    }
+    size_t bytesRead = fread( data, sizeof( uint8_t ), fSize, cacheFile );
+    fclose( cacheFile );
+    if( bytesRead != (size_t) fSize ){
+        LOG( WARN, "Failed to read pipeline cache %s", _path );
+        free( data );
+        return NULL;
+    }
+    *_dataSize = fSize;
+    return data;
+}
+
+int pomPipelineCacheCreate( const char *_cachePath ){
+    if( pipelineCacheCtx.initialised ){
+        LOG( WARN, "Attempting to re-initialise pipeline cache" );
+        return 1;
+    }
+    VkDevice * dev = pomGetLogicalDevice();
+    if( !dev ){
+        LOG( ERR, "Attempting to create pipeline cache with no available logical device" );
+        return 1;
+    }
+
+    size_t dataSize = 0;
+    uint8_t *data = _pomPipelineCacheLoadFile( _cachePath, &dataSize );
+    if( data && !_pomPipelineCacheDataValid( data, dataSize ) ){
+        free( data );
+        data = NULL;
+        dataSize = 0;
+    }
+
+    VkPipelineCacheCreateInfo cacheInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = dataSize,
+        .pInitialData = data
+    };
+    VkResult res = vkCreatePipelineCache( *dev, &cacheInfo, NULL, &pipelineCacheCtx.cache );
+    if( res != VK_SUCCESS && data ){
+        LOG( WARN, "Driver rejected pipeline cache data, starting empty" );
+        cacheInfo.initialDataSize = 0;
+        cacheInfo.pInitialData = NULL;
+        res = vkCreatePipelineCache( *dev, &cacheInfo, NULL, &pipelineCacheCtx.cache );
+    }
+    free( data );
+    if( res != VK_SUCCESS ){
+        LOG( ERR, "Failed to create pipeline cache" );
+        return 1;
+    }
+    LOG( DEBUG, "Pipeline cache created with %lu bytes of data", dataSize );
+
+    size_t pathSize = strlen( _cachePath ) + 1;
+    pipelineCacheCtx.cachePath = (char*) malloc( pathSize );
+    if( pipelineCacheCtx.cachePath ){
+        memcpy( pipelineCacheCtx.cachePath, _cachePath, pathSize );
+    }else{
+        LOG( WARN, "Failed to allocate pipeline cache path, cache won't be saved" );
+    }
+
+    pipelineCacheCtx.initialised = true;
+    return 0;
+}
+
+// Write the cache data to a temporary file next to the cache, then rename it over the
+// cache. Returns 0 on success, 1 on failure
+static int _pomPipelineCacheSave( VkDevice _dev ){
+    size_t dataSize = 0;
+    if( vkGetPipelineCacheData( _dev, pipelineCacheCtx.cache, &dataSize, NULL ) != VK_SUCCESS ||
+        !dataSize ){
+        LOG( WARN, "No pipeline cache data to save" );
+        return 1;
+    }
+    uint8_t *data = (uint8_t*) malloc( dataSize );
+    if( !data ){
+        LOG( ERR, "Failed to allocate %lu bytes for pipeline cache data", dataSize );
+        return 1;
+    }
+    if( vkGetPipelineCacheData( _dev, pipelineCacheCtx.cache, &dataSize, data ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to get pipeline cache data" );
+        free( data );
+        return 1;
+    }
+
+    const char *cachePath = pipelineCacheCtx.cachePath;
+    size_t tmpPathSize = strlen( cachePath ) + sizeof( ".tmp" );
+    char *tmpPath = (char*) malloc( tmpPathSize );
+    if( !tmpPath ){
+        LOG( ERR, "Failed to allocate pipeline cache path" );
+        free( data );
+        return 1;
+    }
+    snprintf( tmpPath, tmpPathSize, "%s.tmp", cachePath );
+
+    int toRet = 1;
+    FILE *cacheFile = fopen( tmpPath, "wb" );
+    if( !cacheFile ){
+        LOG( ERR, "Failed to open %s to save pipeline cache", tmpPath );
+        goto saveCleanup;
+    }
+    size_t written = fwrite( data, sizeof( uint8_t ), dataSize, cacheFile );
+    // Make sure the data has hit the disk before the rename can
+    bool flushed = fflush( cacheFile ) == 0 && fsync( fileno( cacheFile ) ) == 0;
+    if( fclose( cacheFile ) || written != dataSize || !flushed ){
+        LOG( ERR, "Failed to write pipeline cache to %s", tmpPath );
+        remove( tmpPath );
+        goto saveCleanup;
+    }
+    if( rename( tmpPath, cachePath ) ){
+        LOG( ERR, "Failed to replace pipeline cache %s", cachePath );
+        remove( tmpPath );
+        goto saveCleanup;
+    }
+    LOG( DEBUG, "Saved %lu bytes of pipeline cache to %s", dataSize, cachePath );
+    toRet = 0;
+
+saveCleanup:
+    free( tmpPath );
+    free( data );
+    return toRet;
+}
+
+int pomPipelineCacheDestroy(){
+    if( !pipelineCacheCtx.initialised ){
+        LOG( WARN, "Attempting to destroy uninitialised pipeline cache" );
+        return 1;
+    }
+    VkDevice * dev = pomGetLogicalDevice();
+    if( !dev ){
+        LOG( ERR, "Attempting to destroy pipeline cache with no available logical device" );
+        return 1;
+    }
+    // Failing to save only costs the next run some compile time
+    if( pipelineCacheCtx.cachePath && _pomPipelineCacheSave( *dev ) ){
+        LOG( WARN, "Pipeline cache not saved" );
+    }
+    vkDestroyPipelineCache( *dev, pipelineCacheCtx.cache, NULL );
+    free( pipelineCacheCtx.cachePath );
+    pipelineCacheCtx = (PomPipelineCacheCtx){ 0 };
+    return 0;
+}
+
+VkPipelineCache pomPipelineCacheGet(){
+    if( !pipelineCacheCtx.initialised ){
+        return VK_NULL_HANDLE;
+    }
+    return pipelineCacheCtx.cache;
+}
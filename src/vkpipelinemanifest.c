@@ -0,0 +1,441 @@
+#include "vkpipelinemanifest.h"
+#include "vkpipelineregistry.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <threads.h>
+#include <unistd.h>
+
+#define LOG( level, log, ... ) LOG_MODULE( level, vkpipelinemanifest, log, ##__VA_ARGS__ )
+
+#define MANIFEST_HEADER "PomPipelineManifest 1"
+// programPath, the 4 stage paths and variantDefines
+#define MANIFEST_NUM_STRINGS 6
+// PomPipelineState is all 32-bit members, written out as one hex word each
+#define MANIFEST_NUM_STATE_WORDS ( sizeof( PomPipelineState ) / sizeof( uint32_t ) )
+
+typedef struct PomPipelineManifestEntry PomPipelineManifestEntry;
+typedef struct PomPipelineManifestCtx PomPipelineManifestCtx;
+
+struct PomPipelineManifestEntry{
+    // NULL for unset paths/defines
+    char *strings[ MANIFEST_NUM_STRINGS ];
+    PomPipelineState state;
+    // Set by the warmup job
+    PomPipelineCtx *warmPipeline;
+    PomThreadpoolJob warmupJob;
+};
+
+struct PomPipelineManifestCtx{
+    char *manifestPath;
+    // Pipelines of the previous run, to be warmed up
+    uint32_t numLoadedEntries;
+    PomPipelineManifestEntry *loadedEntries;
+    // Pipelines requested this run
+    uint32_t numRecordedEntries;
+    uint32_t recordedEntriesCapacity;
+    PomPipelineManifestEntry *recordedEntries;
+
+    VkRenderPass warmupRenderPass;
+    uint32_t numWarmupJobsPending;
+    mtx_t mutex;
+    cnd_t warmupDoneCond;
+    bool initialised;
+};
+
+static PomPipelineManifestCtx pipelineManifestCtx = { 0 };
+
+static char *_pomManifestStrdup( const char *_string, size_t _length ){
+    char *copy = (char*) malloc( _length + 1 );
+    if( copy ){
+        memcpy( copy, _string, _length );
+        copy[ _length ] = '\0';
+    }
+    return copy;
+}
+
+static void _pomManifestEntryClear( PomPipelineManifestEntry *_entry ){
+    for( uint32_t i = 0; i < MANIFEST_NUM_STRINGS; i++ ){
+        free( _entry->strings[ i ] );
+    }
+}
+
+static void _pomManifestEntryStrings( const ShaderInfo *_shaderDesc,
+                                      const char *_strings[ MANIFEST_NUM_STRINGS ] ){
+    _strings[ 0 ] = _shaderDesc->programPath;
+    _strings[ 1 ] = _shaderDesc->vertexShaderPath;
+    _strings[ 2 ] = _shaderDesc->fragmentShaderPath;
+    _strings[ 3 ] = _shaderDesc->geometryShaderPath;
+    _strings[ 4 ] = _shaderDesc->tesselationShaderPath;
+    _strings[ 5 ] = _shaderDesc->variantDefines;
+}
+
+static ShaderInfo _pomManifestEntryShaderDesc( const PomPipelineManifestEntry *_entry ){
+    return (ShaderInfo){
+        .programPath = _entry->strings[ 0 ],
+        .vertexShaderPath = _entry->strings[ 1 ],
+        .fragmentShaderPath = _entry->strings[ 2 ],
+        .geometryShaderPath = _entry->strings[ 3 ],
+        .tesselationShaderPath = _entry->strings[ 4 ],
+        .variantDefines = _entry->strings[ 5 ]
+    };
+}
+
+// Parse one `<state words>\t<string>...` line, modified in place.
+// Returns 0 on success, 1 if the line is malformed
+static int _pomManifestParseLine( char *_line, PomPipelineManifestEntry *_entry ){
+    char *fields[ MANIFEST_NUM_STRINGS + 1 ];
+    char *fieldStart = _line;
+    for( uint32_t i = 0; i < MANIFEST_NUM_STRINGS + 1; i++ ){
+        if( !fieldStart ){
+            return 1;
+        }
+        fields[ i ] = fieldStart;
+        char *tab = strchr( fieldStart, '\t' );
+        if( tab ){
+            *tab = '\0';
+            fieldStart = tab + 1;
+        }else{
+            fieldStart = NULL;
+        }
+    }
+    if( fieldStart ){
+        // Too many fields
+        return 1;
+    }
+
+    uint32_t stateWords[ MANIFEST_NUM_STATE_WORDS ];
+    char *wordStart = fields[ 0 ];
+    for( uint32_t i = 0; i < MANIFEST_NUM_STATE_WORDS; i++ ){
+        char *wordEnd;
+        unsigned long word = strtoul( wordStart, &wordEnd, 16 );
+        bool last = i == MANIFEST_NUM_STATE_WORDS - 1;
+        if( wordEnd == wordStart || word > UINT32_MAX || *wordEnd != ( last ? '\0' : ',' ) ){
+            return 1;
+        }
+        stateWords[ i ] = (uint32_t) word;
+        wordStart = wordEnd + 1;
+    }
+
+    *_entry = (PomPipelineManifestEntry){ 0 };
+    memcpy( &_entry->state, stateWords, sizeof( PomPipelineState ) );
+    for( uint32_t i = 0; i < MANIFEST_NUM_STRINGS; i++ ){
+        const char *field = fields[ i + 1 ];
+        size_t length = strlen( field );
+        if( !length ){
+            continue;
+        }
+        _entry->strings[ i ] = _pomManifestStrdup( field, length );
+        if( !_entry->strings[ i ] ){
+            _pomManifestEntryClear( _entry );
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Load the entries of an existing manifest. A missing or unreadable manifest just means
+// there's nothing to warm up
+static void _pomManifestLoad( const char *_path ){
+    FILE *manifestFile = fopen( _path, "r" );
+    if( !manifestFile ){
+        LOG( INFO, "No pipeline manifest at %s, nothing to warm up", _path );
+        return;
+    }
+    fseek( manifestFile, 0, SEEK_END );
+    long fSize = ftell( manifestFile );
+    fseek( manifestFile, 0, SEEK_SET );
+    if( fSize <= 0 ){
+        fclose( manifestFile );
+        return;
+    }
+    char *manifestStr = (char*) malloc( fSize + 1 );
+    if( !manifestStr ){
+        LOG( ERR, "Failed to allocate %ld bytes for pipeline manifest", fSize );
+        fclose( manifestFile );
+        return;
+    }
+    size_t bytesRead = fread( manifestStr, 1, fSize, manifestFile );
+    fclose( manifestFile );
+    manifestStr[ bytesRead ] = '\0';
+
+    // Every line is at most one entry
+    uint32_t maxEntries = 0;
+    for( char *c = manifestStr; *c; c++ ){
+        maxEntries += *c == '\n';
+    }
+    PomPipelineManifestEntry *entries =
+        (PomPipelineManifestEntry*) calloc( maxEntries + 1, sizeof( PomPipelineManifestEntry ) );
+    if( !entries ){
+        LOG( ERR, "Failed to allocate pipeline manifest entries" );
+        free( manifestStr );
+        return;
+    }
+
+    uint32_t numEntries = 0;
+    char *line = manifestStr;
+    bool headerValid = false;
+    while( line ){
+        char *lineEnd = strchr( line, '\n' );
+        if( lineEnd ){
+            *lineEnd = '\0';
+        }
+        if( !headerValid ){
+            if( strcmp( line, MANIFEST_HEADER ) ){
+                LOG( WARN, "Pipeline manifest %s has an unknown format, ignoring it", _path );
+                break;
+            }
+            headerValid = true;
+        }else if( *line && _pomManifestParseLine( line, &entries[ numEntries ] ) ){
+            LOG( WARN, "Skipping malformed pipeline manifest entry" );
+        }else if( *line ){
+            numEntries++;
+        }
+        line = lineEnd ? lineEnd + 1 : NULL;
+    }
+    free( manifestStr );
+
+    if( !numEntries ){
+        free( entries );
+        return;
+    }
+    LOG( DEBUG, "Loaded %u pipelines from manifest %s", numEntries, _path );
+    pipelineManifestCtx.loadedEntries = entries;
+    pipelineManifestCtx.numLoadedEntries = numEntries;
+}
+
+// Write the recorded entries to a temporary file beside the manifest, then rename it over
+// the manifest. Returns 0 on success, 1 on failure
+static int _pomManifestSave(){
+    const char *manifestPath = pipelineManifestCtx.manifestPath;
+    size_t tmpPathSize = strlen( manifestPath ) + sizeof( ".tmp" );
+    char *tmpPath = (char*) malloc( tmpPathSize );
+    if( !tmpPath ){
+        LOG( ERR, "Failed to allocate pipeline manifest path" );
+        return 1;
+    }
+    snprintf( tmpPath, tmpPathSize, "%s.tmp", manifestPath );
+
+    FILE *manifestFile = fopen( tmpPath, "w" );
+    if( !manifestFile ){
+        LOG( ERR, "Failed to open %s to save pipeline manifest", tmpPath );
+        free( tmpPath );
+        return 1;
+    }
+    bool written = fprintf( manifestFile, "%s\n", MANIFEST_HEADER ) > 0;
+    for( uint32_t i = 0; i < pipelineManifestCtx.numRecordedEntries && written; i++ ){
+        const PomPipelineManifestEntry *entry = &pipelineManifestCtx.recordedEntries[ i ];
+        uint32_t stateWords[ MANIFEST_NUM_STATE_WORDS ];
+        memcpy( stateWords, &entry->state, sizeof( PomPipelineState ) );
+        for( uint32_t w = 0; w < MANIFEST_NUM_STATE_WORDS; w++ ){
+            written &= fprintf( manifestFile, w ? ",%x" : "%x", stateWords[ w ] ) > 0;
+        }
+        for( uint32_t s = 0; s < MANIFEST_NUM_STRINGS; s++ ){
+            written &= fprintf( manifestFile, "\t%s", entry->strings[ s ] ? entry->strings[ s ] : "" ) > 0;
+        }
+        written &= fputc( '\n', manifestFile ) != EOF;
+    }
+    bool flushed = fflush( manifestFile ) == 0 && fsync( fileno( manifestFile ) ) == 0;
+    int toRet = 1;
+    if( fclose( manifestFile ) || !written || !flushed ){
+        LOG( ERR, "Failed to write pipeline manifest to %s", tmpPath );
+        remove( tmpPath );
+    }else if( rename( tmpPath, manifestPath ) ){
+        LOG( ERR, "Failed to replace pipeline manifest %s", manifestPath );
+        remove( tmpPath );
+    }else{
+        LOG( DEBUG, "Saved %u pipelines to manifest %s", pipelineManifestCtx.numRecordedEntries,
+             manifestPath );
+        toRet = 0;
+    }
+    free( tmpPath );
+    return toRet;
+}
+
+int pomPipelineManifestCreate( const char *_manifestPath ){
+    if( pipelineManifestCtx.initialised ){
+        LOG( WARN, "Attempting to re-initialise pipeline manifest" );
+        return 1;
+    }
+    pipelineManifestCtx.manifestPath = _pomManifestStrdup( _manifestPath, strlen( _manifestPath ) );
+    if( !pipelineManifestCtx.manifestPath ){
+        LOG( ERR, "Failed to allocate pipeline manifest path" );
+        return 1;
+    }
+    if( mtx_init( &pipelineManifestCtx.mutex, mtx_plain ) != thrd_success ){
+        LOG( ERR, "Failed to create pipeline manifest mutex" );
+        free( pipelineManifestCtx.manifestPath );
+        return 1;
+    }
+    if( cnd_init( &pipelineManifestCtx.warmupDoneCond ) != thrd_success ){
+        LOG( ERR, "Failed to create pipeline manifest condition" );
+        mtx_destroy( &pipelineManifestCtx.mutex );
+        free( pipelineManifestCtx.manifestPath );
+        return 1;
+    }
+    _pomManifestLoad( _manifestPath );
+    pipelineManifestCtx.initialised = true;
+    return 0;
+}
+
+int pomPipelineManifestDestroy(){
+    if( !pipelineManifestCtx.initialised ){
+        LOG( WARN, "Attempting to destroy uninitialised pipeline manifest" );
+        return 1;
+    }
+    mtx_lock( &pipelineManifestCtx.mutex );
+    while( pipelineManifestCtx.numWarmupJobsPending ){
+        cnd_wait( &pipelineManifestCtx.warmupDoneCond, &pipelineManifestCtx.mutex );
+    }
+    mtx_unlock( &pipelineManifestCtx.mutex );
+
+    for( uint32_t i = 0; i < pipelineManifestCtx.numLoadedEntries; i++ ){
+        PomPipelineManifestEntry *entry = &pipelineManifestCtx.loadedEntries[ i ];
+        if( entry->warmPipeline ){
+            pomPipelineRegistryRelease( entry->warmPipeline );
+        }
+        _pomManifestEntryClear( entry );
+    }
+    free( pipelineManifestCtx.loadedEntries );
+
+    int toRet = 0;
+    // Keep the previous manifest if this run never got as far as requesting a pipeline
+    if( pipelineManifestCtx.numRecordedEntries && _pomManifestSave() ){
+        LOG( WARN, "Pipeline manifest not saved" );
+        toRet = 1;
+    }
+    for( uint32_t i = 0; i < pipelineManifestCtx.numRecordedEntries; i++ ){
+        _pomManifestEntryClear( &pipelineManifestCtx.recordedEntries[ i ] );
+    }
+    free( pipelineManifestCtx.recordedEntries );
+    free( pipelineManifestCtx.manifestPath );
+    cnd_destroy( &pipelineManifestCtx.warmupDoneCond );
+    mtx_destroy( &pipelineManifestCtx.mutex );
+    pipelineManifestCtx = (PomPipelineManifestCtx){ 0 };
+    return toRet;
+}
+
+int pomPipelineManifestRecord( const ShaderInfo *_shaderDesc, const PomPipelineState *_state ){
+    if( !pipelineManifestCtx.initialised ){
+        // Not recording this run
+        return 0;
+    }
+    const char *strings[ MANIFEST_NUM_STRINGS ];
+    _pomManifestEntryStrings( _shaderDesc, strings );
+    for( uint32_t i = 0; i < MANIFEST_NUM_STRINGS; i++ ){
+        if( strings[ i ] && strpbrk( strings[ i ], "\t\n" ) ){
+            LOG( WARN, "Can't record pipeline with tabs or newlines in its shader description" );
+            return 1;
+        }
+    }
+
+    mtx_lock( &pipelineManifestCtx.mutex );
+    for( uint32_t i = 0; i < pipelineManifestCtx.numRecordedEntries; i++ ){
+        const PomPipelineManifestEntry *entry = &pipelineManifestCtx.recordedEntries[ i ];
+        if( memcmp( &entry->state, _state, sizeof( PomPipelineState ) ) ){
+            continue;
+        }
+        bool stringsMatch = true;
+        for( uint32_t s = 0; s < MANIFEST_NUM_STRINGS && stringsMatch; s++ ){
+            const char *recorded = entry->strings[ s ] ? entry->strings[ s ] : "";
+            stringsMatch = !strcmp( recorded, strings[ s ] ? strings[ s ] : "" );
+        }
+        if( stringsMatch ){
+            mtx_unlock( &pipelineManifestCtx.mutex );
+            return 0;
+        }
+    }
+
+    if( pipelineManifestCtx.numRecordedEntries == pipelineManifestCtx.recordedEntriesCapacity ){
+        uint32_t newCapacity = pipelineManifestCtx.recordedEntriesCapacity ?
+                               pipelineManifestCtx.recordedEntriesCapacity * 2 : 16;
+        PomPipelineManifestEntry *newEntries = (PomPipelineManifestEntry*) realloc(
+            pipelineManifestCtx.recordedEntries, newCapacity * sizeof( PomPipelineManifestEntry ) );
+        if( !newEntries ){
+            LOG( ERR, "Failed to grow pipeline manifest" );
+            mtx_unlock( &pipelineManifestCtx.mutex );
+            return 1;
+        }
+        pipelineManifestCtx.recordedEntries = newEntries;
+        pipelineManifestCtx.recordedEntriesCapacity = newCapacity;
+    }
+    PomPipelineManifestEntry *entry =
+        &pipelineManifestCtx.recordedEntries[ pipelineManifestCtx.numRecordedEntries ];
+    *entry = (PomPipelineManifestEntry){ .state = *_state };
+    for( uint32_t i = 0; i < MANIFEST_NUM_STRINGS; i++ ){
+        size_t length = strings[ i ] ? strlen( strings[ i ] ) : 0;
+        if( !length ){
+            continue;
+        }
+        entry->strings[ i ] = _pomManifestStrdup( strings[ i ], length );
+        if( !entry->strings[ i ] ){
+            LOG( ERR, "Failed to allocate pipeline manifest entry" );
+            _pomManifestEntryClear( entry );
+            mtx_unlock( &pipelineManifestCtx.mutex );
+            return 1;
+        }
+    }
+    pipelineManifestCtx.numRecordedEntries++;
+    mtx_unlock( &pipelineManifestCtx.mutex );
+    return 0;
+}
+
+static void _pomManifestWarmupJobDone(){
+    mtx_lock( &pipelineManifestCtx.mutex );
+    if( --pipelineManifestCtx.numWarmupJobsPending == 0 ){
+        cnd_broadcast( &pipelineManifestCtx.warmupDoneCond );
+    }
+    mtx_unlock( &pipelineManifestCtx.mutex );
+}
+
+static void _pomManifestWarmupJob( void *_args ){
+    PomPipelineManifestEntry *entry = (PomPipelineManifestEntry*) _args;
+    ShaderInfo shaderDesc = _pomManifestEntryShaderDesc( entry );
+    entry->warmPipeline = pomPipelineRegistryPrewarm( &shaderDesc, &entry->state,
+                                                      &pipelineManifestCtx.warmupRenderPass );
+    if( !entry->warmPipeline ){
+        // The pipeline may no longer exist; it'll be dropped from the next manifest
+        LOG( WARN, "Failed to warm up pipeline from manifest" );
+    }
+
+    _pomManifestWarmupJobDone();
+}
+
+int pomPipelineManifestWarmup( VkRenderPass *_renderPass, PomThreadpoolCtx *_threadpool ){
+    if( !pipelineManifestCtx.initialised ){
+        LOG( ERR, "Attempting to warm up pipelines of uninitialised manifest" );
+        return 1;
+    }
+    mtx_lock( &pipelineManifestCtx.mutex );
+    if( pipelineManifestCtx.numWarmupJobsPending ){
+        mtx_unlock( &pipelineManifestCtx.mutex );
+        LOG( WARN, "Attempting to warm up pipelines while already warming up" );
+        return 1;
+    }
+    pipelineManifestCtx.warmupRenderPass = *_renderPass;
+    // Count every job before scheduling any, so none can finish and signal early
+    uint32_t numJobs = 0;
+    for( uint32_t i = 0; i < pipelineManifestCtx.numLoadedEntries; i++ ){
+        numJobs += !pipelineManifestCtx.loadedEntries[ i ].warmPipeline;
+    }
+    pipelineManifestCtx.numWarmupJobsPending = numJobs;
+    mtx_unlock( &pipelineManifestCtx.mutex );
+    LOG( DEBUG, "Warming up %u pipelines", numJobs );
+
+    int toRet = 0;
+    for( uint32_t i = 0; i < pipelineManifestCtx.numLoadedEntries; i++ ){
+        PomPipelineManifestEntry *entry = &pipelineManifestCtx.loadedEntries[ i ];
+        if( entry->warmPipeline ){
+            continue;
+        }
+        entry->warmupJob = (PomThreadpoolJob){ .func = _pomManifestWarmupJob, .args = entry };
+        if( pomThreadpoolScheduleJob( _threadpool, &entry->warmupJob ) ){
+            LOG( WARN, "Failed to schedule pipeline warmup job" );
+            _pomManifestWarmupJobDone();
+            toRet = 1;
+        }
+    }
+    return toRet;
+}
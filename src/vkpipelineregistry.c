@@ -0,0 +1,377 @@
+#include "vkpipelineregistry.h"
+#include "vkpipelinemanifest.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <threads.h>
+
+#define LOG( level, log, ... ) LOG_MODULE( level, vkpipelineregistry, log, ##__VA_ARGS__ )
+
+#define REGISTRY_INITIAL_BUCKETS 64
+// programPath, the 4 stage paths and variantDefines
+#define REGISTRY_NUM_KEY_STRINGS 6
+
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+typedef struct PomPipelineRegistryEntry PomPipelineRegistryEntry;
+typedef struct PomPipelineRegistryCtx PomPipelineRegistryCtx;
+
+struct PomPipelineRegistryEntry{
+    // Next entry in the same bucket
+    PomPipelineRegistryEntry *next;
+    uint64_t hash;
+
+    // Key. The strings are copies owned by the entry, which shaderInfo points into
+    char *keyStrings[ REGISTRY_NUM_KEY_STRINGS ];
+    PomPipelineState state;
+    VkRenderPass renderPass;
+
+    ShaderInfo shaderInfo;
+    PomPipelineCtx pipelineCtx;
+    // Includes threads waiting on the entry to be built
+    uint32_t refCount;
+    bool building;
+    bool failed;
+};
+
+struct PomPipelineRegistryCtx{
+    PomPipelineRegistryEntry **buckets;
+    uint32_t numBuckets;
+    uint32_t numEntries;
+    uint32_t nextId;
+    mtx_t mutex;
+    // Signalled whenever an entry finishes building
+    cnd_t builtCond;
+    bool initialised;
+};
+
+static PomPipelineRegistryCtx pipelineRegistryCtx = { 0 };
+
+static void _pomRegistryKeyStrings( const ShaderInfo *_shaderDesc,
+                                    const char *_strings[ REGISTRY_NUM_KEY_STRINGS ] ){
+    _strings[ 0 ] = _shaderDesc->programPath;
+    _strings[ 1 ] = _shaderDesc->vertexShaderPath;
+    _strings[ 2 ] = _shaderDesc->fragmentShaderPath;
+    _strings[ 3 ] = _shaderDesc->geometryShaderPath;
+    _strings[ 4 ] = _shaderDesc->tesselationShaderPath;
+    _strings[ 5 ] = _shaderDesc->variantDefines;
+}
+
+static uint64_t _pomRegistryHashBytes( uint64_t _hash, const void *_data, size_t _sizeBytes ){
+    const uint8_t *bytes = (const uint8_t*) _data;
+    for( size_t i = 0; i < _sizeBytes; i++ ){
+        _hash ^= bytes[ i ];
+        _hash *= FNV_PRIME;
+    }
+    return _hash;
+}
+
+static uint64_t _pomRegistryHash( const char *_strings[ REGISTRY_NUM_KEY_STRINGS ],
+                                  const PomPipelineState *_state, VkRenderPass _renderPass ){
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for( uint32_t i = 0; i < REGISTRY_NUM_KEY_STRINGS; i++ ){
+        // Hash the terminator too (or a lone one for NULL), so "ab","c" and "a","bc" differ
+        if( _strings[ i ] ){
+            hash = _pomRegistryHashBytes( hash, _strings[ i ], strlen( _strings[ i ] ) + 1 );
+        }else{
+            hash = _pomRegistryHashBytes( hash, "", 1 );
+        }
+    }
+    hash = _pomRegistryHashBytes( hash, _state, sizeof( PomPipelineState ) );
+    // Render passes are only compared by handle; a compatible but separately created
+    // render pass gets its own pipeline
+    hash = _pomRegistryHashBytes( hash, &_renderPass, sizeof( VkRenderPass ) );
+    return hash;
+}
+
+static bool _pomRegistryEntryMatches( const PomPipelineRegistryEntry *_entry, uint64_t _hash,
+                                      const char *_strings[ REGISTRY_NUM_KEY_STRINGS ],
+                                      const PomPipelineState *_state, VkRenderPass _renderPass ){
+    if( _entry->hash != _hash || _entry->renderPass != _renderPass ||
+        memcmp( &_entry->state, _state, sizeof( PomPipelineState ) ) ){
+        return false;
+    }
+    for( uint32_t i = 0; i < REGISTRY_NUM_KEY_STRINGS; i++ ){
+        const char *entryString = _entry->keyStrings[ i ];
+        if( !entryString || !_strings[ i ] ){
+            if( entryString != _strings[ i ] ){
+                return false;
+            }
+        }else if( strcmp( entryString, _strings[ i ] ) ){
+            return false;
+        }
+    }
+    return true;
+}
+
+static PomPipelineRegistryEntry *_pomRegistryEntryFromPipeline( const PomPipelineCtx *_pipelineCtx ){
+    return (PomPipelineRegistryEntry*) ( (uint8_t*) _pipelineCtx -
+                                         offsetof( PomPipelineRegistryEntry, pipelineCtx ) );
+}
+
+static void _pomRegistryEntryFree( PomPipelineRegistryEntry *_entry ){
+    for( uint32_t i = 0; i < REGISTRY_NUM_KEY_STRINGS; i++ ){
+        free( _entry->keyStrings[ i ] );
+    }
+    free( _entry );
+}
+
+// Double the bucket count. Failing to grow just makes the chains longer
+static void _pomRegistryGrow(){
+    uint32_t newNumBuckets = pipelineRegistryCtx.numBuckets * 2;
+    PomPipelineRegistryEntry **newBuckets =
+        (PomPipelineRegistryEntry**) calloc( newNumBuckets, sizeof( PomPipelineRegistryEntry* ) );
+    if( !newBuckets ){
+        LOG( WARN, "Failed to grow pipeline registry" );
+        return;
+    }
+    for( uint32_t i = 0; i < pipelineRegistryCtx.numBuckets; i++ ){
+        PomPipelineRegistryEntry *entry = pipelineRegistryCtx.buckets[ i ];
+        while( entry ){
+            PomPipelineRegistryEntry *next = entry->next;
+            PomPipelineRegistryEntry **bucket = &newBuckets[ entry->hash & ( newNumBuckets - 1 ) ];
+            entry->next = *bucket;
+            *bucket = entry;
+            entry = next;
+        }
+    }
+    free( pipelineRegistryCtx.buckets );
+    pipelineRegistryCtx.buckets = newBuckets;
+    pipelineRegistryCtx.numBuckets = newNumBuckets;
+}
+
+// Must hold the registry mutex
+static void _pomRegistryRemove( PomPipelineRegistryEntry *_entry ){
+    PomPipelineRegistryEntry **link =
+        &pipelineRegistryCtx.buckets[ _entry->hash & ( pipelineRegistryCtx.numBuckets - 1 ) ];
+    while( *link && *link != _entry ){
+        link = &( *link )->next;
+    }
+    if( *link ){
+        *link = _entry->next;
+        pipelineRegistryCtx.numEntries--;
+    }
+}
+
+int pomPipelineRegistryCreate(){
+    if( pipelineRegistryCtx.initialised ){
+        LOG( WARN, "Attempting to re-initialise pipeline registry" );
+        return 1;
+    }
+    pipelineRegistryCtx.buckets =
+        (PomPipelineRegistryEntry**) calloc( REGISTRY_INITIAL_BUCKETS, sizeof( PomPipelineRegistryEntry* ) );
+    if( !pipelineRegistryCtx.buckets ){
+        LOG( ERR, "Failed to allocate pipeline registry" );
+        return 1;
+    }
+    if( mtx_init( &pipelineRegistryCtx.mutex, mtx_plain ) != thrd_success ){
+        LOG( ERR, "Failed to create pipeline registry mutex" );
+        free( pipelineRegistryCtx.buckets );
+        return 1;
+    }
+    if( cnd_init( &pipelineRegistryCtx.builtCond ) != thrd_success ){
+        LOG( ERR, "Failed to create pipeline registry condition" );
+        mtx_destroy( &pipelineRegistryCtx.mutex );
+        free( pipelineRegistryCtx.buckets );
+        return 1;
+    }
+    pipelineRegistryCtx.numBuckets = REGISTRY_INITIAL_BUCKETS;
+    pipelineRegistryCtx.numEntries = 0;
+    pipelineRegistryCtx.nextId = 1;
+    pipelineRegistryCtx.initialised = true;
+    return 0;
+}
+
+int pomPipelineRegistryDestroy(){
+    if( !pipelineRegistryCtx.initialised ){
+        LOG( WARN, "Attempting to destroy uninitialised pipeline registry" );
+        return 1;
+    }
+    for( uint32_t i = 0; i < pipelineRegistryCtx.numBuckets; i++ ){
+        PomPipelineRegistryEntry *entry = pipelineRegistryCtx.buckets[ i ];
+        while( entry ){
+            PomPipelineRegistryEntry *next = entry->next;
+            const char *name = entry->keyStrings[ 0 ] ? entry->keyStrings[ 0 ] : entry->keyStrings[ 1 ];
+            LOG( WARN, "Pipeline %u (%s) leaked with %u references", entry->pipelineCtx.registryId,
+                 name ? name : "unnamed", entry->refCount );
+            if( !entry->building ){
+                pomPipelineDestroy( &entry->pipelineCtx );
+                pomShaderDestroy( &entry->shaderInfo );
+            }
+            _pomRegistryEntryFree( entry );
+            entry = next;
+        }
+    }
+    free( pipelineRegistryCtx.buckets );
+    cnd_destroy( &pipelineRegistryCtx.builtCond );
+    mtx_destroy( &pipelineRegistryCtx.mutex );
+    pipelineRegistryCtx = (PomPipelineRegistryCtx){ 0 };
+    return 0;
+}
+
+// Create the shader and pipeline of a new entry. Called without the registry mutex held,
+// so other pipelines can be built alongside it
+static int _pomRegistryEntryBuild( PomPipelineRegistryEntry *_entry ){
+    _entry->shaderInfo = (ShaderInfo){
+        .programPath = _entry->keyStrings[ 0 ],
+        .vertexShaderPath = _entry->keyStrings[ 1 ],
+        .fragmentShaderPath = _entry->keyStrings[ 2 ],
+        .geometryShaderPath = _entry->keyStrings[ 3 ],
+        .tesselationShaderPath = _entry->keyStrings[ 4 ],
+        .variantDefines = _entry->keyStrings[ 5 ]
+    };
+    if( pomShaderCreate( &_entry->shaderInfo ) ){
+        LOG( ERR, "Failed to create shader for pipeline %u", _entry->pipelineCtx.registryId );
+        return 1;
+    }
+    if( pomPipelineCreate( &_entry->pipelineCtx, &_entry->shaderInfo, &_entry->state,
+                           &_entry->renderPass ) ){
+        LOG( ERR, "Failed to create pipeline %u", _entry->pipelineCtx.registryId );
+        pomShaderDestroy( &_entry->shaderInfo );
+        return 1;
+    }
+    return 0;
+}
+
+static PomPipelineCtx *_pomPipelineRegistryAcquire( const ShaderInfo *_shaderDesc,
+                                                    const PomPipelineState *_state,
+                                                    VkRenderPass *_renderPass ){
+    if( !pipelineRegistryCtx.initialised ){
+        LOG( ERR, "Attempting to acquire pipeline from uninitialised registry" );
+        return NULL;
+    }
+    PomPipelineState state = _state ? *_state : POM_PIPELINE_STATE_DEFAULT;
+    const char *keyStrings[ REGISTRY_NUM_KEY_STRINGS ];
+    _pomRegistryKeyStrings( _shaderDesc, keyStrings );
+    uint64_t hash = _pomRegistryHash( keyStrings, &state, *_renderPass );
+
+    mtx_lock( &pipelineRegistryCtx.mutex );
+    PomPipelineRegistryEntry *entry =
+        pipelineRegistryCtx.buckets[ hash & ( pipelineRegistryCtx.numBuckets - 1 ) ];
+    while( entry && !_pomRegistryEntryMatches( entry, hash, keyStrings, &state, *_renderPass ) ){
+        entry = entry->next;
+    }
+
+    if( entry ){
+        // Hold a reference while waiting, so a failed build can't free the entry under us
+        entry->refCount++;
+        while( entry->building ){
+            cnd_wait( &pipelineRegistryCtx.builtCond, &pipelineRegistryCtx.mutex );
+        }
+        if( entry->failed ){
+            if( --entry->refCount == 0 ){
+                _pomRegistryEntryFree( entry );
+            }
+            mtx_unlock( &pipelineRegistryCtx.mutex );
+            return NULL;
+        }
+        mtx_unlock( &pipelineRegistryCtx.mutex );
+        return &entry->pipelineCtx;
+    }
+
+    entry = (PomPipelineRegistryEntry*) calloc( 1, sizeof( PomPipelineRegistryEntry ) );
+    if( !entry ){
+        LOG( ERR, "Failed to allocate pipeline registry entry" );
+        mtx_unlock( &pipelineRegistryCtx.mutex );
+        return NULL;
+    }
+    for( uint32_t i = 0; i < REGISTRY_NUM_KEY_STRINGS; i++ ){
+        if( !keyStrings[ i ] ){
+            continue;
+        }
+        size_t stringSize = strlen( keyStrings[ i ] ) + 1;
+        entry->keyStrings[ i ] = (char*) malloc( stringSize );
+        if( !entry->keyStrings[ i ] ){
+            LOG( ERR, "Failed to allocate pipeline registry key" );
+            _pomRegistryEntryFree( entry );
+            mtx_unlock( &pipelineRegistryCtx.mutex );
+            return NULL;
+        }
+        memcpy( entry->keyStrings[ i ], keyStrings[ i ], stringSize );
+    }
+    entry->hash = hash;
+    entry->state = state;
+    entry->renderPass = *_renderPass;
+    entry->refCount = 1;
+    entry->building = true;
+    entry->pipelineCtx.registryId = pipelineRegistryCtx.nextId++;
+
+    if( pipelineRegistryCtx.numEntries >= pipelineRegistryCtx.numBuckets ){
+        _pomRegistryGrow();
+    }
+    PomPipelineRegistryEntry **bucket =
+        &pipelineRegistryCtx.buckets[ hash & ( pipelineRegistryCtx.numBuckets - 1 ) ];
+    entry->next = *bucket;
+    *bucket = entry;
+    pipelineRegistryCtx.numEntries++;
+    mtx_unlock( &pipelineRegistryCtx.mutex );
+
+    int buildFailed = _pomRegistryEntryBuild( entry );
+
+    mtx_lock( &pipelineRegistryCtx.mutex );
+    entry->building = false;
+    PomPipelineCtx *toRet = &entry->pipelineCtx;
+    if( buildFailed ){
+        // Leave the key free for a later retry; any waiters free the entry when done with it
+        entry->failed = true;
+        _pomRegistryRemove( entry );
+        if( --entry->refCount == 0 ){
+            _pomRegistryEntryFree( entry );
+        }
+        toRet = NULL;
+    }
+    cnd_broadcast( &pipelineRegistryCtx.builtCond );
+    mtx_unlock( &pipelineRegistryCtx.mutex );
+    return toRet;
+}
+
+int pomPipelineRegistryRelease( PomPipelineCtx *_pipelineCtx ){
+    if( !pipelineRegistryCtx.initialised ){
+        LOG( ERR, "Attempting to release pipeline to uninitialised registry" );
+        return 1;
+    }
+    if( !_pipelineCtx->registryId ){
+        LOG( ERR, "Attempting to release pipeline not owned by registry" );
+        return 1;
+    }
+    PomPipelineRegistryEntry *entry = _pomRegistryEntryFromPipeline( _pipelineCtx );
+
+    mtx_lock( &pipelineRegistryCtx.mutex );
+    if( --entry->refCount ){
+        mtx_unlock( &pipelineRegistryCtx.mutex );
+        return 0;
+    }
+    _pomRegistryRemove( entry );
+    mtx_unlock( &pipelineRegistryCtx.mutex );
+
+    int toRet = 0;
+    if( pomPipelineDestroy( &entry->pipelineCtx ) || pomShaderDestroy( &entry->shaderInfo ) ){
+        LOG( ERR, "Failed to destroy pipeline %u", entry->pipelineCtx.registryId );
+        toRet = 1;
+    }
+    _pomRegistryEntryFree( entry );
+    return toRet;
+}
+
+PomPipelineCtx *pomPipelineRegistryAcquire( const ShaderInfo *_shaderDesc,
+                                            const PomPipelineState *_state,
+                                            VkRenderPass *_renderPass ){
+    PomPipelineCtx *pipelineCtx = _pomPipelineRegistryAcquire( _shaderDesc, _state, _renderPass );
+    if( pipelineCtx ){
+        pomPipelineManifestRecord( _shaderDesc, &pipelineCtx->state );
+    }
+    return pipelineCtx;
+}
+
+PomPipelineCtx *pomPipelineRegistryPrewarm( const ShaderInfo *_shaderDesc,
+                                            const PomPipelineState *_state,
+                                            VkRenderPass *_renderPass ){
+    return _pomPipelineRegistryAcquire( _shaderDesc, _state, _renderPass );
+}
+
+uint32_t pomPipelineRegistryGetId( const PomPipelineCtx *_pipelineCtx ){
+    return _pipelineCtx->registryId;
+}
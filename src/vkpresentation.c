@@ -1,6 +1,7 @@
 #include "vkpresentation.h"
 #include "common.h"
 #include "vkdevice.h"
+#include "vkmemory.h"
 #include <stdbool.h>
 #include <stdlib.h>
 
@@ -11,6 +12,7 @@
 
 typedef struct SwapchainImageViews SwapchainImageViews;
 typedef struct SwapchainFramebuffers SwapchainFramebuffers;
+typedef struct SwapchainDepth SwapchainDepth;
 
 struct SwapchainImageViews{
     VkImageView *imageViews;
@@ -26,8 +28,138 @@ struct SwapchainFramebuffers{
     bool initialised;
 };
 
+// One depth image shared by every framebuffer, since only one frame renders at a time
+struct SwapchainDepth{
+    VkImage image;
+    PomVkMemoryCtx memCtx;
+    VkImageView imageView;
+
+    bool initialised;
+};
+
 SwapchainImageViews swapchainImageViews = { 0 };
 SwapchainFramebuffers swapchainFramebuffers = { 0 };
+SwapchainDepth swapchainDepth = { 0 };
+static VkFormat swapchainDepthFormat = VK_FORMAT_UNDEFINED;
+
+VkFormat pomSwapchainDepthFormatGet(){
+    if( swapchainDepthFormat != VK_FORMAT_UNDEFINED ){
+        return swapchainDepthFormat;
+    }
+    VkPhysicalDevice *phyDev = pomGetPhysicalDevice();
+    if( !phyDev ){
+        LOG( ERR, "Attempting to find depth format with no available physical device" );
+        return VK_FORMAT_UNDEFINED;
+    }
+    // In order of preference. We don't use stencil, but not every device has D32 alone
+    const VkFormat candidates[] = {
+        VK_FORMAT_D32_SFLOAT,
+        VK_FORMAT_D32_SFLOAT_S8_UINT,
+        VK_FORMAT_D24_UNORM_S8_UINT
+    };
+    for( uint32_t i = 0; i < sizeof( candidates ) / sizeof( VkFormat ); i++ ){
+        VkFormatProperties formatProps;
+        vkGetPhysicalDeviceFormatProperties( *phyDev, candidates[ i ], &formatProps );
+        if( formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT ){
+            swapchainDepthFormat = candidates[ i ];
+            return swapchainDepthFormat;
+        }
+    }
+    LOG( ERR, "No supported depth format" );
+    return VK_FORMAT_UNDEFINED;
+}
+
+int pomSwapchainDepthCreate(){
+    if( swapchainDepth.initialised ){
+        LOG( WARN, "Swapchain depth already initialised" );
+        return 1;
+    }
+    VkDevice *dev = pomGetLogicalDevice();
+    if( !dev ){
+        LOG( ERR, "No logical device available for swapchain depth creation" );
+        return 1;
+    }
+    VkFormat depthFormat = pomSwapchainDepthFormatGet();
+    if( depthFormat == VK_FORMAT_UNDEFINED ){
+        return 1;
+    }
+    VkExtent2D *swapchainExtent = pomGetSwapchainExtent();
+
+    // Depth is cleared on load and never stored, so the image only lives within a render pass
+    VkImageCreateInfo imageInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = depthFormat,
+        .extent = { .width = swapchainExtent->width, .height = swapchainExtent->height, .depth = 1 },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+    if( vkCreateImage( *dev, &imageInfo, NULL, &swapchainDepth.image ) != VK_SUCCESS ){
+        LOG( ERR, "Could not create swapchain depth image" );
+        return 1;
+    }
+    VkMemoryRequirements memReqs;
+    vkGetImageMemoryRequirements( *dev, swapchainDepth.image, &memReqs );
+    swapchainDepth.memCtx = (PomVkMemoryCtx){ 0 };
+    if( pomVkAllocateMemory( &swapchainDepth.memCtx, POM_VK_MEMORY_RESOURCE_OPTIMAL,
+                             POM_VK_MEMORY_CATEGORY_IMAGE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0,
+                             &memReqs, POM_VK_MEMORY_SITE ) ){
+        LOG( ERR, "Could not allocate swapchain depth memory" );
+        vkDestroyImage( *dev, swapchainDepth.image, NULL );
+        return 1;
+    }
+    if( vkBindImageMemory( *dev, swapchainDepth.image, swapchainDepth.memCtx.memory,
+                           swapchainDepth.memCtx.offset ) != VK_SUCCESS ){
+        LOG( ERR, "Could not bind swapchain depth memory" );
+        goto depthCreateFailed;
+    }
+
+    VkImageViewCreateInfo viewInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = swapchainDepth.image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = depthFormat,
+        .subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+        .subresourceRange.baseMipLevel = 0,
+        .subresourceRange.levelCount = 1,
+        .subresourceRange.baseArrayLayer = 0,
+        .subresourceRange.layerCount = 1
+    };
+    if( vkCreateImageView( *dev, &viewInfo, NULL, &swapchainDepth.imageView ) != VK_SUCCESS ){
+        LOG( ERR, "Could not create swapchain depth image view" );
+        goto depthCreateFailed;
+    }
+
+    swapchainDepth.initialised = true;
+    return 0;
+
+depthCreateFailed:
+    pomVkFreeMemory( &swapchainDepth.memCtx );
+    vkDestroyImage( *dev, swapchainDepth.image, NULL );
+    return 1;
+}
+
+int pomSwapchainDepthDestroy(){
+    if( !swapchainDepth.initialised ){
+        LOG( WARN, "Attempting to destroy uninitialised swapchain depth" );
+        return 1;
+    }
+    VkDevice *dev = pomGetLogicalDevice();
+    if( !dev ){
+        LOG( ERR, "Logical device destroyed before swapchain depth" );
+        return 1;
+    }
+    vkDestroyImageView( *dev, swapchainDepth.imageView, NULL );
+    vkDestroyImage( *dev, swapchainDepth.image, NULL );
+    pomVkFreeMemory( &swapchainDepth.memCtx );
+    swapchainDepth.initialised = false;
+    return 0;
+}
 
 int pomSwapchainImageViewsCreate(){
     if( swapchainImageViews.initialised ){
@@ -119,6 +251,12 @@ int pomSwapchainFramebuffersCreate( VkRenderPass *_renderPass ){
             return 1;
         }
     }
+    if( !swapchainDepth.initialised ){
+        // Likewise the depth attachment
+        if( pomSwapchainDepthCreate() ){
+            return 1;
+        }
+    }
 
     VkExtent2D *swapchainExtent = pomGetSwapchainExtent();
     uint32_t width = swapchainExtent->width;
@@ -131,8 +269,8 @@ int pomSwapchainFramebuffersCreate( VkRenderPass *_renderPass ){
     for( uint32_t i = 0; i < swapchainImageViews.numViews; i++ ){
         VkFramebufferCreateInfo framebufferInfo = {
             .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-            .attachmentCount = 1,
-            .pAttachments = (VkImageView[]){ swapchainImageViews.imageViews[ i ] },
+            .attachmentCount = 2,
+            .pAttachments = (VkImageView[]){ swapchainImageViews.imageViews[ i ], swapchainDepth.imageView },
             .height = height,
             .width = width,
             .renderPass = *_renderPass,
@@ -158,8 +296,9 @@ int pomSwapchainFramebuffersDestroy(){
         LOG( WARN, "Attempting to destroy uninitialised swapchain framebuffer" );
         return 1;
     }
-    // Destroy the swapchain image views since we may have created them
+    // Destroy the swapchain image views and depth since we may have created them
     pomSwapchainImageViewsDestroy();
+    pomSwapchainDepthDestroy();
 
     VkDevice * dev = pomGetLogicalDevice();
     if( !dev ){
@@ -170,10 +309,211 @@ int pomSwapchainFramebuffersDestroy(){
     for( uint32_t i = 0; i < swapchainFramebuffers.numFramebuffers; i++ ){
         vkDestroyFramebuffer( *dev, swapchainFramebuffers.framebuffers[ i ], NULL );
     }
+    free( swapchainFramebuffers.framebuffers );
     swapchainFramebuffers.initialised = false;
     return 0;
 }
 
+int pomSwapchainResize( VkRenderPass *_renderPass ){
+    VkDevice *dev = pomGetLogicalDevice();
+    if( !dev ){
+        LOG( ERR, "Attempting to resize swapchain with no available logical device" );
+        return 1;
+    }
+    // Previous frames may still be using the old framebuffers
+    vkDeviceWaitIdle( *dev );
+
+    if( swapchainFramebuffers.initialised ){
+        pomSwapchainFramebuffersDestroy();
+    }
+    if( swapchainImageViews.initialised ){
+        pomSwapchainImageViewsDestroy();
+    }
+    if( swapchainDepth.initialised ){
+        pomSwapchainDepthDestroy();
+    }
+    int recreateRet = pomSwapchainRecreate();
+    if( recreateRet == 2 ){
+        // Nothing to render to yet; the views, depth and framebuffers are made on a later try
+        return 2;
+    }
+    if( recreateRet ){
+        LOG( ERR, "Failed to recreate swapchain" );
+        return 1;
+    }
+    if( *_renderPass == VK_NULL_HANDLE ){
+        // Rendering dynamically, so there are no framebuffers
+        if( pomSwapchainImageViewsCreate() || pomSwapchainDepthCreate() ){
+            LOG( ERR, "Failed to recreate swapchain image views and depth" );
+            return 1;
+        }
+        return 0;
+    }
+    // Creates the image views and depth along with the framebuffers
+    if( pomSwapchainFramebuffersCreate( _renderPass ) ){
+        LOG( ERR, "Failed to recreate swapchain framebuffers" );
+        return 1;
+    }
+    return 0;
+}
+
+static VkImageAspectFlags depthBarrierAspect(){
+    VkFormat format = pomSwapchainDepthFormatGet();
+    // Layout transitions of combined formats must cover both aspects
+    if( format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT ){
+        return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+    }
+    return VK_IMAGE_ASPECT_DEPTH_BIT;
+}
+
+int pomSwapchainRenderingBegin( VkCommandBuffer _cmdBuffer, uint32_t _imageIdx,
+                                VkRenderPass *_renderPass, const VkClearValue _clearValues[ 2 ] ){
+    VkExtent2D *swapchainExtent = pomGetSwapchainExtent();
+    VkRect2D renderArea = {
+        .offset = (VkOffset2D){ .x = 0, .y = 0 },
+        .extent = *swapchainExtent
+    };
+    if( *_renderPass != VK_NULL_HANDLE ){
+        if( !swapchainFramebuffers.initialised || _imageIdx >= swapchainFramebuffers.numFramebuffers ){
+            LOG( ERR, "Attempting to begin RenderPass without a framebuffer for image %u", _imageIdx );
+            return 1;
+        }
+        VkRenderPassBeginInfo renderPassBeginInfo = {
+            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+            .framebuffer = swapchainFramebuffers.framebuffers[ _imageIdx ],
+            .renderArea = renderArea,
+            .renderPass = *_renderPass,
+            .pClearValues = _clearValues,
+            .clearValueCount = 2
+        };
+        vkCmdBeginRenderPass( _cmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE );
+        return 0;
+    }
+
+    uint32_t numImages;
+    VkImage *swapchainImages = pomGetSwapchainImages( &numImages );
+    if( !swapchainImages || !swapchainImageViews.initialised || !swapchainDepth.initialised ||
+        _imageIdx >= numImages ){
+        LOG( ERR, "Attempting to begin rendering without attachments for image %u", _imageIdx );
+        return 1;
+    }
+    // Do the render pass's layout transitions ourselves. Neither attachment's contents are kept
+    // from before, and the depth image must wait for the previous frame to finish with it
+    VkImageMemoryBarrier barriers[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = swapchainImages[ _imageIdx ],
+            .subresourceRange = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1
+            }
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                             VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = swapchainDepth.image,
+            .subresourceRange = {
+                .aspectMask = depthBarrierAspect(),
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1
+            }
+        }
+    };
+    vkCmdPipelineBarrier( _cmdBuffer,
+                          VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                          VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                          VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                          VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+                          0, 0, NULL, 0, NULL,
+                          sizeof( barriers ) / sizeof( VkImageMemoryBarrier ), barriers );
+
+    VkRenderingAttachmentInfoKHR colourAttachment = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+        .imageView = swapchainImageViews.imageViews[ _imageIdx ],
+        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .resolveMode = VK_RESOLVE_MODE_NONE,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .clearValue = _clearValues[ 0 ]
+    };
+    VkRenderingAttachmentInfoKHR depthAttachment = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+        .imageView = swapchainDepth.imageView,
+        .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        .resolveMode = VK_RESOLVE_MODE_NONE,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .clearValue = _clearValues[ 1 ]
+    };
+    VkRenderingInfoKHR renderingInfo = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR,
+        .renderArea = renderArea,
+        .layerCount = 1,
+        .viewMask = 0,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &colourAttachment,
+        .pDepthAttachment = &depthAttachment,
+        .pStencilAttachment = NULL
+    };
+    pomDeviceCmdBeginRendering( _cmdBuffer, &renderingInfo );
+    return 0;
+}
+
+int pomSwapchainRenderingEnd( VkCommandBuffer _cmdBuffer, uint32_t _imageIdx,
+                              VkRenderPass *_renderPass ){
+    if( *_renderPass != VK_NULL_HANDLE ){
+        vkCmdEndRenderPass( _cmdBuffer );
+        return 0;
+    }
+    pomDeviceCmdEndRendering( _cmdBuffer );
+
+    uint32_t numImages;
+    VkImage *swapchainImages = pomGetSwapchainImages( &numImages );
+    if( !swapchainImages || _imageIdx >= numImages ){
+        LOG( ERR, "Attempting to end rendering to unknown swapchain image %u", _imageIdx );
+        return 1;
+    }
+    // Hand the image over to presentation, which the present's semaphore wait makes visible
+    VkImageMemoryBarrier presentBarrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .dstAccessMask = 0,
+        .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = swapchainImages[ _imageIdx ],
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        }
+    };
+    vkCmdPipelineBarrier( _cmdBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                          VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL,
+                          1, &presentBarrier );
+    return 0;
+}
+
 VkFramebuffer *pomSwapchainFramebuffersGet( uint32_t *numBuffers ){
     if( !swapchainFramebuffers.initialised ){
         LOG( ERR, "Attempting to fetch uninitialised swapchain framebuffers" );
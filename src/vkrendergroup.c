@@ -6,6 +6,8 @@
 #define LOG( lvl, log, ... ) LOG_MODULE( lvl, VkRenderGroup, log, ##__VA_ARGS__ )
 
 static int rgGetDescriptorSetSize( PomVkRenderGroupCtx *_renderGroupCtx );
+static void rgRecordDraws( PomVkRenderGroupCtx *_renderGroupCtx, PomPipelineCtx *_pipelineCtx,
+                           VkCommandBuffer _cmdBuffer, uint32_t bufferIdx );
 // TODO - auto set pipeline->shader->attributes
 int pomVkRenderGroupCreate( PomVkRenderGroupCtx *_renderGroupCtx, PomPipelineCtx *_pipelineCtx,
                             uint32_t _numLocalDescriptors, PomVkDescriptorCtx *_localDescriptorsCtx,
@@ -37,6 +39,7 @@ int pomVkRenderGroupCreate( PomVkRenderGroupCtx *_renderGroupCtx, PomPipelineCtx
     memcpy( _renderGroupCtx->modelList, _models, sizeof( PomVkModelCtx*) * numModels );
     _renderGroupCtx->numModels = numModels;
     _renderGroupCtx->pipelineCtx = _pipelineCtx;
+    _renderGroupCtx->depthPrepassPipelineCtx = NULL;
 
     // Get/set the number of descriptor sets used by this rendergroup (local + model)
     if( rgGetDescriptorSetSize( _renderGroupCtx ) ){
@@ -85,6 +88,11 @@ int pomVkRenderGroupAllocateDescriptorSets( PomVkRenderGroupCtx *_renderGroupCtx
         LOG( ERR, "Failed to get swapchain image count" );
         return 1;
     }
+    // The swapchain may have been recreated with a different image count since creation
+    if( rgGetDescriptorSetSize( _renderGroupCtx ) ){
+        LOG( ERR, "Failed to get RenderGroups Descriptor Set count" );
+        return 1;
+    }
 
 //    uint32_t totalDS = _renderGroupCtx->numModelDescriptorSets +
 //                       _renderGroupCtx->numRenderGroupDescriptorSets;
@@ -104,6 +112,15 @@ int pomVkRenderGroupAllocateDescriptorSets( PomVkRenderGroupCtx *_renderGroupCtx
 
     
     uint32_t numModels = _renderGroupCtx->numModels;
+
+    // Rendergroup-local descriptors fill the bindings of set 0 in order, and the model
+    // descriptor is the first binding of set 1
+    if( shaderDSCtx->numLayouts < 2 ||
+        _renderGroupCtx->numLocalDescriptors > shaderDSCtx->layoutInfos[ 0 ].numBindings ||
+        !shaderDSCtx->layoutInfos[ 1 ].numBindings ){
+        LOG( ERR, "Shader descriptor sets don't match the RenderGroup's descriptors" );
+        return 1;
+    }
     const size_t rgDSLArraySize = sizeof( VkDescriptorSetLayout ) * numShaderRGDSL;
     const size_t modelDSLArraySize = sizeof( VkDescriptorSetLayout ) * numShaderModelDSL;
     const size_t setsPerSwapchainImage = ( numShaderModelDSL * numModels ) + numShaderRGDSL;
@@ -118,11 +135,11 @@ int pomVkRenderGroupAllocateDescriptorSets( PomVkRenderGroupCtx *_renderGroupCtx
     // Loop for each swapchain image
     for( uint32_t i = 0; i < swapchainImageCount; i++ ){
         memcpy( currLayoutOffset, shaderRGDSLs, rgDSLArraySize );
-        currLayoutOffset += 1;
+        currLayoutOffset += numShaderRGDSL;
         // Loop for each model
         for( uint32_t modelIdx = 0; modelIdx < numModels; modelIdx++ ){
             memcpy( currLayoutOffset, shaderModelDSLs, modelDSLArraySize );
-            currLayoutOffset += 1;
+            currLayoutOffset += numShaderModelDSL;
         }
     }
 
@@ -139,14 +156,56 @@ int pomVkRenderGroupAllocateDescriptorSets( PomVkRenderGroupCtx *_renderGroupCtx
         LOG( ERR, "Failed to allocate descriptor set" );
         return 1;
     }
+    _renderGroupCtx->allDescriptorSets = descriptorSets;
+    _renderGroupCtx->setsPerSwapchainImage = setsPerSwapchainImage;
+    free( layouts );
+
+    return pomVkRenderGroupWriteDescriptorSets( _renderGroupCtx );
+}
+
+int pomVkRenderGroupReleaseDescriptorSets( PomVkRenderGroupCtx *_renderGroupCtx ){
+    if( !_renderGroupCtx->initialised ){
+        LOG( ERR, "Attempting to release uninitialised RenderGroup's Descriptor Sets" );
+        return 1;
+    }
+    free( _renderGroupCtx->allDescriptorSets );
+    _renderGroupCtx->allDescriptorSets = NULL;
+    return 0;
+}
+
+int pomVkRenderGroupWriteDescriptorSets( PomVkRenderGroupCtx *_renderGroupCtx ){
+    if( !_renderGroupCtx->initialised || !_renderGroupCtx->allDescriptorSets ){
+        LOG( ERR, "Attempting to write RenderGroup's unallocated Descriptor Sets" );
+        return 1;
+    }
+    VkDevice * dev = pomGetLogicalDevice();
+    if( !dev ){
+        LOG( ERR, "No logical device available for descriptor set writes" );
+        return 1;
+    }
+    uint32_t swapchainImageCount;
+    if( !pomGetSwapchainImages( &swapchainImageCount ) ){
+        LOG( ERR, "Failed to get swapchain image count" );
+        return 1;
+    }
+    ShaderDescriptorSetCtx *shaderDSCtx = &_renderGroupCtx->pipelineCtx->shaderInfo.
+                                            shaderInputAttributes.descriptorSetLayoutCtx;
+    const ShaderDescriptorSetLayoutInfo *rgSetInfo = &shaderDSCtx->layoutInfos[ 0 ];
+    const ShaderDescriptorSetLayoutInfo *modelSetInfo = &shaderDSCtx->layoutInfos[ 1 ];
+    uint32_t numShaderModelDSL = shaderDSCtx->numModelLocalLayouts;
+    uint32_t numShaderRGDSL = shaderDSCtx->numRenderGroupLocalLayouts;
+    uint32_t numModels = _renderGroupCtx->numModels;
+    const size_t setsPerSwapchainImage = _renderGroupCtx->setsPerSwapchainImage;
+    VkDescriptorSet *descriptorSets = _renderGroupCtx->allDescriptorSets;
+
     // Set up the descriptor sets
     for( uint32_t i = 0; i < swapchainImageCount; i++ ){
         VkDescriptorSet *currSetGroup = &descriptorSets[ setsPerSwapchainImage * i ];
-        uint32_t currSetOffset = 0;
+        uint32_t currSetOffset = numShaderRGDSL;
         // Set up rendergroup-local DS
         for( uint32_t rgDsIdx = 0; rgDsIdx < _renderGroupCtx->numLocalDescriptors; rgDsIdx++ ){
             PomVkDescriptorCtx *rgDescriptorCtx = &_renderGroupCtx->localDescriptors[ rgDsIdx ];
-            VkDescriptorBufferInfo *buffInfo = pomVkDescriptorGetBufferInfo( rgDescriptorCtx );
+            VkDescriptorBufferInfo *buffInfo = pomVkDescriptorGetFrameBufferInfo( rgDescriptorCtx, i );
             if( !buffInfo ){
                 LOG( ERR, "Could not get render-local descriptor buffer info" );
                 // TODO - cleanup here
@@ -154,16 +213,15 @@ int pomVkRenderGroupAllocateDescriptorSets( PomVkRenderGroupCtx *_renderGroupCtx
             }
             VkWriteDescriptorSet writeDS = {
                 .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                .dstSet = currSetGroup[ currSetOffset ],
-                .dstBinding = 0, // TODO - get binding here (maybe from shader?)
+                .dstSet = currSetGroup[ 0 ],
+                .dstBinding = rgSetInfo->bindings[ rgDsIdx ].binding,
                 .dstArrayElement = 0, // Assume no arrays for now
-                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, // Assume only UBOs for now
-                .descriptorCount = 1, // 1 descriptor per DS for now
+                .descriptorType = rgSetInfo->bindings[ rgDsIdx ].descriptorType,
+                .descriptorCount = 1,
                 .pBufferInfo = buffInfo,
-                .pImageInfo = NULL, // Only UBOs for now
+                .pImageInfo = NULL, // Only buffers for now
                 .pTexelBufferView = NULL, // Ditto
             };
-            currSetOffset++;
             // Could maybe defer this till the end?
             vkUpdateDescriptorSets( *dev, 1, &writeDS, 0, NULL );
 
@@ -174,7 +232,7 @@ int pomVkRenderGroupAllocateDescriptorSets( PomVkRenderGroupCtx *_renderGroupCtx
             PomVkModelCtx *model = _renderGroupCtx->modelList[ modelIdx ];
 
             PomVkDescriptorCtx *modelDescriptorCtx = &model->modelDescriptorCtx;
-            VkDescriptorBufferInfo *descBuffInfo = pomVkDescriptorGetBufferInfo( modelDescriptorCtx );
+            VkDescriptorBufferInfo *descBuffInfo = pomVkDescriptorGetFrameBufferInfo( modelDescriptorCtx, i );
             if( !descBuffInfo ){
                 LOG( ERR, "Could not get model-local descriptor buffer info" );
                 // TODO - cleanup here
@@ -183,32 +241,57 @@ int pomVkRenderGroupAllocateDescriptorSets( PomVkRenderGroupCtx *_renderGroupCtx
             VkWriteDescriptorSet writeDS = {
                 .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
                 .dstSet = currSetGroup[ currSetOffset ],
-                .dstBinding = 1, // TODO - get binding here (maybe from shader?)
+                .dstBinding = modelSetInfo->bindings[ 0 ].binding,
                 .dstArrayElement = 0, // Assume no arrays for now
-                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, // Assume only UBOs for now
-                .descriptorCount = 1, // 1 descriptor per DS for now
+                .descriptorType = modelSetInfo->bindings[ 0 ].descriptorType,
+                .descriptorCount = 1,
                 .pBufferInfo = descBuffInfo,
-                .pImageInfo = NULL, // Only UBOs for now
+                .pImageInfo = NULL, // Only buffers for now
                 .pTexelBufferView = NULL, // Ditto
             };
-            currSetOffset++;
+            currSetOffset += numShaderModelDSL;
             // Could maybe defer this till the end?
             vkUpdateDescriptorSets( *dev, 1, &writeDS, 0, NULL );
         }
     }
-    _renderGroupCtx->allDescriptorSets = descriptorSets;
-    _renderGroupCtx->setsPerSwapchainImage = setsPerSwapchainImage;
-    free( layouts );
-
     return 0;
 }
 
 
+int pomVkRenderGroupSetDepthPrepass( PomVkRenderGroupCtx *_renderGroupCtx,
+                                     PomPipelineCtx *_prepassPipelineCtx ){
+    if( !_renderGroupCtx->initialised ){
+        LOG( ERR, "Attempting to set depth prepass of uninitialised RenderGroup" );
+        return 1;
+    }
+    if( _prepassPipelineCtx && !_prepassPipelineCtx->state.depthOnly ){
+        LOG( ERR, "RenderGroup depth prepass pipeline isn't depth-only" );
+        return 1;
+    }
+    _renderGroupCtx->depthPrepassPipelineCtx = _prepassPipelineCtx;
+    return 0;
+}
+
 int pomVkRenderGroupRecord( PomVkRenderGroupCtx *_renderGroupCtx, VkCommandBuffer _cmdBuffer,
                             uint32_t bufferIdx ){
-      
-    vkCmdBindPipeline( _cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                       _renderGroupCtx->pipelineCtx->pipeline );
+    rgRecordDraws( _renderGroupCtx, _renderGroupCtx->pipelineCtx, _cmdBuffer, bufferIdx );
+    return 0;
+}
+
+int pomVkRenderGroupRecordDepthPrepass( PomVkRenderGroupCtx *_renderGroupCtx,
+                                        VkCommandBuffer _cmdBuffer, uint32_t bufferIdx ){
+    if( _renderGroupCtx->depthPrepassPipelineCtx ){
+        rgRecordDraws( _renderGroupCtx, _renderGroupCtx->depthPrepassPipelineCtx,
+                       _cmdBuffer, bufferIdx );
+    }
+    return 0;
+}
+
+// Draw every active model with _pipelineCtx. The descriptor sets are allocated against the
+// group's own pipeline, which any prepass pipeline's layout is compatible with
+static void rgRecordDraws( PomVkRenderGroupCtx *_renderGroupCtx, PomPipelineCtx *_pipelineCtx,
+                           VkCommandBuffer _cmdBuffer, uint32_t bufferIdx ){
+    vkCmdBindPipeline( _cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipelineCtx->pipeline );
     
     // Bind rendergroup-local Descriptors
     const uint32_t descriptorSetOffset =  _renderGroupCtx->setsPerSwapchainImage * bufferIdx;
@@ -218,7 +301,7 @@ int pomVkRenderGroupRecord( PomVkRenderGroupCtx *_renderGroupCtx, VkCommandBuffe
     const uint32_t numModelLocalDSL = _renderGroupCtx->pipelineCtx->shaderInfo.shaderInputAttributes.
                                         descriptorSetLayoutCtx.numModelLocalLayouts;
     vkCmdBindDescriptorSets( _cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                             _renderGroupCtx->pipelineCtx->graphicsPipelineInfo.layout,
+                             _pipelineCtx->graphicsPipelineInfo.layout,
                              0, numRgLocalDSL,
                              descriptorSets, 0, NULL );
     uint32_t numRgLocalLayouts =  _renderGroupCtx->pipelineCtx->shaderInfo.shaderInputAttributes.
@@ -233,11 +316,11 @@ int pomVkRenderGroupRecord( PomVkRenderGroupCtx *_renderGroupCtx, VkCommandBuffe
             continue;
         }
         
-        // Bind model-local descriptors
-        VkDescriptorSet *modelDS = &modelDescriptorSets[ i ];
+        // Bind all of the model-local sets in one go
+        VkDescriptorSet *modelDS = &modelDescriptorSets[ i * numModelLocalDSL ];
         vkCmdBindDescriptorSets( _cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                                _renderGroupCtx->pipelineCtx->graphicsPipelineInfo.layout,
-                                1, numModelLocalDSL, // Only 1 DS per model for now
+                                _pipelineCtx->graphicsPipelineInfo.layout,
+                                numRgLocalDSL, numModelLocalDSL,
                                 modelDS, 0, NULL );
 
         // Vertex data starts after index data in buffer
@@ -247,10 +330,24 @@ int pomVkRenderGroupRecord( PomVkRenderGroupCtx *_renderGroupCtx, VkCommandBuffe
         vkCmdBindVertexBuffers( _cmdBuffer, 0, 1, &model->modelBuffer.buffer, offsets );
         vkCmdBindIndexBuffer( _cmdBuffer, model->modelBuffer.buffer, 0, VK_INDEX_TYPE_UINT32 );
 
-        vkCmdDrawIndexed( _cmdBuffer, model->modelMeshInfo->numIndices, 1, 0, 0, 0 );
+        if( !model->numSubmodels ){
+            vkCmdDrawIndexed( _cmdBuffer, model->modelMeshInfo->numIndices, 1, 0, 0, 0 );
+            continue;
+        }
+        // Merged meshes are drawn by their source meshes' ranges. Adjacent ranges, which
+        // they usually all are, go in one draw
+        uint32_t runFirstIndex = model->submodels[ 0 ].firstIndex;
+        uint32_t runEndIndex = runFirstIndex;
+        for( uint32_t s = 0; s < model->numSubmodels; s++ ){
+            const PomSubmodelInfo *submodel = &model->submodels[ s ];
+            if( submodel->firstIndex != runEndIndex ){
+                vkCmdDrawIndexed( _cmdBuffer, runEndIndex - runFirstIndex, 1, runFirstIndex, 0, 0 );
+                runFirstIndex = submodel->firstIndex;
+            }
+            runEndIndex = submodel->firstIndex + (uint32_t) submodel->numIndices;
+        }
+        vkCmdDrawIndexed( _cmdBuffer, runEndIndex - runFirstIndex, 1, runFirstIndex, 0, 0 );
     }
-
-    return 0;
 }
 
 
@@ -273,6 +370,7 @@ static int rgGetDescriptorSetSize( PomVkRenderGroupCtx *_renderGroupCtx ){
     
     _renderGroupCtx->numRenderGroupDescriptorSets = numRgLocalDSets;
     _renderGroupCtx->numModelDescriptorSets = numModelDSets;
+    _renderGroupCtx->setsPerSwapchainImage = numRenderGroupDSL + ( numModelDSL * numModels );
     return 0;
 }
 
@@ -0,0 +1,128 @@
+#include "vkringbuffer.h"
+#include "vkdevice.h"
+
+#define LOG( lvl, log, ... ) LOG_MODULE( lvl, VkRingBuffer, log, ##__VA_ARGS__ )
+
+static VkDeviceSize alignUp( VkDeviceSize _value, VkDeviceSize _alignment ){
+    return ( _value + _alignment - 1 ) & ~( _alignment - 1 );
+}
+
+int pomVkRingBufferCreate( PomVkRingBufferCtx *_ringCtx, VkDeviceSize _frameSize, uint32_t _numFrames ){
+    if( _ringCtx->initialised ){
+        LOG( WARN, "Attempting to reinitialise ring buffer" );
+        return 1;
+    }
+    if( !_frameSize || !_numFrames ){
+        LOG( ERR, "Attempting to create empty ring buffer" );
+        return 1;
+    }
+    VkPhysicalDevice *phyDev = pomGetPhysicalDevice();
+    if( !phyDev ){
+        LOG( ERR, "Attempting to create ring buffer with no available physical device" );
+        return 1;
+    }
+    VkPhysicalDeviceProperties devProps;
+    vkGetPhysicalDeviceProperties( *phyDev, &devProps );
+    VkDeviceSize alignment = devProps.limits.minUniformBufferOffsetAlignment;
+    if( !alignment ){
+        alignment = 1;
+    }
+    VkDeviceSize frameSize = alignUp( _frameSize, alignment );
+
+    // Written by the host every frame and read by the GPU once, which device-local host-visible
+    // memory suits best where there is any. Frames are flushed, so coherence is only preferred
+    _ringCtx->bufferCtx = (PomVkBufferCtx){ 0 };
+    if( pomVkBufferCreate( &_ringCtx->bufferCtx, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                           frameSize * _numFrames, 1, NULL, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                           POM_VK_MEMORY_SITE ) ){
+        LOG( ERR, "Failed to create ring buffer" );
+        return 1;
+    }
+    if( pomVkBufferBind( &_ringCtx->bufferCtx, 0 ) ){
+        LOG( ERR, "Failed to bind ring buffer" );
+        pomVkBufferDestroy( &_ringCtx->bufferCtx );
+        return 1;
+    }
+    _ringCtx->mapped = (uint8_t*) pomVkBufferGetMapped( &_ringCtx->bufferCtx );
+    if( !_ringCtx->mapped ){
+        LOG( ERR, "Ring buffer memory is not mapped" );
+        pomVkBufferUnbind( &_ringCtx->bufferCtx );
+        pomVkBufferDestroy( &_ringCtx->bufferCtx );
+        return 1;
+    }
+    _ringCtx->alignment = alignment;
+    _ringCtx->frameSize = frameSize;
+    _ringCtx->numFrames = _numFrames;
+    _ringCtx->frameIdx = 0;
+    _ringCtx->head = 0;
+    _ringCtx->initialised = true;
+    return 0;
+}
+
+int pomVkRingBufferDestroy( PomVkRingBufferCtx *_ringCtx ){
+    if( !_ringCtx->initialised ){
+        LOG( WARN, "Attempting to destroy uninitialised ring buffer" );
+        return 1;
+    }
+    pomVkBufferUnbind( &_ringCtx->bufferCtx );
+    if( pomVkBufferDestroy( &_ringCtx->bufferCtx ) ){
+        LOG( ERR, "Failed to destroy ring buffer" );
+        return 1;
+    }
+    _ringCtx->mapped = NULL;
+    _ringCtx->initialised = false;
+    return 0;
+}
+
+int pomVkRingBufferResize( PomVkRingBufferCtx *_ringCtx, uint32_t _numFrames ){
+    if( !_ringCtx->initialised ){
+        LOG( ERR, "Attempting to resize uninitialised ring buffer" );
+        return 1;
+    }
+    if( _numFrames == _ringCtx->numFrames ){
+        return 0;
+    }
+    // Already aligned, so each frame stays the same size
+    VkDeviceSize frameSize = _ringCtx->frameSize;
+    if( pomVkRingBufferDestroy( _ringCtx ) ||
+        pomVkRingBufferCreate( _ringCtx, frameSize, _numFrames ) ){
+        LOG( ERR, "Failed to resize ring buffer to %u frames", _numFrames );
+        return 1;
+    }
+    return 0;
+}
+
+int pomVkRingBufferBeginFrame( PomVkRingBufferCtx *_ringCtx, uint32_t _frameIdx ){
+    if( !_ringCtx->initialised ){
+        LOG( ERR, "Attempting to begin frame of uninitialised ring buffer" );
+        return 1;
+    }
+    if( _frameIdx >= _ringCtx->numFrames ){
+        LOG( ERR, "Ring buffer has no frame %u, only %u", _frameIdx, _ringCtx->numFrames );
+        return 1;
+    }
+    _ringCtx->frameIdx = _frameIdx;
+    _ringCtx->head = 0;
+    return 0;
+}
+
+void *pomVkRingBufferAllocate( PomVkRingBufferCtx *_ringCtx, VkDeviceSize _size, VkDeviceSize *_offset ){
+    VkDeviceSize start = alignUp( _ringCtx->head, _ringCtx->alignment );
+    if( start + _size > _ringCtx->frameSize ){
+        LOG( ERR, "Ring buffer frame of %lu bytes is full", _ringCtx->frameSize );
+        return NULL;
+    }
+    _ringCtx->head = start + _size;
+    *_offset = _ringCtx->frameIdx * _ringCtx->frameSize + start;
+    pomVkBufferMarkDirty( &_ringCtx->bufferCtx, *_offset, _size );
+    return _ringCtx->mapped + *_offset;
+}
+
+int pomVkRingBufferFlush( PomVkRingBufferCtx *_ringCtx ){
+    if( !_ringCtx->initialised ){
+        LOG( ERR, "Attempting to flush uninitialised ring buffer" );
+        return 1;
+    }
+    return pomVkBufferFlush( &_ringCtx->bufferCtx );
+}
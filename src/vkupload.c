@@ -0,0 +1,491 @@
+#include "vkupload.h"
+#include "vkdevice.h"
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#define LOG( lvl, log, ... ) LOG_MODULE( lvl, VkUpload, log, ##__VA_ARGS__ )
+
+// One batch filling while the other's copies run
+#define UPLOAD_NUM_BATCHES 2
+
+typedef struct PomVkUploadBatch PomVkUploadBatch;
+typedef struct PomVkUploadCtx PomVkUploadCtx;
+
+struct PomVkUploadBatch{
+    PomVkBufferCtx stagingBuffer;
+    uint8_t *mapped;
+    // Staging bytes used by the batch's copies so far
+    VkDeviceSize head;
+    VkCommandBuffer transferCmd;
+    // Takes ownership of the written ranges on the graphics queue. Only used with a
+    // separate transfer family
+    VkCommandBuffer acquireCmd;
+    VkSemaphore transferDone;
+    VkFence fence;
+    // Copies recorded but not yet submitted
+    bool recording;
+    // Submitted, and the fence not yet waited on
+    bool pending;
+    // Destination ranges, needing barriers once the copies are done
+    VkBufferMemoryBarrier *barriers;
+    uint32_t numBarriers;
+    uint32_t barrierCapacity;
+};
+
+struct PomVkUploadCtx{
+    bool initialised;
+    mtx_t mutex;
+    VkQueue *transferQueue;
+    VkQueue *gfxQueue;
+    uint32_t transferFamily;
+    uint32_t gfxFamily;
+    bool ownershipTransfer;
+    VkCommandPool transferPool;
+    VkCommandPool gfxPool;
+    VkDeviceSize stagingSize;
+    VkDeviceSize copyAlignment;
+    PomVkUploadBatch batches[ UPLOAD_NUM_BATCHES ];
+    uint32_t batchIdx;
+};
+
+static PomVkUploadCtx uploadCtx = { 0 };
+
+static VkDeviceSize alignUp( VkDeviceSize _value, VkDeviceSize _alignment ){
+    return ( _value + _alignment - 1 ) & ~( _alignment - 1 );
+}
+
+static int createCommandPool( VkDevice _dev, uint32_t _queueFamily, VkCommandPool *_pool ){
+    VkCommandPoolCreateInfo poolInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = _queueFamily
+    };
+    if( vkCreateCommandPool( _dev, &poolInfo, NULL, _pool ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to create upload command pool for queue family %u", _queueFamily );
+        return 1;
+    }
+    return 0;
+}
+
+static void batchDestroy( VkDevice _dev, PomVkUploadBatch *_batch ){
+    if( _batch->stagingBuffer.initialised ){
+        pomVkBufferUnbind( &_batch->stagingBuffer );
+        pomVkBufferDestroy( &_batch->stagingBuffer );
+    }
+    if( _batch->fence != VK_NULL_HANDLE ){
+        vkDestroyFence( _dev, _batch->fence, NULL );
+    }
+    if( _batch->transferDone != VK_NULL_HANDLE ){
+        vkDestroySemaphore( _dev, _batch->transferDone, NULL );
+    }
+    free( _batch->barriers );
+    *_batch = (PomVkUploadBatch){ 0 };
+}
+
+static int batchCreate( VkDevice _dev, PomVkUploadBatch *_batch ){
+    *_batch = (PomVkUploadBatch){ 0 };
+    // Only ever a copy source, so no need for it to be device-local. Flushed before each
+    // submission, so coherence is only preferred
+    if( pomVkBufferCreate( &_batch->stagingBuffer, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                           uploadCtx.stagingSize, 1, NULL, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                           VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, POM_VK_MEMORY_SITE ) ){
+        LOG( ERR, "Failed to create staging buffer" );
+        return 1;
+    }
+    if( pomVkBufferBind( &_batch->stagingBuffer, 0 ) ){
+        LOG( ERR, "Failed to bind staging buffer" );
+        goto batchCreateFailed;
+    }
+    _batch->mapped = (uint8_t*) pomVkBufferGetMapped( &_batch->stagingBuffer );
+    if( !_batch->mapped ){
+        LOG( ERR, "Staging buffer memory is not mapped" );
+        goto batchCreateFailed;
+    }
+
+    VkCommandBufferAllocateInfo cmdInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = uploadCtx.transferPool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1
+    };
+    if( vkAllocateCommandBuffers( _dev, &cmdInfo, &_batch->transferCmd ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to allocate upload command buffer" );
+        goto batchCreateFailed;
+    }
+    VkFenceCreateInfo fenceInfo = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO
+    };
+    if( vkCreateFence( _dev, &fenceInfo, NULL, &_batch->fence ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to create upload fence" );
+        goto batchCreateFailed;
+    }
+    if( uploadCtx.ownershipTransfer ){
+        cmdInfo.commandPool = uploadCtx.gfxPool;
+        if( vkAllocateCommandBuffers( _dev, &cmdInfo, &_batch->acquireCmd ) != VK_SUCCESS ){
+            LOG( ERR, "Failed to allocate upload acquire command buffer" );
+            goto batchCreateFailed;
+        }
+        VkSemaphoreCreateInfo semaphoreInfo = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
+        };
+        if( vkCreateSemaphore( _dev, &semaphoreInfo, NULL, &_batch->transferDone ) != VK_SUCCESS ){
+            LOG( ERR, "Failed to create upload semaphore" );
+            goto batchCreateFailed;
+        }
+    }
+    return 0;
+
+batchCreateFailed:
+    // Command buffers go with their pools
+    batchDestroy( _dev, _batch );
+    return 1;
+}
+
+// Wait for a batch's submission to complete, leaving its staging memory free for reuse
+static int batchWait( VkDevice _dev, PomVkUploadBatch *_batch ){
+    if( !_batch->pending ){
+        return 0;
+    }
+    if( vkWaitForFences( _dev, 1, &_batch->fence, VK_TRUE, UINT64_MAX ) != VK_SUCCESS ||
+        vkResetFences( _dev, 1, &_batch->fence ) != VK_SUCCESS ){
+        LOG( ERR, "Failed waiting for upload batch" );
+        return 1;
+    }
+    _batch->pending = false;
+    return 0;
+}
+
+static int batchBegin( VkDevice _dev, PomVkUploadBatch *_batch ){
+    if( batchWait( _dev, _batch ) ){
+        return 1;
+    }
+    VkCommandBufferBeginInfo beginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    };
+    if( vkBeginCommandBuffer( _batch->transferCmd, &beginInfo ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to begin upload command buffer" );
+        return 1;
+    }
+    _batch->head = 0;
+    _batch->numBarriers = 0;
+    _batch->recording = true;
+    return 0;
+}
+
+// Note that a range of _buffer was written. Ranges following on from the last one written
+// share its barrier
+static int batchAddBarrier( PomVkUploadBatch *_batch, VkBuffer _buffer, VkDeviceSize _offset,
+                            VkDeviceSize _size ){
+    if( _batch->numBarriers ){
+        VkBufferMemoryBarrier *last = &_batch->barriers[ _batch->numBarriers - 1 ];
+        if( last->buffer == _buffer && last->offset + last->size == _offset ){
+            last->size += _size;
+            return 0;
+        }
+    }
+    if( _batch->numBarriers == _batch->barrierCapacity ){
+        uint32_t capacity = _batch->barrierCapacity ? _batch->barrierCapacity * 2 : 16;
+        VkBufferMemoryBarrier *barriers = (VkBufferMemoryBarrier*)
+            realloc( _batch->barriers, sizeof( VkBufferMemoryBarrier ) * capacity );
+        if( !barriers ){
+            LOG( ERR, "Failed to grow upload barrier list" );
+            return 1;
+        }
+        _batch->barriers = barriers;
+        _batch->barrierCapacity = capacity;
+    }
+    _batch->barriers[ _batch->numBarriers++ ] = (VkBufferMemoryBarrier){
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .buffer = _buffer,
+        .offset = _offset,
+        .size = _size
+    };
+    return 0;
+}
+
+// Make the batch's writes visible to the graphics queue and submit it
+static int batchSubmit( PomVkUploadBatch *_batch ){
+    if( pomVkBufferFlush( &_batch->stagingBuffer ) ){
+        LOG( ERR, "Failed to flush staging buffer" );
+        return 1;
+    }
+    for( uint32_t i = 0; i < _batch->numBarriers; i++ ){
+        VkBufferMemoryBarrier *barrier = &_batch->barriers[ i ];
+        barrier->srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        if( uploadCtx.ownershipTransfer ){
+            // Release. Visibility comes from the matching acquire on the graphics queue
+            barrier->dstAccessMask = 0;
+            barrier->srcQueueFamilyIndex = uploadCtx.transferFamily;
+            barrier->dstQueueFamilyIndex = uploadCtx.gfxFamily;
+        }else{
+            barrier->dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+            barrier->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        }
+    }
+    VkPipelineStageFlags dstStage = uploadCtx.ownershipTransfer ?
+        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    vkCmdPipelineBarrier( _batch->transferCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0,
+                          0, NULL, _batch->numBarriers, _batch->barriers, 0, NULL );
+    _batch->recording = false;
+    if( vkEndCommandBuffer( _batch->transferCmd ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to end upload command buffer" );
+        return 1;
+    }
+
+    VkSubmitInfo transferSubmit = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &_batch->transferCmd
+    };
+    if( !uploadCtx.ownershipTransfer ){
+        if( vkQueueSubmit( *uploadCtx.transferQueue, 1, &transferSubmit, _batch->fence ) != VK_SUCCESS ){
+            LOG( ERR, "Failed to submit uploads" );
+            return 1;
+        }
+        _batch->pending = true;
+        return 0;
+    }
+
+    VkCommandBufferBeginInfo beginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    };
+    if( vkBeginCommandBuffer( _batch->acquireCmd, &beginInfo ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to begin upload acquire command buffer" );
+        return 1;
+    }
+    for( uint32_t i = 0; i < _batch->numBarriers; i++ ){
+        _batch->barriers[ i ].srcAccessMask = 0;
+        _batch->barriers[ i ].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    }
+    vkCmdPipelineBarrier( _batch->acquireCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                          0, NULL, _batch->numBarriers, _batch->barriers, 0, NULL );
+    if( vkEndCommandBuffer( _batch->acquireCmd ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to end upload acquire command buffer" );
+        return 1;
+    }
+    transferSubmit.signalSemaphoreCount = 1;
+    transferSubmit.pSignalSemaphores = &_batch->transferDone;
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSubmitInfo acquireSubmit = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &_batch->transferDone,
+        .pWaitDstStageMask = &waitStage,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &_batch->acquireCmd
+    };
+    if( vkQueueSubmit( *uploadCtx.transferQueue, 1, &transferSubmit, VK_NULL_HANDLE ) != VK_SUCCESS ){
+        LOG( ERR, "Failed to submit uploads" );
+        return 1;
+    }
+    if( vkQueueSubmit( *uploadCtx.gfxQueue, 1, &acquireSubmit, _batch->fence ) != VK_SUCCESS ){
+        // The semaphore is left signalled, with nothing to wait on it. The device is in no
+        // state to carry on anyway
+        LOG( ERR, "Failed to submit upload ownership acquire" );
+        return 1;
+    }
+    _batch->pending = true;
+    return 0;
+}
+
+// Submit the current batch and move on to the next. Call with the mutex held
+static int submitCurrent(){
+    PomVkUploadBatch *batch = &uploadCtx.batches[ uploadCtx.batchIdx ];
+    if( !batch->recording ){
+        return 2;
+    }
+    uploadCtx.batchIdx = ( uploadCtx.batchIdx + 1 ) % UPLOAD_NUM_BATCHES;
+    return batchSubmit( batch );
+}
+
+int pomVkUploadManagerCreate( VkDeviceSize _stagingSize ){
+    if( uploadCtx.initialised ){
+        LOG( WARN, "Attempting to re-initialise upload manager" );
+        return 1;
+    }
+    if( !_stagingSize ){
+        LOG( ERR, "Attempting to create upload manager without staging memory" );
+        return 1;
+    }
+    VkDevice *dev = pomGetLogicalDevice();
+    VkPhysicalDevice *phyDev = pomGetPhysicalDevice();
+    if( !dev || !phyDev ){
+        LOG( ERR, "Attempting to create upload manager with no available device" );
+        return 1;
+    }
+    uploadCtx.transferQueue = pomDeviceGetTransferQueue( &uploadCtx.transferFamily );
+    uploadCtx.gfxQueue = pomDeviceGetGraphicsQueue( &uploadCtx.gfxFamily );
+    uploadCtx.ownershipTransfer = uploadCtx.transferFamily != uploadCtx.gfxFamily;
+    VkPhysicalDeviceProperties devProps;
+    vkGetPhysicalDeviceProperties( *phyDev, &devProps );
+    uploadCtx.copyAlignment = devProps.limits.optimalBufferCopyOffsetAlignment;
+    if( !uploadCtx.copyAlignment ){
+        uploadCtx.copyAlignment = 1;
+    }
+    uploadCtx.stagingSize = alignUp( _stagingSize, uploadCtx.copyAlignment );
+
+    if( mtx_init( &uploadCtx.mutex, mtx_plain ) != thrd_success ){
+        LOG( ERR, "Failed to create upload manager mutex" );
+        return 1;
+    }
+    if( createCommandPool( *dev, uploadCtx.transferFamily, &uploadCtx.transferPool ) ){
+        goto createFailed;
+    }
+    if( uploadCtx.ownershipTransfer &&
+        createCommandPool( *dev, uploadCtx.gfxFamily, &uploadCtx.gfxPool ) ){
+        goto createFailed;
+    }
+    for( uint32_t i = 0; i < UPLOAD_NUM_BATCHES; i++ ){
+        if( batchCreate( *dev, &uploadCtx.batches[ i ] ) ){
+            goto createFailed;
+        }
+    }
+    uploadCtx.batchIdx = 0;
+    uploadCtx.initialised = true;
+    LOG( DEBUG, "Upload manager created, %s ownership transfer",
+         uploadCtx.ownershipTransfer ? "with" : "without" );
+    return 0;
+
+createFailed:
+    for( uint32_t i = 0; i < UPLOAD_NUM_BATCHES; i++ ){
+        batchDestroy( *dev, &uploadCtx.batches[ i ] );
+    }
+    if( uploadCtx.gfxPool != VK_NULL_HANDLE ){
+        vkDestroyCommandPool( *dev, uploadCtx.gfxPool, NULL );
+    }
+    if( uploadCtx.transferPool != VK_NULL_HANDLE ){
+        vkDestroyCommandPool( *dev, uploadCtx.transferPool, NULL );
+    }
+    mtx_destroy( &uploadCtx.mutex );
+    uploadCtx = (PomVkUploadCtx){ 0 };
+    return 1;
+}
+
+int pomVkUploadManagerDestroy(){
+    if( !uploadCtx.initialised ){
+        LOG( WARN, "Attempting to destroy uninitialised upload manager" );
+        return 1;
+    }
+    VkDevice *dev = pomGetLogicalDevice();
+    if( !dev ){
+        LOG( ERR, "Logical device destroyed before upload manager" );
+        return 1;
+    }
+    if( pomVkUploadWaitIdle() ){
+        // Leave the batches alone rather than free anything the device may still be using
+        LOG( ERR, "Failed to wait for uploads, not destroying upload manager" );
+        return 1;
+    }
+    for( uint32_t i = 0; i < UPLOAD_NUM_BATCHES; i++ ){
+        batchDestroy( *dev, &uploadCtx.batches[ i ] );
+    }
+    if( uploadCtx.gfxPool != VK_NULL_HANDLE ){
+        vkDestroyCommandPool( *dev, uploadCtx.gfxPool, NULL );
+    }
+    vkDestroyCommandPool( *dev, uploadCtx.transferPool, NULL );
+    mtx_destroy( &uploadCtx.mutex );
+    uploadCtx = (PomVkUploadCtx){ 0 };
+    return 0;
+}
+
+int pomVkUploadBuffer( PomVkBufferCtx *_dstBuffer, VkDeviceSize _dstOffset,
+                       const void *_data, VkDeviceSize _size ){
+    if( !uploadCtx.initialised ){
+        LOG( ERR, "Attempting to upload with uninitialised upload manager" );
+        return 1;
+    }
+    if( !_dstBuffer->initialised || !atomic_load( &_dstBuffer->bound ) ){
+        LOG( ERR, "Attempting to upload to unbound buffer" );
+        return 1;
+    }
+    if( _dstOffset + _size > _dstBuffer->bufferInfo.size ){
+        LOG( ERR, "Attempting to upload past the end of a buffer" );
+        return 1;
+    }
+    VkDevice *dev = pomGetLogicalDevice();
+    if( !dev ){
+        LOG( ERR, "Attempting to upload with no available device" );
+        return 1;
+    }
+    int ret = 0;
+    const uint8_t *data = (const uint8_t*) _data;
+    mtx_lock( &uploadCtx.mutex );
+    while( _size ){
+        PomVkUploadBatch *batch = &uploadCtx.batches[ uploadCtx.batchIdx ];
+        if( !batch->recording && batchBegin( *dev, batch ) ){
+            ret = 1;
+            break;
+        }
+        if( batch->head == uploadCtx.stagingSize ){
+            // Full, so send it on its way and carry on in the next
+            if( submitCurrent() == 1 ){
+                ret = 1;
+                break;
+            }
+            continue;
+        }
+        VkDeviceSize chunkSize = uploadCtx.stagingSize - batch->head;
+        if( chunkSize > _size ){
+            chunkSize = _size;
+        }
+        memcpy( batch->mapped + batch->head, data, (size_t) chunkSize );
+        pomVkBufferMarkDirty( &batch->stagingBuffer, batch->head, chunkSize );
+        VkBufferCopy region = {
+            .srcOffset = batch->head,
+            .dstOffset = _dstOffset,
+            .size = chunkSize
+        };
+        vkCmdCopyBuffer( batch->transferCmd, batch->stagingBuffer.buffer, _dstBuffer->buffer,
+                         1, &region );
+        if( batchAddBarrier( batch, _dstBuffer->buffer, _dstOffset, chunkSize ) ){
+            ret = 1;
+            break;
+        }
+        batch->head = alignUp( batch->head + chunkSize, uploadCtx.copyAlignment );
+        if( batch->head > uploadCtx.stagingSize ){
+            batch->head = uploadCtx.stagingSize;
+        }
+        data += chunkSize;
+        _dstOffset += chunkSize;
+        _size -= chunkSize;
+    }
+    mtx_unlock( &uploadCtx.mutex );
+    return ret;
+}
+
+int pomVkUploadSubmit(){
+    if( !uploadCtx.initialised ){
+        LOG( ERR, "Attempting to submit uploads with uninitialised upload manager" );
+        return 1;
+    }
+    mtx_lock( &uploadCtx.mutex );
+    int ret = submitCurrent();
+    mtx_unlock( &uploadCtx.mutex );
+    return ret;
+}
+
+int pomVkUploadWaitIdle(){
+    if( !uploadCtx.initialised ){
+        LOG( ERR, "Attempting to wait for uploads with uninitialised upload manager" );
+        return 1;
+    }
+    VkDevice *dev = pomGetLogicalDevice();
+    if( !dev ){
+        LOG( ERR, "Attempting to wait for uploads with no available device" );
+        return 1;
+    }
+    mtx_lock( &uploadCtx.mutex );
+    int ret = submitCurrent() == 1;
+    for( uint32_t i = 0; i < UPLOAD_NUM_BATCHES; i++ ){
+        if( batchWait( *dev, &uploadCtx.batches[ i ] ) ){
+            ret = 1;
+        }
+    }
+    mtx_unlock( &uploadCtx.mutex );
+    return ret;
+}